@@ -0,0 +1,30 @@
+#!/bin/sh
+# Generate synthetic DBC databases and measure parse file load time.
+# Usage: ./dbcbench.sh [signal counts...]
+
+COUNTS=${*:-"1000 2500 5000 10000"}
+TMPDIR=$(mktemp -d)
+
+for N in $COUNTS; do
+    awk -v n=$N 'BEGIN {
+        print "VERSION \"Synthetic " n "\"";
+        print "";
+        for(i=0;i<n;i++) {
+            if(i%8==0) {
+                printf("BO_ %u MSG%05u: 8 Vector__XXX\n", 256+i/8, i/8);
+                printf(" SG_ MUX%05u M : 0|4@1+ (1,0) [0|15] \"\" Vector__XXX\n",
+                    i/8);
+            }
+            if(i%2==0) {
+                printf(" SG_ SIG%05u m%u : %u|8@1- (0.25,-40) [0|0] \"V\" " \
+                    "Vector__XXX\n", i, (i/8)%16, 8*(i%8));
+            } else {
+                printf(" SG_ SIG%05u : %u|8@0+ (0.5,0) [0|0] \"A\" " \
+                    "Vector__XXX\n", i, 8*(i%8)+7);
+            }
+        }
+    }' > $TMPDIR/bench-$N.dbc
+    ./src/tbox-logger --parse-file=$TMPDIR/bench-$N.dbc --parse-check
+done
+
+rm -rf $TMPDIR
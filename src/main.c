@@ -8,10 +8,15 @@
 #include "tl-parser.h"
 #include "tl-gps.h"
 #include "tl-serial.h"
+#include "tl-history.h"
+#include "tl-shm.h"
+#include "tl-membudget.h"
+#include "tl-bgwork.h"
 
 static GMainLoop *g_tl_main_loop = NULL;
 static gboolean g_tl_main_cmd_daemon = FALSE;
 static gchar *g_tl_main_cmd_log_storage_path = NULL;
+static gchar *g_tl_main_cmd_log_hot_path = NULL;
 static gchar *g_tl_main_cmd_conf_path = NULL;
 static gchar *g_tl_main_cmd_vin_code = NULL;
 static gchar *g_tl_main_cmd_iccid_code = NULL;
@@ -20,6 +25,27 @@ static gint g_tl_main_cmd_fallback_vehicle_server_port = 0;
 static gchar *g_tl_main_cmd_serial_port = NULL;
 static gboolean g_tl_main_cmd_shutdown = FALSE;
 static gboolean g_tl_main_cmd_use_vcan = FALSE;
+static gchar *g_tl_main_cmd_parse_file = NULL;
+static gboolean g_tl_main_cmd_parse_check = FALSE;
+static gint g_tl_main_cmd_history_size = 4;
+static gint g_tl_main_cmd_history_minutes = 10;
+static gchar *g_tl_main_cmd_shm_name = NULL;
+static gint g_tl_main_cmd_shm_slots = 4096;
+static gint g_tl_main_cmd_budget_log_write = -1;
+static gint g_tl_main_cmd_budget_log_cache = -1;
+static gint g_tl_main_cmd_budget_net_data = -1;
+static gint g_tl_main_cmd_budget_net_write = -1;
+static gint g_tl_main_cmd_log_keyframe_interval = -1;
+static gint g_tl_main_cmd_log_commit_size = -1;
+static gint g_tl_main_cmd_log_commit_interval = -1;
+static gboolean g_tl_main_cmd_log_inline_compress = FALSE;
+static gchar *g_tl_main_cmd_log_codec = NULL;
+static gint g_tl_main_cmd_log_codec_level = G_MININT;
+static gchar *g_tl_main_cmd_log_zstd_dict = NULL;
+static gchar *g_tl_main_cmd_log_downsample = NULL;
+static gint g_tl_main_cmd_log_trigger_interval = -1;
+static gint g_tl_main_cmd_background_can_rate = -1;
+static gboolean g_tl_main_cmd_background_normal_priority = FALSE;
 
 static GOptionEntry g_tl_main_cmd_entries[] =
 {
@@ -31,6 +57,10 @@ static GOptionEntry g_tl_main_cmd_entries[] =
         "Set ICCID code", NULL },
     { "log-storage-path", 'L', 0, G_OPTION_ARG_STRING,
         &g_tl_main_cmd_log_storage_path, "Set log storage path", NULL },
+    { "log-hot-path", 0, 0, G_OPTION_ARG_STRING,
+        &g_tl_main_cmd_log_hot_path,
+        "Write the current log file to this RAM (tmpfs) directory and move "
+        "it to the log storage path when finished", NULL },
     { "config-path", 'C', 0, G_OPTION_ARG_STRING,
         &g_tl_main_cmd_conf_path, "Set config path", NULL },
     { "fallback-vehicle-server-host", 0, 0, G_OPTION_ARG_STRING,
@@ -43,10 +73,127 @@ static GOptionEntry g_tl_main_cmd_entries[] =
         "Set STM8 connection serial port", NULL },
     { "use-vcan", 0, 0, G_OPTION_ARG_NONE, &g_tl_main_cmd_use_vcan,
         "Use virutal CAN instead of normal one", NULL },
+    { "parse-file", 0, 0, G_OPTION_ARG_STRING, &g_tl_main_cmd_parse_file,
+        "Set signal parse file (tboxparse.xml or DBC file)", NULL },
+    { "parse-check", 0, 0, G_OPTION_ARG_NONE, &g_tl_main_cmd_parse_check,
+        "Load parse file, print statistics and exit", NULL },
+    { "history-size", 0, 0, G_OPTION_ARG_INT, &g_tl_main_cmd_history_size,
+        "Set in-memory signal history size in MB (0 to disable)", NULL },
+    { "history-minutes", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_history_minutes,
+        "Set in-memory signal history retention in minutes", NULL },
+    { "shm-name", 0, 0, G_OPTION_ARG_STRING, &g_tl_main_cmd_shm_name,
+        "Set shared memory name for live state export", NULL },
+    { "shm-slots", 0, 0, G_OPTION_ARG_INT, &g_tl_main_cmd_shm_slots,
+        "Set live state export slot count (0 to disable)", NULL },
+    { "budget-log-write", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_budget_log_write,
+        "Set log write queue memory budget in KB (0 for unlimited)", NULL },
+    { "budget-log-cache", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_budget_log_cache,
+        "Set log record cache memory budget in KB (0 for unlimited)", NULL },
+    { "budget-net-data", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_budget_net_data,
+        "Set pending upload data memory budget in KB (0 for unlimited)",
+        NULL },
+    { "budget-net-write", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_budget_net_write,
+        "Set network write queue memory budget in KB (0 for unlimited)",
+        NULL },
+    { "log-keyframe-interval", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_log_keyframe_interval,
+        "Write a full log record every N records, deltas in between "
+        "(1 disables deltas)", NULL },
+    { "log-commit-size", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_log_commit_size,
+        "Flush log records to storage once this many KB are buffered",
+        NULL },
+    { "log-commit-interval", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_log_commit_interval,
+        "Flush buffered log records to storage at least every N seconds",
+        NULL },
+    { "log-inline-compress", 0, 0, G_OPTION_ARG_NONE,
+        &g_tl_main_cmd_log_inline_compress,
+        "Compress log files while writing instead of archiving them later",
+        NULL },
+    { "log-codec", 0, 0, G_OPTION_ARG_STRING, &g_tl_main_cmd_log_codec,
+        "Compress log files with zlib (default), lz4 or zstd", NULL },
+    { "log-codec-level", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_log_codec_level,
+        "Set the log compression level (codec default if not set)", NULL },
+    { "log-zstd-dict", 0, 0, G_OPTION_ARG_STRING,
+        &g_tl_main_cmd_log_zstd_dict,
+        "Load a zstd dictionary for log compression and queries", NULL },
+    { "log-downsample", 0, 0, G_OPTION_ARG_STRING,
+        &g_tl_main_cmd_log_downsample,
+        "Keep one record per SECONDS of archived logs older than DAYS, "
+        "as DAYS:SECONDS[,...]", NULL },
+    { "log-trigger-interval", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_log_trigger_interval,
+        "Write a log record every N ms inside trigger windows (default 100)",
+        NULL },
+    { "background-can-rate", 0, 0, G_OPTION_ARG_INT,
+        &g_tl_main_cmd_background_can_rate,
+        "Pause log archiving while more CAN frames per second arrive "
+        "(0 to disable)", NULL },
+    { "background-normal-priority", 0, 0, G_OPTION_ARG_NONE,
+        &g_tl_main_cmd_background_normal_priority,
+        "Archive logs at normal instead of idle CPU and I/O priority", NULL },
     { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
 };
 
 
+static gchar *tl_main_parse_file_path_get(const gchar *conf_file_path)
+{
+    gchar *path;
+    
+    if(g_tl_main_cmd_parse_file!=NULL)
+    {
+        return g_strdup(g_tl_main_cmd_parse_file);
+    }
+    
+    path = g_build_filename(conf_file_path, "tboxparse.xml", NULL);
+    if(!g_file_test(path, G_FILE_TEST_EXISTS))
+    {
+        g_free(path);
+        path = g_build_filename(conf_file_path, "tboxparse.dbc", NULL);
+        if(!g_file_test(path, G_FILE_TEST_EXISTS))
+        {
+            g_free(path);
+            path = g_build_filename(conf_file_path, "tboxparse.xml", NULL);
+        }
+    }
+    
+    return path;
+}
+
+static int tl_main_parse_check(const gchar *conf_file_path)
+{
+    gchar *parse_file_path;
+    gint64 start_time, load_time;
+    gboolean ret;
+    
+    if(!tl_parser_init())
+    {
+        g_printerr("Cannot initialize parser!\n");
+        return 3;
+    }
+    
+    parse_file_path = tl_main_parse_file_path_get(conf_file_path);
+    start_time = g_get_monotonic_time();
+    ret = tl_parser_load_parse_file(parse_file_path);
+    load_time = g_get_monotonic_time() - start_time;
+    
+    g_print("%s: %u signal(s) loaded in %"G_GINT64_FORMAT".%03d ms\n",
+        parse_file_path, tl_parser_signal_count_get(), load_time / 1000,
+        (gint)(load_time % 1000));
+    
+    g_free(parse_file_path);
+    tl_parser_uninit();
+    
+    return ret ? 0 : 3;
+}
+
 static gboolean tl_main_shutdown_request_timeout(gpointer user_data)
 {
     g_warning("Serial port waiting timeout, start to shutdown!");
@@ -64,6 +211,7 @@ int main(int argc, char *argv[])
     const gchar *log_file_path;
     const gchar *serial_port;
     gchar *parse_file_path;
+    TLCodecType log_codec;
     
     context = g_option_context_new("- TBox Logger");
     g_option_context_set_ignore_unknown_options(context, TRUE);
@@ -74,6 +222,12 @@ int main(int argc, char *argv[])
         g_clear_error(&error);
     }
     
+    if(g_tl_main_cmd_parse_check)
+    {
+        return tl_main_parse_check(g_tl_main_cmd_conf_path!=NULL ?
+            g_tl_main_cmd_conf_path : "/var/lib/tbox/conf");
+    }
+    
     if(g_tl_main_cmd_vin_code==NULL)
     {
         g_error("VIN code should be specified!");
@@ -121,11 +275,103 @@ int main(int argc, char *argv[])
         serial_port = "/dev/ttymxc3";
     }
     
-    if(!tl_logger_init(log_file_path))
+    if(g_tl_main_cmd_history_size>0 && !tl_history_init(
+        (gsize)g_tl_main_cmd_history_size * 1024 * 1024,
+        (guint)MAX(g_tl_main_cmd_history_minutes, 1) * 60))
+    {
+        g_warning("Cannot initialize signal history!");
+    }
+    
+    if(g_tl_main_cmd_shm_slots>0 && !tl_shm_init(g_tl_main_cmd_shm_name,
+        g_tl_main_cmd_shm_slots))
+    {
+        g_warning("Cannot initialize live state export!");
+    }
+    
+    if(g_tl_main_cmd_budget_log_write>=0)
+    {
+        tl_membudget_budget_set(TL_MEMBUDGET_QUEUE_LOG_WRITE,
+            (gsize)g_tl_main_cmd_budget_log_write * 1024);
+    }
+    if(g_tl_main_cmd_budget_log_cache>=0)
+    {
+        tl_membudget_budget_set(TL_MEMBUDGET_QUEUE_LOG_CACHE,
+            (gsize)g_tl_main_cmd_budget_log_cache * 1024);
+    }
+    if(g_tl_main_cmd_budget_net_data>=0)
+    {
+        tl_membudget_budget_set(TL_MEMBUDGET_QUEUE_NET_DATA,
+            (gsize)g_tl_main_cmd_budget_net_data * 1024);
+    }
+    if(g_tl_main_cmd_budget_net_write>=0)
+    {
+        tl_membudget_budget_set(TL_MEMBUDGET_QUEUE_NET_WRITE,
+            (gsize)g_tl_main_cmd_budget_net_write * 1024);
+    }
+    tl_membudget_init();
+    
+    if(g_tl_main_cmd_background_can_rate>=0)
+    {
+        tl_bgwork_can_frame_rate_limit_set(
+            g_tl_main_cmd_background_can_rate);
+    }
+    tl_bgwork_idle_priority_set(!g_tl_main_cmd_background_normal_priority);
+    tl_bgwork_init();
+    
+    /* The logger threads may use the dictionary as soon as they start. */
+    if(g_tl_main_cmd_log_zstd_dict!=NULL &&
+        !tl_codec_dictionary_load(g_tl_main_cmd_log_zstd_dict))
+    {
+        g_warning("Cannot load zstd dictionary, compressing without it!");
+    }
+    
+    if(!tl_logger_init(log_file_path, g_tl_main_cmd_log_hot_path))
     {
         g_error("Cannot initialize logger!");
         return 2;
     }
+    if(g_tl_main_cmd_log_keyframe_interval>=0)
+    {
+        tl_logger_log_keyframe_interval_set(
+            g_tl_main_cmd_log_keyframe_interval);
+    }
+    if(g_tl_main_cmd_log_commit_size>=0)
+    {
+        tl_logger_log_commit_size_set(g_tl_main_cmd_log_commit_size * 1024);
+    }
+    if(g_tl_main_cmd_log_commit_interval>=0)
+    {
+        tl_logger_log_commit_interval_set(g_tl_main_cmd_log_commit_interval);
+    }
+    tl_logger_log_inline_compress_set(g_tl_main_cmd_log_inline_compress);
+    if(g_tl_main_cmd_log_codec!=NULL)
+    {
+        if(!tl_codec_parse(g_tl_main_cmd_log_codec, &log_codec) ||
+            !tl_logger_log_codec_set(log_codec,
+            g_tl_main_cmd_log_codec_level!=G_MININT ?
+            g_tl_main_cmd_log_codec_level :
+            tl_codec_level_default_get(log_codec)))
+        {
+            g_warning("Log codec %s is not supported, using zlib!",
+                g_tl_main_cmd_log_codec);
+        }
+    }
+    else if(g_tl_main_cmd_log_codec_level!=G_MININT)
+    {
+        tl_logger_log_codec_set(TL_CODEC_ZLIB,
+            g_tl_main_cmd_log_codec_level);
+    }
+    if(g_tl_main_cmd_log_downsample!=NULL &&
+        !tl_logger_log_downsample_set(g_tl_main_cmd_log_downsample))
+    {
+        g_warning("Invalid log downsampling tiers %s, keeping full "
+            "resolution!", g_tl_main_cmd_log_downsample);
+    }
+    if(g_tl_main_cmd_log_trigger_interval>=0)
+    {
+        tl_logger_log_trigger_interval_set(
+            g_tl_main_cmd_log_trigger_interval);
+    }
     
     if(!tl_parser_init())
     {
@@ -157,7 +403,7 @@ int main(int argc, char *argv[])
         g_warning("Cannot initialize serial port for STM8!");
     }
     
-    parse_file_path = g_build_filename(conf_file_path, "tboxparse.xml", NULL);
+    parse_file_path = tl_main_parse_file_path_get(conf_file_path);
     tl_parser_load_parse_file(parse_file_path);
     g_free(parse_file_path);
     
@@ -169,6 +415,10 @@ int main(int argc, char *argv[])
     tl_canbus_uninit();
     tl_parser_uninit();
     tl_logger_uninit();
+    tl_bgwork_uninit();
+    tl_membudget_uninit();
+    tl_history_uninit();
+    tl_shm_uninit();
     
     tl_serial_uninit();
     
@@ -184,11 +434,18 @@ void tl_main_request_shutdown()
 {
     g_message("Prepare to shutdown.");
     
+    /* Commit buffered log records before the slower teardown. */
+    tl_logger_log_flush();
+    
     tl_net_uninit();
     tl_gps_uninit();
     tl_canbus_uninit();
     tl_parser_uninit();
     tl_logger_uninit();
+    tl_bgwork_uninit();
+    tl_membudget_uninit();
+    tl_history_uninit();
+    tl_shm_uninit();
     
     sync();
     
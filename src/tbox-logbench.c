@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "tl-codec.h"
+#include "tl-logfmt.h"
+
+#define TBOX_LOGBENCH_DICTIONARY_SIZE_DEFAULT 112640
+#define TBOX_LOGBENCH_SAMPLE_SIZE 4096
+#define TBOX_LOGBENCH_SCAN_READ_SIZE 64 * 1024
+#define TBOX_LOGBENCH_RUN_TIME G_TIME_SPAN_SECOND
+
+typedef struct _TBoxLogBenchCodec
+{
+    TLCodecType codec;
+    gint level;
+}TBoxLogBenchCodec;
+
+/* Runs data through converter to the end of its stream. */
+static gboolean tbox_logbench_convert(GConverter *converter,
+    const guint8 *data, gsize len, GByteArray *output)
+{
+    GError *error = NULL;
+    
+    g_byte_array_set_size(output, 0);
+    if(!tl_codec_convert(converter, data, len, output, &error))
+    {
+        fprintf(stderr, "Conversion failed: %s\n", error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Compresses data in independent blocks of block_size bytes (one stream
+ * if 0) and decompresses them again, each pass repeated for at least
+ * TBOX_LOGBENCH_RUN_TIME, then prints ratio and speed.
+ */
+static gboolean tbox_logbench_run(const GByteArray *data, gsize block_size,
+    TLCodecType codec, gint level, const gchar *label)
+{
+    GConverter *compressor, *decompressor;
+    GPtrArray *blocks;
+    GByteArray *output;
+    gsize offset, len, compressed_size = 0;
+    gint64 start_time, compress_time, decompress_time;
+    guint compress_runs = 0, decompress_runs = 0, i;
+    gboolean ret = TRUE;
+    
+    if(block_size==0)
+    {
+        block_size = data->len;
+    }
+    
+    compressor = tl_codec_compressor_new(codec, level);
+    decompressor = tl_codec_decompressor_new(codec);
+    blocks = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    output = g_byte_array_new();
+    
+    start_time = g_get_monotonic_time();
+    do
+    {
+        g_ptr_array_set_size(blocks, 0);
+        compressed_size = 0;
+        for(offset=0;offset<data->len && ret;offset+=len)
+        {
+            len = MIN(block_size, data->len - offset);
+            ret = tbox_logbench_convert(compressor, data->data + offset, len,
+                output);
+            g_ptr_array_add(blocks, g_bytes_new(output->data, output->len));
+            compressed_size += output->len;
+        }
+        compress_runs++;
+        compress_time = g_get_monotonic_time() - start_time;
+    }
+    while(ret && compress_time < TBOX_LOGBENCH_RUN_TIME);
+    
+    start_time = g_get_monotonic_time();
+    do
+    {
+        offset = 0;
+        for(i=0;i<blocks->len && ret;i++)
+        {
+            ret = tbox_logbench_convert(decompressor, g_bytes_get_data(
+                g_ptr_array_index(blocks, i), NULL), g_bytes_get_size(
+                g_ptr_array_index(blocks, i)), output);
+            if(ret && (offset + output->len > data->len ||
+                memcmp(data->data + offset, output->data, output->len)!=0))
+            {
+                fprintf(stderr, "%s: decompressed data does not match!\n",
+                    label);
+                ret = FALSE;
+            }
+            offset += output->len;
+        }
+        decompress_runs++;
+        decompress_time = g_get_monotonic_time() - start_time;
+    }
+    while(ret && decompress_time < TBOX_LOGBENCH_RUN_TIME);
+    
+    if(ret)
+    {
+        printf("%-16s %6d %8.2f %14.1f %16.1f\n", label, level,
+            (gdouble)data->len / MAX(compressed_size, 1),
+            (gdouble)data->len * compress_runs / compress_time,
+            (gdouble)data->len * decompress_runs / decompress_time);
+    }
+    
+    g_byte_array_unref(output);
+    g_ptr_array_unref(blocks);
+    g_object_unref(decompressor);
+    g_object_unref(compressor);
+    
+    return ret;
+}
+
+static gboolean tbox_logbench_scan_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    guint *frames = (guint *)user_data;
+    
+    (*frames)++;
+    
+    return TRUE;
+}
+
+/*
+ * Splits data into frames in pieces of the size queries read, repeated
+ * for at least TBOX_LOGBENCH_RUN_TIME, then prints the frame count and
+ * the speed.
+ */
+static void tbox_logbench_scan_run(const GByteArray *data)
+{
+    TLLogFmtScanner *scanner;
+    gint64 start_time, scan_time;
+    guint frames, runs = 0;
+    gsize offset;
+    
+    start_time = g_get_monotonic_time();
+    do
+    {
+        frames = 0;
+        scanner = tl_logfmt_scanner_new();
+        for(offset=0;offset<data->len;
+            offset+=TBOX_LOGBENCH_SCAN_READ_SIZE)
+        {
+            tl_logfmt_scanner_feed(scanner, data->data + offset,
+                MIN(TBOX_LOGBENCH_SCAN_READ_SIZE, data->len - offset),
+                tbox_logbench_scan_cb, &frames);
+        }
+        tl_logfmt_scanner_free(scanner);
+        runs++;
+        scan_time = g_get_monotonic_time() - start_time;
+    }
+    while(scan_time < TBOX_LOGBENCH_RUN_TIME);
+    
+    printf("%u frames, scanned at %.1f MB/s\n", frames,
+        (gdouble)data->len * runs / scan_time);
+}
+
+static gboolean tbox_logbench_file_read(const gchar *path, GByteArray *data)
+{
+    GInputStream *istream;
+    GError *error = NULL;
+    guint8 buffer[4096];
+    gssize read_size;
+    
+    istream = tl_codec_file_read(path, &error);
+    if(istream==NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    
+    while((read_size=g_input_stream_read(istream, buffer, sizeof(buffer),
+        NULL, &error))>0)
+    {
+        g_byte_array_append(data, buffer, read_size);
+    }
+    g_object_unref(istream);
+    if(read_size<0 && !g_error_matches(error, G_IO_ERROR,
+        G_IO_ERROR_PARTIAL_INPUT))
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", path, error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    g_clear_error(&error);
+    
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    const gchar *dictionary_path = NULL, *train_path = NULL;
+    gsize block_size = 0, dictionary_size =
+        TBOX_LOGBENCH_DICTIONARY_SIZE_DEFAULT;
+    GArray *codecs;
+    TBoxLogBenchCodec bench_codec;
+    GByteArray *data;
+    GPtrArray *samples;
+    GBytes *dictionary = NULL;
+    GError *error = NULL;
+    gchar **codec_strv, *contents, *label;
+    gsize len, offset;
+    gboolean failed = FALSE;
+    guint i;
+    int opt;
+    
+    codecs = g_array_new(FALSE, FALSE, sizeof(TBoxLogBenchCodec));
+    while((opt=getopt(argc, argv, "c:b:D:t:s:h"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'c':
+            {
+                codec_strv = g_strsplit(optarg, ":", 2);
+                if(!tl_codec_parse(codec_strv[0], &(bench_codec.codec)) ||
+                    !tl_codec_available(bench_codec.codec))
+                {
+                    fprintf(stderr, "Codec %s is not supported.\n",
+                        codec_strv[0]);
+                    g_strfreev(codec_strv);
+                    return 1;
+                }
+                bench_codec.level = codec_strv[1]!=NULL ?
+                    g_ascii_strtoll(codec_strv[1], NULL, 10) :
+                    tl_codec_level_default_get(bench_codec.codec);
+                g_array_append_val(codecs, bench_codec);
+                g_strfreev(codec_strv);
+                break;
+            }
+            case 'b':
+            {
+                block_size = g_ascii_strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'D':
+            {
+                dictionary_path = optarg;
+                break;
+            }
+            case 't':
+            {
+                train_path = optarg;
+                break;
+            }
+            case 's':
+            {
+                dictionary_size = g_ascii_strtoull(optarg, NULL, 10);
+                break;
+            }
+            default:
+            {
+                fprintf(stderr, "Usage: %s [-c codec[:level]]... "
+                    "[-b block-size] [-D dictionary] [-t dictionary-output "
+                    "[-s dictionary-size]] log-file...\n"
+                    "Measures the frame scan speed of queries, then "
+                    "compression ratio and speed of the codecs on "
+                    "the records of the log files, in independent blocks "
+                    "with -b. -t trains a zstd dictionary on blocks of the "
+                    "records and saves it, -D uses a saved one.\n", argv[0]);
+                return opt=='h' ? 0 : 1;
+            }
+        }
+    }
+    
+    if(optind>=argc)
+    {
+        fprintf(stderr, "No input file.\n");
+        return 1;
+    }
+    
+    data = g_byte_array_new();
+    for(i=optind;i<argc;i++)
+    {
+        if(!tbox_logbench_file_read(argv[i], data))
+        {
+            return 2;
+        }
+    }
+    if(data->len==0)
+    {
+        fprintf(stderr, "No log records found.\n");
+        return 2;
+    }
+    
+    if(train_path!=NULL)
+    {
+        samples = g_ptr_array_new_with_free_func(
+            (GDestroyNotify)g_bytes_unref);
+        len = block_size>0 ? block_size : TBOX_LOGBENCH_SAMPLE_SIZE;
+        for(offset=0;offset<data->len;offset+=len)
+        {
+            g_ptr_array_add(samples, g_bytes_new(data->data + offset,
+                MIN(len, data->len - offset)));
+        }
+        dictionary = tl_codec_dictionary_train(samples, dictionary_size);
+        g_ptr_array_unref(samples);
+        if(dictionary==NULL || !g_file_set_contents(train_path,
+            g_bytes_get_data(dictionary, NULL),
+            g_bytes_get_size(dictionary), &error))
+        {
+            fprintf(stderr, "Cannot save dictionary %s: %s\n", train_path,
+                error!=NULL ? error->message : "training failed");
+            g_clear_error(&error);
+            return 3;
+        }
+    }
+    else if(dictionary_path!=NULL)
+    {
+        if(!g_file_get_contents(dictionary_path, &contents, &len, &error))
+        {
+            fprintf(stderr, "Cannot load dictionary %s: %s\n",
+                dictionary_path, error->message);
+            g_clear_error(&error);
+            return 2;
+        }
+        dictionary = g_bytes_new_take(contents, len);
+    }
+    
+    if(codecs->len==0)
+    {
+        for(i=0;i<TL_CODEC_LAST;i++)
+        {
+            if(tl_codec_available(i))
+            {
+                bench_codec.codec = i;
+                bench_codec.level = tl_codec_level_default_get(i);
+                g_array_append_val(codecs, bench_codec);
+            }
+        }
+    }
+    
+    tbox_logbench_scan_run(data);
+    
+    printf("%u bytes of records, %s\n", data->len, block_size>0 ?
+        "independent blocks" : "one stream");
+    if(block_size>0)
+    {
+        printf("block size %"G_GSIZE_FORMAT" bytes\n", block_size);
+    }
+    printf("%-16s %6s %8s %14s %16s\n", "codec", "level", "ratio",
+        "compress MB/s", "decompress MB/s");
+    
+    for(i=0;i<codecs->len && !failed;i++)
+    {
+        bench_codec = g_array_index(codecs, TBoxLogBenchCodec, i);
+        failed = !tbox_logbench_run(data, block_size, bench_codec.codec,
+            bench_codec.level, tl_codec_name_get(bench_codec.codec));
+        
+        if(!failed && bench_codec.codec==TL_CODEC_ZSTD && dictionary!=NULL)
+        {
+            if(!tl_codec_dictionary_set(dictionary))
+            {
+                return 3;
+            }
+            label = g_strdup_printf("zstd+%u", tl_codec_dictionary_id_get());
+            failed = !tbox_logbench_run(data, block_size, bench_codec.codec,
+                bench_codec.level, label);
+            g_free(label);
+            tl_codec_dictionary_set(NULL);
+        }
+    }
+    
+    if(dictionary!=NULL)
+    {
+        g_bytes_unref(dictionary);
+    }
+    g_byte_array_unref(data);
+    g_array_unref(codecs);
+    
+    return failed ? 3 : 0;
+}
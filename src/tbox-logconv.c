@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "tl-logfmt.h"
+#include "tl-codec.h"
+#include "tl-logarc.h"
+
+typedef struct _TBoxLogConvData
+{
+    TLLogFmtReader *reader;
+    GOutputStream *ostream;
+    TLLogArcWriter *writer;
+    GByteArray *buffer;
+    guint frame_count;
+    gboolean failed;
+}TBoxLogConvData;
+
+static gint tbox_logconv_item_compare(gconstpointer a, gconstpointer b)
+{
+    const TLLoggerLogItemData *item_a = *(const TLLoggerLogItemData **)a;
+    const TLLoggerLogItemData *item_b = *(const TLLoggerLogItemData **)b;
+    
+    return g_strcmp0(item_a->name, item_b->name);
+}
+
+static gboolean tbox_logconv_frame_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    TBoxLogConvData *conv_data = (TBoxLogConvData *)user_data;
+    GHashTable *log_table;
+    GHashTableIter iter;
+    TLLoggerLogItemData *item_data, *time_data;
+    GPtrArray *items;
+    GError *error = NULL;
+    
+    log_table = tl_logfmt_reader_frame_decode(conv_data->reader, type,
+        payload, len);
+    if(log_table==NULL)
+    {
+        return TRUE;
+    }
+    
+    time_data = g_hash_table_lookup(log_table, "time");
+    if(time_data==NULL)
+    {
+        g_hash_table_unref(log_table);
+        return TRUE;
+    }
+    
+    items = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, log_table);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&item_data))
+    {
+        if(item_data!=time_data)
+        {
+            g_ptr_array_add(items, item_data);
+        }
+    }
+    g_ptr_array_sort(items, tbox_logconv_item_compare);
+    
+    g_byte_array_set_size(conv_data->buffer, 0);
+    tl_logfmt_json_frame_append(conv_data->buffer, time_data->value,
+        (const TLLoggerLogItemData * const *)items->pdata, items->len);
+    g_ptr_array_unref(items);
+    g_hash_table_unref(log_table);
+    
+    if(conv_data->writer!=NULL)
+    {
+        if(!tl_logarc_writer_write(conv_data->writer, conv_data->buffer->data,
+            conv_data->buffer->len, &error))
+        {
+            fprintf(stderr, "Cannot write output: %s\n", error->message);
+            g_clear_error(&error);
+            conv_data->failed = TRUE;
+            return FALSE;
+        }
+    }
+    else if(conv_data->ostream==NULL)
+    {
+        if(fwrite(conv_data->buffer->data, 1, conv_data->buffer->len,
+            stdout)!=conv_data->buffer->len)
+        {
+            fprintf(stderr, "Cannot write output!\n");
+            conv_data->failed = TRUE;
+            return FALSE;
+        }
+    }
+    else if(!g_output_stream_write_all(conv_data->ostream,
+        conv_data->buffer->data, conv_data->buffer->len, NULL, NULL,
+        &error))
+    {
+        fprintf(stderr, "Cannot write output: %s\n", error->message);
+        g_clear_error(&error);
+        conv_data->failed = TRUE;
+        return FALSE;
+    }
+    conv_data->frame_count++;
+    
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    const gchar *input_path, *output_path = NULL;
+    gboolean compress = FALSE;
+    TLCodecType codec = TL_CODEC_ZLIB;
+    GFile *file;
+    GInputStream *istream;
+    GOutputStream *ostream;
+    GError *error = NULL;
+    TLLogFmtScanner *scanner;
+    TBoxLogConvData conv_data = {0};
+    guint8 buffer[4096];
+    gssize read_size;
+    int opt;
+    
+    while((opt=getopt(argc, argv, "o:zc:D:h"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'o':
+            {
+                output_path = optarg;
+                break;
+            }
+            case 'z':
+            {
+                compress = TRUE;
+                break;
+            }
+            case 'c':
+            {
+                if(!tl_codec_parse(optarg, &codec) ||
+                    !tl_codec_available(codec))
+                {
+                    fprintf(stderr, "Codec %s is not supported.\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'D':
+            {
+                if(!tl_codec_dictionary_load(optarg))
+                {
+                    return 1;
+                }
+                break;
+            }
+            default:
+            {
+                fprintf(stderr, "Usage: %s [-D dictionary] [-o output [-z] "
+                    "[-c codec]] input\n"
+                    "Converts a .tl/.tlw/.tlz log file to JSON frames, "
+                    "-z compresses the output file as a .tlz block archive "
+                    "with the codec (zlib, lz4 or zstd, default zlib), -D "
+                    "loads a zstd dictionary.\n", argv[0]);
+                return opt=='h' ? 0 : 1;
+            }
+        }
+    }
+    
+    if(optind>=argc)
+    {
+        fprintf(stderr, "No input file.\n");
+        return 1;
+    }
+    if(compress && output_path==NULL)
+    {
+        fprintf(stderr, "Compressed output needs an output file.\n");
+        return 1;
+    }
+    input_path = argv[optind];
+    
+    istream = tl_codec_file_read(input_path, &error);
+    if(istream==NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", input_path, error->message);
+        g_clear_error(&error);
+        return 2;
+    }
+    
+    if(output_path!=NULL)
+    {
+        file = g_file_new_for_path(output_path);
+        ostream = G_OUTPUT_STREAM(g_file_replace(file, NULL, FALSE,
+            G_FILE_CREATE_NONE, NULL, &error));
+        g_object_unref(file);
+        if(ostream==NULL)
+        {
+            fprintf(stderr, "Cannot create %s: %s\n", output_path,
+                error->message);
+            g_clear_error(&error);
+            g_object_unref(istream);
+            return 2;
+        }
+    }
+    else
+    {
+        ostream = NULL;
+    }
+    conv_data.ostream = ostream;
+    if(compress)
+    {
+        conv_data.writer = tl_logarc_writer_new(ostream, codec,
+            tl_codec_level_default_get(codec), TL_LOGARC_BLOCK_SIZE_DEFAULT,
+            &error);
+        if(conv_data.writer==NULL)
+        {
+            fprintf(stderr, "Cannot write %s: %s\n", output_path,
+                error->message);
+            g_clear_error(&error);
+            g_object_unref(ostream);
+            g_object_unref(istream);
+            return 2;
+        }
+    }
+    
+    scanner = tl_logfmt_scanner_new();
+    conv_data.reader = tl_logfmt_reader_new();
+    conv_data.buffer = g_byte_array_new();
+    
+    while((read_size=g_input_stream_read(istream, buffer, sizeof(buffer),
+        NULL, &error))>0)
+    {
+        if(!tl_logfmt_scanner_feed(scanner, buffer, read_size,
+            tbox_logconv_frame_cb, &conv_data))
+        {
+            break;
+        }
+    }
+    if(read_size<0 && g_error_matches(error, G_IO_ERROR,
+        G_IO_ERROR_PARTIAL_INPUT))
+    {
+        /* A segment recovered after a crash ends at its last flush. */
+        fprintf(stderr, "%s ends before its compressed stream does.\n",
+            input_path);
+        g_clear_error(&error);
+    }
+    else if(read_size<0)
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", input_path, error->message);
+        g_clear_error(&error);
+        conv_data.failed = TRUE;
+    }
+    
+    if(conv_data.writer!=NULL)
+    {
+        if(!conv_data.failed && !tl_logarc_writer_finish(conv_data.writer,
+            &error))
+        {
+            fprintf(stderr, "Cannot write output: %s\n", error->message);
+            g_clear_error(&error);
+            conv_data.failed = TRUE;
+        }
+        tl_logarc_writer_free(conv_data.writer);
+    }
+    if(conv_data.ostream!=NULL)
+    {
+        if(!g_output_stream_close(conv_data.ostream, NULL, &error))
+        {
+            fprintf(stderr, "Cannot close output: %s\n", error->message);
+            g_clear_error(&error);
+            conv_data.failed = TRUE;
+        }
+        g_object_unref(conv_data.ostream);
+    }
+    else
+    {
+        fflush(stdout);
+    }
+    g_object_unref(istream);
+    g_byte_array_unref(conv_data.buffer);
+    tl_logfmt_reader_free(conv_data.reader);
+    tl_logfmt_scanner_free(scanner);
+    
+    fprintf(stderr, "Converted %u records.\n", conv_data.frame_count);
+    
+    return conv_data.failed ? 3 : 0;
+}
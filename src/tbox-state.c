@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "tl-shm-reader.h"
+
+static void tbox_state_print_signal(TLShmReader *reader, unsigned int index)
+{
+    int64_t value, timestamp;
+    double unit;
+    int offset, source;
+    
+    if(tl_shm_reader_read(reader, index, &value, &timestamp)!=0 ||
+        tl_shm_reader_signal_scale(reader, index, &unit, &offset,
+        &source)!=0)
+    {
+        return;
+    }
+    if(timestamp==0)
+    {
+        printf("%s: no data\n", tl_shm_reader_signal_name(reader, index));
+        return;
+    }
+    
+    printf("%s: %" PRId64 " (%g) at %" PRId64 ".%06" PRId64 "\n",
+        tl_shm_reader_signal_name(reader, index), value,
+        (double)value * unit + offset, timestamp / 1000000,
+        timestamp % 1000000);
+}
+
+int main(int argc, char *argv[])
+{
+    TLShmReader *reader;
+    const char *name = NULL;
+    unsigned int interval = 0, count, i;
+    int opt, index, ret = 0;
+    
+    while((opt=getopt(argc, argv, "n:w:h"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'n':
+            {
+                name = optarg;
+                break;
+            }
+            case 'w':
+            {
+                interval = strtoul(optarg, NULL, 10);
+                break;
+            }
+            default:
+            {
+                fprintf(stderr, "Usage: %s [-n shm-name] [-w interval-ms] "
+                    "[signal ...]\n", argv[0]);
+                return opt=='h' ? 0 : 1;
+            }
+        }
+    }
+    
+    reader = tl_shm_reader_open(name);
+    if(reader==NULL)
+    {
+        fprintf(stderr, "Cannot open tbox-logger state, is it running?\n");
+        return 2;
+    }
+    
+    do
+    {
+        if(tl_shm_reader_is_stale(reader))
+        {
+            fprintf(stderr, "tbox-logger has exited.\n");
+            ret = 3;
+            break;
+        }
+        
+        if(optind>=argc)
+        {
+            count = tl_shm_reader_signal_count(reader);
+            for(i=0;i<count;i++)
+            {
+                tbox_state_print_signal(reader, i);
+            }
+        }
+        else
+        {
+            for(i=optind;i<(unsigned int)argc;i++)
+            {
+                index = tl_shm_reader_lookup(reader, argv[i]);
+                if(index<0)
+                {
+                    printf("%s: unknown\n", argv[i]);
+                    continue;
+                }
+                tbox_state_print_signal(reader, index);
+            }
+        }
+        
+        if(interval>0)
+        {
+            fflush(stdout);
+            usleep(interval * 1000);
+        }
+    }
+    while(interval>0);
+    
+    tl_shm_reader_close(reader);
+    
+    return ret;
+}
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "tl-bgwork.h"
+#include "tl-membudget.h"
+#include "tl-shm.h"
+
+#define TL_BGWORK_PROBE_INTERVAL 100
+#define TL_BGWORK_SAMPLE_PROBES 10
+#define TL_BGWORK_CAN_FRAME_RATE_LIMIT_DEFAULT 2500
+#define TL_BGWORK_PAUSE_CHECK_INTERVAL 200
+#define TL_BGWORK_PAUSE_MAXIMUM 30
+#define TL_BGWORK_RUN_MINIMUM 10
+
+#ifndef IOPRIO_CLASS_IDLE
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#endif
+
+/*
+ * The main loop probe runs every 100ms and records how late it was
+ * dispatched. Every 10 probes it computes the CAN frame rate and checks
+ * the network queues; background work pauses while either is high, the
+ * network queues count as high from half their budget. A pause lasts at
+ * most 30s and is followed by at least 10s of work, so archiving keeps up
+ * with a bus which stays busy for a whole trip.
+ */
+typedef struct _TLBgWorkData
+{
+    gboolean initialized;
+    GMutex mutex;
+    GCond cond;
+    gboolean busy;
+    gint64 run_until;
+    gint64 paused_time;
+    guint can_frame_rate_limit;
+    gboolean idle_priority;
+    guint can_frames;
+    guint probe_count;
+    gint64 probe_time;
+    gint64 sample_time;
+    gint64 latency_max;
+    gint64 latency_sum;
+    gint64 latency_peak;
+    guint64 latency_count;
+    guint probe_timeout_id;
+    gint latency_slot;
+    gint can_frame_rate_slot;
+    gint busy_slot;
+}TLBgWorkData;
+
+static TLBgWorkData g_tl_bgwork_data =
+{
+    .can_frame_rate_limit = TL_BGWORK_CAN_FRAME_RATE_LIMIT_DEFAULT,
+    .idle_priority = TRUE,
+    .latency_slot = -1,
+    .can_frame_rate_slot = -1,
+    .busy_slot = -1
+};
+
+static gboolean tl_bgwork_net_queue_is_high(TLMemBudgetQueue queue)
+{
+    gsize budget;
+    
+    budget = tl_membudget_budget_get(queue);
+    
+    return (budget>0 && tl_membudget_usage_get(queue) >= budget / 2);
+}
+
+static gboolean tl_bgwork_probe_timer_cb(gpointer user_data)
+{
+    TLBgWorkData *bgwork_data = (TLBgWorkData *)user_data;
+    gint64 now, latency, rate;
+    gboolean busy;
+    
+    now = g_get_monotonic_time();
+    latency = now - bgwork_data->probe_time -
+        TL_BGWORK_PROBE_INTERVAL * 1000;
+    if(latency<0)
+    {
+        latency = 0;
+    }
+    bgwork_data->probe_time = now;
+    if(latency>bgwork_data->latency_max)
+    {
+        bgwork_data->latency_max = latency;
+    }
+    if(latency>bgwork_data->latency_peak)
+    {
+        bgwork_data->latency_peak = latency;
+    }
+    bgwork_data->latency_sum += latency;
+    bgwork_data->latency_count++;
+    
+    bgwork_data->probe_count++;
+    if(bgwork_data->probe_count<TL_BGWORK_SAMPLE_PROBES)
+    {
+        return TRUE;
+    }
+    
+    rate = (gint64)bgwork_data->can_frames * G_USEC_PER_SEC /
+        MAX(now - bgwork_data->sample_time, 1);
+    busy = (bgwork_data->can_frame_rate_limit>0 &&
+        rate>bgwork_data->can_frame_rate_limit) ||
+        tl_bgwork_net_queue_is_high(TL_MEMBUDGET_QUEUE_NET_DATA) ||
+        tl_bgwork_net_queue_is_high(TL_MEMBUDGET_QUEUE_NET_WRITE);
+    
+    g_mutex_lock(&(bgwork_data->mutex));
+    if(bgwork_data->busy && !busy)
+    {
+        g_cond_broadcast(&(bgwork_data->cond));
+    }
+    bgwork_data->busy = busy;
+    g_mutex_unlock(&(bgwork_data->mutex));
+    
+    now = g_get_real_time();
+    tl_shm_slot_update(bgwork_data->latency_slot, bgwork_data->latency_max,
+        now);
+    tl_shm_slot_update(bgwork_data->can_frame_rate_slot, rate, now);
+    tl_shm_slot_update(bgwork_data->busy_slot, busy ? 1 : 0, now);
+    
+    bgwork_data->can_frames = 0;
+    bgwork_data->probe_count = 0;
+    bgwork_data->latency_max = 0;
+    bgwork_data->sample_time = bgwork_data->probe_time;
+    
+    return TRUE;
+}
+
+gboolean tl_bgwork_init()
+{
+    if(g_tl_bgwork_data.initialized)
+    {
+        g_warning("TLBgWork already initialized!");
+        return TRUE;
+    }
+    
+    g_tl_bgwork_data.latency_slot = tl_shm_slot_add(
+        "bgwork.dispatch-latency", 1.0, 0, 0);
+    g_tl_bgwork_data.can_frame_rate_slot = tl_shm_slot_add(
+        "bgwork.can-frame-rate", 1.0, 0, 0);
+    g_tl_bgwork_data.busy_slot = tl_shm_slot_add("bgwork.paused", 1.0, 0,
+        0);
+    
+    g_tl_bgwork_data.probe_time = g_get_monotonic_time();
+    g_tl_bgwork_data.sample_time = g_tl_bgwork_data.probe_time;
+    g_tl_bgwork_data.probe_timeout_id = g_timeout_add(
+        TL_BGWORK_PROBE_INTERVAL, tl_bgwork_probe_timer_cb,
+        &g_tl_bgwork_data);
+    
+    g_tl_bgwork_data.initialized = TRUE;
+    
+    return TRUE;
+}
+
+void tl_bgwork_uninit()
+{
+    if(!g_tl_bgwork_data.initialized)
+    {
+        return;
+    }
+    
+    g_tl_bgwork_data.initialized = FALSE;
+    
+    if(g_tl_bgwork_data.probe_timeout_id>0)
+    {
+        g_source_remove(g_tl_bgwork_data.probe_timeout_id);
+        g_tl_bgwork_data.probe_timeout_id = 0;
+    }
+    
+    g_mutex_lock(&(g_tl_bgwork_data.mutex));
+    g_tl_bgwork_data.busy = FALSE;
+    g_cond_broadcast(&(g_tl_bgwork_data.cond));
+    g_mutex_unlock(&(g_tl_bgwork_data.mutex));
+    
+    g_message("TLBgWork main loop dispatch latency mean %"G_GINT64_FORMAT
+        " us, maximum %"G_GINT64_FORMAT" us, background work paused for %"
+        G_GINT64_FORMAT" s.", g_tl_bgwork_data.latency_count>0 ?
+        g_tl_bgwork_data.latency_sum / (gint64)
+        g_tl_bgwork_data.latency_count : 0, g_tl_bgwork_data.latency_peak,
+        g_tl_bgwork_data.paused_time / G_USEC_PER_SEC);
+    
+    g_tl_bgwork_data.latency_slot = -1;
+    g_tl_bgwork_data.can_frame_rate_slot = -1;
+    g_tl_bgwork_data.busy_slot = -1;
+}
+
+void tl_bgwork_can_frame_rate_limit_set(guint rate)
+{
+    g_tl_bgwork_data.can_frame_rate_limit = rate;
+}
+
+void tl_bgwork_idle_priority_set(gboolean enabled)
+{
+    g_tl_bgwork_data.idle_priority = enabled;
+}
+
+/* Called on the main loop for every received CAN frame. */
+void tl_bgwork_can_frame_add()
+{
+    g_tl_bgwork_data.can_frames++;
+}
+
+/*
+ * Moves the calling thread to the idle CPU scheduling class and the idle
+ * I/O priority class, so it only runs and reaches the storage when
+ * nothing else wants to.
+ */
+void tl_bgwork_thread_enter()
+{
+    struct sched_param param;
+    int ret;
+    
+    if(!g_tl_bgwork_data.idle_priority)
+    {
+        return;
+    }
+    
+    memset(&param, 0, sizeof(struct sched_param));
+    ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if(ret!=0)
+    {
+        g_warning("TLBgWork cannot set idle CPU priority: %s",
+            strerror(ret));
+    }
+    
+    if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+        IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)!=0)
+    {
+        g_warning("TLBgWork cannot set idle I/O priority: %s",
+            strerror(errno));
+    }
+}
+
+/*
+ * Called by a worker between chunks of its work. Waits while the system
+ * is busy, returns whether the worker should go on. The owner of work_flag
+ * does not hold our mutex, so it must clear the flag atomically.
+ */
+gboolean tl_bgwork_yield(const gboolean *work_flag)
+{
+    gint64 now, start, deadline;
+    
+    g_mutex_lock(&(g_tl_bgwork_data.mutex));
+    now = g_get_monotonic_time();
+    if(g_tl_bgwork_data.busy && now>=g_tl_bgwork_data.run_until)
+    {
+        start = now;
+        deadline = now + TL_BGWORK_PAUSE_MAXIMUM * G_TIME_SPAN_SECOND;
+        while(g_atomic_int_get(work_flag) && g_tl_bgwork_data.busy &&
+            now<deadline)
+        {
+            g_cond_wait_until(&(g_tl_bgwork_data.cond),
+                &(g_tl_bgwork_data.mutex), MIN(deadline, now +
+                TL_BGWORK_PAUSE_CHECK_INTERVAL * G_TIME_SPAN_MILLISECOND));
+            now = g_get_monotonic_time();
+        }
+        g_tl_bgwork_data.paused_time += now - start;
+        if(g_tl_bgwork_data.busy)
+        {
+            g_tl_bgwork_data.run_until = now + TL_BGWORK_RUN_MINIMUM *
+                G_TIME_SPAN_SECOND;
+        }
+    }
+    g_mutex_unlock(&(g_tl_bgwork_data.mutex));
+    
+    return g_atomic_int_get(work_flag);
+}
@@ -0,0 +1,23 @@
+#ifndef HAVE_TL_BGWORK_H
+#define HAVE_TL_BGWORK_H
+
+#include <glib.h>
+
+/*
+ * Pacing of deferrable background work such as archiving and downsampling
+ * log files. A worker thread calls tl_bgwork_thread_enter() once to run at
+ * idle CPU and I/O priority, then tl_bgwork_yield() between chunks of its
+ * work, which waits while the CAN frame rate or the network queues are
+ * high. A main loop timer samples the load and measures how late the main
+ * loop dispatches its sources.
+ */
+
+gboolean tl_bgwork_init();
+void tl_bgwork_uninit();
+void tl_bgwork_can_frame_rate_limit_set(guint rate);
+void tl_bgwork_idle_priority_set(gboolean enabled);
+void tl_bgwork_can_frame_add();
+void tl_bgwork_thread_enter();
+gboolean tl_bgwork_yield(const gboolean *work_flag);
+
+#endif
@@ -11,6 +11,7 @@
 #include "tl-canbus.h"
 #include "tl-parser.h"
 #include "tl-serial.h"
+#include "tl-bgwork.h"
 #include "tl-main.h"
 
 #define TL_CANBUS_NO_DATA_TIMEOUT 180
@@ -75,6 +76,7 @@ static gboolean tl_canbus_socket_io_channel_watch(GIOChannel *source,
             {
                 tl_parser_parse_can_data(socket_data->device,
                     frame.can_id, frame.data, frame.len);
+                tl_bgwork_can_frame_add();
                     
                 g_tl_canbus_data.data_timestamp = g_get_monotonic_time();
             }
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include "tl-catalog.h"
+#include "tl-logfmt.h"
+
+#define TL_CATALOG_MAGIC ((const guint8 *)"TLCT")
+#define TL_CATALOG_VERSION 1
+#define TL_CATALOG_HEADER_SIZE 12
+#define TL_CATALOG_ENTRY_SIZE 33
+
+struct _TLCatalog
+{
+    gchar *path;
+    GMutex mutex;
+    GMutex sync_mutex;
+    GHashTable *segments;
+    gboolean dirty;
+};
+
+static TLCatalogSegment *tl_catalog_segment_dup(
+    const TLCatalogSegment *segment)
+{
+    TLCatalogSegment *new_segment;
+    
+    new_segment = g_new(TLCatalogSegment, 1);
+    memcpy(new_segment, segment, sizeof(TLCatalogSegment));
+    new_segment->name = g_strdup(segment->name);
+    
+    return new_segment;
+}
+
+static int tl_catalog_segment_compare(const TLCatalogSegment **a,
+    const TLCatalogSegment **b)
+{
+    if((*a)->first_time!=(*b)->first_time)
+    {
+        return (*a)->first_time < (*b)->first_time ? -1 : 1;
+    }
+    return g_strcmp0((*a)->name, (*b)->name);
+}
+
+static inline guint64 tl_catalog_uint64_get(const guint8 *data)
+{
+    guint64 value;
+    
+    memcpy(&value, data, 8);
+    return GUINT64_FROM_BE(value);
+}
+
+static inline void tl_catalog_uint64_append(GByteArray *ba, guint64 value)
+{
+    value = GUINT64_TO_BE(value);
+    g_byte_array_append(ba, (const guint8 *)&value, 8);
+}
+
+static gboolean tl_catalog_load(TLCatalog *catalog, const guint8 *data,
+    gsize len)
+{
+    TLCatalogSegment segment, *new_segment;
+    guint32 becount, count, i;
+    guint16 becrc;
+    gsize offset, name_len;
+    
+    if(len<TL_CATALOG_HEADER_SIZE + 2 ||
+        memcmp(data, TL_CATALOG_MAGIC, 4)!=0 ||
+        data[4]!=TL_CATALOG_VERSION)
+    {
+        return FALSE;
+    }
+    memcpy(&becrc, data + len - 2, 2);
+    if(g_ntohs(becrc)!=tl_logfmt_crc16_compute(data, len - 2))
+    {
+        return FALSE;
+    }
+    memcpy(&becount, data + 8, 4);
+    count = g_ntohl(becount);
+    
+    offset = TL_CATALOG_HEADER_SIZE;
+    for(i=0;i<count;i++)
+    {
+        if(offset + 1 > len - 2)
+        {
+            return FALSE;
+        }
+        name_len = data[offset];
+        if(name_len==0 || offset + 1 + name_len + TL_CATALOG_ENTRY_SIZE >
+            len - 2)
+        {
+            return FALSE;
+        }
+        segment.name = g_strndup((const gchar *)data + offset + 1, name_len);
+        offset += 1 + name_len;
+        segment.state = data[offset];
+        segment.size = tl_catalog_uint64_get(data + offset + 1);
+        segment.records = tl_catalog_uint64_get(data + offset + 9);
+        segment.first_time = tl_catalog_uint64_get(data + offset + 17);
+        segment.last_time = tl_catalog_uint64_get(data + offset + 25);
+        offset += TL_CATALOG_ENTRY_SIZE;
+        
+        new_segment = tl_catalog_segment_dup(&segment);
+        g_hash_table_replace(catalog->segments, new_segment->name,
+            new_segment);
+        g_free(segment.name);
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Loads the catalog at path. A missing or damaged catalog gives an empty
+ * one, which is written to path on the next sync.
+ */
+TLCatalog *tl_catalog_open(const gchar *path)
+{
+    TLCatalog *catalog;
+    gchar *contents;
+    gsize len;
+    GError *error = NULL;
+    
+    catalog = g_new0(TLCatalog, 1);
+    catalog->path = g_strdup(path);
+    g_mutex_init(&(catalog->mutex));
+    g_mutex_init(&(catalog->sync_mutex));
+    catalog->segments = g_hash_table_new_full(g_str_hash, g_str_equal,
+        NULL, (GDestroyNotify)tl_catalog_segment_free);
+    
+    if(g_file_get_contents(path, &contents, &len, &error))
+    {
+        if(!tl_catalog_load(catalog, (const guint8 *)contents, len))
+        {
+            g_warning("TLCatalog ignores damaged catalog %s.", path);
+            g_hash_table_remove_all(catalog->segments);
+        }
+        g_free(contents);
+    }
+    else
+    {
+        if(!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+            g_warning("TLCatalog cannot read catalog %s: %s", path,
+                error->message);
+        }
+        g_clear_error(&error);
+    }
+    catalog->dirty = TRUE;
+    
+    return catalog;
+}
+
+void tl_catalog_free(TLCatalog *catalog)
+{
+    if(catalog==NULL)
+    {
+        return;
+    }
+    
+    g_hash_table_unref(catalog->segments);
+    g_mutex_clear(&(catalog->mutex));
+    g_mutex_clear(&(catalog->sync_mutex));
+    g_free(catalog->path);
+    g_free(catalog);
+}
+
+static gboolean tl_catalog_file_write(const gchar *path, const guint8 *data,
+    gsize len)
+{
+    ssize_t rsize;
+    int fd;
+    gboolean ret = TRUE;
+    
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if(fd<0)
+    {
+        return FALSE;
+    }
+    while(len>0)
+    {
+        rsize = write(fd, data, len);
+        if(rsize<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(rsize<=0)
+        {
+            ret = FALSE;
+            break;
+        }
+        data += rsize;
+        len -= rsize;
+    }
+    if(ret && fdatasync(fd)!=0)
+    {
+        ret = FALSE;
+    }
+    if(close(fd)!=0)
+    {
+        ret = FALSE;
+    }
+    
+    return ret;
+}
+
+/*
+ * Saves the catalog if it changed since the last sync. The new catalog
+ * replaces the old one by rename, so a crash leaves either of them.
+ */
+gboolean tl_catalog_sync(TLCatalog *catalog)
+{
+    GHashTableIter iter;
+    TLCatalogSegment *segment;
+    GByteArray *ba;
+    guint8 header[TL_CATALOG_HEADER_SIZE];
+    guint32 becount;
+    guint16 becrc;
+    gchar *tmp_path, *dir_path;
+    guint8 name_len, state;
+    int fd;
+    gboolean ret = TRUE;
+    
+    if(catalog==NULL)
+    {
+        return FALSE;
+    }
+    
+    /* One writer at a time, they share the temporary file. */
+    g_mutex_lock(&(catalog->sync_mutex));
+    g_mutex_lock(&(catalog->mutex));
+    if(!catalog->dirty)
+    {
+        g_mutex_unlock(&(catalog->mutex));
+        g_mutex_unlock(&(catalog->sync_mutex));
+        return TRUE;
+    }
+    
+    memset(header, 0, TL_CATALOG_HEADER_SIZE);
+    memcpy(header, TL_CATALOG_MAGIC, 4);
+    header[4] = TL_CATALOG_VERSION;
+    becount = g_htonl(g_hash_table_size(catalog->segments));
+    memcpy(header + 8, &becount, 4);
+    ba = g_byte_array_new();
+    g_byte_array_append(ba, header, TL_CATALOG_HEADER_SIZE);
+    
+    g_hash_table_iter_init(&iter, catalog->segments);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&segment))
+    {
+        name_len = strlen(segment->name);
+        state = segment->state;
+        g_byte_array_append(ba, (const guint8 *)&name_len, 1);
+        g_byte_array_append(ba, (const guint8 *)segment->name, name_len);
+        g_byte_array_append(ba, &state, 1);
+        tl_catalog_uint64_append(ba, segment->size);
+        tl_catalog_uint64_append(ba, segment->records);
+        tl_catalog_uint64_append(ba, segment->first_time);
+        tl_catalog_uint64_append(ba, segment->last_time);
+    }
+    catalog->dirty = FALSE;
+    g_mutex_unlock(&(catalog->mutex));
+    
+    becrc = g_htons(tl_logfmt_crc16_compute(ba->data, ba->len));
+    g_byte_array_append(ba, (const guint8 *)&becrc, 2);
+    
+    tmp_path = g_strdup_printf("%s.tmp", catalog->path);
+    if(!tl_catalog_file_write(tmp_path, ba->data, ba->len) ||
+        g_rename(tmp_path, catalog->path)!=0)
+    {
+        g_warning("TLCatalog cannot save catalog %s: %s", catalog->path,
+            strerror(errno));
+        g_remove(tmp_path);
+        ret = FALSE;
+    }
+    else
+    {
+        /* Make the rename itself durable. */
+        dir_path = g_path_get_dirname(catalog->path);
+        fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+        if(fd>=0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+        g_free(dir_path);
+    }
+    g_free(tmp_path);
+    g_byte_array_unref(ba);
+    
+    if(!ret)
+    {
+        g_mutex_lock(&(catalog->mutex));
+        catalog->dirty = TRUE;
+        g_mutex_unlock(&(catalog->mutex));
+    }
+    g_mutex_unlock(&(catalog->sync_mutex));
+    
+    return ret;
+}
+
+/* Returns the file name suffix of segments in state. */
+const gchar *tl_catalog_state_suffix_get(TLCatalogState state)
+{
+    switch(state)
+    {
+        case TL_CATALOG_STATE_WRITING:
+        {
+            return ".tlw";
+        }
+        case TL_CATALOG_STATE_CLOSED:
+        {
+            return ".tl";
+        }
+        case TL_CATALOG_STATE_ARCHIVED:
+        {
+            return ".tlz";
+        }
+        default:
+        {
+            break;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Adds segment, or replaces the segment with the same name. */
+void tl_catalog_segment_set(TLCatalog *catalog,
+    const TLCatalogSegment *segment)
+{
+    TLCatalogSegment *new_segment;
+    
+    if(catalog==NULL || segment==NULL || segment->name==NULL ||
+        strlen(segment->name)==0 || strlen(segment->name)>G_MAXUINT8)
+    {
+        return;
+    }
+    
+    new_segment = tl_catalog_segment_dup(segment);
+    
+    g_mutex_lock(&(catalog->mutex));
+    g_hash_table_replace(catalog->segments, new_segment->name, new_segment);
+    catalog->dirty = TRUE;
+    g_mutex_unlock(&(catalog->mutex));
+}
+
+void tl_catalog_segment_state_set(TLCatalog *catalog, const gchar *name,
+    TLCatalogState state, guint64 size)
+{
+    TLCatalogSegment *segment;
+    
+    if(catalog==NULL || name==NULL)
+    {
+        return;
+    }
+    
+    g_mutex_lock(&(catalog->mutex));
+    segment = g_hash_table_lookup(catalog->segments, name);
+    if(segment!=NULL)
+    {
+        segment->state = state;
+        segment->size = size;
+        catalog->dirty = TRUE;
+    }
+    g_mutex_unlock(&(catalog->mutex));
+}
+
+/*
+ * Counts a record written to a segment. Only the memory copy changes, the
+ * catalog is saved with the next state change.
+ */
+void tl_catalog_segment_record_add(TLCatalog *catalog, const gchar *name,
+    gint64 time)
+{
+    TLCatalogSegment *segment;
+    
+    if(catalog==NULL || name==NULL)
+    {
+        return;
+    }
+    
+    g_mutex_lock(&(catalog->mutex));
+    segment = g_hash_table_lookup(catalog->segments, name);
+    if(segment!=NULL)
+    {
+        if(segment->records==0 || time<segment->first_time)
+        {
+            segment->first_time = time;
+        }
+        if(segment->records==0 || time>segment->last_time)
+        {
+            segment->last_time = time;
+        }
+        segment->records++;
+        catalog->dirty = TRUE;
+    }
+    g_mutex_unlock(&(catalog->mutex));
+}
+
+void tl_catalog_segment_remove(TLCatalog *catalog, const gchar *name)
+{
+    if(catalog==NULL || name==NULL)
+    {
+        return;
+    }
+    
+    g_mutex_lock(&(catalog->mutex));
+    if(g_hash_table_remove(catalog->segments, name))
+    {
+        catalog->dirty = TRUE;
+    }
+    g_mutex_unlock(&(catalog->mutex));
+}
+
+/* Returns a copy of the segment called name, or NULL. */
+TLCatalogSegment *tl_catalog_segment_lookup(TLCatalog *catalog,
+    const gchar *name)
+{
+    TLCatalogSegment *segment;
+    
+    if(catalog==NULL || name==NULL)
+    {
+        return NULL;
+    }
+    
+    g_mutex_lock(&(catalog->mutex));
+    segment = g_hash_table_lookup(catalog->segments, name);
+    if(segment!=NULL)
+    {
+        segment = tl_catalog_segment_dup(segment);
+    }
+    g_mutex_unlock(&(catalog->mutex));
+    
+    return segment;
+}
+
+/*
+ * Returns copies of the segments in one of states, oldest first. With a
+ * begin or end time, only segments with records overlapping the range.
+ */
+GPtrArray *tl_catalog_segments_list(TLCatalog *catalog, guint states,
+    gboolean begin_time_set, gint64 begin_time, gboolean end_time_set,
+    gint64 end_time)
+{
+    GHashTableIter iter;
+    TLCatalogSegment *segment;
+    GPtrArray *segments;
+    
+    segments = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_catalog_segment_free);
+    if(catalog==NULL)
+    {
+        return segments;
+    }
+    
+    g_mutex_lock(&(catalog->mutex));
+    g_hash_table_iter_init(&iter, catalog->segments);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&segment))
+    {
+        if(!(segment->state & states))
+        {
+            continue;
+        }
+        if((begin_time_set || end_time_set) && segment->records==0)
+        {
+            continue;
+        }
+        if((begin_time_set && segment->last_time<begin_time) ||
+            (end_time_set && segment->first_time>end_time))
+        {
+            continue;
+        }
+        g_ptr_array_add(segments, tl_catalog_segment_dup(segment));
+    }
+    g_mutex_unlock(&(catalog->mutex));
+    
+    g_ptr_array_sort(segments, (GCompareFunc)tl_catalog_segment_compare);
+    
+    return segments;
+}
+
+void tl_catalog_segment_free(TLCatalogSegment *segment)
+{
+    if(segment==NULL)
+    {
+        return;
+    }
+    g_free(segment->name);
+    g_free(segment);
+}
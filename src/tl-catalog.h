@@ -0,0 +1,62 @@
+#ifndef HAVE_TL_CATALOG_H
+#define HAVE_TL_CATALOG_H
+
+#include <glib.h>
+
+/*
+ * The catalog lists the log segments of the storage directory with their
+ * state, size, record count and time range, so queries, the archive pass
+ * and retention do not have to scan and open every file. It is kept in
+ * memory and saved by tl_catalog_sync() to a temporary file which is
+ * synced and renamed over the catalog:
+ * | "TLCT" | version (1B) | reserved (3B) | count (4B BE) | count x entry |
+ *   CRC16 (2B BE) |
+ * entry: | name length (1B) | name | state (1B) | size (8B BE) |
+ *   records (8B BE) | first time (8B BE) | last time (8B BE) |
+ *
+ * A crash may leave the catalog behind the files, the owner checks the
+ * entries against the directory when it opens the catalog.
+ */
+
+typedef enum
+{
+    TL_CATALOG_STATE_WRITING = 1 << 0,
+    TL_CATALOG_STATE_CLOSED = 1 << 1,
+    TL_CATALOG_STATE_ARCHIVED = 1 << 2
+}TLCatalogState;
+
+#define TL_CATALOG_STATE_ALL (TL_CATALOG_STATE_WRITING | \
+    TL_CATALOG_STATE_CLOSED | TL_CATALOG_STATE_ARCHIVED)
+
+typedef struct _TLCatalogSegment
+{
+    gchar *name;
+    TLCatalogState state;
+    guint64 size;
+    guint64 records;
+    gint64 first_time;
+    gint64 last_time;
+}TLCatalogSegment;
+
+typedef struct _TLCatalog TLCatalog;
+
+TLCatalog *tl_catalog_open(const gchar *path);
+void tl_catalog_free(TLCatalog *catalog);
+gboolean tl_catalog_sync(TLCatalog *catalog);
+const gchar *tl_catalog_state_suffix_get(TLCatalogState state);
+
+void tl_catalog_segment_set(TLCatalog *catalog,
+    const TLCatalogSegment *segment);
+void tl_catalog_segment_state_set(TLCatalog *catalog, const gchar *name,
+    TLCatalogState state, guint64 size);
+void tl_catalog_segment_record_add(TLCatalog *catalog, const gchar *name,
+    gint64 time);
+void tl_catalog_segment_remove(TLCatalog *catalog, const gchar *name);
+TLCatalogSegment *tl_catalog_segment_lookup(TLCatalog *catalog,
+    const gchar *name);
+GPtrArray *tl_catalog_segments_list(TLCatalog *catalog, guint states,
+    gboolean begin_time_set, gint64 begin_time, gboolean end_time_set,
+    gint64 end_time);
+void tl_catalog_segment_free(TLCatalogSegment *segment);
+
+#endif
@@ -0,0 +1,901 @@
+#include <string.h>
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#include "tl-codec.h"
+#include "tl-logseg.h"
+#include "tl-logarc.h"
+
+#define TL_CODEC_MAGIC ((const guint8 *)"TLCZ")
+#define TL_CODEC_VERSION 1
+
+typedef struct _TLCodecData
+{
+    GBytes *dictionary;
+    guint32 dictionary_id;
+#ifdef HAVE_ZSTD
+    ZSTD_DDict *dictionary_ddict;
+#endif
+}TLCodecData;
+
+static TLCodecData g_tl_codec_data = {0};
+
+static const gchar * const g_tl_codec_names[TL_CODEC_LAST] =
+{
+    "zlib", "lz4", "zstd"
+};
+
+#if defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+
+/*
+ * A GConverter for the LZ4 frame and zstd stream formats, so they plug
+ * into the same converter streams as GZlibCompressor.
+ */
+typedef struct _TLCodecConverter
+{
+    GObject parent_instance;
+    TLCodecType codec;
+    gboolean compress;
+    gboolean started;
+#ifdef HAVE_LZ4
+    LZ4F_cctx *lz4_cctx;
+    LZ4F_dctx *lz4_dctx;
+    LZ4F_preferences_t lz4_prefs;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd_cctx;
+    ZSTD_DCtx *zstd_dctx;
+#endif
+}TLCodecConverter;
+
+typedef struct _TLCodecConverterClass
+{
+    GObjectClass parent_class;
+}TLCodecConverterClass;
+
+static void tl_codec_converter_iface_init(GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(TLCodecConverter, tl_codec_converter, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(G_TYPE_CONVERTER, tl_codec_converter_iface_init))
+
+/*
+ * Converters report no progress as missing input or missing output space,
+ * the converter streams then read more or grow their buffer.
+ */
+static GConverterResult tl_codec_converter_stalled(gboolean input_needed,
+    GError **error)
+{
+    if(input_needed)
+    {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+            "Need more input");
+    }
+    else
+    {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+            "Need more output space");
+    }
+    
+    return G_CONVERTER_ERROR;
+}
+
+#ifdef HAVE_LZ4
+
+static GConverterResult tl_codec_lz4_compress(TLCodecConverter *converter,
+    const void *inbuf, gsize inbuf_size, void *outbuf, gsize outbuf_size,
+    GConverterFlags flags, gsize *bytes_read, gsize *bytes_written,
+    GError **error)
+{
+    size_t ret;
+    
+    /*
+     * LZ4F only writes with room for its worst case, a call which does
+     * not fit stops early.
+     */
+    if(!converter->started)
+    {
+        if(outbuf_size < LZ4F_HEADER_SIZE_MAX)
+        {
+            return tl_codec_converter_stalled(FALSE, error);
+        }
+        ret = LZ4F_compressBegin(converter->lz4_cctx, outbuf, outbuf_size,
+            &(converter->lz4_prefs));
+        if(LZ4F_isError(ret))
+        {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "LZ4 compression failed: %s", LZ4F_getErrorName(ret));
+            return G_CONVERTER_ERROR;
+        }
+        *bytes_written += ret;
+        converter->started = TRUE;
+    }
+    
+    if(inbuf_size>0)
+    {
+        if(outbuf_size - *bytes_written < LZ4F_compressBound(inbuf_size,
+            &(converter->lz4_prefs)))
+        {
+            return *bytes_written>0 ? G_CONVERTER_CONVERTED :
+                tl_codec_converter_stalled(FALSE, error);
+        }
+        ret = LZ4F_compressUpdate(converter->lz4_cctx,
+            (guint8 *)outbuf + *bytes_written, outbuf_size - *bytes_written,
+            inbuf, inbuf_size, NULL);
+        if(LZ4F_isError(ret))
+        {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "LZ4 compression failed: %s", LZ4F_getErrorName(ret));
+            return G_CONVERTER_ERROR;
+        }
+        *bytes_read = inbuf_size;
+        *bytes_written += ret;
+    }
+    
+    if(flags & (G_CONVERTER_INPUT_AT_END | G_CONVERTER_FLUSH))
+    {
+        if(outbuf_size - *bytes_written < LZ4F_compressBound(0,
+            &(converter->lz4_prefs)))
+        {
+            return *bytes_written>0 ? G_CONVERTER_CONVERTED :
+                tl_codec_converter_stalled(FALSE, error);
+        }
+        if(flags & G_CONVERTER_INPUT_AT_END)
+        {
+            ret = LZ4F_compressEnd(converter->lz4_cctx,
+                (guint8 *)outbuf + *bytes_written,
+                outbuf_size - *bytes_written, NULL);
+        }
+        else
+        {
+            ret = LZ4F_flush(converter->lz4_cctx,
+                (guint8 *)outbuf + *bytes_written,
+                outbuf_size - *bytes_written, NULL);
+        }
+        if(LZ4F_isError(ret))
+        {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "LZ4 compression failed: %s", LZ4F_getErrorName(ret));
+            return G_CONVERTER_ERROR;
+        }
+        *bytes_written += ret;
+        
+        return (flags & G_CONVERTER_INPUT_AT_END) ? G_CONVERTER_FINISHED :
+            G_CONVERTER_FLUSHED;
+    }
+    
+    if(*bytes_read==0 && *bytes_written==0)
+    {
+        return tl_codec_converter_stalled(inbuf_size==0, error);
+    }
+    
+    return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult tl_codec_lz4_decompress(TLCodecConverter *converter,
+    const void *inbuf, gsize inbuf_size, void *outbuf, gsize outbuf_size,
+    GConverterFlags flags, gsize *bytes_read, gsize *bytes_written,
+    GError **error)
+{
+    size_t ret, src_size = inbuf_size, dst_size = outbuf_size;
+    
+    ret = LZ4F_decompress(converter->lz4_dctx, outbuf, &dst_size, inbuf,
+        &src_size, NULL);
+    if(LZ4F_isError(ret))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "Invalid LZ4 data: %s", LZ4F_getErrorName(ret));
+        return G_CONVERTER_ERROR;
+    }
+    *bytes_read = src_size;
+    *bytes_written = dst_size;
+    
+    if(ret==0)
+    {
+        return G_CONVERTER_FINISHED;
+    }
+    if(src_size==0 && dst_size==0)
+    {
+        return tl_codec_converter_stalled(inbuf_size==0, error);
+    }
+    
+    return G_CONVERTER_CONVERTED;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+static GConverterResult tl_codec_zstd_compress(TLCodecConverter *converter,
+    const void *inbuf, gsize inbuf_size, void *outbuf, gsize outbuf_size,
+    GConverterFlags flags, gsize *bytes_read, gsize *bytes_written,
+    GError **error)
+{
+    ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+    ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+    ZSTD_EndDirective mode = ZSTD_e_continue;
+    size_t ret;
+    
+    if(flags & G_CONVERTER_INPUT_AT_END)
+    {
+        mode = ZSTD_e_end;
+    }
+    else if(flags & G_CONVERTER_FLUSH)
+    {
+        mode = ZSTD_e_flush;
+    }
+    
+    ret = ZSTD_compressStream2(converter->zstd_cctx, &output, &input, mode);
+    if(ZSTD_isError(ret))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+            "zstd compression failed: %s", ZSTD_getErrorName(ret));
+        return G_CONVERTER_ERROR;
+    }
+    *bytes_read = input.pos;
+    *bytes_written = output.pos;
+    
+    /* With a directive the return value is what is left to flush. */
+    if(mode!=ZSTD_e_continue && ret==0 && input.pos==inbuf_size)
+    {
+        return mode==ZSTD_e_end ? G_CONVERTER_FINISHED :
+            G_CONVERTER_FLUSHED;
+    }
+    if(input.pos==0 && output.pos==0)
+    {
+        return tl_codec_converter_stalled(mode==ZSTD_e_continue &&
+            inbuf_size==0, error);
+    }
+    
+    return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult tl_codec_zstd_decompress(TLCodecConverter *converter,
+    const void *inbuf, gsize inbuf_size, void *outbuf, gsize outbuf_size,
+    GConverterFlags flags, gsize *bytes_read, gsize *bytes_written,
+    GError **error)
+{
+    ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+    ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+    unsigned dictionary_id;
+    size_t ret;
+    
+    /*
+     * Only frames which name a dictionary are decoded with it, a frame
+     * header is at most ZSTD_FRAMEHEADERSIZE_MAX (18) bytes.
+     */
+    if(!converter->started)
+    {
+        if(inbuf_size < 18 && !(flags & G_CONVERTER_INPUT_AT_END))
+        {
+            return tl_codec_converter_stalled(TRUE, error);
+        }
+        dictionary_id = ZSTD_getDictID_fromFrame(inbuf, inbuf_size);
+        if(dictionary_id!=0)
+        {
+            if(g_tl_codec_data.dictionary==NULL ||
+                dictionary_id!=g_tl_codec_data.dictionary_id)
+            {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Data needs zstd dictionary %u", dictionary_id);
+                return G_CONVERTER_ERROR;
+            }
+            ZSTD_DCtx_refDDict(converter->zstd_dctx,
+                g_tl_codec_data.dictionary_ddict);
+        }
+        converter->started = TRUE;
+    }
+    
+    ret = ZSTD_decompressStream(converter->zstd_dctx, &output, &input);
+    if(ZSTD_isError(ret))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "Invalid zstd data: %s", ZSTD_getErrorName(ret));
+        return G_CONVERTER_ERROR;
+    }
+    *bytes_read = input.pos;
+    *bytes_written = output.pos;
+    
+    if(ret==0)
+    {
+        return G_CONVERTER_FINISHED;
+    }
+    if(input.pos==0 && output.pos==0)
+    {
+        return tl_codec_converter_stalled(inbuf_size==0, error);
+    }
+    
+    return G_CONVERTER_CONVERTED;
+}
+
+#endif
+
+static GConverterResult tl_codec_converter_convert(GConverter *converter,
+    const void *inbuf, gsize inbuf_size, void *outbuf, gsize outbuf_size,
+    GConverterFlags flags, gsize *bytes_read, gsize *bytes_written,
+    GError **error)
+{
+    TLCodecConverter *codec_converter = (TLCodecConverter *)converter;
+    
+    *bytes_read = 0;
+    *bytes_written = 0;
+    
+    switch(codec_converter->codec)
+    {
+#ifdef HAVE_LZ4
+        case TL_CODEC_LZ4:
+        {
+            if(codec_converter->compress)
+            {
+                return tl_codec_lz4_compress(codec_converter, inbuf,
+                    inbuf_size, outbuf, outbuf_size, flags, bytes_read,
+                    bytes_written, error);
+            }
+            return tl_codec_lz4_decompress(codec_converter, inbuf,
+                inbuf_size, outbuf, outbuf_size, flags, bytes_read,
+                bytes_written, error);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case TL_CODEC_ZSTD:
+        {
+            if(codec_converter->compress)
+            {
+                return tl_codec_zstd_compress(codec_converter, inbuf,
+                    inbuf_size, outbuf, outbuf_size, flags, bytes_read,
+                    bytes_written, error);
+            }
+            return tl_codec_zstd_decompress(codec_converter, inbuf,
+                inbuf_size, outbuf, outbuf_size, flags, bytes_read,
+                bytes_written, error);
+        }
+#endif
+        default:
+        {
+            break;
+        }
+    }
+    
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Codec not supported");
+    
+    return G_CONVERTER_ERROR;
+}
+
+static void tl_codec_converter_reset(GConverter *converter)
+{
+    TLCodecConverter *codec_converter = (TLCodecConverter *)converter;
+    
+    codec_converter->started = FALSE;
+#ifdef HAVE_LZ4
+    if(codec_converter->lz4_dctx!=NULL)
+    {
+        LZ4F_resetDecompressionContext(codec_converter->lz4_dctx);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if(codec_converter->zstd_cctx!=NULL)
+    {
+        ZSTD_CCtx_reset(codec_converter->zstd_cctx, ZSTD_reset_session_only);
+    }
+    if(codec_converter->zstd_dctx!=NULL)
+    {
+        ZSTD_DCtx_reset(codec_converter->zstd_dctx,
+            ZSTD_reset_session_and_parameters);
+    }
+#endif
+}
+
+static void tl_codec_converter_finalize(GObject *object)
+{
+    TLCodecConverter *codec_converter = (TLCodecConverter *)object;
+
+#ifdef HAVE_LZ4
+    if(codec_converter->lz4_cctx!=NULL)
+    {
+        LZ4F_freeCompressionContext(codec_converter->lz4_cctx);
+    }
+    if(codec_converter->lz4_dctx!=NULL)
+    {
+        LZ4F_freeDecompressionContext(codec_converter->lz4_dctx);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if(codec_converter->zstd_cctx!=NULL)
+    {
+        ZSTD_freeCCtx(codec_converter->zstd_cctx);
+    }
+    if(codec_converter->zstd_dctx!=NULL)
+    {
+        ZSTD_freeDCtx(codec_converter->zstd_dctx);
+    }
+#endif
+    
+    G_OBJECT_CLASS(tl_codec_converter_parent_class)->finalize(object);
+}
+
+static void tl_codec_converter_init(TLCodecConverter *converter)
+{
+}
+
+static void tl_codec_converter_class_init(TLCodecConverterClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->finalize = tl_codec_converter_finalize;
+}
+
+static void tl_codec_converter_iface_init(GConverterIface *iface)
+{
+    iface->convert = tl_codec_converter_convert;
+    iface->reset = tl_codec_converter_reset;
+}
+
+static GConverter *tl_codec_converter_new(TLCodecType codec,
+    gboolean compress, gint level)
+{
+    TLCodecConverter *converter;
+    
+    converter = g_object_new(tl_codec_converter_get_type(), NULL);
+    converter->codec = codec;
+    converter->compress = compress;
+    
+    switch(codec)
+    {
+#ifdef HAVE_LZ4
+        case TL_CODEC_LZ4:
+        {
+            if(compress)
+            {
+                LZ4F_createCompressionContext(&(converter->lz4_cctx),
+                    LZ4F_VERSION);
+                converter->lz4_prefs.compressionLevel = level;
+            }
+            else
+            {
+                LZ4F_createDecompressionContext(&(converter->lz4_dctx),
+                    LZ4F_VERSION);
+            }
+            break;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case TL_CODEC_ZSTD:
+        {
+            if(compress)
+            {
+                converter->zstd_cctx = ZSTD_createCCtx();
+                ZSTD_CCtx_setParameter(converter->zstd_cctx,
+                    ZSTD_c_compressionLevel, level);
+                if(g_tl_codec_data.dictionary!=NULL)
+                {
+                    ZSTD_CCtx_loadDictionary(converter->zstd_cctx,
+                        g_bytes_get_data(g_tl_codec_data.dictionary, NULL),
+                        g_bytes_get_size(g_tl_codec_data.dictionary));
+                }
+            }
+            else
+            {
+                converter->zstd_dctx = ZSTD_createDCtx();
+            }
+            break;
+        }
+#endif
+        default:
+        {
+            break;
+        }
+    }
+    
+    return G_CONVERTER(converter);
+}
+
+#endif
+
+gboolean tl_codec_available(TLCodecType codec)
+{
+    switch(codec)
+    {
+        case TL_CODEC_ZLIB:
+        {
+            return TRUE;
+        }
+        case TL_CODEC_LZ4:
+        {
+#ifdef HAVE_LZ4
+            return TRUE;
+#else
+            return FALSE;
+#endif
+        }
+        case TL_CODEC_ZSTD:
+        {
+#ifdef HAVE_ZSTD
+            return TRUE;
+#else
+            return FALSE;
+#endif
+        }
+        default:
+        {
+            break;
+        }
+    }
+    
+    return FALSE;
+}
+
+const gchar *tl_codec_name_get(TLCodecType codec)
+{
+    if(codec>=TL_CODEC_LAST)
+    {
+        return NULL;
+    }
+    
+    return g_tl_codec_names[codec];
+}
+
+gboolean tl_codec_parse(const gchar *name, TLCodecType *codec)
+{
+    guint i;
+    
+    for(i=0;i<TL_CODEC_LAST;i++)
+    {
+        if(g_ascii_strcasecmp(name, g_tl_codec_names[i])==0)
+        {
+            if(codec!=NULL)
+            {
+                *codec = i;
+            }
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+/* zlib level 5 is what the archive always used. */
+gint tl_codec_level_default_get(TLCodecType codec)
+{
+    switch(codec)
+    {
+        case TL_CODEC_ZLIB:
+        {
+            return 5;
+        }
+        case TL_CODEC_ZSTD:
+        {
+            return 3;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+gboolean tl_codec_dictionary_load(const gchar *path)
+{
+    gchar *contents;
+    gsize len;
+    GError *error = NULL;
+    GBytes *dictionary;
+    gboolean ret;
+    
+    if(!g_file_get_contents(path, &contents, &len, &error))
+    {
+        g_warning("TLCodec cannot load dictionary %s: %s", path,
+            error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    
+    dictionary = g_bytes_new_take(contents, len);
+    ret = tl_codec_dictionary_set(dictionary);
+    g_bytes_unref(dictionary);
+    
+    return ret;
+}
+
+/*
+ * Sets the zstd dictionary used by new compressors, and by decompressors
+ * for frames naming it. Call before the converters are used, NULL clears
+ * it.
+ */
+gboolean tl_codec_dictionary_set(GBytes *dictionary)
+{
+#ifdef HAVE_ZSTD
+    if(g_tl_codec_data.dictionary!=NULL)
+    {
+        ZSTD_freeDDict(g_tl_codec_data.dictionary_ddict);
+        g_tl_codec_data.dictionary_ddict = NULL;
+        g_bytes_unref(g_tl_codec_data.dictionary);
+        g_tl_codec_data.dictionary = NULL;
+        g_tl_codec_data.dictionary_id = 0;
+    }
+    if(dictionary==NULL)
+    {
+        return TRUE;
+    }
+    
+    g_tl_codec_data.dictionary_id = ZSTD_getDictID_fromDict(
+        g_bytes_get_data(dictionary, NULL), g_bytes_get_size(dictionary));
+    if(g_tl_codec_data.dictionary_id==0)
+    {
+        g_warning("TLCodec dictionary has no ID, it is not a trained zstd "
+            "dictionary!");
+        return FALSE;
+    }
+    g_tl_codec_data.dictionary_ddict = ZSTD_createDDict(
+        g_bytes_get_data(dictionary, NULL), g_bytes_get_size(dictionary));
+    if(g_tl_codec_data.dictionary_ddict==NULL)
+    {
+        g_warning("TLCodec cannot load zstd dictionary!");
+        g_tl_codec_data.dictionary_id = 0;
+        return FALSE;
+    }
+    g_tl_codec_data.dictionary = g_bytes_ref(dictionary);
+    
+    return TRUE;
+#else
+    if(dictionary!=NULL)
+    {
+        g_warning("TLCodec built without zstd, dictionary ignored.");
+    }
+    
+    return dictionary==NULL;
+#endif
+}
+
+guint32 tl_codec_dictionary_id_get()
+{
+    return g_tl_codec_data.dictionary_id;
+}
+
+/*
+ * Trains a zstd dictionary of at most size bytes on samples (GBytes of
+ * log frames). Returns NULL without zstd or if training fails.
+ */
+GBytes *tl_codec_dictionary_train(GPtrArray *samples, gsize size)
+{
+#ifdef HAVE_ZSTD
+    GByteArray *buffer;
+    GBytes *sample;
+    size_t *sample_sizes;
+    guint8 *dictionary;
+    size_t ret;
+    gconstpointer data;
+    gsize len;
+    guint i;
+    
+    buffer = g_byte_array_new();
+    sample_sizes = g_new(size_t, samples->len);
+    for(i=0;i<samples->len;i++)
+    {
+        sample = g_ptr_array_index(samples, i);
+        data = g_bytes_get_data(sample, &len);
+        g_byte_array_append(buffer, data, len);
+        sample_sizes[i] = len;
+    }
+    
+    dictionary = g_malloc(size);
+    ret = ZDICT_trainFromBuffer(dictionary, size, buffer->data,
+        sample_sizes, samples->len);
+    g_free(sample_sizes);
+    g_byte_array_unref(buffer);
+    
+    if(ZDICT_isError(ret))
+    {
+        g_warning("TLCodec failed to train dictionary: %s",
+            ZDICT_getErrorName(ret));
+        g_free(dictionary);
+        return NULL;
+    }
+    
+    return g_bytes_new_take(g_realloc(dictionary, ret), ret);
+#else
+    g_warning("TLCodec built without zstd, cannot train dictionary.");
+    
+    return NULL;
+#endif
+}
+
+/* Returns NULL if codec is not available in this build. */
+GConverter *tl_codec_compressor_new(TLCodecType codec, gint level)
+{
+    if(!tl_codec_available(codec))
+    {
+        return NULL;
+    }
+    if(codec==TL_CODEC_ZLIB)
+    {
+        return G_CONVERTER(g_zlib_compressor_new(
+            G_ZLIB_COMPRESSOR_FORMAT_ZLIB, level));
+    }
+
+#if defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+    return tl_codec_converter_new(codec, TRUE, level);
+#else
+    return NULL;
+#endif
+}
+
+GConverter *tl_codec_decompressor_new(TLCodecType codec)
+{
+    if(!tl_codec_available(codec))
+    {
+        return NULL;
+    }
+    if(codec==TL_CODEC_ZLIB)
+    {
+        return G_CONVERTER(g_zlib_decompressor_new(
+            G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+    }
+
+#if defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+    return tl_codec_converter_new(codec, FALSE, 0);
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Resets converter and runs data through it to the end of its stream,
+ * appending the output to output.
+ */
+gboolean tl_codec_convert(GConverter *converter, const guint8 *data,
+    gsize len, GByteArray *output, GError **error)
+{
+    GConverterResult result;
+    gsize offset, space, bytes_read, bytes_written;
+    GError *convert_error = NULL;
+    
+    g_converter_reset(converter);
+    space = MAX(len, 4096);
+    while(TRUE)
+    {
+        bytes_read = 0;
+        bytes_written = 0;
+        offset = output->len;
+        g_byte_array_set_size(output, offset + space);
+        result = g_converter_convert(converter, data, len,
+            output->data + offset, space, G_CONVERTER_INPUT_AT_END,
+            &bytes_read, &bytes_written, &convert_error);
+        g_byte_array_set_size(output, offset + bytes_written);
+        if(result==G_CONVERTER_ERROR && g_error_matches(convert_error,
+            G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+        {
+            g_clear_error(&convert_error);
+            space *= 2;
+            continue;
+        }
+        if(result==G_CONVERTER_ERROR)
+        {
+            g_propagate_error(error, convert_error);
+            return FALSE;
+        }
+        data += bytes_read;
+        len -= bytes_read;
+        if(result==G_CONVERTER_FINISHED)
+        {
+            break;
+        }
+    }
+    
+    return TRUE;
+}
+
+void tl_codec_header_write(guint8 *header, TLCodecType codec)
+{
+    memset(header, 0, TL_CODEC_HEADER_SIZE);
+    memcpy(header, TL_CODEC_MAGIC, 4);
+    header[4] = TL_CODEC_VERSION;
+    header[5] = codec;
+}
+
+gboolean tl_codec_header_parse(const guint8 *header, gsize len,
+    TLCodecType *codec)
+{
+    if(len < TL_CODEC_HEADER_SIZE || memcmp(header, TL_CODEC_MAGIC, 4)!=0 ||
+        header[4]!=TL_CODEC_VERSION || header[5]>=TL_CODEC_LAST)
+    {
+        return FALSE;
+    }
+    if(codec!=NULL)
+    {
+        *codec = header[5];
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Opens a log file of any kind for reading its frames: segments, with or
+ * without compression, block archives, archives with a codec header and
+ * old zlib archives.
+ */
+GInputStream *tl_codec_file_read(const gchar *path, GError **error)
+{
+    GFile *file;
+    GFileInputStream *file_istream;
+    GInputStream *istream;
+    GConverter *converter;
+    guint8 header[TL_CODEC_HEADER_SIZE];
+    gsize len = 0;
+    goffset offset = 0;
+    gboolean compressed;
+    guint flags;
+    TLCodecType codec = TL_CODEC_ZLIB;
+    TLLogArcReader *archive;
+    GError *archive_error = NULL;
+    
+    archive = tl_logarc_reader_open(path, &archive_error);
+    if(archive!=NULL)
+    {
+        istream = tl_logarc_reader_stream_new(archive, error);
+        tl_logarc_reader_free(archive);
+        return istream;
+    }
+    if(archive_error!=NULL)
+    {
+        g_propagate_error(error, archive_error);
+        return NULL;
+    }
+    
+    file = g_file_new_for_path(path);
+    file_istream = g_file_read(file, NULL, error);
+    g_object_unref(file);
+    if(file_istream==NULL)
+    {
+        return NULL;
+    }
+    
+    if(tl_logseg_header_get(path, &flags, &codec))
+    {
+        offset = TL_LOGSEG_BLOCK_SIZE;
+        compressed = (flags & TL_LOGSEG_FLAG_COMPRESSED);
+    }
+    else if(g_input_stream_read_all(G_INPUT_STREAM(file_istream), header,
+        TL_CODEC_HEADER_SIZE, &len, NULL, NULL) &&
+        tl_codec_header_parse(header, len, &codec))
+    {
+        offset = TL_CODEC_HEADER_SIZE;
+        compressed = TRUE;
+    }
+    else
+    {
+        compressed = g_str_has_suffix(path, ".tlz");
+    }
+    
+    if(!g_seekable_seek(G_SEEKABLE(file_istream), offset, G_SEEK_SET, NULL,
+        error))
+    {
+        g_object_unref(file_istream);
+        return NULL;
+    }
+    if(!compressed)
+    {
+        return G_INPUT_STREAM(file_istream);
+    }
+    
+    converter = tl_codec_decompressor_new(codec);
+    if(converter==NULL)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "%s is compressed with %s, which is not built in", path,
+            tl_codec_name_get(codec));
+        g_object_unref(file_istream);
+        return NULL;
+    }
+    istream = g_converter_input_stream_new(G_INPUT_STREAM(file_istream),
+        converter);
+    g_object_unref(converter);
+    g_object_unref(file_istream);
+    
+    return istream;
+}
@@ -0,0 +1,49 @@
+#ifndef HAVE_TL_CODEC_H
+#define HAVE_TL_CODEC_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/*
+ * Compressed log files start with a codec header:
+ * | "TLCZ" | version (1B) | codec (1B) | reserved (2B) |
+ * followed by the compressed stream. Files without it are zlib streams
+ * (archives written before the header existed). Compressed segments keep
+ * the codec in their segment header instead, see tl-logseg.h.
+ *
+ * LZ4 and zstd are only available when built with them (HAVE_LZ4,
+ * HAVE_ZSTD). zstd can use a dictionary trained on log records, which is
+ * referenced by its ID in each zstd frame.
+ */
+
+#define TL_CODEC_HEADER_SIZE 8
+
+typedef enum
+{
+    TL_CODEC_ZLIB = 0,
+    TL_CODEC_LZ4 = 1,
+    TL_CODEC_ZSTD = 2,
+    TL_CODEC_LAST
+}TLCodecType;
+
+gboolean tl_codec_available(TLCodecType codec);
+const gchar *tl_codec_name_get(TLCodecType codec);
+gboolean tl_codec_parse(const gchar *name, TLCodecType *codec);
+gint tl_codec_level_default_get(TLCodecType codec);
+
+gboolean tl_codec_dictionary_load(const gchar *path);
+gboolean tl_codec_dictionary_set(GBytes *dictionary);
+guint32 tl_codec_dictionary_id_get();
+GBytes *tl_codec_dictionary_train(GPtrArray *samples, gsize size);
+
+GConverter *tl_codec_compressor_new(TLCodecType codec, gint level);
+GConverter *tl_codec_decompressor_new(TLCodecType codec);
+gboolean tl_codec_convert(GConverter *converter, const guint8 *data,
+    gsize len, GByteArray *output, GError **error);
+
+void tl_codec_header_write(guint8 *header, TLCodecType codec);
+gboolean tl_codec_header_parse(const guint8 *header, gsize len,
+    TLCodecType *codec);
+GInputStream *tl_codec_file_read(const gchar *path, GError **error);
+
+#endif
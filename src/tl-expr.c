@@ -0,0 +1,884 @@
+#include <string.h>
+#include <math.h>
+#include "tl-expr.h"
+#include "tl-logger.h"
+
+#define TL_EXPR_CODE_MAXIMUM 64
+#define TL_EXPR_STACK_MAXIMUM 16
+#define TL_EXPR_CONST_MAXIMUM 16
+#define TL_EXPR_STATE_MAXIMUM 4
+#define TL_EXPR_DEPTH_MAXIMUM 4
+#define TL_EXPR_DEPENDENT_MAXIMUM 32
+
+typedef enum
+{
+    TL_EXPR_OP_CONST,
+    TL_EXPR_OP_LOAD,
+    TL_EXPR_OP_ADD,
+    TL_EXPR_OP_SUB,
+    TL_EXPR_OP_MUL,
+    TL_EXPR_OP_DIV,
+    TL_EXPR_OP_NEG,
+    TL_EXPR_OP_ABS,
+    TL_EXPR_OP_MIN,
+    TL_EXPR_OP_MAX,
+    TL_EXPR_OP_INTEG,
+    TL_EXPR_OP_LT,
+    TL_EXPR_OP_LE,
+    TL_EXPR_OP_GT,
+    TL_EXPR_OP_GE,
+    TL_EXPR_OP_EQ,
+    TL_EXPR_OP_NE,
+    TL_EXPR_OP_BIT
+}TLExprOpCode;
+
+typedef struct _TLExprIntegState
+{
+    gdouble sum;
+    gdouble last_value;
+    gint64 last_time;
+}TLExprIntegState;
+
+typedef struct _TLExprData
+{
+    gchar *name;
+    gdouble unit;
+    gint offset;
+    gint slot;
+    guint16 code[TL_EXPR_CODE_MAXIMUM];
+    guint code_len;
+    gdouble consts[TL_EXPR_CONST_MAXIMUM];
+    guint const_len;
+    TLExprIntegState states[TL_EXPR_STATE_MAXIMUM];
+    guint state_len;
+}TLExprData;
+
+typedef struct _TLExprSlotData
+{
+    gchar *name;
+    gdouble value;
+    gboolean valid;
+    GArray *dependents;
+}TLExprSlotData;
+
+typedef struct _TLExprCompilerData
+{
+    const gchar *p;
+    TLExprData *expr;
+    guint depth;
+    guint max_depth;
+    const gchar *error;
+}TLExprCompilerData;
+
+typedef struct _TLExprEngineData
+{
+    gboolean initialized;
+    GPtrArray *slots;
+    GHashTable *slot_table;
+    GPtrArray *exprs;
+    guint update_depth;
+}TLExprEngineData;
+
+static TLExprEngineData g_tl_expr_data = {0};
+
+static void tl_expr_data_free(TLExprData *data)
+{
+    if(data==NULL)
+    {
+        return;
+    }
+    if(data->name!=NULL)
+    {
+        g_free(data->name);
+    }
+    g_free(data);
+}
+
+static void tl_expr_slot_data_free(TLExprSlotData *data)
+{
+    if(data==NULL)
+    {
+        return;
+    }
+    if(data->name!=NULL)
+    {
+        g_free(data->name);
+    }
+    if(data->dependents!=NULL)
+    {
+        g_array_unref(data->dependents);
+    }
+    g_free(data);
+}
+
+static gint tl_expr_slot_intern(const gchar *name)
+{
+    TLExprSlotData *slot_data;
+    gpointer value;
+    
+    value = g_hash_table_lookup(g_tl_expr_data.slot_table, name);
+    if(value!=NULL)
+    {
+        return GPOINTER_TO_INT(value) - 1;
+    }
+    
+    slot_data = g_new0(TLExprSlotData, 1);
+    slot_data->name = g_strdup(name);
+    g_ptr_array_add(g_tl_expr_data.slots, slot_data);
+    g_hash_table_replace(g_tl_expr_data.slot_table, slot_data->name,
+        GINT_TO_POINTER(g_tl_expr_data.slots->len));
+    
+    return g_tl_expr_data.slots->len - 1;
+}
+
+static inline void tl_expr_compiler_skip_space(TLExprCompilerData *compiler)
+{
+    while(*compiler->p==' ' || *compiler->p=='\t' || *compiler->p=='\r' ||
+        *compiler->p=='\n')
+    {
+        compiler->p++;
+    }
+}
+
+static gboolean tl_expr_compiler_emit(TLExprCompilerData *compiler,
+    TLExprOpCode op, gint operand, gint stack_change)
+{
+    TLExprData *expr = compiler->expr;
+    
+    if(expr->code_len + (operand>=0 ? 2 : 1) > TL_EXPR_CODE_MAXIMUM)
+    {
+        compiler->error = "expression too long";
+        return FALSE;
+    }
+    
+    expr->code[expr->code_len++] = op;
+    if(operand>=0)
+    {
+        expr->code[expr->code_len++] = operand;
+    }
+    
+    compiler->depth += stack_change;
+    if(compiler->depth > TL_EXPR_STACK_MAXIMUM)
+    {
+        compiler->error = "expression too deep";
+        return FALSE;
+    }
+    if(compiler->depth > compiler->max_depth)
+    {
+        compiler->max_depth = compiler->depth;
+    }
+    
+    return TRUE;
+}
+
+static gboolean tl_expr_compile_compare(TLExprCompilerData *compiler);
+
+static gboolean tl_expr_compile_call(TLExprCompilerData *compiler,
+    const gchar *name, gsize name_len)
+{
+    guint argc = 0;
+    TLExprData *expr = compiler->expr;
+    
+    compiler->p++;
+    tl_expr_compiler_skip_space(compiler);
+    if(*compiler->p!=')')
+    {
+        while(TRUE)
+        {
+            if(!tl_expr_compile_compare(compiler))
+            {
+                return FALSE;
+            }
+            argc++;
+            tl_expr_compiler_skip_space(compiler);
+            if(*compiler->p==',')
+            {
+                compiler->p++;
+                continue;
+            }
+            break;
+        }
+    }
+    if(*compiler->p!=')')
+    {
+        compiler->error = "missing ')'";
+        return FALSE;
+    }
+    compiler->p++;
+    
+    if(name_len==3 && strncmp(name, "abs", 3)==0 && argc==1)
+    {
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_ABS, -1, 0);
+    }
+    else if(name_len==3 && strncmp(name, "min", 3)==0 && argc>=1)
+    {
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_MIN, argc,
+            1 - (gint)argc);
+    }
+    else if(name_len==3 && strncmp(name, "max", 3)==0 && argc>=1)
+    {
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_MAX, argc,
+            1 - (gint)argc);
+    }
+    else if(name_len==5 && strncmp(name, "integ", 5)==0 && argc==1)
+    {
+        if(expr->state_len>=TL_EXPR_STATE_MAXIMUM)
+        {
+            compiler->error = "too many integ() calls";
+            return FALSE;
+        }
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_INTEG,
+            expr->state_len++, 0);
+    }
+    else if(name_len==3 && strncmp(name, "bit", 3)==0 && argc==2)
+    {
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_BIT, -1, -1);
+    }
+    
+    compiler->error = "unknown function or wrong argument count";
+    return FALSE;
+}
+
+static gboolean tl_expr_compile_primary(TLExprCompilerData *compiler)
+{
+    TLExprData *expr = compiler->expr;
+    const gchar *start;
+    gchar *endptr;
+    gchar *name;
+    gsize name_len;
+    gdouble value;
+    gint slot;
+    
+    tl_expr_compiler_skip_space(compiler);
+    
+    if(*compiler->p=='(')
+    {
+        compiler->p++;
+        if(!tl_expr_compile_compare(compiler))
+        {
+            return FALSE;
+        }
+        tl_expr_compiler_skip_space(compiler);
+        if(*compiler->p!=')')
+        {
+            compiler->error = "missing ')'";
+            return FALSE;
+        }
+        compiler->p++;
+        return TRUE;
+    }
+    
+    if(g_ascii_isdigit(*compiler->p) || *compiler->p=='.')
+    {
+        value = g_ascii_strtod(compiler->p, &endptr);
+        if(endptr==compiler->p)
+        {
+            compiler->error = "bad number";
+            return FALSE;
+        }
+        compiler->p = endptr;
+        if(expr->const_len>=TL_EXPR_CONST_MAXIMUM)
+        {
+            compiler->error = "too many constants";
+            return FALSE;
+        }
+        expr->consts[expr->const_len] = value;
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_CONST,
+            expr->const_len++, 1);
+    }
+    
+    if(g_ascii_isalpha(*compiler->p) || *compiler->p=='_')
+    {
+        start = compiler->p;
+        while(g_ascii_isalnum(*compiler->p) || *compiler->p=='_')
+        {
+            compiler->p++;
+        }
+        name_len = compiler->p - start;
+        tl_expr_compiler_skip_space(compiler);
+        if(*compiler->p=='(')
+        {
+            return tl_expr_compile_call(compiler, start, name_len);
+        }
+        
+        name = g_strndup(start, name_len);
+        slot = tl_expr_slot_intern(name);
+        g_free(name);
+        
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_LOAD, slot, 1);
+    }
+    
+    compiler->error = "unexpected character";
+    return FALSE;
+}
+
+static gboolean tl_expr_compile_unary(TLExprCompilerData *compiler)
+{
+    tl_expr_compiler_skip_space(compiler);
+    if(*compiler->p=='-')
+    {
+        compiler->p++;
+        if(!tl_expr_compile_unary(compiler))
+        {
+            return FALSE;
+        }
+        return tl_expr_compiler_emit(compiler, TL_EXPR_OP_NEG, -1, 0);
+    }
+    else if(*compiler->p=='+')
+    {
+        compiler->p++;
+        return tl_expr_compile_unary(compiler);
+    }
+    
+    return tl_expr_compile_primary(compiler);
+}
+
+static gboolean tl_expr_compile_term(TLExprCompilerData *compiler)
+{
+    gchar op;
+    
+    if(!tl_expr_compile_unary(compiler))
+    {
+        return FALSE;
+    }
+    while(TRUE)
+    {
+        tl_expr_compiler_skip_space(compiler);
+        op = *compiler->p;
+        if(op!='*' && op!='/')
+        {
+            break;
+        }
+        compiler->p++;
+        if(!tl_expr_compile_unary(compiler))
+        {
+            return FALSE;
+        }
+        if(!tl_expr_compiler_emit(compiler, op=='*' ? TL_EXPR_OP_MUL :
+            TL_EXPR_OP_DIV, -1, -1))
+        {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+static gboolean tl_expr_compile_expr(TLExprCompilerData *compiler)
+{
+    gchar op;
+    
+    if(!tl_expr_compile_term(compiler))
+    {
+        return FALSE;
+    }
+    while(TRUE)
+    {
+        tl_expr_compiler_skip_space(compiler);
+        op = *compiler->p;
+        if(op!='+' && op!='-')
+        {
+            break;
+        }
+        compiler->p++;
+        if(!tl_expr_compile_term(compiler))
+        {
+            return FALSE;
+        }
+        if(!tl_expr_compiler_emit(compiler, op=='+' ? TL_EXPR_OP_ADD :
+            TL_EXPR_OP_SUB, -1, -1))
+        {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Comparisons bind weaker than arithmetic and yield 1 or 0, so they can
+ * be combined with min() as "and" and max() as "or".
+ */
+static gboolean tl_expr_compile_compare(TLExprCompilerData *compiler)
+{
+    TLExprOpCode op;
+    
+    if(!tl_expr_compile_expr(compiler))
+    {
+        return FALSE;
+    }
+    while(TRUE)
+    {
+        tl_expr_compiler_skip_space(compiler);
+        if(compiler->p[0]=='<' && compiler->p[1]=='=')
+        {
+            op = TL_EXPR_OP_LE;
+            compiler->p += 2;
+        }
+        else if(compiler->p[0]=='>' && compiler->p[1]=='=')
+        {
+            op = TL_EXPR_OP_GE;
+            compiler->p += 2;
+        }
+        else if(compiler->p[0]=='=' && compiler->p[1]=='=')
+        {
+            op = TL_EXPR_OP_EQ;
+            compiler->p += 2;
+        }
+        else if(compiler->p[0]=='!' && compiler->p[1]=='=')
+        {
+            op = TL_EXPR_OP_NE;
+            compiler->p += 2;
+        }
+        else if(compiler->p[0]=='<')
+        {
+            op = TL_EXPR_OP_LT;
+            compiler->p++;
+        }
+        else if(compiler->p[0]=='>')
+        {
+            op = TL_EXPR_OP_GT;
+            compiler->p++;
+        }
+        else
+        {
+            break;
+        }
+        if(!tl_expr_compile_expr(compiler))
+        {
+            return FALSE;
+        }
+        if(!tl_expr_compiler_emit(compiler, op, -1, -1))
+        {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+static gboolean tl_expr_evaluate(TLExprData *expr, gint64 now,
+    gdouble *result)
+{
+    gdouble stack[TL_EXPR_STACK_MAXIMUM];
+    guint sp = 0, pc = 0, n, i;
+    TLExprSlotData *slot_data;
+    TLExprIntegState *state;
+    
+    while(pc < expr->code_len)
+    {
+        switch(expr->code[pc++])
+        {
+            case TL_EXPR_OP_CONST:
+            {
+                stack[sp++] = expr->consts[expr->code[pc++]];
+                break;
+            }
+            case TL_EXPR_OP_LOAD:
+            {
+                slot_data = g_ptr_array_index(g_tl_expr_data.slots,
+                    expr->code[pc++]);
+                if(!slot_data->valid)
+                {
+                    return FALSE;
+                }
+                stack[sp++] = slot_data->value;
+                break;
+            }
+            case TL_EXPR_OP_ADD:
+            {
+                sp--;
+                stack[sp-1] += stack[sp];
+                break;
+            }
+            case TL_EXPR_OP_SUB:
+            {
+                sp--;
+                stack[sp-1] -= stack[sp];
+                break;
+            }
+            case TL_EXPR_OP_MUL:
+            {
+                sp--;
+                stack[sp-1] *= stack[sp];
+                break;
+            }
+            case TL_EXPR_OP_DIV:
+            {
+                sp--;
+                if(stack[sp]==0.0)
+                {
+                    return FALSE;
+                }
+                stack[sp-1] /= stack[sp];
+                break;
+            }
+            case TL_EXPR_OP_NEG:
+            {
+                stack[sp-1] = -stack[sp-1];
+                break;
+            }
+            case TL_EXPR_OP_ABS:
+            {
+                stack[sp-1] = fabs(stack[sp-1]);
+                break;
+            }
+            case TL_EXPR_OP_MIN:
+            {
+                n = expr->code[pc++];
+                for(i=1;i<n;i++)
+                {
+                    sp--;
+                    if(stack[sp] < stack[sp-1])
+                    {
+                        stack[sp-1] = stack[sp];
+                    }
+                }
+                break;
+            }
+            case TL_EXPR_OP_MAX:
+            {
+                n = expr->code[pc++];
+                for(i=1;i<n;i++)
+                {
+                    sp--;
+                    if(stack[sp] > stack[sp-1])
+                    {
+                        stack[sp-1] = stack[sp];
+                    }
+                }
+                break;
+            }
+            case TL_EXPR_OP_INTEG:
+            {
+                /* Inputs are piecewise constant between updates. */
+                state = &(expr->states[expr->code[pc++]]);
+                if(state->last_time>0)
+                {
+                    state->sum += state->last_value *
+                        (gdouble)(now - state->last_time) / 1e6;
+                }
+                state->last_value = stack[sp-1];
+                state->last_time = now;
+                stack[sp-1] = state->sum;
+                break;
+            }
+            case TL_EXPR_OP_LT:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] < stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_LE:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] <= stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_GT:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] > stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_GE:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] >= stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_EQ:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] == stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_NE:
+            {
+                sp--;
+                stack[sp-1] = (stack[sp-1] != stack[sp]) ? 1.0 : 0.0;
+                break;
+            }
+            case TL_EXPR_OP_BIT:
+            {
+                sp--;
+                if(stack[sp]<0.0 || stack[sp]>=64.0)
+                {
+                    return FALSE;
+                }
+                stack[sp-1] = (gdouble)(((guint64)(gint64)stack[sp-1] >>
+                    (guint)stack[sp]) & 1);
+                break;
+            }
+            default:
+            {
+                return FALSE;
+            }
+        }
+    }
+    
+    if(sp!=1)
+    {
+        return FALSE;
+    }
+    
+    *result = stack[0];
+    
+    return TRUE;
+}
+
+gboolean tl_expr_init()
+{
+    if(g_tl_expr_data.initialized)
+    {
+        g_warning("TLExpr already initialized!");
+        return TRUE;
+    }
+    
+    g_tl_expr_data.slots = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_expr_slot_data_free);
+    g_tl_expr_data.slot_table = g_hash_table_new(g_str_hash, g_str_equal);
+    g_tl_expr_data.exprs = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_expr_data_free);
+    
+    g_tl_expr_data.initialized = TRUE;
+    
+    return TRUE;
+}
+
+void tl_expr_uninit()
+{
+    if(!g_tl_expr_data.initialized)
+    {
+        return;
+    }
+    
+    if(g_tl_expr_data.slot_table!=NULL)
+    {
+        g_hash_table_unref(g_tl_expr_data.slot_table);
+        g_tl_expr_data.slot_table = NULL;
+    }
+    if(g_tl_expr_data.exprs!=NULL)
+    {
+        g_ptr_array_unref(g_tl_expr_data.exprs);
+        g_tl_expr_data.exprs = NULL;
+    }
+    if(g_tl_expr_data.slots!=NULL)
+    {
+        g_ptr_array_unref(g_tl_expr_data.slots);
+        g_tl_expr_data.slots = NULL;
+    }
+    
+    g_tl_expr_data.initialized = FALSE;
+}
+
+void tl_expr_clear()
+{
+    if(!g_tl_expr_data.initialized)
+    {
+        return;
+    }
+    
+    g_hash_table_remove_all(g_tl_expr_data.slot_table);
+    g_ptr_array_set_size(g_tl_expr_data.exprs, 0);
+    g_ptr_array_set_size(g_tl_expr_data.slots, 0);
+}
+
+gboolean tl_expr_add(const gchar *name, const gchar *expression,
+    gdouble unit, gint offset)
+{
+    TLExprCompilerData compiler = {0};
+    TLExprData *expr;
+    TLExprSlotData *slot_data;
+    guint i, expr_index;
+    gint slot;
+    
+    if(!g_tl_expr_data.initialized || name==NULL || expression==NULL)
+    {
+        return FALSE;
+    }
+    
+    expr = g_new0(TLExprData, 1);
+    expr->unit = (unit!=0.0) ? unit : 1.0;
+    expr->offset = offset;
+    
+    compiler.p = expression;
+    compiler.expr = expr;
+    if(tl_expr_compile_compare(&compiler))
+    {
+        tl_expr_compiler_skip_space(&compiler);
+        if(*compiler.p!='\0')
+        {
+            compiler.error = "trailing characters";
+        }
+    }
+    else if(compiler.error==NULL)
+    {
+        compiler.error = "syntax error";
+    }
+    
+    if(compiler.error!=NULL)
+    {
+        g_warning("TLExpr failed to compile expression %s (%s): %s", name,
+            expression, compiler.error);
+        tl_expr_data_free(expr);
+        return FALSE;
+    }
+    
+    /*
+     * An expression missing from the index of one of its inputs would not
+     * follow that input, so it is rejected as a whole.
+     */
+    for(i=0;i<expr->code_len;i++)
+    {
+        switch(expr->code[i])
+        {
+            case TL_EXPR_OP_LOAD:
+            {
+                slot = expr->code[++i];
+                slot_data = g_ptr_array_index(g_tl_expr_data.slots, slot);
+                if(slot_data->dependents!=NULL &&
+                    slot_data->dependents->len>=TL_EXPR_DEPENDENT_MAXIMUM)
+                {
+                    g_warning("TLExpr signal %s has too many dependent "
+                        "expressions, %s ignored!", slot_data->name, name);
+                    tl_expr_data_free(expr);
+                    return FALSE;
+                }
+                break;
+            }
+            case TL_EXPR_OP_CONST:
+            case TL_EXPR_OP_MIN:
+            case TL_EXPR_OP_MAX:
+            case TL_EXPR_OP_INTEG:
+            {
+                i++;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+    
+    expr->name = g_strdup(name);
+    expr->slot = tl_expr_slot_intern(name);
+    expr_index = g_tl_expr_data.exprs->len;
+    g_ptr_array_add(g_tl_expr_data.exprs, expr);
+    
+    /* Build the signal to expression dependency index. */
+    for(i=0;i<expr->code_len;i++)
+    {
+        switch(expr->code[i])
+        {
+            case TL_EXPR_OP_LOAD:
+            {
+                slot = expr->code[++i];
+                slot_data = g_ptr_array_index(g_tl_expr_data.slots, slot);
+                if(slot_data->dependents==NULL)
+                {
+                    slot_data->dependents = g_array_new(FALSE, FALSE,
+                        sizeof(guint));
+                }
+                if(slot_data->dependents->len==0 ||
+                    g_array_index(slot_data->dependents, guint,
+                    slot_data->dependents->len-1)!=expr_index)
+                {
+                    g_array_append_val(slot_data->dependents, expr_index);
+                }
+                break;
+            }
+            case TL_EXPR_OP_CONST:
+            case TL_EXPR_OP_MIN:
+            case TL_EXPR_OP_MAX:
+            case TL_EXPR_OP_INTEG:
+            {
+                i++;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+    
+    g_debug("TLExpr compiled %s into %u code words.", name, expr->code_len);
+    
+    return TRUE;
+}
+
+gint tl_expr_slot_lookup(const gchar *name)
+{
+    gpointer value;
+    
+    if(!g_tl_expr_data.initialized || name==NULL)
+    {
+        return -1;
+    }
+    
+    value = g_hash_table_lookup(g_tl_expr_data.slot_table, name);
+    if(value==NULL)
+    {
+        return -1;
+    }
+    
+    return GPOINTER_TO_INT(value) - 1;
+}
+
+void tl_expr_slot_update(gint slot, gdouble value)
+{
+    TLExprSlotData *slot_data;
+    TLExprData *expr;
+    TLLoggerLogItemData item_data = {0};
+    gdouble result, raw;
+    gint64 now;
+    guint i;
+    
+    if(!g_tl_expr_data.initialized || slot<0 ||
+        slot>=(gint)g_tl_expr_data.slots->len)
+    {
+        return;
+    }
+    
+    slot_data = g_ptr_array_index(g_tl_expr_data.slots, slot);
+    if(slot_data->valid && slot_data->value==value)
+    {
+        return;
+    }
+    slot_data->value = value;
+    slot_data->valid = TRUE;
+    
+    if(slot_data->dependents==NULL ||
+        g_tl_expr_data.update_depth>=TL_EXPR_DEPTH_MAXIMUM)
+    {
+        return;
+    }
+    
+    g_tl_expr_data.update_depth++;
+    now = g_get_monotonic_time();
+    
+    for(i=0;i<slot_data->dependents->len;i++)
+    {
+        expr = g_ptr_array_index(g_tl_expr_data.exprs,
+            g_array_index(slot_data->dependents, guint, i));
+        if(!tl_expr_evaluate(expr, now, &result))
+        {
+            continue;
+        }
+        
+        raw = (result - expr->offset) / expr->unit;
+        item_data.name = expr->name;
+        item_data.value = (gint64)(raw>=0 ? raw + 0.5 : raw - 0.5);
+        item_data.unit = expr->unit;
+        item_data.offset = expr->offset;
+        
+        tl_logger_current_data_update(&item_data);
+        
+        tl_expr_slot_update(expr->slot, (gdouble)item_data.value *
+            expr->unit + expr->offset);
+    }
+    
+    g_tl_expr_data.update_depth--;
+}
@@ -0,0 +1,14 @@
+#ifndef HAVE_TL_EXPR_H
+#define HAVE_TL_EXPR_H
+
+#include <glib.h>
+
+gboolean tl_expr_init();
+void tl_expr_uninit();
+void tl_expr_clear();
+gboolean tl_expr_add(const gchar *name, const gchar *expression,
+    gdouble unit, gint offset);
+gint tl_expr_slot_lookup(const gchar *name);
+void tl_expr_slot_update(gint slot, gdouble value);
+
+#endif
@@ -0,0 +1,612 @@
+#include <string.h>
+#include "tl-history.h"
+
+#define TL_HISTORY_BLOCK_DATA_SIZE 432
+#define TL_HISTORY_POINT_BITS_MAXIMUM (4 + 32 + 2 + 12 + 64)
+#define TL_HISTORY_READ_RETRY_MAXIMUM 16
+#define TL_HISTORY_LEADING_INVALID 0xFF
+
+/*
+ * Each block holds a Gorilla encoded run of one series: the first point is
+ * stored raw, later timestamps as delta-of-delta and values as the XOR
+ * against the previous value. Blocks are only written by the main loop and
+ * are protected by a sequence counter so readers never block the writer.
+ */
+typedef struct _TLHistoryBlock
+{
+    guint seq;
+    gint series;
+    gint next;
+    gint pool_next;
+    gint64 first_time;
+    gint64 last_time;
+    guint count;
+    guint bit_len;
+    gint64 prev_delta;
+    guint64 prev_value;
+    guint8 prev_leading;
+    guint8 prev_trailing;
+    guint8 data[TL_HISTORY_BLOCK_DATA_SIZE];
+}TLHistoryBlock;
+
+typedef struct _TLHistorySeriesData
+{
+    gchar *name;
+    gint head;
+    gint tail;
+}TLHistorySeriesData;
+
+typedef struct _TLHistoryBitReader
+{
+    const guint8 *data;
+    guint pos;
+}TLHistoryBitReader;
+
+typedef struct _TLHistoryData
+{
+    gboolean initialized;
+    TLHistoryBlock *blocks;
+    guint block_count;
+    gint free_head;
+    gint oldest;
+    gint newest;
+    gint64 retention;
+    GPtrArray *series;
+    GHashTable *series_table;
+    GMutex series_mutex;
+}TLHistoryData;
+
+static TLHistoryData g_tl_history_data = {0};
+
+static inline void tl_history_bits_write(TLHistoryBlock *block,
+    guint64 value, guint bits)
+{
+    guint offset, room, n;
+    
+    while(bits>0)
+    {
+        offset = block->bit_len & 7;
+        room = 8 - offset;
+        n = bits < room ? bits : room;
+        block->data[block->bit_len >> 3] |= (guint8)(((value >> (bits - n)) &
+            ((1U << n) - 1)) << (room - n));
+        block->bit_len += n;
+        bits -= n;
+    }
+}
+
+static inline guint64 tl_history_bits_read(TLHistoryBitReader *reader,
+    guint bits)
+{
+    guint64 value = 0;
+    guint offset, room, n;
+    
+    while(bits>0)
+    {
+        offset = reader->pos & 7;
+        room = 8 - offset;
+        n = bits < room ? bits : room;
+        value = (value << n) | ((reader->data[reader->pos >> 3] >>
+            (room - n)) & ((1U << n) - 1));
+        reader->pos += n;
+        bits -= n;
+    }
+    
+    return value;
+}
+
+static void tl_history_point_encode(TLHistoryBlock *block, gint64 timestamp,
+    gint64 value)
+{
+    gint64 delta, dod;
+    guint64 xor_value;
+    guint leading, trailing;
+    
+    if(block->count==0)
+    {
+        tl_history_bits_write(block, (guint64)timestamp, 64);
+        tl_history_bits_write(block, (guint64)value, 64);
+        block->first_time = timestamp;
+        block->prev_delta = 0;
+        block->prev_value = (guint64)value;
+        block->prev_leading = TL_HISTORY_LEADING_INVALID;
+        return;
+    }
+    
+    delta = timestamp - block->last_time;
+    dod = delta - block->prev_delta;
+    if(dod==0)
+    {
+        tl_history_bits_write(block, 0, 1);
+    }
+    else if(dod>=-63 && dod<=64)
+    {
+        tl_history_bits_write(block, 2, 2);
+        tl_history_bits_write(block, (guint64)(dod + 63), 7);
+    }
+    else if(dod>=-255 && dod<=256)
+    {
+        tl_history_bits_write(block, 6, 3);
+        tl_history_bits_write(block, (guint64)(dod + 255), 9);
+    }
+    else if(dod>=-2047 && dod<=2048)
+    {
+        tl_history_bits_write(block, 14, 4);
+        tl_history_bits_write(block, (guint64)(dod + 2047), 12);
+    }
+    else
+    {
+        tl_history_bits_write(block, 15, 4);
+        tl_history_bits_write(block, (guint32)(gint32)dod, 32);
+    }
+    block->prev_delta = delta;
+    
+    xor_value = (guint64)value ^ block->prev_value;
+    if(xor_value==0)
+    {
+        tl_history_bits_write(block, 0, 1);
+    }
+    else
+    {
+        leading = __builtin_clzll(xor_value);
+        trailing = __builtin_ctzll(xor_value);
+        if(block->prev_leading!=TL_HISTORY_LEADING_INVALID &&
+            leading>=block->prev_leading && trailing>=block->prev_trailing)
+        {
+            tl_history_bits_write(block, 2, 2);
+            tl_history_bits_write(block, xor_value >> block->prev_trailing,
+                64 - block->prev_leading - block->prev_trailing);
+        }
+        else
+        {
+            tl_history_bits_write(block, 3, 2);
+            tl_history_bits_write(block, leading, 6);
+            tl_history_bits_write(block, 63 - leading - trailing, 6);
+            tl_history_bits_write(block, xor_value >> trailing,
+                64 - leading - trailing);
+            block->prev_leading = leading;
+            block->prev_trailing = trailing;
+        }
+    }
+    block->prev_value = (guint64)value;
+}
+
+static void tl_history_block_decode(const TLHistoryBlock *block,
+    gint64 begin_time, gint64 end_time, GArray *points)
+{
+    TLHistoryBitReader reader;
+    TLHistoryPoint point;
+    gint64 delta = 0, dod;
+    guint64 value, xor_value;
+    guint leading = 0, trailing = 0, length, i;
+    
+    if(block->count==0)
+    {
+        return;
+    }
+    
+    reader.data = block->data;
+    reader.pos = 0;
+    
+    point.timestamp = (gint64)tl_history_bits_read(&reader, 64);
+    value = tl_history_bits_read(&reader, 64);
+    point.value = (gint64)value;
+    if(point.timestamp>=begin_time && point.timestamp<=end_time)
+    {
+        g_array_append_val(points, point);
+    }
+    
+    for(i=1;i<block->count;i++)
+    {
+        if(tl_history_bits_read(&reader, 1)==0)
+        {
+            dod = 0;
+        }
+        else if(tl_history_bits_read(&reader, 1)==0)
+        {
+            dod = (gint64)tl_history_bits_read(&reader, 7) - 63;
+        }
+        else if(tl_history_bits_read(&reader, 1)==0)
+        {
+            dod = (gint64)tl_history_bits_read(&reader, 9) - 255;
+        }
+        else if(tl_history_bits_read(&reader, 1)==0)
+        {
+            dod = (gint64)tl_history_bits_read(&reader, 12) - 2047;
+        }
+        else
+        {
+            dod = (gint32)(guint32)tl_history_bits_read(&reader, 32);
+        }
+        delta += dod;
+        point.timestamp += delta;
+        
+        if(tl_history_bits_read(&reader, 1)!=0)
+        {
+            if(tl_history_bits_read(&reader, 1)!=0)
+            {
+                leading = tl_history_bits_read(&reader, 6);
+                length = tl_history_bits_read(&reader, 6) + 1;
+                trailing = 64 - leading - length;
+            }
+            length = 64 - leading - trailing;
+            xor_value = tl_history_bits_read(&reader, length) << trailing;
+            value ^= xor_value;
+        }
+        point.value = (gint64)value;
+        
+        if(point.timestamp>end_time)
+        {
+            break;
+        }
+        if(point.timestamp>=begin_time)
+        {
+            g_array_append_val(points, point);
+        }
+    }
+}
+
+/* Evicts the oldest block, which is always the head of its series. */
+static void tl_history_block_evict_oldest(TLHistoryData *history_data)
+{
+    TLHistoryBlock *block;
+    TLHistorySeriesData *series_data;
+    gint index;
+    
+    index = history_data->oldest;
+    if(index<0)
+    {
+        return;
+    }
+    block = &(history_data->blocks[index]);
+    
+    series_data = g_ptr_array_index(history_data->series, block->series);
+    if(series_data->tail==index)
+    {
+        series_data->tail = -1;
+        g_atomic_int_set(&(series_data->head), -1);
+    }
+    else
+    {
+        g_atomic_int_set(&(series_data->head), block->next);
+    }
+    
+    history_data->oldest = block->pool_next;
+    if(history_data->oldest<0)
+    {
+        history_data->newest = -1;
+    }
+    
+    g_atomic_int_inc(&(block->seq));
+    block->series = -1;
+    block->next = -1;
+    block->count = 0;
+    g_atomic_int_inc(&(block->seq));
+    
+    block->pool_next = history_data->free_head;
+    history_data->free_head = index;
+}
+
+static TLHistoryBlock *tl_history_block_new(TLHistoryData *history_data,
+    gint series)
+{
+    TLHistoryBlock *block, *tail_block;
+    TLHistorySeriesData *series_data;
+    gint index;
+    
+    if(history_data->free_head<0)
+    {
+        tl_history_block_evict_oldest(history_data);
+    }
+    index = history_data->free_head;
+    if(index<0)
+    {
+        return NULL;
+    }
+    block = &(history_data->blocks[index]);
+    history_data->free_head = block->pool_next;
+    
+    g_atomic_int_inc(&(block->seq));
+    block->series = series;
+    block->next = -1;
+    block->pool_next = -1;
+    block->first_time = 0;
+    block->last_time = 0;
+    block->count = 0;
+    block->bit_len = 0;
+    memset(block->data, 0, TL_HISTORY_BLOCK_DATA_SIZE);
+    g_atomic_int_inc(&(block->seq));
+    
+    if(history_data->newest>=0)
+    {
+        history_data->blocks[history_data->newest].pool_next = index;
+    }
+    else
+    {
+        history_data->oldest = index;
+    }
+    history_data->newest = index;
+    
+    series_data = g_ptr_array_index(history_data->series, series);
+    if(series_data->tail>=0)
+    {
+        tail_block = &(history_data->blocks[series_data->tail]);
+        g_atomic_int_inc(&(tail_block->seq));
+        tail_block->next = index;
+        g_atomic_int_inc(&(tail_block->seq));
+    }
+    else
+    {
+        g_atomic_int_set(&(series_data->head), index);
+    }
+    series_data->tail = index;
+    
+    return block;
+}
+
+static gboolean tl_history_block_read(TLHistoryBlock *block,
+    TLHistoryBlock *copy)
+{
+    guint seq1, seq2;
+    guint i;
+    
+    for(i=0;i<TL_HISTORY_READ_RETRY_MAXIMUM;i++)
+    {
+        seq1 = g_atomic_int_get(&(block->seq));
+        if(seq1 & 1)
+        {
+            g_thread_yield();
+            continue;
+        }
+        memcpy(copy, block, sizeof(TLHistoryBlock));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = g_atomic_int_get(&(block->seq));
+        if(seq1==seq2)
+        {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+gboolean tl_history_init(gsize memory_size, guint retention)
+{
+    guint i;
+    
+    if(g_tl_history_data.initialized)
+    {
+        g_warning("TLHistory already initialized!");
+        return TRUE;
+    }
+    
+    g_tl_history_data.block_count = memory_size / sizeof(TLHistoryBlock);
+    if(g_tl_history_data.block_count==0)
+    {
+        return FALSE;
+    }
+    
+    g_tl_history_data.blocks = g_new0(TLHistoryBlock,
+        g_tl_history_data.block_count);
+    for(i=0;i<g_tl_history_data.block_count;i++)
+    {
+        g_tl_history_data.blocks[i].series = -1;
+        g_tl_history_data.blocks[i].next = -1;
+        g_tl_history_data.blocks[i].pool_next =
+            (i+1<g_tl_history_data.block_count) ? (gint)i+1 : -1;
+    }
+    g_tl_history_data.free_head = 0;
+    g_tl_history_data.oldest = -1;
+    g_tl_history_data.newest = -1;
+    g_tl_history_data.retention = (gint64)retention * 1000;
+    
+    g_mutex_init(&(g_tl_history_data.series_mutex));
+    g_tl_history_data.series = g_ptr_array_new();
+    g_tl_history_data.series_table = g_hash_table_new(g_str_hash,
+        g_str_equal);
+    
+    g_tl_history_data.initialized = TRUE;
+    
+    return TRUE;
+}
+
+void tl_history_uninit()
+{
+    TLHistorySeriesData *series_data;
+    guint i;
+    
+    if(!g_tl_history_data.initialized)
+    {
+        return;
+    }
+    
+    g_tl_history_data.initialized = FALSE;
+    
+    g_hash_table_unref(g_tl_history_data.series_table);
+    g_tl_history_data.series_table = NULL;
+    for(i=0;i<g_tl_history_data.series->len;i++)
+    {
+        series_data = g_ptr_array_index(g_tl_history_data.series, i);
+        g_free(series_data->name);
+        g_free(series_data);
+    }
+    g_ptr_array_unref(g_tl_history_data.series);
+    g_tl_history_data.series = NULL;
+    g_mutex_clear(&(g_tl_history_data.series_mutex));
+    
+    g_free(g_tl_history_data.blocks);
+    g_tl_history_data.blocks = NULL;
+    g_tl_history_data.block_count = 0;
+}
+
+gint tl_history_series_add(const gchar *name)
+{
+    TLHistorySeriesData *series_data;
+    gint index;
+    
+    if(!g_tl_history_data.initialized || name==NULL)
+    {
+        return -1;
+    }
+    
+    g_mutex_lock(&(g_tl_history_data.series_mutex));
+    
+    index = GPOINTER_TO_INT(g_hash_table_lookup(
+        g_tl_history_data.series_table, name)) - 1;
+    if(index<0)
+    {
+        series_data = g_new0(TLHistorySeriesData, 1);
+        series_data->name = g_strdup(name);
+        series_data->head = -1;
+        series_data->tail = -1;
+        
+        index = g_tl_history_data.series->len;
+        g_ptr_array_add(g_tl_history_data.series, series_data);
+        g_hash_table_replace(g_tl_history_data.series_table,
+            series_data->name, GINT_TO_POINTER(index+1));
+    }
+    
+    g_mutex_unlock(&(g_tl_history_data.series_mutex));
+    
+    return index;
+}
+
+void tl_history_append(gint series, gint64 timestamp, gint64 value)
+{
+    TLHistoryData *history_data = &g_tl_history_data;
+    TLHistorySeriesData *series_data;
+    TLHistoryBlock *block = NULL;
+    gint64 now, dod = 0;
+    
+    if(!history_data->initialized || series<0 ||
+        (guint)series>=history_data->series->len)
+    {
+        return;
+    }
+    
+    now = timestamp / 1000;
+    
+    while(history_data->oldest>=0 &&
+        history_data->blocks[history_data->oldest].last_time <
+        now - history_data->retention)
+    {
+        tl_history_block_evict_oldest(history_data);
+    }
+    
+    series_data = g_ptr_array_index(history_data->series, series);
+    if(series_data->tail>=0)
+    {
+        block = &(history_data->blocks[series_data->tail]);
+        dod = (now - block->last_time) - block->prev_delta;
+    }
+    if(block==NULL || block->bit_len + TL_HISTORY_POINT_BITS_MAXIMUM >
+        TL_HISTORY_BLOCK_DATA_SIZE * 8 || dod < G_MININT32 ||
+        dod > G_MAXINT32)
+    {
+        block = tl_history_block_new(history_data, series);
+        if(block==NULL)
+        {
+            return;
+        }
+    }
+    
+    g_atomic_int_inc(&(block->seq));
+    tl_history_point_encode(block, now, value);
+    block->last_time = now;
+    block->count++;
+    g_atomic_int_inc(&(block->seq));
+}
+
+/*
+ * Can be called from any thread. Returns the points of the series between
+ * begin_time and end_time (milliseconds since epoch, inclusive) in time
+ * order, or NULL if the series is unknown.
+ */
+GArray *tl_history_range_read(const gchar *name, gint64 begin_time,
+    gint64 end_time)
+{
+    TLHistoryData *history_data = &g_tl_history_data;
+    TLHistorySeriesData *series_data = NULL;
+    TLHistoryBlock copy;
+    GArray *points;
+    gint series, index;
+    gboolean consistent = FALSE;
+    guint retry;
+    
+    if(!history_data->initialized || name==NULL)
+    {
+        return NULL;
+    }
+    
+    g_mutex_lock(&(history_data->series_mutex));
+    series = GPOINTER_TO_INT(g_hash_table_lookup(
+        history_data->series_table, name)) - 1;
+    if(series>=0)
+    {
+        series_data = g_ptr_array_index(history_data->series, series);
+    }
+    g_mutex_unlock(&(history_data->series_mutex));
+    
+    if(series_data==NULL)
+    {
+        return NULL;
+    }
+    
+    points = g_array_new(FALSE, FALSE, sizeof(TLHistoryPoint));
+    
+    for(retry=0;!consistent && retry<TL_HISTORY_READ_RETRY_MAXIMUM;retry++)
+    {
+        g_array_set_size(points, 0);
+        consistent = TRUE;
+        
+        index = g_atomic_int_get(&(series_data->head));
+        while(index>=0)
+        {
+            if(!tl_history_block_read(&(history_data->blocks[index]),
+                &copy) || copy.series!=series)
+            {
+                consistent = FALSE;
+                break;
+            }
+            if(copy.first_time>end_time)
+            {
+                break;
+            }
+            if(copy.last_time>=begin_time)
+            {
+                tl_history_block_decode(&copy, begin_time, end_time, points);
+            }
+            index = copy.next;
+        }
+    }
+    
+    if(!consistent)
+    {
+        g_warning("TLHistory cannot get a consistent read of %s.", name);
+    }
+    
+    return points;
+}
+
+gchar **tl_history_series_names_get()
+{
+    TLHistorySeriesData *series_data;
+    gchar **names;
+    guint i;
+    
+    if(!g_tl_history_data.initialized)
+    {
+        return NULL;
+    }
+    
+    g_mutex_lock(&(g_tl_history_data.series_mutex));
+    names = g_new0(gchar *, g_tl_history_data.series->len + 1);
+    for(i=0;i<g_tl_history_data.series->len;i++)
+    {
+        series_data = g_ptr_array_index(g_tl_history_data.series, i);
+        names[i] = g_strdup(series_data->name);
+    }
+    g_mutex_unlock(&(g_tl_history_data.series_mutex));
+    
+    return names;
+}
@@ -0,0 +1,20 @@
+#ifndef HAVE_TL_HISTORY_H
+#define HAVE_TL_HISTORY_H
+
+#include <glib.h>
+
+typedef struct _TLHistoryPoint
+{
+    gint64 timestamp;
+    gint64 value;
+}TLHistoryPoint;
+
+gboolean tl_history_init(gsize memory_size, guint retention);
+void tl_history_uninit();
+gint tl_history_series_add(const gchar *name);
+void tl_history_append(gint series, gint64 timestamp, gint64 value);
+GArray *tl_history_range_read(const gchar *name, gint64 begin_time,
+    gint64 end_time);
+gchar **tl_history_series_names_get();
+
+#endif
@@ -0,0 +1,507 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tl-logarc.h"
+#include "tl-logfmt.h"
+
+#define TL_LOGARC_MAGIC ((const guint8 *)"TLCB")
+#define TL_LOGARC_INDEX_MAGIC ((const guint8 *)"TLCX")
+#define TL_LOGARC_TAIL_MAGIC ((const guint8 *)"TLCE")
+#define TL_LOGARC_VERSION 1
+#define TL_LOGARC_HEADER_SIZE 8
+#define TL_LOGARC_TRAILER_SIZE 12
+#define TL_LOGARC_ENTRY_SIZE 36
+
+struct _TLLogArcWriter
+{
+    GOutputStream *ostream;
+    GConverter *compressor;
+    TLLogFmtScanner *scanner;
+    gsize block_size;
+    guint64 offset;
+    GByteArray *block;
+    GByteArray *output;
+    TLLogArcBlock current;
+    GArray *blocks;
+    GError *error;
+};
+
+struct _TLLogArcReader
+{
+    int fd;
+    gchar *path;
+    GConverter *decompressor;
+    GArray *blocks;
+    GByteArray *buffer;
+};
+
+static inline void tl_logarc_uint_write(guint8 *data, guint64 value,
+    guint size)
+{
+    guint i;
+    
+    for(i=0;i<size;i++)
+    {
+        data[i] = (value >> (8 * (size - i - 1))) & 0xFF;
+    }
+}
+
+static inline guint64 tl_logarc_uint_read(const guint8 *data, guint size)
+{
+    guint64 value = 0;
+    guint i;
+    
+    for(i=0;i<size;i++)
+    {
+        value = (value << 8) | data[i];
+    }
+    
+    return value;
+}
+
+static gboolean tl_logarc_writer_block_flush(TLLogArcWriter *writer,
+    GError **error)
+{
+    if(writer->block->len==0)
+    {
+        return TRUE;
+    }
+    
+    g_byte_array_set_size(writer->output, 0);
+    if(!tl_codec_convert(writer->compressor, writer->block->data,
+        writer->block->len, writer->output, error))
+    {
+        return FALSE;
+    }
+    if(!g_output_stream_write_all(writer->ostream, writer->output->data,
+        writer->output->len, NULL, NULL, error))
+    {
+        return FALSE;
+    }
+    
+    writer->current.offset = writer->offset;
+    writer->current.compressed_size = writer->output->len;
+    writer->current.size = writer->block->len;
+    g_array_append_val(writer->blocks, writer->current);
+    writer->offset += writer->output->len;
+    g_byte_array_set_size(writer->block, 0);
+    
+    return TRUE;
+}
+
+static gboolean tl_logarc_writer_frame_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    TLLogArcWriter *writer = (TLLogArcWriter *)user_data;
+    gint64 time;
+    
+    if(writer->block->len>=writer->block_size &&
+        (type==TL_LOGFMT_FRAME_RECORD || type==TL_LOGFMT_FRAME_JSON))
+    {
+        if(!tl_logarc_writer_block_flush(writer, &(writer->error)))
+        {
+            return FALSE;
+        }
+    }
+    
+    if(writer->block->len==0)
+    {
+        writer->current.first_time = G_MAXINT64;
+        writer->current.last_time = G_MININT64;
+        writer->current.flags = 0;
+    }
+    if(type==TL_LOGFMT_FRAME_META)
+    {
+        writer->current.flags |= TL_LOGARC_BLOCK_FLAG_META;
+    }
+    else if(tl_logfmt_frame_time_get(type, payload, len, &time))
+    {
+        writer->current.first_time = MIN(writer->current.first_time, time);
+        writer->current.last_time = MAX(writer->current.last_time, time);
+    }
+    tl_logfmt_frame_append(writer->block, type, payload, len);
+    
+    return TRUE;
+}
+
+/*
+ * Starts a block archive on ostream, blocks are compressed with codec at
+ * level. Returns NULL if the codec is not built in or the header cannot
+ * be written.
+ */
+TLLogArcWriter *tl_logarc_writer_new(GOutputStream *ostream,
+    TLCodecType codec, gint level, gsize block_size, GError **error)
+{
+    TLLogArcWriter *writer;
+    GConverter *compressor;
+    guint8 header[TL_LOGARC_HEADER_SIZE];
+    
+    compressor = tl_codec_compressor_new(codec, level);
+    if(compressor==NULL)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "Codec %s is not built in", tl_codec_name_get(codec));
+        return NULL;
+    }
+    
+    memset(header, 0, TL_LOGARC_HEADER_SIZE);
+    memcpy(header, TL_LOGARC_MAGIC, 4);
+    header[4] = TL_LOGARC_VERSION;
+    header[5] = codec;
+    if(!g_output_stream_write_all(ostream, header, TL_LOGARC_HEADER_SIZE,
+        NULL, NULL, error))
+    {
+        g_object_unref(compressor);
+        return NULL;
+    }
+    
+    writer = g_new0(TLLogArcWriter, 1);
+    writer->ostream = g_object_ref(ostream);
+    writer->compressor = compressor;
+    writer->scanner = tl_logfmt_scanner_new();
+    writer->block_size = block_size>0 ? block_size :
+        TL_LOGARC_BLOCK_SIZE_DEFAULT;
+    writer->offset = TL_LOGARC_HEADER_SIZE;
+    writer->block = g_byte_array_new();
+    writer->output = g_byte_array_new();
+    writer->blocks = g_array_new(FALSE, FALSE, sizeof(TLLogArcBlock));
+    
+    return writer;
+}
+
+/* Adds log data to the archive, data may be cut anywhere between calls. */
+gboolean tl_logarc_writer_write(TLLogArcWriter *writer, const guint8 *data,
+    gsize len, GError **error)
+{
+    if(writer->error==NULL)
+    {
+        tl_logfmt_scanner_feed(writer->scanner, data, len,
+            tl_logarc_writer_frame_cb, writer);
+    }
+    if(writer->error!=NULL)
+    {
+        if(error!=NULL)
+        {
+            *error = g_error_copy(writer->error);
+        }
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* Writes the last block and the index. The output stream stays open. */
+gboolean tl_logarc_writer_finish(TLLogArcWriter *writer, GError **error)
+{
+    GByteArray *index;
+    const TLLogArcBlock *block;
+    guint8 *entry;
+    guint16 becrc;
+    guint i;
+    gboolean ret;
+    
+    if(writer->error!=NULL)
+    {
+        if(error!=NULL)
+        {
+            *error = g_error_copy(writer->error);
+        }
+        return FALSE;
+    }
+    if(!tl_logarc_writer_block_flush(writer, error))
+    {
+        return FALSE;
+    }
+    
+    index = g_byte_array_sized_new(8 + writer->blocks->len *
+        TL_LOGARC_ENTRY_SIZE + 2 + TL_LOGARC_TRAILER_SIZE);
+    g_byte_array_set_size(index, 8 + writer->blocks->len *
+        TL_LOGARC_ENTRY_SIZE);
+    memcpy(index->data, TL_LOGARC_INDEX_MAGIC, 4);
+    tl_logarc_uint_write(index->data + 4, writer->blocks->len, 4);
+    for(i=0;i<writer->blocks->len;i++)
+    {
+        block = &g_array_index(writer->blocks, TLLogArcBlock, i);
+        entry = index->data + 8 + i * TL_LOGARC_ENTRY_SIZE;
+        tl_logarc_uint_write(entry, block->offset, 8);
+        tl_logarc_uint_write(entry + 8, block->compressed_size, 4);
+        tl_logarc_uint_write(entry + 12, block->size, 4);
+        tl_logarc_uint_write(entry + 16, block->first_time, 8);
+        tl_logarc_uint_write(entry + 24, block->last_time, 8);
+        tl_logarc_uint_write(entry + 32, block->flags, 4);
+    }
+    becrc = g_htons(tl_logfmt_crc16_compute(index->data, index->len));
+    g_byte_array_append(index, (const guint8 *)&becrc, 2);
+    g_byte_array_set_size(index, index->len + 8);
+    tl_logarc_uint_write(index->data + index->len - 8, writer->offset, 8);
+    g_byte_array_append(index, TL_LOGARC_TAIL_MAGIC, 4);
+    
+    ret = g_output_stream_write_all(writer->ostream, index->data,
+        index->len, NULL, NULL, error);
+    g_byte_array_unref(index);
+    
+    return ret;
+}
+
+void tl_logarc_writer_free(TLLogArcWriter *writer)
+{
+    if(writer==NULL)
+    {
+        return;
+    }
+    g_object_unref(writer->ostream);
+    g_object_unref(writer->compressor);
+    tl_logfmt_scanner_free(writer->scanner);
+    g_byte_array_unref(writer->block);
+    g_byte_array_unref(writer->output);
+    g_array_unref(writer->blocks);
+    g_clear_error(&(writer->error));
+    g_free(writer);
+}
+
+static gboolean tl_logarc_pread(int fd, guint8 *data, gsize len,
+    guint64 offset)
+{
+    ssize_t rsize;
+    
+    while(len>0)
+    {
+        rsize = pread(fd, data, len, offset);
+        if(rsize<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(rsize<=0)
+        {
+            return FALSE;
+        }
+        data += rsize;
+        len -= rsize;
+        offset += rsize;
+    }
+    
+    return TRUE;
+}
+
+static gboolean tl_logarc_reader_index_load(TLLogArcReader *reader,
+    guint64 file_size)
+{
+    guint8 trailer[TL_LOGARC_TRAILER_SIZE];
+    guint8 *index, *entry;
+    guint64 index_offset, index_size, count;
+    TLLogArcBlock block;
+    guint16 becrc;
+    guint i;
+    gboolean ret = FALSE;
+    
+    if(file_size < TL_LOGARC_HEADER_SIZE + TL_LOGARC_TRAILER_SIZE ||
+        !tl_logarc_pread(reader->fd, trailer, TL_LOGARC_TRAILER_SIZE,
+        file_size - TL_LOGARC_TRAILER_SIZE) ||
+        memcmp(trailer + 8, TL_LOGARC_TAIL_MAGIC, 4)!=0)
+    {
+        return FALSE;
+    }
+    index_offset = tl_logarc_uint_read(trailer, 8);
+    if(index_offset < TL_LOGARC_HEADER_SIZE || index_offset + 10 +
+        TL_LOGARC_TRAILER_SIZE > file_size)
+    {
+        return FALSE;
+    }
+    index_size = file_size - TL_LOGARC_TRAILER_SIZE - index_offset;
+    
+    index = g_malloc(index_size);
+    G_STMT_START
+    {
+        if(!tl_logarc_pread(reader->fd, index, index_size, index_offset) ||
+            memcmp(index, TL_LOGARC_INDEX_MAGIC, 4)!=0)
+        {
+            break;
+        }
+        count = tl_logarc_uint_read(index + 4, 4);
+        if(index_size!=8 + count * TL_LOGARC_ENTRY_SIZE + 2)
+        {
+            break;
+        }
+        memcpy(&becrc, index + index_size - 2, 2);
+        if(g_ntohs(becrc)!=tl_logfmt_crc16_compute(index, index_size - 2))
+        {
+            break;
+        }
+        
+        for(i=0;i<count;i++)
+        {
+            entry = index + 8 + i * TL_LOGARC_ENTRY_SIZE;
+            block.offset = tl_logarc_uint_read(entry, 8);
+            block.compressed_size = tl_logarc_uint_read(entry + 8, 4);
+            block.size = tl_logarc_uint_read(entry + 12, 4);
+            block.first_time = tl_logarc_uint_read(entry + 16, 8);
+            block.last_time = tl_logarc_uint_read(entry + 24, 8);
+            block.flags = tl_logarc_uint_read(entry + 32, 4);
+            if(block.offset < TL_LOGARC_HEADER_SIZE ||
+                block.offset + block.compressed_size > index_offset)
+            {
+                break;
+            }
+            g_array_append_val(reader->blocks, block);
+        }
+        ret = (i==count);
+    }
+    G_STMT_END;
+    g_free(index);
+    
+    return ret;
+}
+
+/*
+ * Opens a block archive and loads its index. Returns NULL without setting
+ * error if path is not a block archive, so the caller can read it as a
+ * stream instead.
+ */
+TLLogArcReader *tl_logarc_reader_open(const gchar *path, GError **error)
+{
+    TLLogArcReader *reader;
+    guint8 header[TL_LOGARC_HEADER_SIZE];
+    struct stat statbuf;
+    TLCodecType codec;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if(fd<0)
+    {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+            "Cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if(!tl_logarc_pread(fd, header, TL_LOGARC_HEADER_SIZE, 0) ||
+        memcmp(header, TL_LOGARC_MAGIC, 4)!=0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    codec = header[5];
+    if(header[4]!=TL_LOGARC_VERSION || codec>=TL_CODEC_LAST ||
+        fstat(fd, &statbuf)!=0)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "%s is not a supported block archive", path);
+        close(fd);
+        return NULL;
+    }
+    if(!tl_codec_available(codec))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+            "%s is compressed with %s, which is not built in", path,
+            tl_codec_name_get(codec));
+        close(fd);
+        return NULL;
+    }
+    
+    reader = g_new0(TLLogArcReader, 1);
+    reader->fd = fd;
+    reader->path = g_strdup(path);
+    reader->blocks = g_array_new(FALSE, FALSE, sizeof(TLLogArcBlock));
+    reader->buffer = g_byte_array_new();
+    if(!tl_logarc_reader_index_load(reader, statbuf.st_size))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+            "Block index of %s is damaged", path);
+        tl_logarc_reader_free(reader);
+        return NULL;
+    }
+    reader->decompressor = tl_codec_decompressor_new(codec);
+    
+    return reader;
+}
+
+void tl_logarc_reader_free(TLLogArcReader *reader)
+{
+    if(reader==NULL)
+    {
+        return;
+    }
+    close(reader->fd);
+    g_free(reader->path);
+    if(reader->decompressor!=NULL)
+    {
+        g_object_unref(reader->decompressor);
+    }
+    g_array_unref(reader->blocks);
+    g_byte_array_unref(reader->buffer);
+    g_free(reader);
+}
+
+guint tl_logarc_reader_block_count_get(const TLLogArcReader *reader)
+{
+    return reader->blocks->len;
+}
+
+const TLLogArcBlock *tl_logarc_reader_block_get(const TLLogArcReader *reader,
+    guint index)
+{
+    if(index>=reader->blocks->len)
+    {
+        return NULL;
+    }
+    
+    return &g_array_index(reader->blocks, TLLogArcBlock, index);
+}
+
+/* Decompresses a block and appends its frames to output. */
+gboolean tl_logarc_reader_block_read(TLLogArcReader *reader, guint index,
+    GByteArray *output, GError **error)
+{
+    const TLLogArcBlock *block;
+    
+    block = tl_logarc_reader_block_get(reader, index);
+    if(block==NULL)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+            "%s has no block %u", reader->path, index);
+        return FALSE;
+    }
+    
+    g_byte_array_set_size(reader->buffer, block->compressed_size);
+    if(!tl_logarc_pread(reader->fd, reader->buffer->data,
+        block->compressed_size, block->offset))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+            "Cannot read block %u of %s", index, reader->path);
+        return FALSE;
+    }
+    
+    return tl_codec_convert(reader->decompressor, reader->buffer->data,
+        block->compressed_size, output, error);
+}
+
+/*
+ * Decompresses all blocks into memory and returns them as one stream of
+ * frames, for tools reading whole files.
+ */
+GInputStream *tl_logarc_reader_stream_new(TLLogArcReader *reader,
+    GError **error)
+{
+    GByteArray *data;
+    GBytes *bytes;
+    GInputStream *istream;
+    guint i;
+    
+    data = g_byte_array_new();
+    for(i=0;i<reader->blocks->len;i++)
+    {
+        if(!tl_logarc_reader_block_read(reader, i, data, error))
+        {
+            g_byte_array_unref(data);
+            return NULL;
+        }
+    }
+    
+    bytes = g_byte_array_free_to_bytes(data);
+    istream = g_memory_input_stream_new_from_bytes(bytes);
+    g_bytes_unref(bytes);
+    
+    return istream;
+}
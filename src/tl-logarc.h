@@ -0,0 +1,60 @@
+#ifndef HAVE_TL_LOGARC_H
+#define HAVE_TL_LOGARC_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "tl-codec.h"
+
+/*
+ * Block archives keep the frames of a log file in blocks which are
+ * compressed independently, followed by an index of the blocks:
+ * | "TLCB" | version (1B) | codec (1B) | reserved (2B) | block... |
+ *   index | index offset (8B BE) | "TLCE" |
+ * index: | "TLCX" | count (4B BE) | count x entry | CRC16 (2B BE) |
+ * entry: | offset (8B BE) | compressed size (4B BE) | size (4B BE) |
+ *   first time (8B BE) | last time (8B BE) | flags (4B BE) |
+ *
+ * A block is cut before a keyframe or JSON record once it holds
+ * block_size bytes, so it decodes on its own once the handles declared
+ * before it are known. Blocks with handle declarations are flagged, a
+ * reader skipping blocks has to apply their metadata frames.
+ */
+
+#define TL_LOGARC_BLOCK_SIZE_DEFAULT 64 * 1024
+
+typedef enum
+{
+    TL_LOGARC_BLOCK_FLAG_META = 1 << 0
+}TLLogArcBlockFlags;
+
+typedef struct _TLLogArcBlock
+{
+    guint64 offset;
+    guint32 compressed_size;
+    guint32 size;
+    gint64 first_time;
+    gint64 last_time;
+    guint32 flags;
+}TLLogArcBlock;
+
+typedef struct _TLLogArcWriter TLLogArcWriter;
+typedef struct _TLLogArcReader TLLogArcReader;
+
+TLLogArcWriter *tl_logarc_writer_new(GOutputStream *ostream,
+    TLCodecType codec, gint level, gsize block_size, GError **error);
+gboolean tl_logarc_writer_write(TLLogArcWriter *writer, const guint8 *data,
+    gsize len, GError **error);
+gboolean tl_logarc_writer_finish(TLLogArcWriter *writer, GError **error);
+void tl_logarc_writer_free(TLLogArcWriter *writer);
+
+TLLogArcReader *tl_logarc_reader_open(const gchar *path, GError **error);
+void tl_logarc_reader_free(TLLogArcReader *reader);
+guint tl_logarc_reader_block_count_get(const TLLogArcReader *reader);
+const TLLogArcBlock *tl_logarc_reader_block_get(const TLLogArcReader *reader,
+    guint index);
+gboolean tl_logarc_reader_block_read(TLLogArcReader *reader, guint index,
+    GByteArray *output, GError **error);
+GInputStream *tl_logarc_reader_stream_new(TLLogArcReader *reader,
+    GError **error);
+
+#endif
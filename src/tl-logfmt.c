@@ -0,0 +1,1419 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <json.h>
+#include "tl-logfmt.h"
+
+#define TL_LOGFMT_JSON_MAGIC ((const guint8 *)"TLIH")
+#define TL_LOGFMT_META_MAGIC ((const guint8 *)"TLBM")
+#define TL_LOGFMT_RECORD_MAGIC ((const guint8 *)"TLBR")
+#define TL_LOGFMT_DELTA_MAGIC ((const guint8 *)"TLBD")
+#define TL_LOGFMT_TAIL_MAGIC ((const guint8 *)"TLIT")
+#define TL_LOGFMT_MAGIC_PREFIX "TL"
+
+#define TL_LOGFMT_FRAME_HEADER_SIZE 10
+#define TL_LOGFMT_FRAME_OVERHEAD 14
+#define TL_LOGFMT_FRAME_SIZE_MAXIMUM 8 * 1024 * 1024
+#define TL_LOGFMT_HANDLE_MAXIMUM 1048576
+
+#define TL_LOGFMT_HANDLE_LIST_INDEX 1
+#define TL_LOGFMT_HANDLE_LIST_PARENT 2
+
+typedef struct _TLLogFmtHandleData
+{
+    gchar *name;
+    gdouble unit;
+    gint offset;
+    gint8 source;
+    guint8 flags;
+    gchar *list_parent;
+}TLLogFmtHandleData;
+
+typedef struct _TLLogFmtValueData
+{
+    gboolean valid;
+    gint64 value;
+    GHashTable *list_table;
+    GHashTable *index_table;
+}TLLogFmtValueData;
+
+struct _TLLogFmtWriter
+{
+    GPtrArray *handles;
+    GArray *pending;
+    GPtrArray *last_items;
+    guint keyframe_interval;
+    guint delta_count;
+    gboolean keyframe_pending;
+};
+
+struct _TLLogFmtReader
+{
+    GPtrArray *handles;
+    GArray *values;
+    gboolean keyframe_seen;
+};
+
+/*
+ * Frames are handed to the callback straight from the fed data. Only a
+ * frame cut by the end of the data is copied to buffer and completed from
+ * the next piece, spare holds it while it is scanned.
+ */
+struct _TLLogFmtScanner
+{
+    GByteArray *buffer;
+    GByteArray *spare;
+};
+
+typedef struct _TLLogFmtCursor
+{
+    const guint8 *data;
+    gsize len;
+    gsize pos;
+    gboolean error;
+}TLLogFmtCursor;
+
+static const guint8 *g_tl_logfmt_head_magics[] =
+{
+    [TL_LOGFMT_FRAME_JSON] = TL_LOGFMT_JSON_MAGIC,
+    [TL_LOGFMT_FRAME_META] = TL_LOGFMT_META_MAGIC,
+    [TL_LOGFMT_FRAME_RECORD] = TL_LOGFMT_RECORD_MAGIC,
+    [TL_LOGFMT_FRAME_DELTA] = TL_LOGFMT_DELTA_MAGIC
+};
+
+static guint16 g_tl_logfmt_crc16_table[8][256];
+
+/*
+ * Fills the tables of CRC-16/CCITT (polynomial 0x1021): table 0 is the
+ * CRC of each byte, table k the CRC of each byte followed by k zero bytes.
+ */
+static void tl_logfmt_crc16_table_init()
+{
+    static gsize initialized = 0;
+    guint16 crc;
+    guint i, j;
+    
+    if(!g_once_init_enter(&initialized))
+    {
+        return;
+    }
+    
+    for(i=0;i<256;i++)
+    {
+        crc = i << 8;
+        for(j=0;j<8;j++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        g_tl_logfmt_crc16_table[0][i] = crc;
+    }
+    for(i=0;i<256;i++)
+    {
+        for(j=1;j<8;j++)
+        {
+            crc = g_tl_logfmt_crc16_table[j-1][i];
+            g_tl_logfmt_crc16_table[j][i] = (crc << 8) ^
+                g_tl_logfmt_crc16_table[0][crc >> 8];
+        }
+    }
+    
+    g_once_init_leave(&initialized, 1);
+}
+
+/*
+ * Computes the CRC eight bytes at a time with one table lookup per byte
+ * (slicing-by-8), every frame is checked with it when logs are read.
+ */
+guint16 tl_logfmt_crc16_compute(const guint8 *data, gsize len)
+{
+    guint16 crc = 0xFFFF;
+    
+    tl_logfmt_crc16_table_init();
+    
+    while(len>=8)
+    {
+        crc = g_tl_logfmt_crc16_table[7][data[0] ^ (crc >> 8)] ^
+            g_tl_logfmt_crc16_table[6][data[1] ^ (crc & 0xFF)] ^
+            g_tl_logfmt_crc16_table[5][data[2]] ^
+            g_tl_logfmt_crc16_table[4][data[3]] ^
+            g_tl_logfmt_crc16_table[3][data[4]] ^
+            g_tl_logfmt_crc16_table[2][data[5]] ^
+            g_tl_logfmt_crc16_table[1][data[6]] ^
+            g_tl_logfmt_crc16_table[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    while(len--)
+    {
+        crc = (crc << 8) ^ g_tl_logfmt_crc16_table[0][(crc >> 8) ^ *data++];
+    }
+    
+    return crc;
+}
+
+static void tl_logfmt_handle_data_free(TLLogFmtHandleData *data)
+{
+    if(data==NULL)
+    {
+        return;
+    }
+    g_free(data->name);
+    g_free(data->list_parent);
+    g_free(data);
+}
+
+static void tl_logfmt_item_data_free(TLLoggerLogItemData *data)
+{
+    if(data==NULL)
+    {
+        return;
+    }
+    g_free(data->name);
+    g_free(data->list_parent);
+    if(data->list_table!=NULL)
+    {
+        g_hash_table_unref(data->list_table);
+    }
+    if(data->index_table!=NULL)
+    {
+        g_hash_table_unref(data->index_table);
+    }
+    g_free(data);
+}
+
+static void tl_logfmt_value_data_clear(TLLogFmtValueData *data)
+{
+    if(data->list_table!=NULL)
+    {
+        g_hash_table_unref(data->list_table);
+    }
+    if(data->index_table!=NULL)
+    {
+        g_hash_table_unref(data->index_table);
+    }
+    memset(data, 0, sizeof(TLLogFmtValueData));
+}
+
+static GHashTable *tl_logfmt_log_table_new(gint64 time)
+{
+    GHashTable *table;
+    TLLoggerLogItemData *item_data;
+    
+    table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+        (GDestroyNotify)tl_logfmt_item_data_free);
+    
+    item_data = g_new0(TLLoggerLogItemData, 1);
+    item_data->name = g_strdup("time");
+    item_data->value = time;
+    item_data->unit = 1.0;
+    g_hash_table_replace(table, item_data->name, item_data);
+    
+    return table;
+}
+
+static inline void tl_logfmt_uint_write(GByteArray *ba, guint64 value)
+{
+    guint8 buffer[10];
+    guint len = 0;
+    
+    while(value>=0x80)
+    {
+        buffer[len++] = (guint8)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[len++] = (guint8)value;
+    g_byte_array_append(ba, buffer, len);
+}
+
+static inline void tl_logfmt_int_write(GByteArray *ba, gint64 value)
+{
+    tl_logfmt_uint_write(ba, ((guint64)value << 1) ^ (guint64)(value >> 63));
+}
+
+static inline void tl_logfmt_string_write(GByteArray *ba, const gchar *str)
+{
+    gsize len = strlen(str);
+    
+    tl_logfmt_uint_write(ba, len);
+    g_byte_array_append(ba, (const guint8 *)str, len);
+}
+
+static inline guint64 tl_logfmt_uint_read(TLLogFmtCursor *cursor)
+{
+    guint64 value = 0;
+    guint shift = 0;
+    guint8 byte;
+    
+    do
+    {
+        if(cursor->pos>=cursor->len || shift>63)
+        {
+            cursor->error = TRUE;
+            return 0;
+        }
+        byte = cursor->data[cursor->pos++];
+        value |= (guint64)(byte & 0x7F) << shift;
+        shift += 7;
+    }
+    while(byte & 0x80);
+    
+    return value;
+}
+
+static inline gint64 tl_logfmt_int_read(TLLogFmtCursor *cursor)
+{
+    guint64 value = tl_logfmt_uint_read(cursor);
+    
+    return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+static inline const guint8 *tl_logfmt_bytes_read(TLLogFmtCursor *cursor,
+    gsize len)
+{
+    const guint8 *data;
+    
+    if(cursor->error || len>cursor->len - cursor->pos)
+    {
+        cursor->error = TRUE;
+        return NULL;
+    }
+    data = cursor->data + cursor->pos;
+    cursor->pos += len;
+    
+    return data;
+}
+
+static gchar *tl_logfmt_string_read(TLLogFmtCursor *cursor)
+{
+    const guint8 *data;
+    guint64 len;
+    
+    len = tl_logfmt_uint_read(cursor);
+    data = tl_logfmt_bytes_read(cursor, len);
+    if(data==NULL)
+    {
+        return NULL;
+    }
+    
+    return g_strndup((const gchar *)data, len);
+}
+
+static gsize tl_logfmt_frame_begin(GByteArray *ba, const guint8 *magic)
+{
+    gsize offset = ba->len;
+    
+    g_byte_array_append(ba, magic, 4);
+    g_byte_array_append(ba, (const guint8 *)"\0\0\0\0\0\0", 6);
+    
+    return offset;
+}
+
+static void tl_logfmt_frame_end(GByteArray *ba, gsize offset)
+{
+    guint32 len, belen;
+    guint16 becrc;
+    
+    len = ba->len - offset - TL_LOGFMT_FRAME_HEADER_SIZE;
+    belen = g_htonl(len);
+    memcpy(ba->data + offset + 4, &belen, 4);
+    becrc = g_htons(tl_logfmt_crc16_compute(ba->data + offset +
+        TL_LOGFMT_FRAME_HEADER_SIZE, len));
+    memcpy(ba->data + offset + 8, &becrc, 2);
+    
+    g_byte_array_append(ba, TL_LOGFMT_TAIL_MAGIC, 4);
+}
+
+TLLogFmtWriter *tl_logfmt_writer_new()
+{
+    TLLogFmtWriter *writer;
+    
+    writer = g_new0(TLLogFmtWriter, 1);
+    writer->handles = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logfmt_handle_data_free);
+    writer->pending = g_array_new(FALSE, FALSE, sizeof(guint));
+    writer->last_items = g_ptr_array_new();
+    writer->keyframe_pending = TRUE;
+    
+    return writer;
+}
+
+void tl_logfmt_writer_free(TLLogFmtWriter *writer)
+{
+    if(writer==NULL)
+    {
+        return;
+    }
+    g_ptr_array_unref(writer->handles);
+    g_array_unref(writer->pending);
+    g_ptr_array_unref(writer->last_items);
+    g_free(writer);
+}
+
+/*
+ * Starts a new segment, every handle is declared again on first use and
+ * the next record is a keyframe.
+ */
+void tl_logfmt_writer_reset(TLLogFmtWriter *writer)
+{
+    g_ptr_array_set_size(writer->handles, 0);
+    g_ptr_array_set_size(writer->last_items, 0);
+    writer->keyframe_pending = TRUE;
+}
+
+/*
+ * Writes a keyframe every interval records, 0 only at segment start and 1
+ * for every record (no deltas).
+ */
+void tl_logfmt_writer_keyframe_interval_set(TLLogFmtWriter *writer,
+    guint interval)
+{
+    writer->keyframe_interval = interval;
+}
+
+/* Makes the next record a keyframe, e.g. for a reader to start from. */
+void tl_logfmt_writer_keyframe_request(TLLogFmtWriter *writer)
+{
+    writer->keyframe_pending = TRUE;
+}
+
+static gboolean tl_logfmt_handle_matches(const TLLogFmtHandleData *handle,
+    const TLLoggerLogItemData *item_data, guint8 flags)
+{
+    return (handle!=NULL && handle->unit==item_data->unit &&
+        handle->offset==item_data->offset &&
+        handle->source==item_data->source && handle->flags==flags &&
+        g_strcmp0(handle->name, item_data->name)==0 &&
+        g_strcmp0(handle->list_parent, item_data->list_parent)==0);
+}
+
+static void tl_logfmt_item_value_write(GByteArray *ba,
+    const TLLoggerLogItemData *item_data)
+{
+    GHashTableIter iter;
+    gpointer key;
+    gint64 *valueptr;
+    
+    tl_logfmt_int_write(ba, item_data->value);
+    
+    if(item_data->list_parent!=NULL)
+    {
+        if(item_data->list_table!=NULL)
+        {
+            tl_logfmt_uint_write(ba, g_hash_table_size(item_data->list_table));
+            g_hash_table_iter_init(&iter, item_data->list_table);
+            while(g_hash_table_iter_next(&iter, &key, (gpointer *)&valueptr))
+            {
+                tl_logfmt_string_write(ba, (const gchar *)key);
+                tl_logfmt_int_write(ba, valueptr!=NULL ? *valueptr : 0);
+            }
+        }
+        else
+        {
+            tl_logfmt_uint_write(ba, 0);
+        }
+    }
+    if(item_data->list_index)
+    {
+        if(item_data->index_table!=NULL)
+        {
+            tl_logfmt_uint_write(ba,
+                g_hash_table_size(item_data->index_table));
+            g_hash_table_iter_init(&iter, item_data->index_table);
+            while(g_hash_table_iter_next(&iter, &key, NULL))
+            {
+                tl_logfmt_string_write(ba, (const gchar *)key);
+            }
+        }
+        else
+        {
+            tl_logfmt_uint_write(ba, 0);
+        }
+    }
+}
+
+/*
+ * Appends the record to ba, preceded by a metadata frame for the handles
+ * which are new or changed. items[i] is the signal with handle i, or NULL
+ * if it has no value. Deltas detect changes by item pointer, so unchanged
+ * signals must be passed as the same item, and the items must stay valid
+ * until the next append or reset. Returns TLLogFmtRecordFlags.
+ */
+guint tl_logfmt_writer_record_append(TLLogFmtWriter *writer,
+    GByteArray *ba, gint64 time, const TLLoggerLogItemData * const *items,
+    guint count)
+{
+    const TLLoggerLogItemData *item_data;
+    TLLogFmtHandleData *handle;
+    gsize offset, bitmap_offset;
+    guint64 unit_bits;
+    guint8 flags;
+    guint i, handle_index;
+    gboolean keyframe;
+    guint ret = 0;
+    
+    if(writer->handles->len<count)
+    {
+        g_ptr_array_set_size(writer->handles, count);
+    }
+    
+    g_array_set_size(writer->pending, 0);
+    for(i=0;i<count;i++)
+    {
+        item_data = items[i];
+        if(item_data==NULL)
+        {
+            continue;
+        }
+        flags = (item_data->list_index ? TL_LOGFMT_HANDLE_LIST_INDEX : 0) |
+            (item_data->list_parent!=NULL ? TL_LOGFMT_HANDLE_LIST_PARENT : 0);
+        handle = g_ptr_array_index(writer->handles, i);
+        if(tl_logfmt_handle_matches(handle, item_data, flags))
+        {
+            continue;
+        }
+        
+        if(handle==NULL)
+        {
+            handle = g_new0(TLLogFmtHandleData, 1);
+            g_ptr_array_index(writer->handles, i) = handle;
+        }
+        g_free(handle->name);
+        g_free(handle->list_parent);
+        handle->name = g_strdup(item_data->name);
+        handle->unit = item_data->unit;
+        handle->offset = item_data->offset;
+        handle->source = item_data->source;
+        handle->flags = flags;
+        handle->list_parent = g_strdup(item_data->list_parent);
+        g_array_append_val(writer->pending, i);
+    }
+    
+    if(writer->pending->len>0)
+    {
+        offset = tl_logfmt_frame_begin(ba, TL_LOGFMT_META_MAGIC);
+        g_byte_array_append(ba, (const guint8 *)"\1", 1);
+        tl_logfmt_uint_write(ba, writer->pending->len);
+        for(i=0;i<writer->pending->len;i++)
+        {
+            handle_index = g_array_index(writer->pending, guint, i);
+            handle = g_ptr_array_index(writer->handles, handle_index);
+            
+            tl_logfmt_uint_write(ba, handle_index);
+            tl_logfmt_string_write(ba, handle->name);
+            memcpy(&unit_bits, &(handle->unit), 8);
+            unit_bits = GUINT64_TO_LE(unit_bits);
+            g_byte_array_append(ba, (const guint8 *)&unit_bits, 8);
+            tl_logfmt_int_write(ba, handle->offset);
+            g_byte_array_append(ba, (const guint8 *)&(handle->source), 1);
+            g_byte_array_append(ba, &(handle->flags), 1);
+            if(handle->flags & TL_LOGFMT_HANDLE_LIST_PARENT)
+            {
+                tl_logfmt_string_write(ba, handle->list_parent);
+            }
+        }
+        tl_logfmt_frame_end(ba, offset);
+        ret |= TL_LOGFMT_RECORD_METADATA;
+    }
+    
+    /* A delta cannot clear a signal, fall back to a keyframe. */
+    keyframe = writer->keyframe_pending || (writer->keyframe_interval>0 &&
+        writer->delta_count + 1>=writer->keyframe_interval);
+    for(i=0;!keyframe && i<writer->last_items->len;i++)
+    {
+        if(g_ptr_array_index(writer->last_items, i)!=NULL &&
+            (i>=count || items[i]==NULL))
+        {
+            keyframe = TRUE;
+        }
+    }
+    
+    offset = tl_logfmt_frame_begin(ba, keyframe ? TL_LOGFMT_RECORD_MAGIC :
+        TL_LOGFMT_DELTA_MAGIC);
+    g_byte_array_append(ba, (const guint8 *)"\1", 1);
+    tl_logfmt_int_write(ba, time);
+    tl_logfmt_uint_write(ba, count);
+    bitmap_offset = ba->len;
+    g_byte_array_set_size(ba, ba->len + (count + 7) / 8);
+    memset(ba->data + bitmap_offset, 0, (count + 7) / 8);
+    
+    for(i=0;i<count;i++)
+    {
+        item_data = items[i];
+        if(item_data==NULL || (!keyframe && i<writer->last_items->len &&
+            g_ptr_array_index(writer->last_items, i)==item_data))
+        {
+            continue;
+        }
+        ba->data[bitmap_offset + i / 8] |= (guint8)(1 << (i % 8));
+    }
+    for(i=0;!keyframe && i<writer->pending->len;i++)
+    {
+        handle_index = g_array_index(writer->pending, guint, i);
+        ba->data[bitmap_offset + handle_index / 8] |=
+            (guint8)(1 << (handle_index % 8));
+    }
+    
+    for(i=0;i<count;i++)
+    {
+        if(ba->data[bitmap_offset + i / 8] & (1 << (i % 8)))
+        {
+            tl_logfmt_item_value_write(ba, items[i]);
+        }
+    }
+    tl_logfmt_frame_end(ba, offset);
+    
+    g_ptr_array_set_size(writer->last_items, count);
+    memcpy(writer->last_items->pdata, items, count * sizeof(gpointer));
+    writer->keyframe_pending = FALSE;
+    if(keyframe)
+    {
+        writer->delta_count = 0;
+        ret |= TL_LOGFMT_RECORD_KEYFRAME;
+    }
+    else
+    {
+        writer->delta_count++;
+    }
+    
+    return ret;
+}
+
+void tl_logfmt_json_frame_append(GByteArray *ba, gint64 time,
+    const TLLoggerLogItemData * const *items, guint count)
+{
+    const TLLoggerLogItemData *item_data;
+    GHashTableIter iter;
+    gpointer key;
+    gint64 *valueptr;
+    json_object *root, *child, *item_object, *array, *dict;
+    const gchar *json_data;
+    gsize offset;
+    guint i;
+    
+    offset = tl_logfmt_frame_begin(ba, TL_LOGFMT_JSON_MAGIC);
+    
+    root = json_object_new_array();
+    
+    item_object = json_object_new_object();
+    json_object_object_add(item_object, "name",
+        json_object_new_string("time"));
+    json_object_object_add(item_object, "value",
+        json_object_new_int64(time));
+    json_object_object_add(item_object, "offset", json_object_new_int(0));
+    json_object_object_add(item_object, "unit", json_object_new_double(1.0));
+    json_object_object_add(item_object, "source", json_object_new_int(0));
+    json_object_array_add(root, item_object);
+    
+    for(i=0;i<count;i++)
+    {
+        item_data = items[i];
+        if(item_data==NULL)
+        {
+            continue;
+        }
+        
+        item_object = json_object_new_object();
+        
+        child = json_object_new_string(item_data->name);
+        json_object_object_add(item_object, "name", child);
+        
+        child = json_object_new_int64(item_data->value);
+        json_object_object_add(item_object, "value", child);
+        
+        child = json_object_new_int(item_data->offset);
+        json_object_object_add(item_object, "offset", child);
+        
+        child = json_object_new_double(item_data->unit);
+        json_object_object_add(item_object, "unit", child);
+        
+        child = json_object_new_int(item_data->source);
+        json_object_object_add(item_object, "source", child);
+        
+        if(item_data->list_index && item_data->index_table!=NULL)
+        {
+            child = json_object_new_int(1);
+            json_object_object_add(item_object, "listindex", child);
+            
+            array = json_object_new_array();
+            g_hash_table_iter_init(&iter, item_data->index_table);
+            while(g_hash_table_iter_next(&iter, &key, NULL))
+            {
+                child = json_object_new_string((const gchar *)key);
+                json_object_array_add(array, child);
+            }
+            json_object_object_add(item_object, "index", array);
+        }
+        if(item_data->list_parent!=NULL && item_data->list_table!=NULL)
+        {
+            child = json_object_new_string(item_data->list_parent);
+            json_object_object_add(item_object, "listparent", child);
+            dict = json_object_new_object();
+            g_hash_table_iter_init(&iter, item_data->list_table);
+            while(g_hash_table_iter_next(&iter, &key, (gpointer *)&valueptr))
+            {
+                if(valueptr==NULL)
+                {
+                    continue;
+                }
+                child = json_object_new_int64(*valueptr);
+                json_object_object_add(dict, (const gchar *)key, child);
+            }
+            json_object_object_add(item_object, "valuetable", dict);
+        }
+        
+        json_object_array_add(root, item_object);
+    }
+    
+    json_data = json_object_to_json_string(root);
+    g_byte_array_append(ba, (const guint8 *)json_data, strlen(json_data));
+    json_object_put(root);
+    
+    tl_logfmt_frame_end(ba, offset);
+}
+
+/* Appends a frame of the given type around payload, as the scanner found it. */
+void tl_logfmt_frame_append(GByteArray *ba, TLLogFmtFrameType type,
+    const guint8 *payload, gsize len)
+{
+    gsize offset;
+    
+    offset = tl_logfmt_frame_begin(ba, g_tl_logfmt_head_magics[type]);
+    g_byte_array_append(ba, payload, len);
+    tl_logfmt_frame_end(ba, offset);
+}
+
+TLLogFmtScanner *tl_logfmt_scanner_new()
+{
+    TLLogFmtScanner *scanner;
+    
+    scanner = g_new0(TLLogFmtScanner, 1);
+    scanner->buffer = g_byte_array_new();
+    scanner->spare = g_byte_array_new();
+    
+    return scanner;
+}
+
+void tl_logfmt_scanner_free(TLLogFmtScanner *scanner)
+{
+    if(scanner==NULL)
+    {
+        return;
+    }
+    g_byte_array_unref(scanner->buffer);
+    g_byte_array_unref(scanner->spare);
+    g_free(scanner);
+}
+
+static gboolean tl_logfmt_head_magic_check(const guint8 *data)
+{
+    guint i;
+    
+    for(i=0;i<G_N_ELEMENTS(g_tl_logfmt_head_magics);i++)
+    {
+        if(memcmp(data, g_tl_logfmt_head_magics[i], 4)==0)
+        {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+/*
+ * Calls func with the whole frames in data. All head magics start with
+ * "TL", so memmem() skips the bytes between frames. A frame with a bad
+ * length, tail or CRC is skipped by its magic only, the frames it claims
+ * to cover are still found. The start of a frame cut by the end of data
+ * is kept in the scanner buffer, which must be empty.
+ */
+static gboolean tl_logfmt_scanner_scan(TLLogFmtScanner *scanner,
+    const guint8 *data, gsize len, TLLogFmtFrameFunc func,
+    gpointer user_data)
+{
+    const guint8 *end = data + len, *payload;
+    TLLogFmtFrameType type;
+    guint32 belen, frame_len;
+    gsize rest, payload_len, size;
+    gboolean ret = TRUE;
+    
+    while(ret && data<end)
+    {
+        data = memmem(data, end - data, TL_LOGFMT_MAGIC_PREFIX, 2);
+        if(data==NULL)
+        {
+            /* A last "T" may start the next frame. */
+            if(end[-1]==TL_LOGFMT_MAGIC_PREFIX[0])
+            {
+                g_byte_array_append(scanner->buffer, end - 1, 1);
+            }
+            break;
+        }
+        rest = end - data;
+        if(rest<TL_LOGFMT_FRAME_HEADER_SIZE)
+        {
+            g_byte_array_append(scanner->buffer, data, rest);
+            break;
+        }
+        if(!tl_logfmt_head_magic_check(data))
+        {
+            data += 2;
+            continue;
+        }
+        
+        memcpy(&belen, data + 4, 4);
+        frame_len = g_ntohl(belen);
+        if(frame_len>TL_LOGFMT_FRAME_SIZE_MAXIMUM)
+        {
+            data += 4;
+            continue;
+        }
+        if(rest<frame_len + TL_LOGFMT_FRAME_OVERHEAD)
+        {
+            g_byte_array_append(scanner->buffer, data, rest);
+            break;
+        }
+        
+        size = tl_logfmt_frame_check(data, rest, &type, &payload,
+            &payload_len);
+        if(size==0)
+        {
+            g_warning("TLLogFmt detected broken frame in log data!");
+            data += 4;
+            continue;
+        }
+        ret = func(type, payload, payload_len, user_data);
+        data += size;
+    }
+    
+    return ret;
+}
+
+/*
+ * Splits a byte stream into frames and calls func with the payload of each
+ * frame with a valid tail and CRC. Data may be fed in pieces of any size,
+ * larger pieces copy less. Returns FALSE if func asked to stop.
+ */
+gboolean tl_logfmt_scanner_feed(TLLogFmtScanner *scanner,
+    const guint8 *data, gsize len, TLLogFmtFrameFunc func,
+    gpointer user_data)
+{
+    GByteArray *pending;
+    guint32 belen;
+    gsize target, need;
+    gboolean ret = TRUE;
+    
+    while(len>0 && ret)
+    {
+        if(scanner->buffer->len==0)
+        {
+            return tl_logfmt_scanner_scan(scanner, data, len, func,
+                user_data);
+        }
+        
+        /*
+         * Complete the cut frame up to its header, then up to its length,
+         * and scan it again. Whatever it turns out to be, the bytes after
+         * its magic are scanned too.
+         */
+        target = TL_LOGFMT_FRAME_HEADER_SIZE;
+        if(scanner->buffer->len>=TL_LOGFMT_FRAME_HEADER_SIZE)
+        {
+            memcpy(&belen, scanner->buffer->data + 4, 4);
+            target = g_ntohl(belen) + TL_LOGFMT_FRAME_OVERHEAD;
+        }
+        need = MIN(target - scanner->buffer->len, len);
+        g_byte_array_append(scanner->buffer, data, need);
+        data += need;
+        len -= need;
+        if(scanner->buffer->len<target)
+        {
+            break;
+        }
+        
+        pending = scanner->buffer;
+        scanner->buffer = scanner->spare;
+        scanner->spare = pending;
+        ret = tl_logfmt_scanner_scan(scanner, pending->data, pending->len,
+            func, user_data);
+        g_byte_array_set_size(pending, 0);
+    }
+    
+    return ret;
+}
+
+/*
+ * Checks whether data starts with a whole frame with a valid tail and CRC.
+ * Returns the size of the frame and sets its type and payload, or returns
+ * 0.
+ */
+gsize tl_logfmt_frame_check(const guint8 *data, gsize len,
+    TLLogFmtFrameType *type, const guint8 **payload, gsize *payload_len)
+{
+    guint32 belen, frame_len;
+    guint16 becrc;
+    guint i;
+    
+    if(len<TL_LOGFMT_FRAME_OVERHEAD)
+    {
+        return 0;
+    }
+    for(i=0;i<G_N_ELEMENTS(g_tl_logfmt_head_magics);i++)
+    {
+        if(memcmp(data, g_tl_logfmt_head_magics[i], 4)==0)
+        {
+            break;
+        }
+    }
+    if(i==G_N_ELEMENTS(g_tl_logfmt_head_magics))
+    {
+        return 0;
+    }
+    
+    memcpy(&belen, data + 4, 4);
+    frame_len = g_ntohl(belen);
+    if(frame_len>TL_LOGFMT_FRAME_SIZE_MAXIMUM ||
+        frame_len + TL_LOGFMT_FRAME_OVERHEAD > len)
+    {
+        return 0;
+    }
+    memcpy(&becrc, data + 8, 2);
+    if(memcmp(data + TL_LOGFMT_FRAME_HEADER_SIZE + frame_len,
+        TL_LOGFMT_TAIL_MAGIC, 4)!=0 || g_ntohs(becrc)!=
+        tl_logfmt_crc16_compute(data + TL_LOGFMT_FRAME_HEADER_SIZE,
+        frame_len))
+    {
+        return 0;
+    }
+    
+    if(type!=NULL)
+    {
+        *type = i;
+    }
+    if(payload!=NULL)
+    {
+        *payload = data + TL_LOGFMT_FRAME_HEADER_SIZE;
+    }
+    if(payload_len!=NULL)
+    {
+        *payload_len = frame_len;
+    }
+    
+    return frame_len + TL_LOGFMT_FRAME_OVERHEAD;
+}
+
+TLLogFmtReader *tl_logfmt_reader_new()
+{
+    TLLogFmtReader *reader;
+    
+    reader = g_new0(TLLogFmtReader, 1);
+    reader->handles = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logfmt_handle_data_free);
+    reader->values = g_array_new(FALSE, TRUE, sizeof(TLLogFmtValueData));
+    g_array_set_clear_func(reader->values,
+        (GDestroyNotify)tl_logfmt_value_data_clear);
+    
+    return reader;
+}
+
+void tl_logfmt_reader_free(TLLogFmtReader *reader)
+{
+    if(reader==NULL)
+    {
+        return;
+    }
+    g_ptr_array_unref(reader->handles);
+    g_array_unref(reader->values);
+    g_free(reader);
+}
+
+void tl_logfmt_reader_reset(TLLogFmtReader *reader)
+{
+    g_ptr_array_set_size(reader->handles, 0);
+    g_array_set_size(reader->values, 0);
+    reader->keyframe_seen = FALSE;
+}
+
+gboolean tl_logfmt_record_time_peek(const guint8 *payload, gsize len,
+    gint64 *time)
+{
+    TLLogFmtCursor cursor = { payload, len, 1, FALSE };
+    gint64 value;
+    
+    if(len<2 || payload[0]!=TL_LOGFMT_VERSION)
+    {
+        return FALSE;
+    }
+    value = tl_logfmt_int_read(&cursor);
+    if(cursor.error)
+    {
+        return FALSE;
+    }
+    if(time!=NULL)
+    {
+        *time = value;
+    }
+    
+    return TRUE;
+}
+
+static gboolean tl_logfmt_reader_meta_decode(TLLogFmtReader *reader,
+    TLLogFmtCursor *cursor)
+{
+    TLLogFmtHandleData *handle;
+    const guint8 *data;
+    guint64 count, index, unit_bits;
+    guint i;
+    
+    count = tl_logfmt_uint_read(cursor);
+    for(i=0;i<count && !cursor->error;i++)
+    {
+        index = tl_logfmt_uint_read(cursor);
+        if(cursor->error || index>=TL_LOGFMT_HANDLE_MAXIMUM)
+        {
+            return FALSE;
+        }
+        
+        handle = g_new0(TLLogFmtHandleData, 1);
+        handle->name = tl_logfmt_string_read(cursor);
+        data = tl_logfmt_bytes_read(cursor, 8);
+        if(data!=NULL)
+        {
+            memcpy(&unit_bits, data, 8);
+            unit_bits = GUINT64_FROM_LE(unit_bits);
+            memcpy(&(handle->unit), &unit_bits, 8);
+        }
+        handle->offset = tl_logfmt_int_read(cursor);
+        data = tl_logfmt_bytes_read(cursor, 2);
+        if(data!=NULL)
+        {
+            handle->source = (gint8)data[0];
+            handle->flags = data[1];
+        }
+        if(handle->flags & TL_LOGFMT_HANDLE_LIST_PARENT)
+        {
+            handle->list_parent = tl_logfmt_string_read(cursor);
+        }
+        if(cursor->error || handle->name==NULL)
+        {
+            tl_logfmt_handle_data_free(handle);
+            return FALSE;
+        }
+        
+        if(index>=reader->handles->len)
+        {
+            g_ptr_array_set_size(reader->handles, index + 1);
+        }
+        tl_logfmt_handle_data_free(g_ptr_array_index(reader->handles,
+            index));
+        g_ptr_array_index(reader->handles, index) = handle;
+    }
+    
+    return !cursor->error;
+}
+
+/*
+ * Applies a keyframe or delta to the signal state of the reader. On error
+ * the state is unusable until the next keyframe.
+ */
+static gboolean tl_logfmt_reader_record_apply(TLLogFmtReader *reader,
+    TLLogFmtCursor *cursor, gboolean keyframe, gint64 *time)
+{
+    TLLogFmtValueData *value_data;
+    const TLLogFmtHandleData *handle;
+    const guint8 *bitmap;
+    gint64 value;
+    guint64 count, list_count, j;
+    gchar *key;
+    guint i;
+    
+    *time = tl_logfmt_int_read(cursor);
+    count = tl_logfmt_uint_read(cursor);
+    if(cursor->error || count>TL_LOGFMT_HANDLE_MAXIMUM)
+    {
+        return FALSE;
+    }
+    bitmap = tl_logfmt_bytes_read(cursor, (count + 7) / 8);
+    if(bitmap==NULL)
+    {
+        return FALSE;
+    }
+    
+    if(keyframe)
+    {
+        g_array_set_size(reader->values, 0);
+        reader->keyframe_seen = TRUE;
+    }
+    if(reader->values->len<count)
+    {
+        g_array_set_size(reader->values, count);
+    }
+    
+    for(i=0;i<count && !cursor->error;i++)
+    {
+        if(!(bitmap[i / 8] & (1 << (i % 8))))
+        {
+            continue;
+        }
+        handle = i<reader->handles->len ?
+            g_ptr_array_index(reader->handles, i) : NULL;
+        if(handle==NULL)
+        {
+            g_warning("TLLogFmt found undeclared handle %u in record!", i);
+            cursor->error = TRUE;
+            break;
+        }
+        
+        value_data = &g_array_index(reader->values, TLLogFmtValueData, i);
+        tl_logfmt_value_data_clear(value_data);
+        value_data->valid = TRUE;
+        value_data->value = tl_logfmt_int_read(cursor);
+        
+        if(handle->flags & TL_LOGFMT_HANDLE_LIST_PARENT)
+        {
+            value_data->list_table = g_hash_table_new_full(g_str_hash,
+                g_str_equal, g_free, g_free);
+            list_count = tl_logfmt_uint_read(cursor);
+            for(j=0;j<list_count && !cursor->error;j++)
+            {
+                key = tl_logfmt_string_read(cursor);
+                value = tl_logfmt_int_read(cursor);
+                if(key!=NULL)
+                {
+                    g_hash_table_replace(value_data->list_table, key,
+                        g_memdup(&value, sizeof(gint64)));
+                }
+            }
+        }
+        if(handle->flags & TL_LOGFMT_HANDLE_LIST_INDEX)
+        {
+            value_data->index_table = g_hash_table_new_full(g_str_hash,
+                g_str_equal, g_free, NULL);
+            list_count = tl_logfmt_uint_read(cursor);
+            for(j=0;j<list_count && !cursor->error;j++)
+            {
+                key = tl_logfmt_string_read(cursor);
+                if(key!=NULL)
+                {
+                    g_hash_table_add(value_data->index_table, key);
+                }
+            }
+        }
+    }
+    
+    if(cursor->error)
+    {
+        reader->keyframe_seen = FALSE;
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* Builds a log table from the signal state, list tables are shared. */
+static GHashTable *tl_logfmt_reader_table_build(TLLogFmtReader *reader,
+    gint64 time)
+{
+    GHashTable *table;
+    TLLoggerLogItemData *item_data;
+    const TLLogFmtHandleData *handle;
+    const TLLogFmtValueData *value_data;
+    guint i;
+    
+    table = tl_logfmt_log_table_new(time);
+    
+    for(i=0;i<reader->values->len && i<reader->handles->len;i++)
+    {
+        value_data = &g_array_index(reader->values, TLLogFmtValueData, i);
+        handle = g_ptr_array_index(reader->handles, i);
+        if(!value_data->valid || handle==NULL)
+        {
+            continue;
+        }
+        
+        item_data = g_new0(TLLoggerLogItemData, 1);
+        item_data->name = g_strdup(handle->name);
+        item_data->unit = handle->unit;
+        item_data->offset = handle->offset;
+        item_data->source = handle->source;
+        item_data->value = value_data->value;
+        if((handle->flags & TL_LOGFMT_HANDLE_LIST_PARENT) &&
+            value_data->list_table!=NULL)
+        {
+            item_data->list_parent = g_strdup(handle->list_parent);
+            item_data->list_table = g_hash_table_ref(value_data->list_table);
+        }
+        if((handle->flags & TL_LOGFMT_HANDLE_LIST_INDEX) &&
+            value_data->index_table!=NULL)
+        {
+            item_data->list_index = TRUE;
+            item_data->index_table = g_hash_table_ref(
+                value_data->index_table);
+        }
+        
+        g_hash_table_replace(table, item_data->name, item_data);
+    }
+    
+    return table;
+}
+
+static GHashTable *tl_logfmt_json_decode(const gchar *json_data,
+    gsize json_len)
+{
+    struct json_tokener *tokener;
+    struct json_object *root = NULL, *node, *child, *array, *dict;
+    struct json_object_iter json_iter;
+    GHashTable *log_table, *index_table, *value_table;
+    TLLoggerLogItemData *log_item_data;
+    const gchar *name, *listparent, *svalue;
+    guint array_len, array2_len, i, j;
+    gboolean list_index;
+    gint64 i64value;
+    guint ivalue;
+    
+    tokener = json_tokener_new();
+    root = json_tokener_parse_ex(tokener, json_data, json_len);
+    json_tokener_free(tokener);
+    
+    if(root==NULL)
+    {
+        g_warning("TLLogFmt failed to parse JSON data!");
+        return NULL;
+    }
+    
+    array_len = json_object_array_length(root);
+    log_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+        (GDestroyNotify)tl_logfmt_item_data_free);
+    
+    for(i=0;i<array_len;i++)
+    {
+        node = json_object_array_get_idx(root, i);
+        if(node==NULL)
+        {
+            continue;
+        }
+        
+        if(!json_object_object_get_ex(node, "name", &child) ||
+            (name=json_object_get_string(child))==NULL)
+        {
+            continue;
+        }
+        
+        log_item_data = g_new0(TLLoggerLogItemData, 1);
+        log_item_data->name = g_strdup(name);
+        log_item_data->unit = 1.0;
+        
+        if(json_object_object_get_ex(node, "value", &child))
+        {
+            log_item_data->value = json_object_get_int64(child);
+        }
+        if(json_object_object_get_ex(node, "unit", &child))
+        {
+            log_item_data->unit = json_object_get_double(child);
+        }
+        if(json_object_object_get_ex(node, "offset", &child))
+        {
+            log_item_data->offset = json_object_get_int(child);
+        }
+        if(json_object_object_get_ex(node, "source", &child))
+        {
+            log_item_data->source = json_object_get_int(child);
+        }
+        
+        list_index = FALSE;
+        if(json_object_object_get_ex(node, "listindex", &child))
+        {
+            list_index = (json_object_get_int(child)!=0);
+        }
+        if(list_index && json_object_object_get_ex(node, "index", &array))
+        {
+            array2_len = json_object_array_length(array);
+            index_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, NULL);
+            for(j=0;j<array2_len;j++)
+            {
+                child = json_object_array_get_idx(array, j);
+                if(child==NULL)
+                {
+                    continue;
+                }
+                svalue = json_object_get_string(child);
+                if(svalue!=NULL)
+                {
+                    g_hash_table_add(index_table, g_strdup(svalue));
+                }
+            }
+            log_item_data->list_index = TRUE;
+            log_item_data->index_table = index_table;
+        }
+        
+        listparent = NULL;
+        if(!log_item_data->list_index &&
+            json_object_object_get_ex(node, "listparent", &child))
+        {
+            listparent = json_object_get_string(child);
+        }
+        if(listparent!=NULL &&
+            json_object_object_get_ex(node, "valuetable", &dict))
+        {
+            value_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, g_free);
+            json_object_object_foreachC(dict, json_iter)
+            {
+                if(json_iter.key!=NULL && json_iter.val!=NULL &&
+                    sscanf(json_iter.key, "%u", &ivalue)>0)
+                {
+                    i64value = json_object_get_int64(json_iter.val);
+                    g_hash_table_replace(value_table,
+                        g_strdup(json_iter.key),
+                        g_memdup(&i64value, sizeof(gint64)));
+                }
+            }
+            log_item_data->list_parent = g_strdup(listparent);
+            log_item_data->list_table = value_table;
+        }
+        
+        g_hash_table_replace(log_table, log_item_data->name, log_item_data);
+    }
+    
+    json_object_put(root);
+    
+    if(!g_hash_table_contains(log_table, "time"))
+    {
+        g_hash_table_unref(log_table);
+        return NULL;
+    }
+    
+    return log_table;
+}
+
+static gboolean tl_logfmt_reader_frame_update(TLLogFmtReader *reader,
+    TLLogFmtFrameType type, const guint8 *payload, gsize len, gint64 *time)
+{
+    TLLogFmtCursor cursor = { payload, len, 1, FALSE };
+    gboolean keyframe = (type==TL_LOGFMT_FRAME_RECORD);
+    
+    if(len<1 || payload[0]!=TL_LOGFMT_VERSION)
+    {
+        g_warning("TLLogFmt unsupported binary frame version!");
+        return FALSE;
+    }
+    
+    switch(type)
+    {
+        case TL_LOGFMT_FRAME_META:
+        {
+            if(!tl_logfmt_reader_meta_decode(reader, &cursor))
+            {
+                g_warning("TLLogFmt failed to decode metadata frame!");
+            }
+            return FALSE;
+        }
+        case TL_LOGFMT_FRAME_RECORD:
+        case TL_LOGFMT_FRAME_DELTA:
+        {
+            /* Deltas before the first keyframe cannot be rebuilt. */
+            if(!keyframe && !reader->keyframe_seen)
+            {
+                return FALSE;
+            }
+            if(!tl_logfmt_reader_record_apply(reader, &cursor, keyframe,
+                time))
+            {
+                g_warning("TLLogFmt failed to decode record frame!");
+                return FALSE;
+            }
+            return TRUE;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    
+    return FALSE;
+}
+
+/*
+ * Decodes one frame payload. Metadata frames update the reader and return
+ * NULL, records return a log table keyed by signal name, with the record
+ * time in the "time" item. Deltas return the full state rebuilt from the
+ * last keyframe, or NULL if the reader has not seen one.
+ */
+GHashTable *tl_logfmt_reader_frame_decode(TLLogFmtReader *reader,
+    TLLogFmtFrameType type, const guint8 *payload, gsize len)
+{
+    gint64 time;
+    
+    if(type==TL_LOGFMT_FRAME_JSON)
+    {
+        return tl_logfmt_json_decode((const gchar *)payload, len);
+    }
+    if(!tl_logfmt_reader_frame_update(reader, type, payload, len, &time))
+    {
+        return NULL;
+    }
+    
+    return tl_logfmt_reader_table_build(reader, time);
+}
+
+/*
+ * Gets the time of a JSON, keyframe or delta record. Binary records are
+ * only peeked, JSON records have to be parsed.
+ */
+gboolean tl_logfmt_frame_time_get(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gint64 *time)
+{
+    GHashTable *log_table;
+    TLLoggerLogItemData *time_data;
+    gboolean ret = FALSE;
+    
+    switch(type)
+    {
+        case TL_LOGFMT_FRAME_JSON:
+        {
+            log_table = tl_logfmt_json_decode((const gchar *)payload, len);
+            if(log_table==NULL)
+            {
+                break;
+            }
+            time_data = g_hash_table_lookup(log_table, "time");
+            if(time_data!=NULL)
+            {
+                if(time!=NULL)
+                {
+                    *time = time_data->value;
+                }
+                ret = TRUE;
+            }
+            g_hash_table_unref(log_table);
+            break;
+        }
+        case TL_LOGFMT_FRAME_RECORD:
+        case TL_LOGFMT_FRAME_DELTA:
+        {
+            ret = tl_logfmt_record_time_peek(payload, len, time);
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    
+    return ret;
+}
+
+/*
+ * Updates the reader with a frame without building its log table, used to
+ * replay records before the queried range.
+ */
+void tl_logfmt_reader_frame_apply(TLLogFmtReader *reader,
+    TLLogFmtFrameType type, const guint8 *payload, gsize len)
+{
+    gint64 time;
+    
+    if(type!=TL_LOGFMT_FRAME_JSON)
+    {
+        tl_logfmt_reader_frame_update(reader, type, payload, len, &time);
+    }
+}
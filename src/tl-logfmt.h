@@ -0,0 +1,90 @@
+#ifndef HAVE_TL_LOGFMT_H
+#define HAVE_TL_LOGFMT_H
+
+#include <glib.h>
+#include "tl-logger.h"
+
+/*
+ * Log file frames:
+ * | Head Magic (4B) | Length (4B BE) | CRC16 (2B BE) | Payload | "TLIT" |
+ *
+ * "TLIH" frames carry a JSON record (the original format). Binary segments
+ * use "TLBM" frames, which declare signal handles, "TLBR" keyframes with
+ * every signal and "TLBD" deltas with the signals changed since the
+ * previous record:
+ *
+ * TLBM: | version (1B) | count | count x handle entry |
+ *   handle entry: | handle | name | unit (8B double LE) | offset (zigzag) |
+ *     source (1B) | flags (1B) | [list parent name] |
+ * TLBR/TLBD: | version (1B) | time (zigzag) | handle count | bitmap |
+ *     for each handle set: | value (zigzag) | [list values] | [indices] |
+ *   list values: | count | count x (key, value (zigzag)) |
+ *   indices: | count | count x key |
+ *
+ * Integers are LEB128 varints, strings are a varint length and the bytes.
+ * A handle must be declared in the same segment before a record uses it,
+ * and may be declared again when its metadata changes. A segment starts
+ * with a keyframe, and a delta never clears a signal, the writer emits a
+ * keyframe instead.
+ */
+
+#define TL_LOGFMT_VERSION 1
+
+typedef enum
+{
+    TL_LOGFMT_FRAME_JSON,
+    TL_LOGFMT_FRAME_META,
+    TL_LOGFMT_FRAME_RECORD,
+    TL_LOGFMT_FRAME_DELTA
+}TLLogFmtFrameType;
+
+typedef enum
+{
+    TL_LOGFMT_RECORD_METADATA = 1 << 0,
+    TL_LOGFMT_RECORD_KEYFRAME = 1 << 1
+}TLLogFmtRecordFlags;
+
+typedef struct _TLLogFmtWriter TLLogFmtWriter;
+typedef struct _TLLogFmtReader TLLogFmtReader;
+typedef struct _TLLogFmtScanner TLLogFmtScanner;
+
+typedef gboolean (*TLLogFmtFrameFunc)(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data);
+
+guint16 tl_logfmt_crc16_compute(const guint8 *data, gsize len);
+
+TLLogFmtWriter *tl_logfmt_writer_new();
+void tl_logfmt_writer_free(TLLogFmtWriter *writer);
+void tl_logfmt_writer_reset(TLLogFmtWriter *writer);
+void tl_logfmt_writer_keyframe_interval_set(TLLogFmtWriter *writer,
+    guint interval);
+void tl_logfmt_writer_keyframe_request(TLLogFmtWriter *writer);
+guint tl_logfmt_writer_record_append(TLLogFmtWriter *writer,
+    GByteArray *ba, gint64 time, const TLLoggerLogItemData * const *items,
+    guint count);
+void tl_logfmt_json_frame_append(GByteArray *ba, gint64 time,
+    const TLLoggerLogItemData * const *items, guint count);
+void tl_logfmt_frame_append(GByteArray *ba, TLLogFmtFrameType type,
+    const guint8 *payload, gsize len);
+
+TLLogFmtScanner *tl_logfmt_scanner_new();
+void tl_logfmt_scanner_free(TLLogFmtScanner *scanner);
+gboolean tl_logfmt_scanner_feed(TLLogFmtScanner *scanner,
+    const guint8 *data, gsize len, TLLogFmtFrameFunc func,
+    gpointer user_data);
+gsize tl_logfmt_frame_check(const guint8 *data, gsize len,
+    TLLogFmtFrameType *type, const guint8 **payload, gsize *payload_len);
+
+TLLogFmtReader *tl_logfmt_reader_new();
+void tl_logfmt_reader_free(TLLogFmtReader *reader);
+void tl_logfmt_reader_reset(TLLogFmtReader *reader);
+gboolean tl_logfmt_record_time_peek(const guint8 *payload, gsize len,
+    gint64 *time);
+gboolean tl_logfmt_frame_time_get(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gint64 *time);
+GHashTable *tl_logfmt_reader_frame_decode(TLLogFmtReader *reader,
+    TLLogFmtFrameType type, const guint8 *payload, gsize len);
+void tl_logfmt_reader_frame_apply(TLLogFmtReader *reader,
+    TLLogFmtFrameType type, const guint8 *payload, gsize len);
+
+#endif
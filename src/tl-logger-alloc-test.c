@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "tl-logger.h"
+#include "tl-parser.h"
+
+#define TL_LOGGER_ALLOC_TEST_WARMUP_PASSES 2
+#define TL_LOGGER_ALLOC_TEST_PASSES 3
+
+/*
+ * Replays the frames of cantest.sh through the parser definition of
+ * tboxparse.xml and checks that tl_logger_current_data_update() does not
+ * allocate once every signal and list key has been seen.
+ *
+ * Allocations are counted by interposing the glibc allocator, including
+ * its aligned entry points, only while the update of the replaying thread
+ * runs. The program is linked with --wrap=tl_logger_current_data_update so
+ * that the calls from the parser go through
+ * __wrap_tl_logger_current_data_update() below.
+ */
+
+typedef struct _TLLoggerAllocTestFrame
+{
+    int can_id;
+    guint8 data[8];
+    gsize len;
+}TLLoggerAllocTestFrame;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void __real_tl_logger_current_data_update(
+    const TLLoggerLogItemData *item_data);
+
+static __thread gboolean g_tl_logger_alloc_test_counting = FALSE;
+static guint64 g_tl_logger_alloc_test_allocations = 0;
+static guint64 g_tl_logger_alloc_test_updates = 0;
+static guint64 g_tl_logger_alloc_test_failed_updates = 0;
+
+void *malloc(size_t size)
+{
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+    
+    if(g_tl_logger_alloc_test_counting)
+    {
+        g_tl_logger_alloc_test_allocations++;
+    }
+    if(alignment==0 || alignment % sizeof(void *)!=0 ||
+        (alignment & (alignment - 1))!=0)
+    {
+        return EINVAL;
+    }
+    ptr = __libc_memalign(alignment, size);
+    if(ptr==NULL)
+    {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    
+    return 0;
+}
+
+void __wrap_tl_logger_current_data_update(
+    const TLLoggerLogItemData *item_data)
+{
+    guint64 allocations;
+    
+    allocations = g_tl_logger_alloc_test_allocations;
+    g_tl_logger_alloc_test_counting = TRUE;
+    __real_tl_logger_current_data_update(item_data);
+    g_tl_logger_alloc_test_counting = FALSE;
+    
+    g_tl_logger_alloc_test_updates++;
+    if(g_tl_logger_alloc_test_allocations!=allocations)
+    {
+        g_tl_logger_alloc_test_failed_updates++;
+    }
+}
+
+/* Reads the "cansend <device> <id>#<b0>.<b1>..." lines of a script. */
+static GArray *tl_logger_alloc_test_frames_load(const gchar *file)
+{
+    FILE *fp;
+    gchar line[256];
+    gchar *frame_str, *data_str, *endptr;
+    TLLoggerAllocTestFrame frame;
+    GArray *frames;
+    
+    fp = fopen(file, "r");
+    if(fp==NULL)
+    {
+        fprintf(stderr, "Cannot open replay file %s!\n", file);
+        return NULL;
+    }
+    
+    frames = g_array_new(FALSE, FALSE, sizeof(TLLoggerAllocTestFrame));
+    while(fgets(line, sizeof(line), fp)!=NULL)
+    {
+        if(!g_str_has_prefix(line, "cansend "))
+        {
+            continue;
+        }
+        frame_str = strrchr(g_strstrip(line), ' ');
+        if(frame_str==NULL)
+        {
+            continue;
+        }
+        frame_str++;
+        
+        memset(&frame, 0, sizeof(TLLoggerAllocTestFrame));
+        frame.can_id = strtol(frame_str, &endptr, 16);
+        if(*endptr!='#')
+        {
+            continue;
+        }
+        data_str = endptr + 1;
+        while(*data_str!='\0' && frame.len<8)
+        {
+            frame.data[frame.len] = strtoul(data_str, &endptr, 16);
+            if(endptr==data_str)
+            {
+                break;
+            }
+            frame.len++;
+            data_str = endptr;
+            if(*data_str=='.')
+            {
+                data_str++;
+            }
+        }
+        g_array_append_val(frames, frame);
+    }
+    fclose(fp);
+    
+    return frames;
+}
+
+static void tl_logger_alloc_test_replay(GArray *frames)
+{
+    guint i;
+    TLLoggerAllocTestFrame *frame;
+    
+    for(i=0;i<frames->len;i++)
+    {
+        frame = &g_array_index(frames, TLLoggerAllocTestFrame, i);
+        tl_parser_parse_can_data("can0", frame->can_id, frame->data,
+            frame->len);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const gchar *srcdir;
+    gchar *parse_file, *replay_file, *storage_path;
+    const gchar *filename;
+    gchar *fullpath;
+    GArray *frames;
+    GDir *dir;
+    guint i;
+    int ret = 0;
+    
+    srcdir = g_getenv("TL_TEST_SRCDIR");
+    if(srcdir==NULL)
+    {
+        srcdir = "..";
+    }
+    parse_file = g_build_filename(srcdir, "tboxparse.xml", NULL);
+    replay_file = g_build_filename(srcdir, "cantest.sh", NULL);
+    
+    frames = tl_logger_alloc_test_frames_load(replay_file);
+    if(frames==NULL || frames->len==0)
+    {
+        fprintf(stderr, "No frames to replay in %s!\n", replay_file);
+        return 99;
+    }
+    
+    storage_path = g_dir_make_tmp("tl-logger-alloc-test-XXXXXX", NULL);
+    if(storage_path==NULL)
+    {
+        fprintf(stderr, "Cannot create storage directory!\n");
+        return 99;
+    }
+    
+    tl_parser_init();
+    if(!tl_parser_load_parse_file(parse_file))
+    {
+        fprintf(stderr, "Cannot load parser file %s!\n", parse_file);
+        return 99;
+    }
+    if(!tl_logger_init(storage_path, NULL))
+    {
+        fprintf(stderr, "Cannot initialize logger!\n");
+        return 99;
+    }
+    
+    for(i=0;i<TL_LOGGER_ALLOC_TEST_WARMUP_PASSES;i++)
+    {
+        tl_logger_alloc_test_replay(frames);
+    }
+    
+    g_tl_logger_alloc_test_allocations = 0;
+    g_tl_logger_alloc_test_updates = 0;
+    g_tl_logger_alloc_test_failed_updates = 0;
+    for(i=0;i<TL_LOGGER_ALLOC_TEST_PASSES;i++)
+    {
+        tl_logger_alloc_test_replay(frames);
+    }
+    
+    printf("Replayed %u frames %u times, %"G_GUINT64_FORMAT" updates, "
+        "%"G_GUINT64_FORMAT" allocations, %"G_GUINT64_FORMAT
+        " updates allocated.\n", frames->len, TL_LOGGER_ALLOC_TEST_PASSES,
+        g_tl_logger_alloc_test_updates, g_tl_logger_alloc_test_allocations,
+        g_tl_logger_alloc_test_failed_updates);
+    
+    if(g_tl_logger_alloc_test_updates==0)
+    {
+        fprintf(stderr, "The replay did not update any signal!\n");
+        ret = 1;
+    }
+    else if(g_tl_logger_alloc_test_failed_updates>0)
+    {
+        fprintf(stderr, "Steady-state updates allocated memory!\n");
+        ret = 1;
+    }
+    
+    tl_logger_uninit();
+    tl_parser_uninit();
+    g_array_unref(frames);
+    
+    dir = g_dir_open(storage_path, 0, NULL);
+    if(dir!=NULL)
+    {
+        while((filename=g_dir_read_name(dir))!=NULL)
+        {
+            fullpath = g_build_filename(storage_path, filename, NULL);
+            g_remove(fullpath);
+            g_free(fullpath);
+        }
+        g_dir_close(dir);
+    }
+    g_rmdir(storage_path);
+    g_free(storage_path);
+    g_free(replay_file);
+    g_free(parse_file);
+    
+    return ret;
+}
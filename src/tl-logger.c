@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <json.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -10,18 +9,46 @@
 #include <errno.h>
 #include <sys/statvfs.h>
 #include "tl-logger.h"
+#include "tl-history.h"
+#include "tl-shm.h"
+#include "tl-membudget.h"
+#include "tl-logfmt.h"
+#include "tl-logseg.h"
+#include "tl-codec.h"
+#include "tl-logarc.h"
+#include "tl-catalog.h"
+#include "tl-logtier.h"
+#include "tl-bgwork.h"
 
 #define TL_LOGGER_STORAGE_BASE_PATH_DEFAULT "/var/lib/tbox/log"
+#define TL_LOGGER_CATALOG_FILENAME "segments.tlc"
 
-#define TL_LOGGER_LOG_ITEM_HEAD_MAGIC ((const guint8 *)"TLIH")
-#define TL_LOGGER_LOG_ITEM_TAIL_MAGIC ((const guint8 *)"TLIT")
 #define TL_LOGGER_LOG_SIZE_MAXIUM 8 * 1024 * 1024
+#define TL_LOGGER_LOG_ARCHIVE_BLOCK_SIZE 64 * 1024
+#define TL_LOGGER_QUERY_READ_SIZE 64 * 1024
+#define TL_LOGGER_LOG_INDEX_INTERVAL 16
+#define TL_LOGGER_LOG_KEYFRAME_INTERVAL_DEFAULT 30
+#define TL_LOGGER_LOG_COMMIT_SIZE_DEFAULT 256 * 1024
+#define TL_LOGGER_LOG_COMMIT_INTERVAL_DEFAULT 60
 
-#define TL_LOGGER_LOG_PARSE_MAXIUM_SIZE 8 * 1024 * 1024
+#define TL_LOGGER_ARCHIVE_SCAN_INTERVAL 60
 
 #define TL_LOGGER_LOG_FREE_SPACE_MINIUM 200UL * 1024 * 1024
 #define TL_LOGGER_LOG_FREE_NODE_MINIUM 2048
 
+#define TL_LOGGER_LIST_KEY_MAXIMUM 64
+#define TL_LOGGER_LIST_DEPTH_MAXIMUM 8
+#define TL_LOGGER_ITEM_SLAB_BLOCK_SIZE 64
+#define TL_LOGGER_VALUE_SLAB_BLOCK_SIZE 512
+#define TL_LOGGER_SNAPSHOT_PAGE_SIZE 64
+#define TL_LOGGER_HASH_ENTRY_OVERHEAD 64
+#define TL_LOGGER_TRIGGER_INTERVAL_DEFAULT 100
+#define TL_LOGGER_TRIGGER_PRE_MAXIMUM 60
+#define TL_LOGGER_TRIGGER_ITEM_NAME "log.trigger"
+#define TL_LOGGER_TRIGGER_MSEC_ITEM_NAME "log.msec"
+#define TL_LOGGER_LOG_GROUP_MAXIMUM 31
+#define TL_LOGGER_LOG_GROUP_INTERVAL_MINIMUM 100
+
 typedef struct _TLLoggerQueryData
 {
     gboolean begin_time_set;
@@ -32,70 +59,225 @@ typedef struct _TLLoggerQueryData
     gpointer query_result_user_data;
 }TLLoggerQueryData;
 
+typedef struct _TLLoggerDownsampleTier
+{
+    gint64 age;
+    guint interval;
+}TLLoggerDownsampleTier;
+
+typedef struct _TLLoggerSlabData
+{
+    gsize element_size;
+    guint block_elements;
+    GSList *blocks;
+    guint block_used;
+}TLLoggerSlabData;
+
+typedef struct _TLLoggerLogGroup
+{
+    gchar *name;
+    gchar **patterns;
+    guint interval;
+    gint64 next_due;
+    gint64 last_timestamp;
+}TLLoggerLogGroup;
+
+typedef struct _TLLoggerTriggerData
+{
+    gchar *name;
+    guint id;
+    guint pre;
+    guint post;
+    gboolean active;
+}TLLoggerTriggerData;
+
+typedef struct _TLLoggerCurrentItemData
+{
+    TLLoggerLogItemData data;
+    guint slot;
+    gboolean dirty;
+    gint history_series;
+    gint shm_slot;
+    TLLoggerTriggerData *trigger;
+    guint group;
+}TLLoggerCurrentItemData;
+
+typedef struct _TLLoggerCurrentValueData
+{
+    gint64 value;
+    gint history_series;
+    gint shm_slot;
+}TLLoggerCurrentValueData;
+
+typedef struct _TLLoggerSnapshotItem
+{
+    gint ref_count;
+    guint group;
+    TLLoggerLogItemData data;
+}TLLoggerSnapshotItem;
+
+typedef struct _TLLoggerSnapshotPage
+{
+    gint ref_count;
+    TLLoggerSnapshotItem *items[TL_LOGGER_SNAPSHOT_PAGE_SIZE];
+}TLLoggerSnapshotPage;
+
+typedef struct _TLLoggerSnapshotDirectory
+{
+    gint ref_count;
+    guint size;
+    GHashTable *name_table;
+}TLLoggerSnapshotDirectory;
+
+/*
+ * A snapshot is immutable once published. Unchanged pages, items and the
+ * name directory are shared with the previous snapshot by reference count,
+ * so building a snapshot only copies the signals marked dirty since then.
+ * The log fields are only used by the main loop until the snapshot is
+ * queued for writing: groups is the bit mask of the log groups sampled by
+ * its record, logged marks a regular record waiting in the trigger ring,
+ * trigger the window it is written in.
+ */
+struct _TLLoggerSnapshot
+{
+    gint ref_count;
+    guint64 version;
+    gint64 time;
+    gint64 real_time;
+    guint32 groups;
+    gboolean logged;
+    guint trigger;
+    gboolean trigger_start;
+    guint size;
+    guint page_count;
+    gsize bytes;
+    TLLoggerSnapshotDirectory *directory;
+    TLLoggerSnapshotPage *pages[];
+};
+
 typedef struct _TLLoggerData
 {
     gboolean initialized;
     gchar *storage_base_path;
+    gchar *hot_path;
+    TLCatalog *catalog;
     gint64 last_timestamp;
     gint64 new_timestamp;
     
     GMutex cached_log_mutex;
     GQueue *cached_log_data;
     GQueue *write_log_queue;
-    GList *last_saved_data;
+    gsize cached_log_bytes;
+    guint dropped_log_count;
     GHashTable *last_log_data;
+    GStringChunk *current_string_chunk;
+    TLLoggerSlabData current_item_slab;
+    TLLoggerSlabData current_value_slab;
+    GPtrArray *current_slots;
+    GArray *dirty_slots;
     guint log_update_timeout_id;
     
+    GPtrArray *log_groups;
+    guint log_group_timeout_id;
+    guint log_group_tick;
+    gint64 log_group_default_due;
+    gint64 log_group_default_timestamp;
+    
+    GPtrArray *triggers;
+    GQueue *trigger_ring;
+    guint trigger_interval;
+    guint trigger_pre;
+    guint trigger_timeout_id;
+    guint trigger_window;
+    gboolean trigger_window_start;
+    gint64 trigger_window_end;
+    guint trigger_window_count;
+    
+    TLLoggerSnapshot *current_snapshot;
+    guint64 snapshot_version;
+    gint snapshot_readers;
+    GSList *retired_snapshots;
+    
     GThread *write_thread;
     gboolean write_thread_work_flag;
+    GCond write_cond;
     
     GThread *archive_thread;
     gboolean archive_thread_work_flag;
-    gint archive_thread_wait_countdown;
+    gboolean archive_request;
+    GMutex archive_mutex;
+    GCond archive_cond;
+    GArray *downsample_tiers;
     
     GThread *query_thread;
     gboolean query_thread_work_flag;
     GQueue *query_queue;
     TLLoggerQueryData *query_working_data;
     GMutex query_queue_mutex;
+    GCond query_cond;
     gboolean query_work_flag;
     
     guint log_update_timeout;
+    guint log_keyframe_interval;
+    guint log_commit_size;
+    guint log_commit_interval;
+    gint log_flush_request;
+    gint log_migrate_request;
+    gboolean log_inline_compress;
+    gint log_codec;
+    gint log_codec_level;
+    
+    gint app_bytes_slot;
+    gint file_bytes_slot;
+    gint device_bytes_slot;
+    gboolean device_bytes_valid;
+    guint64 device_bytes_base;
 }TLLoggerData;
 
-typedef struct _TLLoggerFileStat
+/*
+ * A record of the current log file kept for queries. It holds the frames
+ * as written to disk, deflated into a single allocation, and is only
+ * inflated and parsed when a query needs it. flags are the
+ * TLLogFmtRecordFlags of the frames: queries replay from the nearest
+ * keyframe and always need the records with metadata.
+ */
+typedef struct _TLLoggerCachedRecord
 {
-    gchar *name;
-    guint64 size;
-}TLLoggerFileStat;
+    gint ref_count;
+    gint64 time;
+    guint len;
+    guint size;
+    gboolean compressed;
+    guint flags;
+    guint8 data[];
+}TLLoggerCachedRecord;
 
-typedef gboolean (*TLLoggerLogQueryCallback)(TLLoggerData *logger_data,
-    GByteArray *ba, TLLoggerQueryData *query_data);
+typedef struct _TLLoggerLogQueryScanData
+{
+    TLLoggerData *logger_data;
+    TLLoggerQueryData *query_data;
+    TLLogFmtReader *reader;
+}TLLoggerLogQueryScanData;
 
 static TLLoggerData g_tl_logger_data = {0};
 
-static TLLoggerLogItemData *tl_logger_log_item_data_dup(
-    TLLoggerLogItemData *data)
+static void tl_logger_log_item_data_copy(TLLoggerLogItemData *new_data,
+    const TLLoggerLogItemData *data)
 {
-    TLLoggerLogItemData *new_data;
     GHashTableIter iter;
     gchar *key;
     gint64 *value;
     
-    if(data==NULL)
-    {
-        return NULL;
-    }
-    
-    new_data = g_new0(TLLoggerLogItemData, 1);
     new_data->name = g_strdup(data->name);
     new_data->value = data->value;
+    new_data->offset = data->offset;
     new_data->unit = data->unit;
+    new_data->list_item = data->list_item;
     new_data->source = data->source;
     new_data->list_parent = g_strdup(data->list_parent);
     new_data->list_index = data->list_index;
     
-    if(data->list_table!=NULL && data->list_item>0)
+    if(data->list_table!=NULL)
     {
         new_data->list_table = g_hash_table_new_full(g_str_hash,
             g_str_equal, g_free, g_free);
@@ -120,36 +302,66 @@ static TLLoggerLogItemData *tl_logger_log_item_data_dup(
             g_hash_table_add(new_data->index_table, g_strdup(key));
         }
     }
+}
+
+static void tl_logger_slab_init(TLLoggerSlabData *slab, gsize element_size,
+    guint block_elements)
+{
+    slab->element_size = element_size;
+    slab->block_elements = block_elements;
+    slab->blocks = NULL;
+    slab->block_used = block_elements;
+}
+
+static gpointer tl_logger_slab_alloc(TLLoggerSlabData *slab)
+{
+    gpointer element;
+    
+    if(slab->block_used>=slab->block_elements)
+    {
+        slab->blocks = g_slist_prepend(slab->blocks,
+            g_malloc0(slab->element_size * slab->block_elements));
+        slab->block_used = 0;
+    }
+    
+    element = (guint8 *)slab->blocks->data + slab->element_size *
+        slab->block_used;
+    slab->block_used++;
     
-    return new_data;
+    return element;
 }
 
-static void tl_logger_log_item_data_free(TLLoggerLogItemData *data)
+static void tl_logger_slab_clear(TLLoggerSlabData *slab)
+{
+    g_slist_free_full(slab->blocks, g_free);
+    slab->blocks = NULL;
+    slab->block_used = slab->block_elements;
+}
+
+/*
+ * Items in the current data table live in the item slab, their names and
+ * list keys in the string chunk and list values in the value slab, so only
+ * the hash tables need to be released here.
+ */
+static void tl_logger_current_item_data_clear(TLLoggerLogItemData *data)
 {
     if(data==NULL)
     {
         return;
     }
-    if(data->name!=NULL)
-    {
-        g_free(data->name);
-    }
-    if(data->list_parent!=NULL)
-    {
-        g_free(data->list_parent);
-    }
     if(data->list_table!=NULL)
     {
         g_hash_table_unref(data->list_table);
+        data->list_table = NULL;
     }
     if(data->index_table!=NULL)
     {
         g_hash_table_unref(data->index_table);
+        data->index_table = NULL;
     }
-    g_free(data);
 }
 
-static void tl_logger_file_stat_free(TLLoggerFileStat *data)
+static void tl_logger_trigger_data_free(TLLoggerTriggerData *data)
 {
     if(data==NULL)
     {
@@ -162,450 +374,544 @@ static void tl_logger_file_stat_free(TLLoggerFileStat *data)
     g_free(data);
 }
 
-static int tl_logger_file_stat_compare(const TLLoggerFileStat *a,
-    const TLLoggerFileStat *b, gpointer user_data)
+static void tl_logger_log_group_free(TLLoggerLogGroup *group)
 {
-    if(a==NULL && b==NULL)
+    if(group==NULL)
     {
-        return 0;
+        return;
     }
-    else if(a==NULL)
+    if(group->name!=NULL)
     {
-        return -1;
+        g_free(group->name);
     }
-    else if(b==NULL)
+    if(group->patterns!=NULL)
     {
-        return 1;
+        g_strfreev(group->patterns);
     }
-    return g_strcmp0(a->name, b->name);
+    g_free(group);
 }
 
-
-static inline guint16 tl_logger_crc16_compute(const guchar *data_p,
-    gsize length)
+/* Returns the log group of a signal, 0 for the default group. */
+static guint tl_logger_log_group_lookup(TLLoggerData *logger_data,
+    const gchar *name)
 {
-    guchar x;
-    guint16 crc = 0xFFFF;
-    while(length--)
+    TLLoggerLogGroup *group;
+    guint i, j;
+    
+    for(i=0;i<logger_data->log_groups->len;i++)
     {
-        x = crc >> 8 ^ *data_p++;
-        x ^= x>>4;
-        crc = (crc << 8) ^ ((guint16)(x << 12)) ^ ((guint16)(x <<5)) ^
-            ((guint16)x);
+        group = g_ptr_array_index(logger_data->log_groups, i);
+        for(j=0;group->patterns[j]!=NULL;j++)
+        {
+            if(g_pattern_match_simple(group->patterns[j], name))
+            {
+                return i + 1;
+            }
+        }
     }
-    return crc;
+    
+    return 0;
 }
 
-static gboolean tl_logger_log_query_from_file(TLLoggerData *logger_data,
-    const gchar *filename, TLLoggerQueryData *query_data,
-    TLLoggerLogQueryCallback callback)
+static TLLoggerTriggerData *tl_logger_trigger_lookup(
+    TLLoggerData *logger_data, const gchar *name)
 {
-    GError *error = NULL;
-    GFile *input_file;
-    GZlibDecompressor *decompressor;
-    GFileInputStream *file_istream;
-    GInputStream *decompress_istream;
-    guint8 buffer[4096];
-    gssize read_size;
-    GByteArray *parse_array;
+    TLLoggerTriggerData *trigger;
     guint i;
-    gboolean ret = TRUE;
-    guint32 except_len = 0;
-    guint16 except_crc;
-    guint16 real_crc;
     
-    if(callback==NULL)
+    for(i=0;i<logger_data->triggers->len;i++)
     {
-        return FALSE;
+        trigger = g_ptr_array_index(logger_data->triggers, i);
+        if(g_strcmp0(trigger->name, name)==0)
+        {
+            return trigger;
+        }
     }
     
-    input_file = g_file_new_for_path(filename);
-    if(input_file==NULL)
+    return NULL;
+}
+
+static inline gsize tl_logger_list_key_append(gchar *key, gsize len,
+    guint value)
+{
+    gchar digits[10];
+    guint n = 0;
+    
+    if(len>0 && len<TL_LOGGER_LIST_KEY_MAXIMUM-1)
     {
-        return FALSE;
+        key[len++] = ':';
     }
-    
-    file_istream = g_file_read(input_file, NULL, &error);
-    g_object_unref(input_file);
-    
-    if(file_istream==NULL)
+    do
     {
-        g_warning("TLLogger cannot open input stream from %s: %s", filename,
-            error->message);
-        g_clear_error(&error);
-        return FALSE;
+        digits[n++] = '0' + value % 10;
+        value /= 10;
     }
-    
-    decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
-    decompress_istream = g_converter_input_stream_new(G_INPUT_STREAM(
-        file_istream), G_CONVERTER(decompressor));
-    g_object_unref(file_istream);
-    g_object_unref(decompressor);
-    
-    parse_array = g_byte_array_new();
-    while((read_size=g_input_stream_read(decompress_istream, buffer, 4096,
-        NULL, NULL))>0 && logger_data->query_work_flag)
+    while(value>0);
+    while(n>0 && len<TL_LOGGER_LIST_KEY_MAXIMUM-1)
     {
-        for(i=0;i<read_size;i++)
-        {
-            if(parse_array->len<4 &&
-                buffer[i]==TL_LOGGER_LOG_ITEM_HEAD_MAGIC[parse_array->len])
-            {
-                g_byte_array_append(parse_array, buffer + i, 1);
-            }
-            else if(parse_array->len>=4)
-            {
-                g_byte_array_append(parse_array, buffer + i, 1);
-                
-                if(except_len==0 && parse_array->len>=6)
-                {
-                    memcpy(&except_len, parse_array->data + 4, 4);
-                    except_len = g_ntohl(except_len);
-                }
-                
-                if(parse_array->len>=14 && parse_array->len==except_len &&
-                    memcmp(parse_array->data + parse_array->len - 4,
-                    TL_LOGGER_LOG_ITEM_TAIL_MAGIC, 4)==0)
-                {
-                    /* Parse the data */
-                    memcpy(&except_crc, parse_array->data + 8, 2);
-                    except_crc = g_ntohs(except_crc);
-                    
-                    real_crc = tl_logger_crc16_compute(parse_array->data + 10,
-                        except_len);
-                    
-                    if(except_crc==real_crc)
-                    {
-                        ret = callback(logger_data, parse_array, query_data);
-                    }
-                    else
-                    {
-                        g_warning("TLLogger detected incorrect CRC in "
-                            "log item!");
-                    }
-                    
-                    g_byte_array_unref(parse_array);
-                    parse_array = g_byte_array_new();
-                }
-                
-                if(parse_array->len > except_len+14 || 
-                    parse_array->len > TL_LOGGER_LOG_PARSE_MAXIUM_SIZE)
-                {
-                    g_byte_array_unref(parse_array);
-                    parse_array = g_byte_array_new();
-                }
-            }
-            
-            if(!ret)
-            {
-                break;
-            }
-        }
-        
-        if(!ret)
-        {
-            break;
-        }
+        key[len++] = digits[--n];
     }
+    key[len] = '\0';
     
-    g_object_unref(decompress_istream);
-    
-    g_byte_array_unref(parse_array);
+    return len;
+}
+
+static void tl_logger_snapshot_item_unref(TLLoggerSnapshotItem *item)
+{
+    if(item==NULL || !g_atomic_int_dec_and_test(&(item->ref_count)))
+    {
+        return;
+    }
     
-    return TRUE;
+    g_free(item->data.name);
+    g_free(item->data.list_parent);
+    if(item->data.list_table!=NULL)
+    {
+        g_hash_table_unref(item->data.list_table);
+    }
+    if(item->data.index_table!=NULL)
+    {
+        g_hash_table_unref(item->data.index_table);
+    }
+    g_free(item);
 }
 
-static gboolean tl_logger_log_query_from_cache(TLLoggerData *logger_data,
-    TLLoggerQueryData *query_data)
+static void tl_logger_snapshot_page_unref(TLLoggerSnapshotPage *page)
 {
-    GList *list_foreach;
-    GHashTable *log_data, *dup_table;
-    GHashTableIter iter;
-    TLLoggerLogItemData *log_item_data, *dup_item_data;
-    GSList *query_result_list = NULL, *slist_foreach;
+    guint i;
     
-    g_mutex_lock(&(logger_data->cached_log_mutex));
+    if(page==NULL || !g_atomic_int_dec_and_test(&(page->ref_count)))
+    {
+        return;
+    }
     
-    for(list_foreach=g_queue_peek_head_link(logger_data->cached_log_data);
-        list_foreach!=NULL;list_foreach=g_list_next(list_foreach))
-    {        
-        log_data = list_foreach->data;
-        if(log_data==NULL)
-        {
-            continue;
-        }
-        
-        log_item_data = g_hash_table_lookup(log_data, "time");
-        if(log_item_data==NULL)
-        {
-            continue;
-        }
-        
-        if(query_data->end_time_set && query_data->end_time <
-            log_item_data->value)
-        {
-            break;
-        }
-        
-        if(query_data->begin_time_set && query_data->begin_time >
-            log_item_data->value)
-        {
-            continue;
-        }
-        
-        dup_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
-            (GDestroyNotify)tl_logger_log_item_data_free);
-        g_hash_table_iter_init(&iter, log_data);
-        while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&log_item_data))
-        {
-            if(log_item_data==NULL)
-            {
-                continue;
-            }
-            
-            dup_item_data = tl_logger_log_item_data_dup(log_item_data);
-            g_hash_table_replace(dup_table, dup_item_data->name, dup_item_data);
-        }
-        
-        query_result_list = g_slist_prepend(query_result_list, dup_table);
+    for(i=0;i<TL_LOGGER_SNAPSHOT_PAGE_SIZE;i++)
+    {
+        tl_logger_snapshot_item_unref(page->items[i]);
+    }
+    g_free(page);
+}
+
+static void tl_logger_snapshot_directory_unref(
+    TLLoggerSnapshotDirectory *directory)
+{
+    if(directory==NULL || !g_atomic_int_dec_and_test(
+        &(directory->ref_count)))
+    {
+        return;
     }
     
-    g_mutex_unlock(&(logger_data->cached_log_mutex));
+    g_hash_table_unref(directory->name_table);
+    g_free(directory);
+}
+
+/* Rough heap footprint of a deep copied item, used for memory accounting. */
+static gsize tl_logger_log_item_data_size(const TLLoggerLogItemData *data)
+{
+    gsize size;
     
-    for(slist_foreach=query_result_list;slist_foreach!=NULL;
-        slist_foreach=g_slist_next(slist_foreach))
+    size = sizeof(TLLoggerSnapshotItem) + strlen(data->name) + 1;
+    if(data->list_parent!=NULL)
     {
-        dup_table = slist_foreach->data;
-        if(dup_table==NULL)
-        {
-            continue;
-        }
-        
-        if(query_data->query_result_cb!=NULL)
-        {
-            query_data->query_result_cb(query_data->begin_time_set,
-                query_data->begin_time, query_data->end_time_set,
-                query_data->end_time, dup_table,
-                query_data->query_result_user_data);
-        }
+        size += strlen(data->list_parent) + 1;
+    }
+    if(data->list_table!=NULL)
+    {
+        size += g_hash_table_size(data->list_table) *
+            (TL_LOGGER_HASH_ENTRY_OVERHEAD + TL_LOGGER_LIST_KEY_MAXIMUM / 4 +
+            sizeof(gint64));
+    }
+    if(data->index_table!=NULL)
+    {
+        size += g_hash_table_size(data->index_table) *
+            (TL_LOGGER_HASH_ENTRY_OVERHEAD + TL_LOGGER_LIST_KEY_MAXIMUM / 4);
     }
     
-    g_slist_free_full(query_result_list, (GDestroyNotify)g_hash_table_unref);
-    
-    return TRUE;
+    return size;
 }
 
 /*
- * Log Frame:
- * | Head Magic (4B) | Length (4B) | CRC16 (2B) | JSON Data | Tail Magic (4B) |
- * 
+ * Creates a snapshot from the current data, real_time is in microseconds.
+ * Called on the main loop only. Pages touched by dirty slots are copied
+ * before they are modified, every other page is shared with the previous
+ * snapshot, snapshot->bytes only counts what this snapshot allocated itself.
  */
-
-static GByteArray *tl_logger_log_to_file_data(GHashTable *log_data)
+static TLLoggerSnapshot *tl_logger_snapshot_create(TLLoggerData *logger_data,
+    gint64 real_time)
 {
-    GByteArray *ba;
-    GHashTableIter iter, iter2;
-    TLLoggerLogItemData *item_data;
-    json_object *root, *child, *item_object, *array, *dict;
-    const gchar *json_data;
-    guint32 json_len, belen;
-    guint16 crc, becrc;
-    gpointer key;
-    gint64 *valueptr;
-    
-    ba = g_byte_array_new();
-    
-    g_byte_array_append(ba, TL_LOGGER_LOG_ITEM_HEAD_MAGIC, 4);
-    g_byte_array_append(ba, (const guint8 *)"\0\0\0\0", 4);
-    g_byte_array_append(ba, (const guint8 *)"\0\0", 2);
+    TLLoggerSnapshot *snapshot, *prev;
+    TLLoggerSnapshotPage *page, *prev_page;
+    TLLoggerSnapshotItem *item;
+    TLLoggerCurrentItemData *current_item;
+    guint size, page_count, slot, page_index, i, j;
+    
+    prev = logger_data->current_snapshot;
+    size = logger_data->current_slots->len;
+    page_count = (size + TL_LOGGER_SNAPSHOT_PAGE_SIZE - 1) /
+        TL_LOGGER_SNAPSHOT_PAGE_SIZE;
+    
+    snapshot = g_malloc0(sizeof(TLLoggerSnapshot) +
+        page_count * sizeof(TLLoggerSnapshotPage *));
+    snapshot->ref_count = 1;
+    snapshot->version = ++logger_data->snapshot_version;
+    snapshot->time = real_time / G_USEC_PER_SEC;
+    snapshot->real_time = real_time;
+    snapshot->groups = G_MAXUINT32;
+    snapshot->size = size;
+    snapshot->page_count = page_count;
+    snapshot->bytes = sizeof(TLLoggerSnapshot) +
+        page_count * sizeof(TLLoggerSnapshotPage *);
+    
+    if(prev!=NULL && prev->directory->size==size)
+    {
+        snapshot->directory = prev->directory;
+        g_atomic_int_inc(&(snapshot->directory->ref_count));
+    }
+    else
+    {
+        snapshot->directory = g_new0(TLLoggerSnapshotDirectory, 1);
+        snapshot->directory->ref_count = 1;
+        snapshot->directory->size = size;
+        snapshot->directory->name_table = g_hash_table_new_full(g_str_hash,
+            g_str_equal, g_free, NULL);
+        for(i=0;i<size;i++)
+        {
+            current_item = g_ptr_array_index(logger_data->current_slots, i);
+            g_hash_table_replace(snapshot->directory->name_table,
+                g_strdup(current_item->data.name), GUINT_TO_POINTER(i+1));
+            snapshot->bytes += TL_LOGGER_HASH_ENTRY_OVERHEAD +
+                strlen(current_item->data.name) + 1;
+        }
+    }
     
-    root = json_object_new_array();
+    for(i=0;prev!=NULL && i<prev->page_count;i++)
+    {
+        snapshot->pages[i] = prev->pages[i];
+        g_atomic_int_inc(&(snapshot->pages[i]->ref_count));
+    }
     
-    g_hash_table_iter_init(&iter, log_data);
-    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&item_data))
+    for(i=0;i<logger_data->dirty_slots->len;i++)
     {
-        item_object = json_object_new_object();
-        
-        child = json_object_new_string(item_data->name);
-        json_object_object_add(item_object, "name", child);
-        
-        child = json_object_new_int64(item_data->value);
-        json_object_object_add(item_object, "value", child);
+        slot = g_array_index(logger_data->dirty_slots, guint, i);
+        page_index = slot / TL_LOGGER_SNAPSHOT_PAGE_SIZE;
+        page = snapshot->pages[page_index];
+        prev_page = (prev!=NULL && page_index<prev->page_count) ?
+            prev->pages[page_index] : NULL;
         
-        child = json_object_new_int(item_data->offset);
-        json_object_object_add(item_object, "offset", child);
-        
-        child = json_object_new_double(item_data->unit);
-        json_object_object_add(item_object, "unit", child);
-        
-        child = json_object_new_int(item_data->source);
-        json_object_object_add(item_object, "source", child);
-        
-        if(item_data->list_item && item_data->index_table!=NULL)
-        {
-            child = json_object_new_int(1);
-            json_object_object_add(item_object, "listindex", child);
-            
-            array = json_object_new_array();
-            g_hash_table_iter_init(&iter2, item_data->index_table);
-            while(g_hash_table_iter_next(&iter2, &key, NULL))
-            {
-                child = json_object_new_string((const gchar *)key);
-                json_object_array_add(array, child);
-            }
-            json_object_object_add(item_object, "index", array);
-        }
-        if(item_data->list_parent!=NULL && item_data->list_table!=NULL)
+        if(page==NULL || page==prev_page)
         {
-            child = json_object_new_string(item_data->list_parent);
-            json_object_object_add(item_object, "listparent", child);
-            dict = json_object_new_object();
-            g_hash_table_iter_init(&iter2, item_data->list_table);
-            while(g_hash_table_iter_next(&iter2, &key, (gpointer *)&valueptr))
+            page = g_new0(TLLoggerSnapshotPage, 1);
+            page->ref_count = 1;
+            snapshot->bytes += sizeof(TLLoggerSnapshotPage);
+            if(prev_page!=NULL)
             {
-                if(valueptr==NULL)
+                for(j=0;j<TL_LOGGER_SNAPSHOT_PAGE_SIZE;j++)
                 {
-                    continue;
+                    page->items[j] = prev_page->items[j];
+                    if(page->items[j]!=NULL)
+                    {
+                        g_atomic_int_inc(&(page->items[j]->ref_count));
+                    }
                 }
-                child = json_object_new_int64(*valueptr);
-                json_object_object_add(dict, (const gchar *)key, child);
+                tl_logger_snapshot_page_unref(prev_page);
             }
-            json_object_object_add(item_object, "valuetable", dict);
+            snapshot->pages[page_index] = page;
         }
         
-        json_object_array_add(root, item_object);
+        current_item = g_ptr_array_index(logger_data->current_slots, slot);
+        current_item->dirty = FALSE;
+        
+        item = g_new0(TLLoggerSnapshotItem, 1);
+        item->ref_count = 1;
+        item->group = current_item->group;
+        tl_logger_log_item_data_copy(&(item->data), &(current_item->data));
+        snapshot->bytes += tl_logger_log_item_data_size(&(item->data));
+        
+        j = slot % TL_LOGGER_SNAPSHOT_PAGE_SIZE;
+        tl_logger_snapshot_item_unref(page->items[j]);
+        page->items[j] = item;
     }
+    g_array_set_size(logger_data->dirty_slots, 0);
     
-    json_data = json_object_to_json_string(root);
-    json_len = strlen(json_data);
-    g_byte_array_append(ba, (const guint8 *)json_data, json_len);
-    
-    crc = tl_logger_crc16_compute((const guchar *)json_data, json_len);
-    
-    json_object_put(root);
-    
-    belen = g_htonl(json_len);
-    memcpy(ba->data+4, &belen, 4);
-    
-    becrc = g_htons(crc);
-    memcpy(ba->data+8, &becrc, 2);
-    
-    g_byte_array_append(ba, TL_LOGGER_LOG_ITEM_TAIL_MAGIC, 4);
-    
-    return ba;
+    return snapshot;
 }
 
-static void tl_logger_archives_clear_old(TLLoggerData *logger_data,
-    guint64 freespace, guint64 freeinodes)
+/*
+ * Replaced snapshots keep the reference taken at publish time until a
+ * moment when no reader is between loading the current pointer and taking
+ * its own reference, after which they can be released safely.
+ */
+static void tl_logger_snapshot_publish(TLLoggerData *logger_data,
+    TLLoggerSnapshot *snapshot)
 {
-    GDir *log_dir;
-    GError *error = NULL;
-    const gchar *filename;
-    struct stat statbuf;
-    TLLoggerFileStat *file_stat;
-    GSequence *file_sequence;
-    GSequenceIter *iter;
-    gchar *fullpath;
+    TLLoggerSnapshot *old;
     
-    log_dir = g_dir_open(logger_data->storage_base_path, 0, &error);
-    if(error!=NULL)
+    old = logger_data->current_snapshot;
+    g_atomic_pointer_set(&(logger_data->current_snapshot), snapshot);
+    
+    if(old!=NULL)
     {
-        g_warning("TLLogger cannot open log storage directionary: %s",
-            error->message);
-        return;
+        logger_data->retired_snapshots = g_slist_prepend(
+            logger_data->retired_snapshots, old);
     }
-    
-    file_sequence = g_sequence_new((GDestroyNotify)tl_logger_file_stat_free);
-    
-    while((filename=g_dir_read_name(log_dir))!=NULL)
+    if(g_atomic_int_get(&(logger_data->snapshot_readers))==0)
     {
-        if(g_str_has_suffix(filename, ".tlz"))
-        {
-            fullpath = g_build_filename(logger_data->storage_base_path,
-                filename, NULL);
-            if(stat(fullpath, &statbuf)==0)
-            {
-                file_stat = g_new0(TLLoggerFileStat, 1);
-                file_stat->name = fullpath;
-                file_stat->size = statbuf.st_size;
-                
-                g_sequence_insert_sorted(file_sequence, file_stat, 
-                    (GCompareDataFunc)tl_logger_file_stat_compare,
-                    logger_data);
-            }
-            else
+        g_slist_free_full(logger_data->retired_snapshots,
+            (GDestroyNotify)tl_logger_snapshot_unref);
+        logger_data->retired_snapshots = NULL;
+    }
+}
+
+static TLLoggerCachedRecord *tl_logger_cached_record_new(gint64 time,
+    const GByteArray *ba, guint flags, GByteArray *scratch)
+{
+    TLLoggerCachedRecord *record;
+    GZlibCompressor *compressor;
+    GConverterResult result;
+    gsize bytes_read = 0, bytes_written = 0;
+    
+    g_byte_array_set_size(scratch, ba->len);
+    compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1);
+    result = g_converter_convert(G_CONVERTER(compressor), ba->data, ba->len,
+        scratch->data, scratch->len, G_CONVERTER_INPUT_AT_END, &bytes_read,
+        &bytes_written, NULL);
+    g_object_unref(compressor);
+    
+    if(result==G_CONVERTER_FINISHED)
+    {
+        record = g_malloc(sizeof(TLLoggerCachedRecord) + bytes_written);
+        record->size = bytes_written;
+        record->compressed = TRUE;
+        memcpy(record->data, scratch->data, bytes_written);
+    }
+    else
+    {
+        record = g_malloc(sizeof(TLLoggerCachedRecord) + ba->len);
+        record->size = ba->len;
+        record->compressed = FALSE;
+        memcpy(record->data, ba->data, ba->len);
+    }
+    record->ref_count = 1;
+    record->time = time;
+    record->len = ba->len;
+    record->flags = flags;
+    
+    return record;
+}
+
+static GByteArray *tl_logger_cached_record_data_get(
+    const TLLoggerCachedRecord *record)
+{
+    GByteArray *ba;
+    GZlibDecompressor *decompressor;
+    GConverterResult result;
+    gsize bytes_read = 0, bytes_written = 0;
+    
+    ba = g_byte_array_sized_new(record->len);
+    g_byte_array_set_size(ba, record->len);
+    if(!record->compressed)
+    {
+        memcpy(ba->data, record->data, record->len);
+        return ba;
+    }
+    
+    decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
+    result = g_converter_convert(G_CONVERTER(decompressor), record->data,
+        record->size, ba->data, ba->len, G_CONVERTER_INPUT_AT_END,
+        &bytes_read, &bytes_written, NULL);
+    g_object_unref(decompressor);
+    
+    if(result!=G_CONVERTER_FINISHED || bytes_written!=record->len)
+    {
+        g_warning("TLLogger failed to inflate cached log record!");
+        g_byte_array_unref(ba);
+        return NULL;
+    }
+    
+    return ba;
+}
+
+static TLLoggerCachedRecord *tl_logger_cached_record_ref(
+    TLLoggerCachedRecord *record)
+{
+    g_atomic_int_inc(&(record->ref_count));
+    
+    return record;
+}
+
+static void tl_logger_cached_record_unref(TLLoggerCachedRecord *record)
+{
+    if(record!=NULL && g_atomic_int_dec_and_test(&(record->ref_count)))
+    {
+        g_free(record);
+    }
+}
+
+/*
+ * Encodes a snapshot, followed by tag_count items which are not part of
+ * the state, such as the trigger window tags. Signals of log groups the
+ * snapshot does not sample keep the item held from their last sample, so
+ * deltas skip them and keyframes repeat that value.
+ */
+static GByteArray *tl_logger_log_to_file_data(TLLogFmtWriter *writer,
+    const TLLoggerSnapshot *snapshot, GPtrArray *held,
+    const TLLoggerLogItemData * const *tags, guint tag_count, guint *flags)
+{
+    GByteArray *ba;
+    const TLLoggerLogItemData **items;
+    TLLoggerSnapshotItem *item;
+    guint i;
+    
+    if(held->len<snapshot->size)
+    {
+        g_ptr_array_set_size(held, snapshot->size);
+    }
+    
+    items = g_new(const TLLoggerLogItemData *, snapshot->size + tag_count);
+    for(i=0;i<snapshot->size;i++)
+    {
+        item = snapshot->pages[i / TL_LOGGER_SNAPSHOT_PAGE_SIZE]->items[
+            i % TL_LOGGER_SNAPSHOT_PAGE_SIZE];
+        if(item!=NULL && g_ptr_array_index(held, i)!=NULL &&
+            !(snapshot->groups & (1U << item->group)))
+        {
+            item = g_ptr_array_index(held, i);
+        }
+        else if(item!=g_ptr_array_index(held, i))
+        {
+            if(item!=NULL)
             {
-                g_warning("TLLogger cannot stat archived log file %s: %s",
-                    filename, strerror(errno));
-                g_free(fullpath);
+                g_atomic_int_inc(&(item->ref_count));
             }
-            
+            tl_logger_snapshot_item_unref(g_ptr_array_index(held, i));
+            g_ptr_array_index(held, i) = item;
         }
+        items[i] = (item!=NULL) ? &(item->data) : NULL;
+    }
+    for(i=0;i<tag_count;i++)
+    {
+        items[snapshot->size + i] = tags[i];
+    }
+    
+    ba = g_byte_array_new();
+    *flags = tl_logfmt_writer_record_append(writer, ba,
+        snapshot->time, items, snapshot->size + tag_count);
+    g_free(items);
+    
+    return ba;
+}
+
+/*
+ * Returns a tag item with value. The writer detects changes by item
+ * pointer, so a changed value goes to the other one of the two buffers.
+ */
+static const TLLoggerLogItemData *tl_logger_log_tag_get(
+    TLLoggerLogItemData *buffers, const TLLoggerLogItemData **last,
+    gint64 value)
+{
+    TLLoggerLogItemData *item;
+    
+    if(*last!=NULL && (*last)->value==value)
+    {
+        return *last;
     }
     
-    for(iter=g_sequence_get_begin_iter(file_sequence);
-        !g_sequence_iter_is_end(iter);iter=g_sequence_iter_next(iter))
+    item = (*last==&buffers[0]) ? &buffers[1] : &buffers[0];
+    item->value = value;
+    *last = item;
+    
+    return item;
+}
+
+/* With a hot tier, the segment being written lives there. */
+static gchar *tl_logger_segment_path_get(TLLoggerData *logger_data,
+    const gchar *name, TLCatalogState state)
+{
+    return g_strdup_printf("%s/%s%s", (state==TL_CATALOG_STATE_WRITING &&
+        logger_data->hot_path!=NULL) ? logger_data->hot_path :
+        logger_data->storage_base_path, name,
+        tl_catalog_state_suffix_get(state));
+}
+
+/* Removes the oldest archives until space and inodes are sufficient. */
+static void tl_logger_archives_clear_old(TLLoggerData *logger_data,
+    guint64 freespace, guint64 freeinodes)
+{
+    GPtrArray *segments;
+    TLCatalogSegment *segment;
+    gchar *fullpath;
+    guint i;
+    
+    segments = tl_catalog_segments_list(logger_data->catalog,
+        TL_CATALOG_STATE_ARCHIVED, FALSE, 0, FALSE, 0);
+    
+    for(i=0;i<segments->len;i++)
     {
-        file_stat = g_sequence_get(iter);
-        if(file_stat==NULL)
-        {
-            continue;
-        }
-        
         if(freespace > TL_LOGGER_LOG_FREE_SPACE_MINIUM &&
             freeinodes > TL_LOGGER_LOG_FREE_NODE_MINIUM)
         {
             break;
         }
         
-        if(g_remove(file_stat->name)==0)
+        segment = g_ptr_array_index(segments, i);
+        fullpath = tl_logger_segment_path_get(logger_data, segment->name,
+            segment->state);
+        if(g_remove(fullpath)==0 || errno==ENOENT)
         {
-            freespace += file_stat->size;
+            freespace += segment->size;
             freeinodes++;
+            tl_catalog_segment_remove(logger_data->catalog, segment->name);
+            g_free(fullpath);
         }
         else
         {
             g_warning("TLLogger failed to remove old archive file %s: %s",
-                file_stat->name, strerror(errno));
+                fullpath, strerror(errno));
+            g_free(fullpath);
             break;
         }
     }
     
-    g_sequence_free(file_sequence);
-    
-    g_dir_close(log_dir);
+    g_ptr_array_unref(segments);
+    tl_catalog_sync(logger_data->catalog);
 }
 
+/*
+ * Compresses a finished log file into a block archive, so queries only
+ * decompress the blocks in their time range.
+ */
 static gboolean tl_logger_log_archive_compress_file(TLLoggerData *logger_data,
     const gchar *file)
 {
     gboolean ret = TRUE;
-    GZlibCompressor *compressor;
+    TLLogArcWriter *writer;
     GFileOutputStream *file_ostream;
-    GOutputStream *compress_ostream;
+    GInputStream *istream;
     GFile *output_file;
-    gssize write_size;
+    gssize read_size;
     GError *error = NULL;
-    FILE *fp;
     gchar *tmpname;
-    gchar buff[4096];
-    size_t rsize;
+    guint8 buff[4096];
     gchar *newname;
+    gsize chunk_size = 0;
     
     if(file==NULL)
     {
         return FALSE;
     }
     
-    tmpname = g_build_filename(logger_data->storage_base_path, "tlz.tmp",
-        NULL);
-    output_file = g_file_new_for_path(tmpname);
-    if(output_file==NULL)
+    istream = tl_codec_file_read(file, &error);
+    if(istream==NULL)
     {
-        g_free(tmpname);
+        g_warning("TLLogger failed to open origin log file for new "
+            "archived log: %s", error->message);
+        g_clear_error(&error);
         return FALSE;
     }
     
+    tmpname = g_build_filename(logger_data->storage_base_path, "tlz.tmp",
+        NULL);
+    output_file = g_file_new_for_path(tmpname);
     file_ostream = g_file_replace(output_file, NULL, FALSE,
         G_FILE_CREATE_PRIVATE, NULL, &error);
     g_object_unref(output_file);
@@ -615,41 +921,54 @@ static gboolean tl_logger_log_archive_compress_file(TLLoggerData *logger_data,
         g_warning("TLLogger cannot open output file stream: %s",
             error->message);
         g_clear_error(&error);
+        g_object_unref(istream);
         g_free(tmpname);
         return FALSE;
     }
     
-    compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 5);
-    compress_ostream = g_converter_output_stream_new(G_OUTPUT_STREAM(
-        file_ostream), G_CONVERTER(compressor));
-    g_object_unref(file_ostream);
-    g_object_unref(compressor);
+    writer = tl_logarc_writer_new(G_OUTPUT_STREAM(file_ostream),
+        g_atomic_int_get(&(logger_data->log_codec)), g_atomic_int_get(
+        &(logger_data->log_codec_level)), TL_LOGGER_LOG_ARCHIVE_BLOCK_SIZE,
+        &error);
     
-    fp = fopen(file, "r");
-    if(fp==NULL)
+    while(writer!=NULL && (read_size=g_input_stream_read(istream, buff,
+        sizeof(buff), NULL, &error))>0)
     {
-        g_warning("TLLogger failed to open origin log file for new "
-            "archived log: %s", strerror(errno));
-        g_output_stream_close(compress_ostream, NULL, NULL);
-        g_object_unref(compress_ostream);
-        return FALSE;
+        if(!tl_logarc_writer_write(writer, buff, read_size, &error))
+        {
+            break;
+        }
+        chunk_size += read_size;
+        if(chunk_size>=TL_LOGGER_LOG_ARCHIVE_BLOCK_SIZE)
+        {
+            chunk_size = 0;
+            if(!tl_bgwork_yield(&(logger_data->archive_thread_work_flag)))
+            {
+                break;
+            }
+        }
     }
-    
-    while((rsize=fread(buff, 1, 4096, fp))>0)
+    if(writer!=NULL && error==NULL)
     {
-        write_size += g_output_stream_write(compress_ostream, buff,
-            rsize, NULL, &error);
-        if(error!=NULL)
+        if(logger_data->archive_thread_work_flag)
+        {
+            tl_logarc_writer_finish(writer, &error);
+        }
+        else
         {
-            g_warning("TLLogger cannot write archive: %s", error->message);
-            g_clear_error(&error);
             ret = FALSE;
-            break;
         }
     }
-    fclose(fp);
-
-    g_output_stream_close(compress_ostream, NULL, &error);
+    if(error!=NULL)
+    {
+        g_warning("TLLogger cannot write archive: %s", error->message);
+        g_clear_error(&error);
+        ret = FALSE;
+    }
+    tl_logarc_writer_free(writer);
+    g_object_unref(istream);
+    
+    g_output_stream_close(G_OUTPUT_STREAM(file_ostream), NULL, &error);
     if(error!=NULL)
     {
         g_warning("TLLogger cannot close archive file stream: %s",
@@ -657,8 +976,8 @@ static gboolean tl_logger_log_archive_compress_file(TLLoggerData *logger_data,
         g_clear_error(&error);
         ret = FALSE;
     }
-    g_object_unref(compress_ostream);
-
+    g_object_unref(file_ostream);
+    
     if(ret)
     {
         newname = g_strdup_printf("%sz", file);
@@ -671,228 +990,79 @@ static gboolean tl_logger_log_archive_compress_file(TLLoggerData *logger_data,
     return ret;
 }
 
-static gboolean tl_logger_log_query_file_cb(TLLoggerData *logger_data,
-    GByteArray *ba, TLLoggerQueryData *query_data)
+/* Applies only handle declarations, for archive blocks before the range. */
+static gboolean tl_logger_log_query_meta_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    TLLoggerLogQueryScanData *scan_data =
+        (TLLoggerLogQueryScanData *)user_data;
+    
+    if(type==TL_LOGFMT_FRAME_META)
+    {
+        tl_logfmt_reader_frame_apply(scan_data->reader, type, payload, len);
+    }
+    
+    return scan_data->logger_data->query_work_flag;
+}
+
+static gboolean tl_logger_log_query_frame_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
 {
-    struct json_tokener *tokener;
-    struct json_object *root = NULL, *node, *child, *array, *dict;
-    guint array_len, array2_len, i, j;
+    TLLoggerLogQueryScanData *scan_data =
+        (TLLoggerLogQueryScanData *)user_data;
+    TLLoggerQueryData *query_data = scan_data->query_data;
+    GHashTable *log_table;
+    TLLoggerLogItemData *time_data;
+    gint64 time;
     gboolean ret = TRUE;
-    gboolean data_completed = TRUE;
-    const gchar *name, *listparent;
-    
-    GHashTable *log_table, *index_table, *value_table;
-    TLLoggerLogItemData *log_item_data;
-    gint64 log_value;
-    gint log_source;
-    gint log_offset;
-    gdouble log_unit;
-    gboolean list_index;
-    gint64 i64value;
-    gint ivalue;
-    const gchar *svalue;
-    struct json_object_iter json_iter;
-    
-    const gchar *json_data = (const gchar *)ba->data + 10;
-    guint json_len = ba->len - 14;
-    
-    tokener = json_tokener_new();
-    root = json_tokener_parse_ex(tokener, json_data, json_len);
-    json_tokener_free(tokener);
-    
-    if(root==NULL)
-    {
-        g_warning("TLLogger failed to parse JSON data!");
+    
+    if(!scan_data->logger_data->query_work_flag)
+    {
         return FALSE;
     }
     
-    array_len = json_object_array_length(root);
-    log_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
-        (GDestroyNotify)tl_logger_log_item_data_free);
-    
-    for(i=0;i<array_len;i++)
+    /*
+     * Binary records before the range only update the reader, so deltas
+     * in range can be rebuilt.
+     */
+    if(type==TL_LOGFMT_FRAME_RECORD || type==TL_LOGFMT_FRAME_DELTA)
     {
-        node = json_object_array_get_idx(root, i);
-        if(node==NULL)
-        {
-            continue;
-        }
-        
-        json_object_object_get_ex(node, "name", &child);
-        if(child==NULL)
-        {
-            continue;
-        }
-        
-        name = json_object_get_string(child);
-        
-        json_object_object_get_ex(node, "value", &child);
-        if(child!=NULL)
-        {
-            log_value = json_object_get_int64(child);
-        }
-        else
-        {
-            log_value = 0;
-        }
-        
-        json_object_object_get_ex(node, "unit", &child);
-        if(child!=NULL)
-        {
-            log_unit = json_object_get_double(child);
-        }
-        else
-        {
-            log_unit = 1.0;
-        }
-        
-        json_object_object_get_ex(node, "offset", &child);
-        if(child!=NULL)
-        {
-            log_offset = json_object_get_int(child);
-        }
-        else
-        {
-            log_offset = 0;
-        }
-        
-        json_object_object_get_ex(node, "source", &child);
-        if(child!=NULL)
-        {
-            log_source = json_object_get_int(child);
-        }
-        else
-        {
-            log_source = 0;
-        }
-        
-        list_index = FALSE;
-        value_table = NULL;
-        index_table = NULL;
-        json_object_object_get_ex(node, "listindex", &child);
-        if(child!=NULL)
-        {
-            list_index = (json_object_get_int(child)!=0);
-            array = NULL;
-            if(list_index)
-            {
-                json_object_object_get_ex(node, "index", &array);
-                if(array==NULL)
-                {
-                    list_index = FALSE;
-                }
-            }
-            if(list_index)
-            {
-                array2_len = json_object_array_length(array);
-                index_table = g_hash_table_new_full(g_str_hash,
-                    g_str_equal, g_free, NULL);
-                for(j=0;j<array2_len;j++)
-                {
-                    child = json_object_array_get_idx(array, j);
-                    if(child==NULL)
-                    {
-                        continue;
-                    }
-                    svalue = json_object_get_string(child);
-                    if(svalue!=NULL)
-                    {
-                        g_hash_table_add(index_table, g_strdup(svalue));
-                    }
-                }   
-            }
-        }
-        
-        listparent = NULL;
-        dict = NULL;
-        if(!list_index)
-        {
-            json_object_object_get_ex(node, "listparent", &child);
-            if(child!=NULL)
-            {
-                listparent = json_object_get_string(child);
-            }
-        }
-        if(listparent!=NULL)
-        {
-            json_object_object_get_ex(node, "valuetable", &dict);
-            if(dict!=NULL)
-            {
-                value_table = g_hash_table_new_full(g_str_hash,
-                    g_str_equal, g_free, g_free);
-                json_object_object_foreachC(dict, json_iter)
-                {
-                    if(json_iter.key!=NULL && json_iter.val!=NULL &&
-                        sscanf(json_iter.key, "%u", &ivalue)>0)
-                    {
-                        svalue = json_object_get_string(json_iter.val);
-                        if(svalue!=NULL)
-                        {
-                            g_hash_table_replace(value_table, g_strdup(svalue),
-                                g_memdup(&i64value, sizeof(gint64)));
-                        }
-                    }
-                }
-            }
-        }
-        
-        if(g_strcmp0(name, "time")==0)
-        {
-            log_value = json_object_get_int64(child);
-        
-            if(query_data->end_time_set && query_data->end_time < log_value)
-            {
-                ret = FALSE;
-                data_completed = FALSE;
-                break;
-            }
-        
-            if(query_data->begin_time_set &&
-                query_data->begin_time > log_value)
-            {
-                data_completed = FALSE;
-                break;
-            }
-        }
-        
-        log_item_data = g_new0(TLLoggerLogItemData, 1);
-        log_item_data->name = g_strdup(name);
-        log_item_data->value = log_value;
-        log_item_data->source = log_source;
-        log_item_data->unit = log_unit;
-        log_item_data->offset = log_offset;
-        
-        if(list_index && index_table!=NULL)
-        {
-            log_item_data->list_index = TRUE;
-            log_item_data->index_table = index_table;
-        }
-        else if(index_table!=NULL)
+        if(!tl_logfmt_record_time_peek(payload, len, &time))
         {
-            g_hash_table_unref(index_table);
+            return TRUE;
         }
-        
-        if(listparent!=NULL && value_table!=NULL)
+        if(query_data->end_time_set && query_data->end_time < time)
         {
-            log_item_data->list_parent = g_strdup(listparent);
-            log_item_data->list_table = value_table;
+            return FALSE;
         }
-        else if(value_table!=NULL)
+        if(query_data->begin_time_set && query_data->begin_time > time)
         {
-            g_hash_table_unref(value_table);
+            tl_logfmt_reader_frame_apply(scan_data->reader, type, payload,
+                len);
+            return TRUE;
         }
-        
-        g_hash_table_replace(log_table, log_item_data->name, log_item_data);
     }
     
-    json_object_put(root);
+    log_table = tl_logfmt_reader_frame_decode(scan_data->reader, type,
+        payload, len);
+    if(log_table==NULL)
+    {
+        return TRUE;
+    }
     
-    if(data_completed && !g_hash_table_contains(log_table, "time"))
+    time_data = g_hash_table_lookup(log_table, "time");
+    if(time_data==NULL)
     {
-        data_completed = FALSE;
+        g_hash_table_unref(log_table);
+        return TRUE;
     }
     
-    if(data_completed)
+    if(query_data->end_time_set && query_data->end_time < time_data->value)
+    {
+        ret = FALSE;
+    }
+    else if(!query_data->begin_time_set ||
+        query_data->begin_time <= time_data->value)
     {
         if(query_data->query_result_cb!=NULL)
         {
@@ -902,372 +1072,1758 @@ static gboolean tl_logger_log_query_file_cb(TLLoggerData *logger_data,
                 query_data->query_result_user_data);
         }
     }
+    
     g_hash_table_unref(log_table);
     
     return ret;
 }
 
-static gpointer tl_logger_log_query_thread(gpointer user_data)
+/*
+ * Reads only the blocks of an archive which overlap the query range.
+ * Skipped blocks which declare handles are still applied to the reader,
+ * every block starts with a keyframe.
+ */
+static void tl_logger_log_query_from_archive(TLLoggerData *logger_data,
+    TLLogArcReader *archive, TLLoggerQueryData *query_data,
+    TLLoggerLogQueryScanData *scan_data)
 {
-    TLLoggerData *logger_data = (TLLoggerData *)user_data;
-    TLLoggerQueryData *query_data;
-    GDir *log_dir;
+    const TLLogArcBlock *block;
+    TLLogFmtScanner *scanner;
+    GByteArray *data;
     GError *error = NULL;
-    const gchar *filename;
-    
-    if(user_data==NULL)
-    {
-        return NULL;
-    }
+    gboolean skip;
+    guint i;
     
-    logger_data->query_thread_work_flag = TRUE;
+    scanner = tl_logfmt_scanner_new();
+    data = g_byte_array_new();
     
-    while(logger_data->query_thread_work_flag)
+    for(i=0;logger_data->query_work_flag &&
+        i<tl_logarc_reader_block_count_get(archive);i++)
     {
-        g_mutex_lock(&(logger_data->query_queue_mutex));
-        query_data = g_queue_pop_head(logger_data->query_queue);
-        logger_data->query_working_data = query_data;
-        logger_data->query_work_flag = TRUE;
-        g_mutex_unlock(&(logger_data->query_queue_mutex));
+        block = tl_logarc_reader_block_get(archive, i);
+        if(query_data->end_time_set && block->first_time >
+            query_data->end_time)
+        {
+            continue;
+        }
+        skip = (query_data->begin_time_set && block->last_time <
+            query_data->begin_time);
+        if(skip && !(block->flags & TL_LOGARC_BLOCK_FLAG_META))
+        {
+            continue;
+        }
         
-        if(query_data!=NULL)
+        g_byte_array_set_size(data, 0);
+        if(!tl_logarc_reader_block_read(archive, i, data, &error))
         {
-            G_STMT_START
+            g_warning("TLLogger cannot read archive block: %s",
+                error->message);
+            g_clear_error(&error);
+            break;
+        }
+        if(!tl_logfmt_scanner_feed(scanner, data->data, data->len,
+            skip ? tl_logger_log_query_meta_cb : tl_logger_log_query_frame_cb,
+            scan_data))
+        {
+            break;
+        }
+    }
+    
+    g_byte_array_unref(data);
+    tl_logfmt_scanner_free(scanner);
+}
+
+/*
+ * Seeks an uncompressed segment to the last indexed keyframe at or before
+ * the query begin time, after applying the handle declarations before
+ * it. Stays at the start of the segment if there is no such keyframe.
+ */
+static void tl_logger_log_query_index_seek(GInputStream *istream,
+    GArray *index, TLLoggerQueryData *query_data,
+    TLLoggerLogQueryScanData *scan_data)
+{
+    const TLLogSegIndexEntry *entry, *start = NULL;
+    TLLogFmtScanner *scanner;
+    GByteArray *data;
+    GError *error = NULL;
+    guint low = 0, high = index->len, middle, i;
+    
+    /* Find the first entry after the begin time. */
+    while(low<high)
+    {
+        middle = low + (high - low) / 2;
+        entry = &g_array_index(index, TLLogSegIndexEntry, middle);
+        if(entry->time <= query_data->begin_time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    for(i=low;i>0 && start==NULL;i--)
+    {
+        entry = &g_array_index(index, TLLogSegIndexEntry, i - 1);
+        if(entry->type==TL_LOGSEG_INDEX_KEYFRAME ||
+            entry->type==TL_LOGSEG_INDEX_TRIGGER)
+        {
+            start = entry;
+        }
+    }
+    if(start==NULL || !G_IS_SEEKABLE(istream))
+    {
+        return;
+    }
+    
+    scanner = tl_logfmt_scanner_new();
+    data = g_byte_array_new();
+    for(i=0;i<index->len;i++)
+    {
+        entry = &g_array_index(index, TLLogSegIndexEntry, i);
+        if(entry->offset>=start->offset)
+        {
+            break;
+        }
+        if(entry->type!=TL_LOGSEG_INDEX_META)
+        {
+            continue;
+        }
+        
+        g_byte_array_set_size(data, entry->len);
+        if(!g_seekable_seek(G_SEEKABLE(istream), entry->offset, G_SEEK_SET,
+            NULL, &error) || !g_input_stream_read_all(istream, data->data,
+            entry->len, NULL, NULL, &error))
+        {
+            break;
+        }
+        tl_logfmt_scanner_feed(scanner, data->data, data->len,
+            tl_logger_log_query_meta_cb, scan_data);
+    }
+    if(error==NULL)
+    {
+        g_seekable_seek(G_SEEKABLE(istream), start->offset, G_SEEK_SET,
+            NULL, &error);
+    }
+    if(error!=NULL)
+    {
+        /* Read the whole segment instead. */
+        g_warning("TLLogger cannot seek in log file: %s", error->message);
+        g_clear_error(&error);
+        tl_logfmt_reader_reset(scan_data->reader);
+        g_seekable_seek(G_SEEKABLE(istream), TL_LOGSEG_BLOCK_SIZE,
+            G_SEEK_SET, NULL, NULL);
+    }
+    
+    g_byte_array_unref(data);
+    tl_logfmt_scanner_free(scanner);
+}
+
+static gboolean tl_logger_log_query_from_file(TLLoggerData *logger_data,
+    const gchar *filename, TLLoggerQueryData *query_data)
+{
+    GError *error = NULL;
+    GInputStream *decompress_istream;
+    guint8 *buffer;
+    gssize read_size;
+    TLLogFmtScanner *scanner;
+    TLLogArcReader *archive;
+    GArray *index;
+    TLLoggerLogQueryScanData scan_data;
+    
+    scan_data.logger_data = logger_data;
+    scan_data.query_data = query_data;
+    
+    archive = tl_logarc_reader_open(filename, &error);
+    if(archive!=NULL)
+    {
+        scan_data.reader = tl_logfmt_reader_new();
+        tl_logger_log_query_from_archive(logger_data, archive, query_data,
+            &scan_data);
+        tl_logfmt_reader_free(scan_data.reader);
+        tl_logarc_reader_free(archive);
+        return TRUE;
+    }
+    if(error!=NULL)
+    {
+        g_warning("TLLogger cannot open archive %s: %s", filename,
+            error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    
+    /* Other files are one stream, read from the start. */
+    decompress_istream = tl_codec_file_read(filename, &error);
+    if(decompress_istream==NULL)
+    {
+        g_warning("TLLogger cannot open input stream from %s: %s", filename,
+            error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+    
+    scanner = tl_logfmt_scanner_new();
+    scan_data.reader = tl_logfmt_reader_new();
+    
+    if(query_data->begin_time_set)
+    {
+        index = tl_logseg_index_load(filename);
+        if(index!=NULL)
+        {
+            tl_logger_log_query_index_seek(decompress_istream, index,
+                query_data, &scan_data);
+            g_array_unref(index);
+        }
+    }
+    
+    /* Large reads let the scanner parse most frames in place. */
+    buffer = g_malloc(TL_LOGGER_QUERY_READ_SIZE);
+    while(logger_data->query_work_flag && (read_size=g_input_stream_read(
+        decompress_istream, buffer, TL_LOGGER_QUERY_READ_SIZE, NULL,
+        NULL))>0)
+    {
+        if(!tl_logfmt_scanner_feed(scanner, buffer, read_size,
+            tl_logger_log_query_frame_cb, &scan_data))
+        {
+            break;
+        }
+    }
+    g_free(buffer);
+    
+    tl_logfmt_reader_free(scan_data.reader);
+    tl_logfmt_scanner_free(scanner);
+    g_object_unref(decompress_istream);
+    
+    return TRUE;
+}
+
+static gboolean tl_logger_log_query_from_cache(TLLoggerData *logger_data,
+    TLLoggerQueryData *query_data)
+{
+    GList *list_foreach, *replay_start = NULL;
+    TLLoggerCachedRecord *record;
+    GByteArray *ba;
+    GSList *query_result_list = NULL, *slist_foreach;
+    TLLogFmtScanner *scanner;
+    TLLoggerLogQueryScanData scan_data;
+    
+    g_mutex_lock(&(logger_data->cached_log_mutex));
+    
+    /* Replay from the last keyframe before the range. */
+    for(list_foreach=g_queue_peek_head_link(logger_data->cached_log_data);
+        list_foreach!=NULL && query_data->begin_time_set;
+        list_foreach=g_list_next(list_foreach))
+    {
+        record = list_foreach->data;
+        if(record==NULL)
+        {
+            continue;
+        }
+        if(record->time > query_data->begin_time)
+        {
+            break;
+        }
+        if(record->flags & TL_LOGFMT_RECORD_KEYFRAME)
+        {
+            replay_start = list_foreach;
+        }
+    }
+    
+    for(list_foreach=g_queue_peek_head_link(logger_data->cached_log_data);
+        list_foreach!=NULL;list_foreach=g_list_next(list_foreach))
+    {        
+        record = list_foreach->data;
+        if(list_foreach==replay_start)
+        {
+            replay_start = NULL;
+        }
+        if(record==NULL)
+        {
+            continue;
+        }
+        
+        if(query_data->end_time_set && query_data->end_time <
+            record->time)
+        {
+            break;
+        }
+        
+        /* Records declaring signals are needed to decode later ones. */
+        if(replay_start!=NULL &&
+            !(record->flags & TL_LOGFMT_RECORD_METADATA))
+        {
+            continue;
+        }
+        
+        query_result_list = g_slist_prepend(query_result_list,
+            tl_logger_cached_record_ref(record));
+    }
+    
+    g_mutex_unlock(&(logger_data->cached_log_mutex));
+    
+    query_result_list = g_slist_reverse(query_result_list);
+    
+    scanner = tl_logfmt_scanner_new();
+    scan_data.logger_data = logger_data;
+    scan_data.query_data = query_data;
+    scan_data.reader = tl_logfmt_reader_new();
+    
+    for(slist_foreach=query_result_list;slist_foreach!=NULL;
+        slist_foreach=g_slist_next(slist_foreach))
+    {
+        record = slist_foreach->data;
+        if(record==NULL || record->len<14)
+        {
+            continue;
+        }
+        
+        ba = tl_logger_cached_record_data_get(record);
+        if(ba==NULL)
+        {
+            continue;
+        }
+        
+        if(!tl_logfmt_scanner_feed(scanner, ba->data, ba->len,
+            tl_logger_log_query_frame_cb, &scan_data))
+        {
+            g_byte_array_unref(ba);
+            break;
+        }
+        g_byte_array_unref(ba);
+    }
+    
+    tl_logfmt_reader_free(scan_data.reader);
+    tl_logfmt_scanner_free(scanner);
+    
+    g_slist_free_full(query_result_list,
+        (GDestroyNotify)tl_logger_cached_record_unref);
+    
+    return TRUE;
+}
+
+static gpointer tl_logger_log_query_thread(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    TLLoggerQueryData *query_data;
+    GPtrArray *segments;
+    TLCatalogSegment *segment;
+    gchar *fullpath;
+    guint i;
+    
+    if(user_data==NULL)
+    {
+        return NULL;
+    }
+    
+    while(logger_data->query_thread_work_flag)
+    {
+        g_mutex_lock(&(logger_data->query_queue_mutex));
+        while(logger_data->query_thread_work_flag &&
+            g_queue_is_empty(logger_data->query_queue))
+        {
+            g_cond_wait(&(logger_data->query_cond),
+                &(logger_data->query_queue_mutex));
+        }
+        query_data = g_queue_pop_head(logger_data->query_queue);
+        logger_data->query_working_data = query_data;
+        logger_data->query_work_flag = TRUE;
+        g_mutex_unlock(&(logger_data->query_queue_mutex));
+        
+        if(query_data!=NULL)
+        {
+            /*
+             * Only finished segments overlapping the range are read, in
+             * time order. The current one is in the cache.
+             */
+            segments = tl_catalog_segments_list(logger_data->catalog,
+                TL_CATALOG_STATE_CLOSED | TL_CATALOG_STATE_ARCHIVED,
+                query_data->begin_time_set, query_data->begin_time,
+                query_data->end_time_set, query_data->end_time);
+            for(i=0;logger_data->query_work_flag && i<segments->len;i++)
             {
-                log_dir = g_dir_open(logger_data->storage_base_path, 0,
-                    &error);
-                if(error!=NULL)
-                {
-                    g_warning("TLLogger cannot open log storage "
-                        "directionary: %s", error->message);
-                    break;
-                }
-                
-                while(logger_data->query_work_flag &&
-                    (filename=g_dir_read_name(log_dir))!=NULL)
+                segment = g_ptr_array_index(segments, i);
+                fullpath = tl_logger_segment_path_get(logger_data,
+                    segment->name, segment->state);
+                if(segment->state==TL_CATALOG_STATE_CLOSED &&
+                    !g_file_test(fullpath, G_FILE_TEST_EXISTS))
                 {
-                    if(g_str_has_suffix(filename, ".tlz"))
-                    {
-                        tl_logger_log_query_from_file(logger_data, filename,
-                            query_data, tl_logger_log_query_file_cb);
-                    }
+                    /* Archived since the list was taken. */
+                    g_free(fullpath);
+                    fullpath = tl_logger_segment_path_get(logger_data,
+                        segment->name, TL_CATALOG_STATE_ARCHIVED);
                 }
+                tl_logger_log_query_from_file(logger_data, fullpath,
+                    query_data);
+                g_free(fullpath);
             }
-            G_STMT_END;
-            
-            g_dir_close(log_dir);
+            g_ptr_array_unref(segments);
             
             tl_logger_log_query_from_cache(logger_data, query_data);
             
             logger_data->query_working_data = NULL;
             g_free(query_data);
         }
-        else
+    }
+    
+    return NULL;
+}
+
+/*
+ * Gets the record interval of a downsampled segment from its name,
+ * "<segment>-r<seconds>", and the length of the source segment name.
+ * Segments at full resolution give 0.
+ */
+static guint tl_logger_segment_resolution_get(const gchar *name,
+    gsize *base_len)
+{
+    const gchar *suffix;
+    gchar *end = NULL;
+    guint64 interval;
+    
+    suffix = strrchr(name, '-');
+    if(suffix!=NULL && suffix[1]=='r' && g_ascii_isdigit(suffix[2]))
+    {
+        interval = g_ascii_strtoull(suffix + 2, &end, 10);
+        if(end!=NULL && *end=='\0' && interval>0 && interval<=G_MAXUINT)
         {
-            g_usleep(100000);
+            if(base_len!=NULL)
+            {
+                *base_len = suffix - name;
+            }
+            return interval;
         }
     }
+    if(base_len!=NULL)
+    {
+        *base_len = strlen(name);
+    }
     
-    return NULL;
+    return 0;
 }
 
-static gpointer tl_logger_log_archive_thread(gpointer user_data)
+/*
+ * Rewrites an archived segment as a tier of one record per interval
+ * seconds, then replaces the segment with it.
+ */
+static gboolean tl_logger_log_downsample_segment(TLLoggerData *logger_data,
+    const TLCatalogSegment *segment, guint interval)
 {
-    TLLoggerData *logger_data = (TLLoggerData *)user_data;
-    GDir *log_dir;
+    TLCatalogSegment new_segment;
+    TLLogTierWriter *writer;
+    GFileOutputStream *file_ostream;
+    GInputStream *istream;
+    GFile *output_file;
     GError *error = NULL;
-    const gchar *filename;
-    gchar *fullpath;
-    struct statvfs statbuf;
-    guint64 freespace;
-    guint64 freeinodes;
+    gssize read_size;
+    guint8 buff[4096];
+    gchar *fullpath, *tmpname, *newpath;
+    struct stat file_stat;
+    gsize base_len;
+    gsize chunk_size = 0;
+    gboolean ret = TRUE;
+    
+    fullpath = tl_logger_segment_path_get(logger_data, segment->name,
+        TL_CATALOG_STATE_ARCHIVED);
+    istream = tl_codec_file_read(fullpath, &error);
+    if(istream==NULL)
+    {
+        g_warning("TLLogger cannot open %s for downsampling: %s", fullpath,
+            error->message);
+        g_clear_error(&error);
+        g_free(fullpath);
+        return FALSE;
+    }
+    
+    tmpname = g_build_filename(logger_data->storage_base_path, "tlz.tmp",
+        NULL);
+    output_file = g_file_new_for_path(tmpname);
+    file_ostream = g_file_replace(output_file, NULL, FALSE,
+        G_FILE_CREATE_PRIVATE, NULL, &error);
+    g_object_unref(output_file);
+    if(file_ostream==NULL)
+    {
+        g_warning("TLLogger cannot open output file stream: %s",
+            error->message);
+        g_clear_error(&error);
+        g_object_unref(istream);
+        g_free(tmpname);
+        g_free(fullpath);
+        return FALSE;
+    }
+    
+    writer = tl_logtier_writer_new(G_OUTPUT_STREAM(file_ostream),
+        g_atomic_int_get(&(logger_data->log_codec)), g_atomic_int_get(
+        &(logger_data->log_codec_level)), interval, &error);
+    while(writer!=NULL && logger_data->archive_thread_work_flag &&
+        (read_size=g_input_stream_read(istream, buff, sizeof(buff), NULL,
+        &error))>0)
+    {
+        if(!tl_logtier_writer_write(writer, buff, read_size, &error))
+        {
+            break;
+        }
+        chunk_size += read_size;
+        if(chunk_size>=TL_LOGGER_LOG_ARCHIVE_BLOCK_SIZE)
+        {
+            chunk_size = 0;
+            tl_bgwork_yield(&(logger_data->archive_thread_work_flag));
+        }
+    }
+    if(writer!=NULL && error==NULL)
+    {
+        if(logger_data->archive_thread_work_flag)
+        {
+            tl_logtier_writer_finish(writer, &error);
+        }
+        else
+        {
+            ret = FALSE;
+        }
+    }
+    if(error!=NULL)
+    {
+        g_warning("TLLogger cannot write downsampled log: %s",
+            error->message);
+        g_clear_error(&error);
+        ret = FALSE;
+    }
+    g_object_unref(istream);
+    
+    g_output_stream_close(G_OUTPUT_STREAM(file_ostream), NULL, &error);
+    if(error!=NULL)
+    {
+        g_warning("TLLogger cannot close downsampled log file stream: %s",
+            error->message);
+        g_clear_error(&error);
+        ret = FALSE;
+    }
+    g_object_unref(file_ostream);
+    
+    if(ret)
+    {
+        tl_logger_segment_resolution_get(segment->name, &base_len);
+        memset(&new_segment, 0, sizeof(TLCatalogSegment));
+        new_segment.name = g_strdup_printf("%.*s-r%u", (int)base_len,
+            segment->name, interval);
+        new_segment.state = TL_CATALOG_STATE_ARCHIVED;
+        new_segment.records = tl_logtier_writer_records_get(writer,
+            &(new_segment.first_time), &(new_segment.last_time));
+        newpath = tl_logger_segment_path_get(logger_data, new_segment.name,
+            TL_CATALOG_STATE_ARCHIVED);
+        if(g_rename(tmpname, newpath)==0)
+        {
+            if(stat(newpath, &file_stat)==0)
+            {
+                new_segment.size = file_stat.st_size;
+            }
+            tl_catalog_segment_set(logger_data->catalog, &new_segment);
+            tl_catalog_segment_remove(logger_data->catalog, segment->name);
+            tl_catalog_sync(logger_data->catalog);
+            g_remove(fullpath);
+        }
+        else
+        {
+            g_warning("TLLogger cannot rename downsampled log to %s: %s",
+                newpath, strerror(errno));
+            ret = FALSE;
+        }
+        g_free(newpath);
+        g_free(new_segment.name);
+    }
+    tl_logtier_writer_free(writer);
+    
+    g_free(tmpname);
+    g_free(fullpath);
+    
+    return ret;
+}
+
+/*
+ * Downsamples the archived segments whose last record is older than the
+ * age of a tier to the longest interval of these tiers.
+ */
+static void tl_logger_log_downsample(TLLoggerData *logger_data)
+{
+    GArray *tiers;
+    GPtrArray *segments;
+    TLCatalogSegment *segment;
+    const TLLoggerDownsampleTier *tier;
+    gint64 now;
+    guint i, j, interval;
+    
+    g_mutex_lock(&(logger_data->archive_mutex));
+    tiers = logger_data->downsample_tiers!=NULL ?
+        g_array_ref(logger_data->downsample_tiers) : NULL;
+    g_mutex_unlock(&(logger_data->archive_mutex));
+    if(tiers==NULL)
+    {
+        return;
+    }
+    
+    now = g_get_real_time() / G_USEC_PER_SEC;
+    segments = tl_catalog_segments_list(logger_data->catalog,
+        TL_CATALOG_STATE_ARCHIVED, FALSE, 0, FALSE, 0);
+    for(i=0;logger_data->archive_thread_work_flag && i<segments->len;i++)
+    {
+        segment = g_ptr_array_index(segments, i);
+        if(segment->records==0)
+        {
+            continue;
+        }
+        
+        interval = 0;
+        for(j=0;j<tiers->len;j++)
+        {
+            tier = &g_array_index(tiers, TLLoggerDownsampleTier, j);
+            if(now - segment->last_time >= tier->age &&
+                tier->interval > interval)
+            {
+                interval = tier->interval;
+            }
+        }
+        if(interval > tl_logger_segment_resolution_get(segment->name,
+            NULL))
+        {
+            tl_logger_log_downsample_segment(logger_data, segment,
+                interval);
+        }
+    }
+    g_ptr_array_unref(segments);
+    g_array_unref(tiers);
+}
+
+static gpointer tl_logger_log_archive_thread(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    GPtrArray *segments;
+    TLCatalogSegment *segment;
+    gchar *fullpath, *index_path;
+    struct stat file_stat;
+    struct statvfs statbuf;
+    guint64 freespace;
+    guint64 freeinodes;
+    gint64 deadline;
+    guint i;
+    
+    if(user_data==NULL)
+    {
+        return NULL;
+    }
+    
+    tl_bgwork_thread_enter();
+    
+    while(logger_data->archive_thread_work_flag)
+    {
+        /* Scan unarchived log every 60s, or when a log file is finished. */
+        if(statvfs(logger_data->storage_base_path, &statbuf)==0)
+        {
+            freespace = (guint64)statbuf.f_bavail * statbuf.f_bsize;
+            freeinodes = statbuf.f_favail;
+            
+            if(freespace < TL_LOGGER_LOG_FREE_SPACE_MINIUM ||
+                freeinodes < TL_LOGGER_LOG_FREE_NODE_MINIUM)
+            {
+                /* Clear the disk for more space or inodes */
+                tl_logger_archives_clear_old(logger_data, freespace,
+                    freeinodes);
+            }
+        }
+        else
+        {
+            g_warning("TLLogger cannot stat storage directory: %s",
+                strerror(errno));
+        }
+        
+        segments = tl_catalog_segments_list(logger_data->catalog,
+            TL_CATALOG_STATE_CLOSED, FALSE, 0, FALSE, 0);
+        for(i=0;logger_data->archive_thread_work_flag && i<segments->len;
+            i++)
+        {
+            segment = g_ptr_array_index(segments, i);
+            fullpath = tl_logger_segment_path_get(logger_data,
+                segment->name, TL_CATALOG_STATE_CLOSED);
+            if(tl_logger_log_archive_compress_file(logger_data, fullpath))
+            {
+                g_remove(fullpath);
+                index_path = tl_logseg_index_path_get(fullpath);
+                g_remove(index_path);
+                g_free(index_path);
+                g_free(fullpath);
+                
+                fullpath = tl_logger_segment_path_get(logger_data,
+                    segment->name, TL_CATALOG_STATE_ARCHIVED);
+                tl_catalog_segment_state_set(logger_data->catalog,
+                    segment->name, TL_CATALOG_STATE_ARCHIVED,
+                    stat(fullpath, &file_stat)==0 ? file_stat.st_size : 0);
+                tl_catalog_sync(logger_data->catalog);
+            }
+            g_free(fullpath);
+        }
+        g_ptr_array_unref(segments);
+        
+        tl_logger_log_downsample(logger_data);
+        
+        g_mutex_lock(&(logger_data->archive_mutex));
+        deadline = g_get_monotonic_time() + TL_LOGGER_ARCHIVE_SCAN_INTERVAL *
+            G_TIME_SPAN_SECOND;
+        while(logger_data->archive_thread_work_flag &&
+            !logger_data->archive_request)
+        {
+            if(!g_cond_wait_until(&(logger_data->archive_cond),
+                &(logger_data->archive_mutex), deadline))
+            {
+                break;
+            }
+        }
+        logger_data->archive_request = FALSE;
+        g_mutex_unlock(&(logger_data->archive_mutex));
+    }
+    
+
+    return NULL;
+}
+
+/* Drops the cached records of the current log file, call with the lock held. */
+static void tl_logger_log_cache_clear(TLLoggerData *logger_data)
+{
+    g_queue_free_full(logger_data->cached_log_data,
+        (GDestroyNotify)tl_logger_cached_record_unref);
+    logger_data->cached_log_data = g_queue_new();
+    tl_membudget_release(TL_MEMBUDGET_QUEUE_LOG_CACHE,
+        logger_data->cached_log_bytes);
+    logger_data->cached_log_bytes = 0;
+}
+
+/*
+ * Closes the log segment, then hands it to the archive thread. A segment
+ * compressed while written is already archived. A segment in the hot tier
+ * is moved to the storage in one sequential pass.
+ */
+static void tl_logger_log_file_finish(TLLoggerData *logger_data,
+    TLLogSegment *segment, const gchar *lastlog_filename,
+    const gchar *lastlog_basename)
+{
+    gchar *fullpath;
+    TLCatalogState state;
+    struct stat file_stat;
+    gboolean moved;
+    
+    state = (tl_logseg_flags_get(segment) & TL_LOGSEG_FLAG_COMPRESSED) ?
+        TL_CATALOG_STATE_ARCHIVED : TL_CATALOG_STATE_CLOSED;
+    tl_logseg_close(segment);
+    
+    if(lastlog_filename!=NULL && lastlog_basename!=NULL)
+    {
+        fullpath = tl_logger_segment_path_get(logger_data, lastlog_basename,
+            state);
+        if(logger_data->hot_path!=NULL)
+        {
+            moved = tl_logseg_migrate(lastlog_filename, fullpath);
+        }
+        else
+        {
+            moved = (g_rename(lastlog_filename, fullpath)==0);
+        }
+        if(moved && stat(fullpath, &file_stat)==0)
+        {
+            tl_catalog_segment_state_set(logger_data->catalog,
+                lastlog_basename, state, file_stat.st_size);
+            tl_catalog_sync(logger_data->catalog);
+        }
+        g_free(fullpath);
+    }
+    
+    g_mutex_lock(&(logger_data->cached_log_mutex));
+    tl_logger_log_cache_clear(logger_data);
+    g_mutex_unlock(&(logger_data->cached_log_mutex));
+    
+    g_mutex_lock(&(logger_data->archive_mutex));
+    logger_data->archive_request = TRUE;
+    g_cond_signal(&(logger_data->archive_cond));
+    g_mutex_unlock(&(logger_data->archive_mutex));
+}
+
+/*
+ * Records are buffered and committed together (group commit) when the
+ * buffer reaches log_commit_size, log_commit_interval seconds after the
+ * last commit, or at once after tl_logger_log_flush(). Records in the
+ * cache may not be on disk yet, queries see them anyway. On exit the
+ * queued snapshots are written and committed before the file is closed.
+ * With a hot tier the file is also finished on exit and after
+ * tl_logger_log_migrate(), so its records reach the storage.
+ */
+static gpointer tl_logger_log_write_thread(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    TLLoggerSnapshot *snapshot;
+    TLLoggerCachedRecord *record;
+    GByteArray *ba, *scratch;
+    TLLogSegment *segment = NULL;
+    TLLogFmtWriter *writer;
+    TLLoggerSnapshot *last_snapshot = NULL;
+    guint flags;
+    gchar *lastlog_filename = NULL;
+    gchar *datestr;
+    gchar *lastlog_basename = NULL;
+    gint64 last_write_time = G_MININT64, write_time;
+    gint64 now, last_commit_time = 0, deadline;
+    gboolean force_commit = FALSE, migrate = FALSE, rotate;
+    guint index_countdown = 0;
+    TLCatalogSegment catalog_segment;
+    GDateTime *dt;
+    TLLoggerLogItemData tag_buffers[4];
+    const TLLoggerLogItemData *last_tags[2] = {NULL, NULL};
+    const TLLoggerLogItemData *tags[2];
+    guint tag_count, i;
+    GPtrArray *held;
+    
+    if(user_data==NULL)
+    {
+        return NULL;
+    }
+    
+    memset(tag_buffers, 0, sizeof(tag_buffers));
+    for(i=0;i<4;i++)
+    {
+        tag_buffers[i].name = (i<2) ? TL_LOGGER_TRIGGER_ITEM_NAME :
+            TL_LOGGER_TRIGGER_MSEC_ITEM_NAME;
+        tag_buffers[i].unit = 1.0;
+    }
+    
+    scratch = g_byte_array_new();
+    writer = tl_logfmt_writer_new();
+    held = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logger_snapshot_item_unref);
+    
+    while(TRUE)
+    {
+        g_mutex_lock(&(logger_data->cached_log_mutex));
+        snapshot = g_queue_pop_head(logger_data->write_log_queue);
+        g_mutex_unlock(&(logger_data->cached_log_mutex));
+        
+        if(g_atomic_int_compare_and_exchange(
+            &(logger_data->log_flush_request), 1, 0) ||
+            !logger_data->write_thread_work_flag)
+        {
+            force_commit = TRUE;
+        }
+        if(g_atomic_int_compare_and_exchange(
+            &(logger_data->log_migrate_request), 1, 0))
+        {
+            migrate = TRUE;
+        }
+        now = g_get_monotonic_time();
+        
+        if(snapshot==NULL)
+        {
+            /* The queue is drained, commit what a flush asked for. */
+            if(segment!=NULL && tl_logseg_pending_get(segment)>0 &&
+                (force_commit || now - last_commit_time >=
+                (gint64)g_atomic_int_get(&(logger_data->log_commit_interval)) *
+                G_TIME_SPAN_SECOND))
+            {
+                tl_logseg_commit(segment);
+                last_commit_time = now;
+            }
+            force_commit = FALSE;
+            if(migrate && segment!=NULL)
+            {
+                tl_logger_log_file_finish(logger_data, segment,
+                    lastlog_filename, lastlog_basename);
+                segment = NULL;
+            }
+            migrate = FALSE;
+            
+            if(!logger_data->write_thread_work_flag)
+            {
+                break;
+            }
+            
+            /*
+             * Sleep until a snapshot is queued, a flush is asked for or
+             * the buffered records are due to be committed.
+             */
+            g_mutex_lock(&(logger_data->cached_log_mutex));
+            while(logger_data->write_thread_work_flag &&
+                g_queue_is_empty(logger_data->write_log_queue) &&
+                !g_atomic_int_get(&(logger_data->log_flush_request)) &&
+                !g_atomic_int_get(&(logger_data->log_migrate_request)))
+            {
+                if(segment!=NULL && tl_logseg_pending_get(segment)>0)
+                {
+                    deadline = last_commit_time + (gint64)g_atomic_int_get(
+                        &(logger_data->log_commit_interval)) *
+                        G_TIME_SPAN_SECOND;
+                    if(!g_cond_wait_until(&(logger_data->write_cond),
+                        &(logger_data->cached_log_mutex), deadline))
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    g_cond_wait(&(logger_data->write_cond),
+                        &(logger_data->cached_log_mutex));
+                }
+            }
+            g_mutex_unlock(&(logger_data->cached_log_mutex));
+            continue;
+        }
+        
+        tl_membudget_release(TL_MEMBUDGET_QUEUE_LOG_WRITE, snapshot->bytes);
+        write_time = snapshot->time;
+        
+        if(segment!=NULL && write_time < last_write_time)
+        {
+            /* Log time is not monotonic! */
+            tl_logger_log_file_finish(logger_data, segment, lastlog_filename,
+                lastlog_basename);
+            segment = NULL;
+        }
+        last_write_time = write_time;
+        
+        if(segment==NULL)
+        {
+            /* Every segment declares its signals again. */
+            tl_logfmt_writer_reset(writer);
+        }
+        tl_logfmt_writer_keyframe_interval_set(writer, g_atomic_int_get(
+            &(logger_data->log_keyframe_interval)));
+        
+        /*
+         * Records of a trigger window carry the trigger and the
+         * milliseconds of their time, the first one is a keyframe.
+         */
+        tag_count = 0;
+        if(snapshot->trigger>0)
+        {
+            tags[0] = tl_logger_log_tag_get(&tag_buffers[0], &last_tags[0],
+                snapshot->trigger);
+            tags[1] = tl_logger_log_tag_get(&tag_buffers[2], &last_tags[1],
+                snapshot->real_time / 1000 % 1000);
+            tag_count = 2;
+            if(snapshot->trigger_start)
+            {
+                tl_logfmt_writer_keyframe_request(writer);
+            }
+        }
+        
+        /*
+         * Snapshots are immutable, encode without holding the cache lock.
+         * The writer compares items with the last snapshot, so keep it.
+         */
+        ba = tl_logger_log_to_file_data(writer, snapshot, held, tags,
+            tag_count, &flags);
+        record = tl_logger_cached_record_new(write_time, ba, flags, scratch);
+        if(last_snapshot!=NULL)
+        {
+            tl_logger_snapshot_unref(last_snapshot);
+        }
+        last_snapshot = snapshot;
+        
+        g_mutex_lock(&(logger_data->cached_log_mutex));
+        g_queue_push_tail(logger_data->cached_log_data, record);
+        logger_data->cached_log_bytes += sizeof(TLLoggerCachedRecord) +
+            record->size;
+        tl_membudget_charge(TL_MEMBUDGET_QUEUE_LOG_CACHE,
+            sizeof(TLLoggerCachedRecord) + record->size);
+        
+        g_mutex_unlock(&(logger_data->cached_log_mutex));
+        
+        if(segment==NULL)
+        {
+            if(lastlog_filename!=NULL)
+            {
+                g_free(lastlog_filename);
+            }
+            if(lastlog_basename!=NULL)
+            {
+                g_free(lastlog_basename);
+            }
+            dt = g_date_time_new_from_unix_local(write_time);
+            datestr = g_date_time_format(dt, "%Y%m%d%H%M%S");
+            lastlog_basename = g_strdup_printf("tbl-%s", datestr);
+            g_free(datestr);
+            g_date_time_unref(dt);
+            
+            lastlog_filename = tl_logger_segment_path_get(logger_data,
+                lastlog_basename, TL_CATALOG_STATE_WRITING);
+            
+            segment = tl_logseg_create(lastlog_filename,
+                TL_LOGGER_LOG_SIZE_MAXIUM, g_atomic_int_get(
+                &(logger_data->log_inline_compress)) ?
+                TL_LOGSEG_FLAG_COMPRESSED : 0, g_atomic_int_get(
+                &(logger_data->log_codec)), g_atomic_int_get(
+                &(logger_data->log_codec_level)));
+            last_commit_time = now;
+            index_countdown = 0;
+            if(segment==NULL)
+            {
+                g_byte_array_unref(ba);
+                continue;
+            }
+            
+            memset(&catalog_segment, 0, sizeof(TLCatalogSegment));
+            catalog_segment.name = lastlog_basename;
+            catalog_segment.state = TL_CATALOG_STATE_WRITING;
+            tl_catalog_segment_set(logger_data->catalog, &catalog_segment);
+            tl_catalog_sync(logger_data->catalog);
+        }
+        
+        /*
+         * Index every signal declaration and a keyframe at most every
+         * TL_LOGGER_LOG_INDEX_INTERVAL records, so queries can seek.
+         */
+        if(flags & TL_LOGFMT_RECORD_METADATA)
+        {
+            tl_logseg_index_add(segment, TL_LOGSEG_INDEX_META, write_time,
+                ba->len);
+        }
+        if(snapshot->trigger_start)
+        {
+            tl_logseg_index_add(segment, TL_LOGSEG_INDEX_TRIGGER,
+                write_time, ba->len);
+            index_countdown = TL_LOGGER_LOG_INDEX_INTERVAL;
+        }
+        else if((flags & TL_LOGFMT_RECORD_KEYFRAME) && index_countdown==0)
+        {
+            tl_logseg_index_add(segment, TL_LOGSEG_INDEX_KEYFRAME,
+                write_time, ba->len);
+            index_countdown = TL_LOGGER_LOG_INDEX_INTERVAL;
+        }
+        if(index_countdown>0)
+        {
+            index_countdown--;
+        }
+        
+        tl_logseg_append(segment, ba->data, ba->len);
+        tl_logseg_record_add(segment, write_time);
+        g_byte_array_unref(ba);
+        tl_catalog_segment_record_add(logger_data->catalog, lastlog_basename,
+            write_time);
+        
+        /*
+         * A cache over budget is relieved by closing the file early, the
+         * query thread then finds its records in the archive.
+         */
+        rotate = (tl_logseg_length_get(segment)>=TL_LOGGER_LOG_SIZE_MAXIUM ||
+            tl_membudget_is_over(TL_MEMBUDGET_QUEUE_LOG_CACHE));
+        
+        if(!rotate && (tl_logseg_pending_get(segment)>=
+            (gsize)g_atomic_int_get(&(logger_data->log_commit_size)) ||
+            now - last_commit_time >= (gint64)g_atomic_int_get(
+            &(logger_data->log_commit_interval)) * G_TIME_SPAN_SECOND))
+        {
+            rotate = !tl_logseg_commit(segment);
+            last_commit_time = now;
+        }
+        
+        if(rotate)
+        {
+            tl_logger_log_file_finish(logger_data, segment, lastlog_filename,
+                lastlog_basename);
+            segment = NULL;
+        }
+    }
+    
+    if(segment!=NULL && logger_data->hot_path!=NULL)
+    {
+        tl_logger_log_file_finish(logger_data, segment, lastlog_filename,
+            lastlog_basename);
+    }
+    else if(segment!=NULL)
+    {
+        tl_logseg_close(segment);
+    }
+    
+    if(lastlog_filename!=NULL)
+    {
+        g_free(lastlog_filename);
+    }
+    if(lastlog_basename!=NULL)
+    {
+        g_free(lastlog_basename);
+    }
+    g_byte_array_unref(scratch);
+    tl_logfmt_writer_free(writer);
+    g_ptr_array_unref(held);
+    if(last_snapshot!=NULL)
+    {
+        tl_logger_snapshot_unref(last_snapshot);
+    }
+    
+    return NULL;
+}
+
+/*
+ * Exports the bytes of log records, the bytes written to log files and
+ * the bytes the storage device wrote since start, which together show the
+ * write amplification of the log storage.
+ */
+static void tl_logger_write_stats_export(TLLoggerData *logger_data)
+{
+    guint64 app_bytes, file_bytes, device_bytes;
+    gint64 now;
+    
+    now = g_get_real_time();
+    tl_logseg_stats_get(&app_bytes, &file_bytes);
+    tl_shm_slot_update(logger_data->app_bytes_slot, app_bytes, now);
+    tl_shm_slot_update(logger_data->file_bytes_slot, file_bytes, now);
+    if(logger_data->device_bytes_valid && tl_logseg_device_written_get(
+        logger_data->storage_base_path, &device_bytes))
+    {
+        tl_shm_slot_update(logger_data->device_bytes_slot,
+            device_bytes - logger_data->device_bytes_base, now);
+    }
+}
+
+/* Queues a snapshot for the write thread, which takes a reference. */
+static void tl_logger_log_queue(TLLoggerData *logger_data,
+    TLLoggerSnapshot *snapshot)
+{
+    /*
+     * Every snapshot holds the complete state, so skipping one while
+     * the storage stalls only lowers the record rate of the file.
+     */
+    if(tl_membudget_is_over(TL_MEMBUDGET_QUEUE_LOG_WRITE))
+    {
+        logger_data->dropped_log_count++;
+        return;
+    }
+    
+    if(logger_data->dropped_log_count>0)
+    {
+        g_message("TLLogger skipped %u log records while the write queue "
+            "was over budget.", logger_data->dropped_log_count);
+        logger_data->dropped_log_count = 0;
+    }
+    
+    g_mutex_lock(&(logger_data->cached_log_mutex));
+    g_queue_push_tail(logger_data->write_log_queue,
+        tl_logger_snapshot_ref(snapshot));
+    tl_membudget_charge(TL_MEMBUDGET_QUEUE_LOG_WRITE, snapshot->bytes);
+    g_cond_signal(&(logger_data->write_cond));
+    g_mutex_unlock(&(logger_data->cached_log_mutex));
+}
+
+/*
+ * Takes the snapshots older than limit (or newer than now, after a clock
+ * step) off the trigger ring. Regular records among them are queued for
+ * writing, the others are dropped.
+ */
+static void tl_logger_trigger_ring_trim(TLLoggerData *logger_data,
+    gint64 limit)
+{
+    TLLoggerSnapshot *snapshot;
+    gint64 now;
+    
+    now = g_get_real_time();
+    while((snapshot=g_queue_peek_head(logger_data->trigger_ring))!=NULL &&
+        (snapshot->real_time < limit || snapshot->real_time > now))
+    {
+        g_queue_pop_head(logger_data->trigger_ring);
+        if(snapshot->logged)
+        {
+            tl_logger_log_queue(logger_data, snapshot);
+        }
+        tl_logger_snapshot_unref(snapshot);
+    }
+}
+
+/*
+ * Samples the state every trigger interval. Inside a window the samples
+ * are written, otherwise they wait in the ring as the pre-trigger history,
+ * together with the regular records, which keeps the log in time order.
+ */
+static gboolean tl_logger_trigger_timer_cb(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    TLLoggerSnapshot *snapshot;
+    TLLoggerLogGroup *group;
+    gint64 now;
+    guint i;
+    
+    now = g_get_real_time();
+    snapshot = tl_logger_snapshot_create(logger_data, now);
+    tl_logger_snapshot_publish(logger_data, snapshot);
+    
+    if(logger_data->trigger_window>0)
+    {
+        snapshot->trigger = logger_data->trigger_window;
+        snapshot->trigger_start = logger_data->trigger_window_start;
+        logger_data->trigger_window_start = FALSE;
+        tl_logger_log_queue(logger_data, snapshot);
+        
+        if(g_get_monotonic_time()>=logger_data->trigger_window_end)
+        {
+            g_message("TLLogger closed high-rate log window of trigger %u.",
+                logger_data->trigger_window);
+            logger_data->trigger_window = 0;
+            logger_data->last_timestamp = logger_data->new_timestamp;
+            
+            /* The window records held every group. */
+            logger_data->log_group_default_timestamp =
+                logger_data->new_timestamp;
+            for(i=0;i<logger_data->log_groups->len;i++)
+            {
+                group = g_ptr_array_index(logger_data->log_groups, i);
+                group->last_timestamp = logger_data->new_timestamp;
+            }
+        }
+    }
+    else
+    {
+        g_queue_push_tail(logger_data->trigger_ring,
+            tl_logger_snapshot_ref(snapshot));
+    }
+    
+    tl_logger_trigger_ring_trim(logger_data, now -
+        (gint64)logger_data->trigger_pre * G_USEC_PER_SEC);
+    
+    if(logger_data->trigger_window==0 && logger_data->trigger_pre==0)
+    {
+        logger_data->trigger_timeout_id = 0;
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+static void tl_logger_trigger_timer_start(TLLoggerData *logger_data)
+{
+    if(logger_data->trigger_timeout_id==0)
+    {
+        logger_data->trigger_timeout_id = g_timeout_add(
+            logger_data->trigger_interval, tl_logger_trigger_timer_cb,
+            logger_data);
+    }
+}
+
+/*
+ * Opens a high-rate window, or extends the open one, when the condition
+ * of a trigger becomes true. The ring up to the pre-trigger time of the
+ * trigger becomes the start of the window.
+ */
+static void tl_logger_trigger_fire(TLLoggerData *logger_data,
+    TLLoggerTriggerData *trigger)
+{
+    TLLoggerSnapshot *snapshot;
+    gint64 end;
+    
+    end = g_get_monotonic_time() + (gint64)trigger->post *
+        G_TIME_SPAN_SECOND;
+    
+    if(logger_data->trigger_window==0)
+    {
+        g_message("TLLogger trigger %s opened a high-rate log window.",
+            trigger->name);
+        tl_logger_trigger_ring_trim(logger_data, g_get_real_time() -
+            (gint64)trigger->pre * G_USEC_PER_SEC);
+        logger_data->trigger_window = trigger->id;
+        logger_data->trigger_window_start = TRUE;
+        logger_data->trigger_window_end = end;
+        logger_data->trigger_window_count++;
+        
+        while((snapshot=g_queue_pop_head(logger_data->trigger_ring))!=NULL)
+        {
+            snapshot->trigger = trigger->id;
+            snapshot->trigger_start = logger_data->trigger_window_start;
+            logger_data->trigger_window_start = FALSE;
+            tl_logger_log_queue(logger_data, snapshot);
+            tl_logger_snapshot_unref(snapshot);
+        }
+    }
+    else if(end>logger_data->trigger_window_end)
+    {
+        logger_data->trigger_window_end = end;
+    }
+    
+    tl_logger_trigger_timer_start(logger_data);
+}
+
+/*
+ * Writes a regular record, through the trigger ring while the ring keeps
+ * the pre-trigger history.
+ */
+static void tl_logger_log_record(TLLoggerData *logger_data,
+    guint32 groups)
+{
+    TLLoggerSnapshot *snapshot;
+    
+    snapshot = tl_logger_snapshot_create(logger_data, g_get_real_time());
+    snapshot->groups = groups;
+    tl_logger_snapshot_publish(logger_data, snapshot);
+    
+    if(logger_data->trigger_timeout_id>0)
+    {
+        snapshot->logged = TRUE;
+        g_queue_push_tail(logger_data->trigger_ring,
+            tl_logger_snapshot_ref(snapshot));
+    }
+    else
+    {
+        tl_logger_log_queue(logger_data, snapshot);
+    }
+}
+
+static gboolean tl_logger_log_update_timer_cb(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    
+    tl_logger_write_stats_export(logger_data);
+    
+    /* With log groups their timer writes the records. */
+    if(logger_data->log_groups->len==0 &&
+        logger_data->new_timestamp > logger_data->last_timestamp +
+        (gint64)10000000)
+    {
+        /* An open trigger window writes every sample already. */
+        if(logger_data->trigger_window==0)
+        {
+            tl_logger_log_record(logger_data, G_MAXUINT32);
+        }
+                
+        logger_data->last_timestamp = logger_data->new_timestamp;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * A group is due when its interval passed and data arrived since it was
+ * last sampled, last_timestamp is only moved forward when it is sampled.
+ */
+static inline gboolean tl_logger_log_group_due(gint64 *next_due,
+    gint64 *last_timestamp, guint interval, gint64 new_timestamp,
+    gint64 now, gint64 slack)
+{
+    if(now + slack < *next_due || new_timestamp<=*last_timestamp)
+    {
+        return FALSE;
+    }
+    
+    *last_timestamp = new_timestamp;
+    *next_due += (gint64)interval * G_TIME_SPAN_MILLISECOND;
+    if(*next_due<now)
+    {
+        *next_due = now + (gint64)interval * G_TIME_SPAN_MILLISECOND;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Runs at the shortest log group interval and writes a record sampling
+ * the groups which are due, bit 0 is the default group of the signals
+ * in no group, sampled every log update timeout.
+ */
+static gboolean tl_logger_log_group_timer_cb(gpointer user_data)
+{
+    TLLoggerData *logger_data = (TLLoggerData *)user_data;
+    TLLoggerLogGroup *group;
+    guint32 due = 0;
+    gint64 now, slack;
+    guint i;
+    
+    /* An open trigger window writes every sample already. */
+    if(logger_data->trigger_window>0)
+    {
+        return TRUE;
+    }
+    
+    now = g_get_monotonic_time();
+    slack = (gint64)logger_data->log_group_tick *
+        G_TIME_SPAN_MILLISECOND / 2;
+    
+    if(tl_logger_log_group_due(&(logger_data->log_group_default_due),
+        &(logger_data->log_group_default_timestamp),
+        logger_data->log_update_timeout, logger_data->new_timestamp, now,
+        slack))
+    {
+        due |= 1;
+    }
+    for(i=0;i<logger_data->log_groups->len;i++)
+    {
+        group = g_ptr_array_index(logger_data->log_groups, i);
+        if(tl_logger_log_group_due(&(group->next_due),
+            &(group->last_timestamp), group->interval,
+            logger_data->new_timestamp, now, slack))
+        {
+            due |= 1U << (i + 1);
+        }
+    }
+    
+    if(due==0)
+    {
+        return TRUE;
+    }
+    
+    tl_logger_log_record(logger_data, due);
+    logger_data->last_timestamp = logger_data->new_timestamp;
+    
+    return TRUE;
+}
+
+/* Restarts the log group timer after the groups or intervals changed. */
+static void tl_logger_log_group_timer_restart(TLLoggerData *logger_data)
+{
+    TLLoggerLogGroup *group;
+    gint64 now;
+    guint i;
+    
+    if(logger_data->log_group_timeout_id>0)
+    {
+        g_source_remove(logger_data->log_group_timeout_id);
+        logger_data->log_group_timeout_id = 0;
+    }
+    if(logger_data->log_groups->len==0)
+    {
+        return;
+    }
+    
+    now = g_get_monotonic_time();
+    logger_data->log_group_tick = logger_data->log_update_timeout;
+    logger_data->log_group_default_due = now;
+    for(i=0;i<logger_data->log_groups->len;i++)
+    {
+        group = g_ptr_array_index(logger_data->log_groups, i);
+        group->next_due = now;
+        logger_data->log_group_tick = MIN(logger_data->log_group_tick,
+            group->interval);
+    }
+    
+    logger_data->log_group_timeout_id = g_timeout_add(
+        logger_data->log_group_tick, tl_logger_log_group_timer_cb,
+        logger_data);
+}
+
+/* Moves the current signals to their log groups after a change. */
+static void tl_logger_log_group_resolve(TLLoggerData *logger_data)
+{
+    TLLoggerCurrentItemData *current_item;
+    guint i, group;
+    
+    for(i=0;i<logger_data->current_slots->len;i++)
+    {
+        current_item = g_ptr_array_index(logger_data->current_slots, i);
+        group = tl_logger_log_group_lookup(logger_data,
+            current_item->data.name);
+        if(group==current_item->group)
+        {
+            continue;
+        }
+        current_item->group = group;
+        if(!current_item->dirty)
+        {
+            current_item->dirty = TRUE;
+            g_array_append_val(logger_data->dirty_slots, current_item->slot);
+        }
+    }
+}
+
+/* Counts the records of a log file and their time range. */
+static gboolean tl_logger_catalog_scan_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    TLCatalogSegment *segment = (TLCatalogSegment *)user_data;
+    gint64 time;
+    
+    if(type==TL_LOGFMT_FRAME_META || !tl_logfmt_frame_time_get(type,
+        payload, len, &time))
+    {
+        return TRUE;
+    }
+    if(segment->records==0 || time<segment->first_time)
+    {
+        segment->first_time = time;
+    }
+    if(segment->records==0 || time>segment->last_time)
+    {
+        segment->last_time = time;
+    }
+    segment->records++;
+    
+    return TRUE;
+}
+
+static void tl_logger_catalog_scan(const gchar *path,
+    TLCatalogSegment *segment)
+{
+    GInputStream *istream;
+    TLLogFmtScanner *scanner;
+    GError *error = NULL;
+    guint8 buffer[4096];
+    gssize read_size;
     
-    if(user_data==NULL)
-    {
-        return NULL;
-    }
+    segment->records = 0;
+    segment->first_time = 0;
+    segment->last_time = 0;
     
-    log_dir = g_dir_open(logger_data->storage_base_path, 0, &error);
-    if(error!=NULL)
+    istream = tl_codec_file_read(path, &error);
+    if(istream==NULL)
     {
-        g_warning("TLLogger cannot open log storage directionary: %s",
+        g_warning("TLLogger cannot open log file %s: %s", path,
             error->message);
         g_clear_error(&error);
-        return NULL;
+        return;
     }
     
-    logger_data->archive_thread_work_flag = TRUE;
-    
-    while(logger_data->archive_thread_work_flag)
+    scanner = tl_logfmt_scanner_new();
+    while((read_size=g_input_stream_read(istream, buffer, sizeof(buffer),
+        NULL, NULL))>0)
     {
-        if(logger_data->archive_thread_wait_countdown>0)
-        {
-            logger_data->archive_thread_wait_countdown--;
-            g_usleep(1000000);
-        }
-        else /* Scan unarchived log every 60s. */
-        {
-            if(statvfs(logger_data->storage_base_path, &statbuf)==0)
-            {
-                freespace = (guint64)statbuf.f_bavail * statbuf.f_bsize;
-                freeinodes = statbuf.f_favail;
-                
-                if(freespace < TL_LOGGER_LOG_FREE_SPACE_MINIUM ||
-                    freeinodes < TL_LOGGER_LOG_FREE_NODE_MINIUM)
-                {
-                    /* Clear the disk for more space or inodes */
-                    tl_logger_archives_clear_old(logger_data, freespace,
-                        freeinodes);
-                }
-            }
-            else
-            {
-                g_warning("TLLogger cannot stat storage directory: %s",
-                    strerror(errno));
-            }
-            
-            while((filename=g_dir_read_name(log_dir))!=NULL)
-            {
-                if(g_str_has_suffix(filename, ".tl"))
-                {
-                    fullpath = g_build_filename(
-                        logger_data->storage_base_path, filename, NULL);
-                    if(tl_logger_log_archive_compress_file(logger_data,
-                        fullpath))
-                    {
-                        g_remove(fullpath);
-                    }
-                    g_free(fullpath);
-                }
-            }
-            
-            g_dir_rewind(log_dir);
-            
-            logger_data->archive_thread_wait_countdown = 60;
-        }
+        tl_logfmt_scanner_feed(scanner, buffer, read_size,
+            tl_logger_catalog_scan_cb, segment);
     }
-    
-    g_dir_close(log_dir);
-    
-    return NULL;
+    tl_logfmt_scanner_free(scanner);
+    g_object_unref(istream);
 }
 
-static gpointer tl_logger_log_write_thread(gpointer user_data)
+/*
+ * Fills in the records of a segment which was being written, from its
+ * recovered checkpoint if it has one, else by scanning the file.
+ */
+static void tl_logger_catalog_segment_recover(const gchar *path,
+    TLCatalogSegment *segment, GHashTable *recovered)
 {
-    TLLoggerData *logger_data = (TLLoggerData *)user_data;
-    GHashTable *item_data;
-    GByteArray *ba;
-    int fd = -1;
-    ssize_t written_size = 0, rsize;
-    gchar *lastlog_filename = NULL;
-    gchar *datestr, *filename, *fullpath;
-    gchar *lastlog_basename = NULL;
-    gint64 last_write_time = G_MININT64, write_time;
-    TLLoggerLogItemData *time_item;
-    GDateTime *dt;
+    const TLCatalogSegment *recovered_segment;
     
-    if(user_data==NULL)
+    recovered_segment = g_hash_table_lookup(recovered, segment->name);
+    if(recovered_segment!=NULL)
     {
-        return NULL;
+        segment->records = recovered_segment->records;
+        segment->first_time = recovered_segment->first_time;
+        segment->last_time = recovered_segment->last_time;
+    }
+    else
+    {
+        tl_logger_catalog_scan(path, segment);
     }
+}
+
+/*
+ * Loads the segment catalog and checks it against the log files after a
+ * restart. Entries of removed files are dropped, files missing from the
+ * catalog are scanned, segments which were being written take the records
+ * recovered from their checkpoint (or are scanned without one), and
+ * segment files left behind by an interrupted archive pass are removed.
+ */
+static void tl_logger_catalog_load(TLLoggerData *logger_data,
+    GHashTable *recovered)
+{
+    GDir *log_dir;
+    const gchar *filename;
+    gchar *path, *name, *index_path;
+    GHashTable *names;
+    GHashTableIter iter;
+    GPtrArray *segments;
+    TLCatalogSegment *segment;
+    struct stat file_stat;
+    gsize base_len;
+    guint i, resolution;
     
-    logger_data->write_thread_work_flag = TRUE;
+    path = g_build_filename(logger_data->storage_base_path,
+        TL_LOGGER_CATALOG_FILENAME, NULL);
+    logger_data->catalog = tl_catalog_open(path);
+    g_free(path);
     
-    while(logger_data->write_thread_work_flag)
+    names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    segments = tl_catalog_segments_list(logger_data->catalog,
+        TL_CATALOG_STATE_ALL, FALSE, 0, FALSE, 0);
+    for(i=0;i<segments->len;i++)
     {
-        g_mutex_lock(&(logger_data->cached_log_mutex));
-        
-        logger_data->last_saved_data = g_queue_pop_head_link(
-            logger_data->write_log_queue);
-        
-        if(logger_data->last_saved_data==NULL)
+        segment = g_ptr_array_index(segments, i);
+        g_hash_table_add(names, g_strdup(segment->name));
+    }
+    g_ptr_array_unref(segments);
+    
+    log_dir = g_dir_open(logger_data->storage_base_path, 0, NULL);
+    while(log_dir!=NULL && (filename=g_dir_read_name(log_dir))!=NULL)
+    {
+        if(g_str_has_suffix(filename, ".tl"))
         {
-            g_mutex_unlock(&(logger_data->cached_log_mutex));
-            g_usleep(100000);
-            continue;
+            g_hash_table_add(names, g_strndup(filename,
+                strlen(filename) - 3));
         }
-        
-        item_data = logger_data->last_saved_data->data;
-        if(item_data==NULL)
+        else if(g_str_has_suffix(filename, ".tlz"))
         {
-            g_list_free_full(logger_data->last_saved_data,
-                (GDestroyNotify)tl_logger_log_item_data_free);
-            logger_data->last_saved_data = NULL;
-            g_mutex_unlock(&(logger_data->cached_log_mutex));
-            g_usleep(100000);
-            continue;
+            g_hash_table_add(names, g_strndup(filename,
+                strlen(filename) - 4));
         }
-        
-        time_item = g_hash_table_lookup(item_data, "time");
-        if(time_item==NULL)
+    }
+    if(log_dir!=NULL)
+    {
+        g_dir_close(log_dir);
+    }
+    
+    g_hash_table_iter_init(&iter, names);
+    while(g_hash_table_iter_next(&iter, (gpointer *)&name, NULL))
+    {
+        segment = tl_catalog_segment_lookup(logger_data->catalog, name);
+        if(segment==NULL)
         {
-            g_list_free_full(logger_data->last_saved_data,
-                (GDestroyNotify)tl_logger_log_item_data_free);
-            logger_data->last_saved_data = NULL;
-            g_mutex_unlock(&(logger_data->cached_log_mutex));
-            g_usleep(100000);
-            continue;
+            segment = g_new0(TLCatalogSegment, 1);
+            segment->name = g_strdup(name);
+            segment->state = TL_CATALOG_STATE_WRITING;
         }
         
-        write_time = time_item->value;
-        
-        if(fd>=0 && write_time < last_write_time)
+        path = tl_logger_segment_path_get(logger_data, name,
+            TL_CATALOG_STATE_CLOSED);
+        if(g_file_test(path, G_FILE_TEST_EXISTS))
         {
-            /* Log time is not monotonic! */
-            fsync(fd);
-            close(fd);
-            fd = -1;
-            
-            if(lastlog_filename!=NULL && lastlog_basename!=NULL)
+            if(segment->state==TL_CATALOG_STATE_WRITING)
             {
-                filename = g_strdup_printf("%s.tl", lastlog_basename);
-                fullpath = g_build_filename(
-                    logger_data->storage_base_path, filename, NULL);
-                g_free(filename);
-                
-                g_rename(lastlog_basename, fullpath);
-                
-                g_free(fullpath);
+                tl_logger_catalog_segment_recover(path, segment, recovered);
             }
-            
-            g_queue_free_full(logger_data->cached_log_data,
-                (GDestroyNotify)g_hash_table_unref);
-            logger_data->cached_log_data = g_queue_new();
-            logger_data->last_saved_data = NULL;
-            
-            logger_data->archive_thread_wait_countdown = 0;
+            segment->state = TL_CATALOG_STATE_CLOSED;
         }
-        last_write_time = write_time;
+        g_free(path);
         
-        ba = tl_logger_log_to_file_data(item_data);
-        
-        g_queue_push_tail_link(logger_data->cached_log_data,
-            logger_data->last_saved_data);
-        
-        g_mutex_unlock(&(logger_data->cached_log_mutex));
-        
-        if(fd<0)
+        path = tl_logger_segment_path_get(logger_data, name,
+            TL_CATALOG_STATE_ARCHIVED);
+        if(g_file_test(path, G_FILE_TEST_EXISTS))
         {
-            if(lastlog_filename!=NULL)
+            if(segment->state==TL_CATALOG_STATE_WRITING)
             {
-                g_free(lastlog_filename);
+                tl_logger_catalog_segment_recover(path, segment, recovered);
             }
-            if(lastlog_basename!=NULL)
+            else if(segment->state==TL_CATALOG_STATE_CLOSED)
             {
-                g_free(lastlog_basename);
+                /* The archive is complete, drop what the pass left. */
+                g_free(path);
+                path = tl_logger_segment_path_get(logger_data, name,
+                    TL_CATALOG_STATE_CLOSED);
+                g_remove(path);
+                index_path = tl_logseg_index_path_get(path);
+                g_remove(index_path);
+                g_free(index_path);
+                g_free(path);
+                path = tl_logger_segment_path_get(logger_data, name,
+                    TL_CATALOG_STATE_ARCHIVED);
             }
-            dt = g_date_time_new_from_unix_local(write_time);
-            datestr = g_date_time_format(dt, "%Y%m%d%H%M%S");
-            lastlog_basename = g_strdup_printf("tbl-%s", datestr);
-            filename = g_strdup_printf("%s.tlw", lastlog_basename);
-            g_free(datestr);
-            g_date_time_unref(dt);
-            
-            lastlog_filename = g_build_filename(
-                logger_data->storage_base_path, filename, NULL);
-            g_free(filename);
-            
-            fd = open(lastlog_filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-            written_size = 0;
+            segment->state = TL_CATALOG_STATE_ARCHIVED;
         }
         
-        rsize = write(fd, ba->data, ba->len);
-        g_byte_array_unref(ba);
-        fsync(fd);
-        
-        if(rsize>0)
+        if(segment->state==TL_CATALOG_STATE_WRITING)
         {
-            written_size += rsize;
+            tl_catalog_segment_remove(logger_data->catalog, name);
         }
-        
-        if(rsize<=0 || written_size>=TL_LOGGER_LOG_SIZE_MAXIUM)
+        else
         {
-            fsync(fd);
-            close(fd);
-            fd = -1;
-            
-            if(lastlog_filename!=NULL && lastlog_basename!=NULL)
+            g_free(path);
+            path = tl_logger_segment_path_get(logger_data, name,
+                segment->state);
+            if(stat(path, &file_stat)==0)
             {
-                filename = g_strdup_printf("%s.tl", lastlog_basename);
-                fullpath = g_build_filename(
-                    logger_data->storage_base_path, filename, NULL);
-                g_free(filename);
-                
-                g_rename(lastlog_basename, fullpath);
-                
-                g_free(fullpath);
+                segment->size = file_stat.st_size;
             }
-            
-            g_mutex_lock(&(logger_data->cached_log_mutex));
-            g_queue_free_full(logger_data->cached_log_data,
-                (GDestroyNotify)g_hash_table_unref);
-            logger_data->cached_log_data = g_queue_new();
-            logger_data->last_saved_data = NULL;
-            g_mutex_unlock(&(logger_data->cached_log_mutex));
-            
-            logger_data->archive_thread_wait_countdown = 0;
+            tl_catalog_segment_set(logger_data->catalog, segment);
+        }
+        g_free(path);
+        tl_catalog_segment_free(segment);
+    }
+    g_hash_table_unref(names);
+    
+    /*
+     * A downsampled segment replaces its source only after it is
+     * complete, drop the sources a crash left behind.
+     */
+    names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    segments = tl_catalog_segments_list(logger_data->catalog,
+        TL_CATALOG_STATE_ALL, FALSE, 0, FALSE, 0);
+    for(i=0;i<segments->len;i++)
+    {
+        segment = g_ptr_array_index(segments, i);
+        resolution = tl_logger_segment_resolution_get(segment->name,
+            &base_len);
+        name = g_strndup(segment->name, base_len);
+        if(GPOINTER_TO_UINT(g_hash_table_lookup(names, name))<resolution)
+        {
+            g_hash_table_replace(names, name, GUINT_TO_POINTER(resolution));
+        }
+        else
+        {
+            g_free(name);
         }
-        
     }
-    
-    if(lastlog_filename!=NULL)
+    for(i=0;i<segments->len;i++)
     {
-        g_free(lastlog_filename);
+        segment = g_ptr_array_index(segments, i);
+        resolution = tl_logger_segment_resolution_get(segment->name,
+            &base_len);
+        name = g_strndup(segment->name, base_len);
+        if(resolution<GPOINTER_TO_UINT(g_hash_table_lookup(names, name)))
+        {
+            path = tl_logger_segment_path_get(logger_data, segment->name,
+                segment->state);
+            g_remove(path);
+            g_free(path);
+            tl_catalog_segment_remove(logger_data->catalog, segment->name);
+        }
+        g_free(name);
     }
+    g_ptr_array_unref(segments);
+    g_hash_table_unref(names);
     
-    return NULL;
+    tl_catalog_sync(logger_data->catalog);
 }
 
-static gboolean tl_logger_log_update_timer_cb(gpointer user_data)
+/*
+ * Moves the segments a crash or a restart left in the hot tier to the
+ * storage, where they are recovered like any other unfinished segment.
+ * Only their committed data is copied.
+ */
+static void tl_logger_hot_tier_drain(TLLoggerData *logger_data)
 {
-    TLLoggerData *logger_data = (TLLoggerData *)user_data;
-    TLLoggerLogItemData *item_data, *dup_data;
-    GHashTableIter iter;
-    GDateTime *dt;
-    GHashTable *dup_table;
+    GDir *hot_dir;
+    GError *error = NULL;
+    const gchar *filename;
+    gchar *fullpath, *newpath;
     
-    if(logger_data->new_timestamp > logger_data->last_timestamp +
-        (gint64)10000000)
+    hot_dir = g_dir_open(logger_data->hot_path, 0, &error);
+    if(hot_dir==NULL)
     {
-        dt = g_date_time_new_now_local();
-        dup_table = g_hash_table_new_full(g_str_hash,
-            g_str_equal, NULL, (GDestroyNotify)tl_logger_log_item_data_free);
-        item_data = g_new0(TLLoggerLogItemData, 1);
-        item_data->name = g_strdup("time");
-        item_data->value = g_date_time_to_unix(dt);
-        g_date_time_unref(dt);
-        item_data->unit = 1.0;
-        item_data->source = 0;
-        g_hash_table_replace(dup_table, item_data->name, item_data);
-        
-        g_hash_table_iter_init(&iter, logger_data->last_log_data);
-        while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&item_data))
+        g_warning("TLLogger cannot open hot log directory: %s",
+            error->message);
+        g_clear_error(&error);
+        return;
+    }
+    
+    while((filename=g_dir_read_name(hot_dir))!=NULL)
+    {
+        if(!g_str_has_suffix(filename, ".tlw"))
         {
-            if(item_data==NULL)
-            {
-                continue;
-            }
-            dup_data = tl_logger_log_item_data_dup(item_data);
-            g_hash_table_replace(dup_table, dup_data->name, dup_data);
+            continue;
         }
-        
-        g_mutex_lock(&(logger_data->cached_log_mutex));
-        g_queue_push_tail(logger_data->write_log_queue, dup_table);
-        g_mutex_unlock(&(logger_data->cached_log_mutex));
-                
-        logger_data->last_timestamp = logger_data->new_timestamp;
+        fullpath = g_build_filename(logger_data->hot_path, filename, NULL);
+        newpath = g_build_filename(logger_data->storage_base_path, filename,
+            NULL);
+        if(!tl_logseg_recover(fullpath, NULL, NULL, NULL))
+        {
+            tl_logseg_trim(fullpath);
+        }
+        if(!tl_logseg_migrate(fullpath, newpath))
+        {
+            g_warning("TLLogger cannot move log file %s from the hot tier.",
+                fullpath);
+        }
+        g_free(newpath);
+        g_free(fullpath);
     }
     
-    return TRUE;
+    g_dir_close(hot_dir);
 }
 
-gboolean tl_logger_init(const gchar *storage_base_path)
+gboolean tl_logger_init(const gchar *storage_base_path, const gchar *hot_path)
 {
     GDir *log_dir;
     GError *error = NULL;
     const gchar *filename;
     gchar *fullpath, *newpath;
     size_t slen;
+    guint flags;
+    GHashTable *recovered;
+    TLCatalogSegment *segment;
     
     if(g_tl_logger_data.initialized)
     {
@@ -1277,11 +2833,29 @@ gboolean tl_logger_init(const gchar *storage_base_path)
     
     g_mutex_init(&(g_tl_logger_data.cached_log_mutex));
     g_mutex_init(&(g_tl_logger_data.query_queue_mutex));
+    g_mutex_init(&(g_tl_logger_data.archive_mutex));
+    g_cond_init(&(g_tl_logger_data.write_cond));
+    g_cond_init(&(g_tl_logger_data.query_cond));
+    g_cond_init(&(g_tl_logger_data.archive_cond));
     
     g_tl_logger_data.cached_log_data = g_queue_new();
     g_tl_logger_data.write_log_queue = g_queue_new();
     g_tl_logger_data.query_queue = g_queue_new();
     
+    g_tl_logger_data.current_string_chunk = g_string_chunk_new(4096);
+    tl_logger_slab_init(&(g_tl_logger_data.current_item_slab),
+        sizeof(TLLoggerCurrentItemData), TL_LOGGER_ITEM_SLAB_BLOCK_SIZE);
+    tl_logger_slab_init(&(g_tl_logger_data.current_value_slab),
+        sizeof(TLLoggerCurrentValueData), TL_LOGGER_VALUE_SLAB_BLOCK_SIZE);
+    g_tl_logger_data.current_slots = g_ptr_array_new();
+    g_tl_logger_data.dirty_slots = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_tl_logger_data.log_groups = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logger_log_group_free);
+    g_tl_logger_data.triggers = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logger_trigger_data_free);
+    g_tl_logger_data.trigger_ring = g_queue_new();
+    g_tl_logger_data.trigger_interval = TL_LOGGER_TRIGGER_INTERVAL_DEFAULT;
+    
     if(storage_base_path!=NULL)
     {
         g_tl_logger_data.storage_base_path = g_strdup(storage_base_path);
@@ -1302,16 +2876,58 @@ gboolean tl_logger_init(const gchar *storage_base_path)
         return FALSE;
     }
     
+    if(hot_path!=NULL)
+    {
+        g_tl_logger_data.hot_path = g_strdup(hot_path);
+        tl_logger_hot_tier_drain(&g_tl_logger_data);
+    }
+    
+    recovered = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+        (GDestroyNotify)tl_catalog_segment_free);
     while((filename=g_dir_read_name(log_dir))!=NULL)
     {
-        if(g_str_has_suffix(filename, ".tlw"))
+        if(g_str_has_suffix(filename, ".part"))
+        {
+            /* A copy from the hot tier cut short, the source is kept. */
+            fullpath = g_build_filename(g_tl_logger_data.storage_base_path,
+                filename, NULL);
+            g_remove(fullpath);
+            g_free(fullpath);
+        }
+        else if(g_str_has_suffix(filename, ".tlw"))
         {
             fullpath = g_build_filename(g_tl_logger_data.storage_base_path,
                 filename, NULL);
             newpath = g_strdup(fullpath);
             slen = strlen(newpath);
-            newpath[slen-1] = '\0';
             
+            /*
+             * Drop the unused preallocated space, uncommitted records and
+             * records torn by the crash, checking only the last commit.
+             * A compressed segment stops at its last flush and goes to the
+             * archive as is, readers stop at the end of its data.
+             */
+            segment = g_new0(TLCatalogSegment, 1);
+            if(tl_logseg_recover(fullpath, &(segment->records),
+                &(segment->first_time), &(segment->last_time)))
+            {
+                segment->name = g_strndup(filename, strlen(filename) - 4);
+                g_hash_table_replace(recovered, segment->name, segment);
+            }
+            else
+            {
+                tl_catalog_segment_free(segment);
+                tl_logseg_trim(fullpath);
+            }
+            if(tl_logseg_header_get(fullpath, &flags, NULL) &&
+                (flags & TL_LOGSEG_FLAG_COMPRESSED))
+            {
+                newpath[slen-1] = 'z';
+            }
+            else
+            {
+                newpath[slen-1] = '\0';
+            }
             g_rename(fullpath, newpath);
             
             g_free(newpath);
@@ -1321,12 +2937,37 @@ gboolean tl_logger_init(const gchar *storage_base_path)
     
     g_dir_close(log_dir);
     
+    tl_logger_catalog_load(&g_tl_logger_data, recovered);
+    g_hash_table_unref(recovered);
+    
     g_tl_logger_data.log_update_timeout = 10000;
+    g_tl_logger_data.log_keyframe_interval =
+        TL_LOGGER_LOG_KEYFRAME_INTERVAL_DEFAULT;
+    g_tl_logger_data.log_commit_size = TL_LOGGER_LOG_COMMIT_SIZE_DEFAULT;
+    g_tl_logger_data.log_commit_interval =
+        TL_LOGGER_LOG_COMMIT_INTERVAL_DEFAULT;
+    g_tl_logger_data.log_codec = TL_CODEC_ZLIB;
+    g_tl_logger_data.log_codec_level = tl_codec_level_default_get(
+        TL_CODEC_ZLIB);
+    
+    g_tl_logger_data.app_bytes_slot = tl_shm_slot_add("logger.app-bytes",
+        1.0, 0, 0);
+    g_tl_logger_data.file_bytes_slot = tl_shm_slot_add("logger.file-bytes",
+        1.0, 0, 0);
+    g_tl_logger_data.device_bytes_slot = tl_shm_slot_add(
+        "logger.device-bytes", 1.0, 0, 0);
+    g_tl_logger_data.device_bytes_valid = tl_logseg_device_written_get(
+        g_tl_logger_data.storage_base_path,
+        &(g_tl_logger_data.device_bytes_base));
     
     g_tl_logger_data.log_update_timeout_id = g_timeout_add(
         g_tl_logger_data.log_update_timeout,
         tl_logger_log_update_timer_cb, &g_tl_logger_data);
     
+    g_tl_logger_data.write_thread_work_flag = TRUE;
+    g_tl_logger_data.archive_thread_work_flag = TRUE;
+    g_tl_logger_data.query_thread_work_flag = TRUE;
+    
     g_tl_logger_data.write_thread = g_thread_new("tl-logger-write-thread",
         tl_logger_log_write_thread, &g_tl_logger_data);
         
@@ -1343,6 +2984,9 @@ gboolean tl_logger_init(const gchar *storage_base_path)
 
 void tl_logger_uninit()
 {
+    TLLoggerSnapshot *snapshot;
+    guint64 app_bytes, file_bytes, device_bytes;
+    
     if(!g_tl_logger_data.initialized)
     {
         return;
@@ -1353,34 +2997,111 @@ void tl_logger_uninit()
         g_source_remove(g_tl_logger_data.log_update_timeout_id);
         g_tl_logger_data.log_update_timeout_id = 0;
     }
+    if(g_tl_logger_data.log_group_timeout_id>0)
+    {
+        g_source_remove(g_tl_logger_data.log_group_timeout_id);
+        g_tl_logger_data.log_group_timeout_id = 0;
+    }
+    if(g_tl_logger_data.trigger_timeout_id>0)
+    {
+        g_source_remove(g_tl_logger_data.trigger_timeout_id);
+        g_tl_logger_data.trigger_timeout_id = 0;
+    }
+    
+    /* Regular records still waiting in the trigger ring go to the file. */
+    tl_logger_trigger_ring_trim(&g_tl_logger_data, G_MAXINT64);
+    if(g_tl_logger_data.trigger_window_count>0)
+    {
+        g_message("TLLogger opened %u high-rate log windows.",
+            g_tl_logger_data.trigger_window_count);
+    }
     
     if(g_tl_logger_data.query_thread!=NULL)
     {
+        g_mutex_lock(&(g_tl_logger_data.query_queue_mutex));
         g_tl_logger_data.query_thread_work_flag = FALSE;
+        g_cond_signal(&(g_tl_logger_data.query_cond));
+        g_mutex_unlock(&(g_tl_logger_data.query_queue_mutex));
         g_thread_join(g_tl_logger_data.query_thread);
         g_tl_logger_data.query_thread = NULL;
     }
     
     if(g_tl_logger_data.write_thread!=NULL)
     {
+        g_mutex_lock(&(g_tl_logger_data.cached_log_mutex));
         g_tl_logger_data.write_thread_work_flag = FALSE;
+        g_cond_signal(&(g_tl_logger_data.write_cond));
+        g_mutex_unlock(&(g_tl_logger_data.cached_log_mutex));
         g_thread_join(g_tl_logger_data.write_thread);
         g_tl_logger_data.write_thread = NULL;
     }
     
+    tl_logseg_stats_get(&app_bytes, &file_bytes);
+    g_message("TLLogger wrote %"G_GUINT64_FORMAT" bytes of log records as %"
+        G_GUINT64_FORMAT" bytes to log files.", app_bytes, file_bytes);
+    if(g_tl_logger_data.device_bytes_valid && tl_logseg_device_written_get(
+        g_tl_logger_data.storage_base_path, &device_bytes))
+    {
+        g_message("TLLogger storage device wrote %"G_GUINT64_FORMAT
+            " bytes meanwhile.", device_bytes -
+            g_tl_logger_data.device_bytes_base);
+    }
+    
     if(g_tl_logger_data.archive_thread!=NULL)
     {
-        g_tl_logger_data.archive_thread_work_flag = FALSE;
-        g_tl_logger_data.archive_thread_wait_countdown = 0;
+        g_mutex_lock(&(g_tl_logger_data.archive_mutex));
+        g_atomic_int_set(&(g_tl_logger_data.archive_thread_work_flag),
+            FALSE);
+        g_cond_signal(&(g_tl_logger_data.archive_cond));
+        g_mutex_unlock(&(g_tl_logger_data.archive_mutex));
         g_thread_join(g_tl_logger_data.archive_thread);
         g_tl_logger_data.archive_thread = NULL;
     }
 
+    if(g_tl_logger_data.catalog!=NULL)
+    {
+        tl_catalog_sync(g_tl_logger_data.catalog);
+        tl_catalog_free(g_tl_logger_data.catalog);
+        g_tl_logger_data.catalog = NULL;
+    }
+    
     if(g_tl_logger_data.last_log_data!=NULL)
     {
         g_hash_table_unref(g_tl_logger_data.last_log_data);
         g_tl_logger_data.last_log_data = NULL;
     }
+    if(g_tl_logger_data.current_slots!=NULL)
+    {
+        g_ptr_array_unref(g_tl_logger_data.current_slots);
+        g_tl_logger_data.current_slots = NULL;
+    }
+    if(g_tl_logger_data.dirty_slots!=NULL)
+    {
+        g_array_unref(g_tl_logger_data.dirty_slots);
+        g_tl_logger_data.dirty_slots = NULL;
+    }
+    if(g_tl_logger_data.log_groups!=NULL)
+    {
+        g_ptr_array_unref(g_tl_logger_data.log_groups);
+        g_tl_logger_data.log_groups = NULL;
+    }
+    if(g_tl_logger_data.triggers!=NULL)
+    {
+        g_ptr_array_unref(g_tl_logger_data.triggers);
+        g_tl_logger_data.triggers = NULL;
+    }
+    if(g_tl_logger_data.trigger_ring!=NULL)
+    {
+        g_queue_free(g_tl_logger_data.trigger_ring);
+        g_tl_logger_data.trigger_ring = NULL;
+    }
+    tl_logger_slab_clear(&(g_tl_logger_data.current_item_slab));
+    tl_logger_slab_clear(&(g_tl_logger_data.current_value_slab));
+    if(g_tl_logger_data.current_string_chunk!=NULL)
+    {
+        g_string_chunk_free(g_tl_logger_data.current_string_chunk);
+        g_tl_logger_data.current_string_chunk = NULL;
+    }
     
     if(g_tl_logger_data.query_queue!=NULL)
     {
@@ -1390,35 +3111,71 @@ void tl_logger_uninit()
     
     if(g_tl_logger_data.write_log_queue!=NULL)
     {
-        g_queue_free_full(g_tl_logger_data.write_log_queue,
-            (GDestroyNotify)g_hash_table_unref);
+        while((snapshot=g_queue_pop_head(
+            g_tl_logger_data.write_log_queue))!=NULL)
+        {
+            tl_membudget_release(TL_MEMBUDGET_QUEUE_LOG_WRITE,
+                snapshot->bytes);
+            tl_logger_snapshot_unref(snapshot);
+        }
+        g_queue_free(g_tl_logger_data.write_log_queue);
         g_tl_logger_data.write_log_queue = NULL;
     }
     if(g_tl_logger_data.cached_log_data!=NULL)
     {
-        g_queue_free_full(g_tl_logger_data.cached_log_data,
-            (GDestroyNotify)g_hash_table_unref);
+        tl_logger_log_cache_clear(&g_tl_logger_data);
+        g_queue_free(g_tl_logger_data.cached_log_data);
         g_tl_logger_data.cached_log_data = NULL;
     }
     
+    g_slist_free_full(g_tl_logger_data.retired_snapshots,
+        (GDestroyNotify)tl_logger_snapshot_unref);
+    g_tl_logger_data.retired_snapshots = NULL;
+    if(g_tl_logger_data.current_snapshot!=NULL)
+    {
+        tl_logger_snapshot_unref(g_tl_logger_data.current_snapshot);
+        g_tl_logger_data.current_snapshot = NULL;
+    }
+    
     if(g_tl_logger_data.storage_base_path!=NULL)
     {
         g_free(g_tl_logger_data.storage_base_path);
         g_tl_logger_data.storage_base_path = NULL;
     }
+    if(g_tl_logger_data.hot_path!=NULL)
+    {
+        g_free(g_tl_logger_data.hot_path);
+        g_tl_logger_data.hot_path = NULL;
+    }
     
     g_mutex_clear(&(g_tl_logger_data.cached_log_mutex));
     g_mutex_clear(&(g_tl_logger_data.query_queue_mutex));
+    g_mutex_clear(&(g_tl_logger_data.archive_mutex));
+    if(g_tl_logger_data.downsample_tiers!=NULL)
+    {
+        g_array_unref(g_tl_logger_data.downsample_tiers);
+        g_tl_logger_data.downsample_tiers = NULL;
+    }
+    g_cond_clear(&(g_tl_logger_data.write_cond));
+    g_cond_clear(&(g_tl_logger_data.query_cond));
+    g_cond_clear(&(g_tl_logger_data.archive_cond));
     
     g_tl_logger_data.initialized = FALSE;
 }
 
 void tl_logger_current_data_update(const TLLoggerLogItemData *item_data)
 {
+    TLLoggerCurrentItemData *current_item;
     TLLoggerLogItemData *idata;
     const TLLoggerLogItemData *pdata;
-    GString *pindex;
-    gchar svalue[16] = {0};
+    gboolean changed = FALSE;
+    guint parent_values[TL_LOGGER_LIST_DEPTH_MAXIMUM];
+    guint parent_count = 0;
+    gchar key[TL_LOGGER_LIST_KEY_MAXIMUM];
+    gsize key_len = 0;
+    TLLoggerCurrentValueData *value_data;
+    gchar *series_name;
+    gint64 now;
     
     if(item_data==NULL || item_data->name==NULL)
     {
@@ -1427,13 +3184,17 @@ void tl_logger_current_data_update(const TLLoggerLogItemData *item_data)
     if(g_tl_logger_data.last_log_data==NULL)
     {
         g_tl_logger_data.last_log_data = g_hash_table_new_full(g_str_hash,
-            g_str_equal, NULL, (GDestroyNotify)tl_logger_log_item_data_free);
+            g_str_equal, NULL,
+            (GDestroyNotify)tl_logger_current_item_data_clear);
     }
     
-    pindex = g_string_new(NULL);
+    now = g_get_real_time();
     
+    /* Build the list key without allocation, outermost parent first. */
+    key[0] = '\0';
     pdata = item_data;
-    while(pdata->list_parent!=NULL)
+    while(pdata->list_parent!=NULL &&
+        parent_count<TL_LOGGER_LIST_DEPTH_MAXIMUM)
     {
         pdata = g_hash_table_lookup(g_tl_logger_data.last_log_data,
             pdata->list_parent);
@@ -1441,122 +3202,133 @@ void tl_logger_current_data_update(const TLLoggerLogItemData *item_data)
         {
             break;
         }
-        if(pindex->len==0)
+        parent_values[parent_count++] = (guint)pdata->value;
+    }
+    while(parent_count>0)
+    {
+        key_len = tl_logger_list_key_append(key, key_len,
+            parent_values[--parent_count]);
+    }
+    
+    current_item = g_hash_table_lookup(g_tl_logger_data.last_log_data,
+        item_data->name);
+    if(current_item==NULL)
+    {
+        current_item = tl_logger_slab_alloc(
+            &(g_tl_logger_data.current_item_slab));
+        current_item->data.name = g_string_chunk_insert_const(
+            g_tl_logger_data.current_string_chunk, item_data->name);
+        current_item->slot = g_tl_logger_data.current_slots->len;
+        current_item->history_series = tl_history_series_add(
+            current_item->data.name);
+        current_item->shm_slot = tl_shm_slot_add(current_item->data.name,
+            item_data->unit, item_data->offset, item_data->source);
+        current_item->trigger = tl_logger_trigger_lookup(&g_tl_logger_data,
+            current_item->data.name);
+        current_item->group = tl_logger_log_group_lookup(&g_tl_logger_data,
+            current_item->data.name);
+        g_ptr_array_add(g_tl_logger_data.current_slots, current_item);
+        g_hash_table_replace(g_tl_logger_data.last_log_data,
+            current_item->data.name, current_item);
+        changed = TRUE;
+    }
+    idata = &(current_item->data);
+    
+    if(idata->value!=item_data->value || idata->unit!=item_data->unit ||
+        idata->offset!=item_data->offset)
+    {
+        changed = TRUE;
+    }
+    
+    idata->value = item_data->value;
+    idata->unit = item_data->unit;
+    idata->source = item_data->source;
+    idata->offset = item_data->offset;
+    idata->list_index = item_data->list_index;
+    if(g_strcmp0(idata->list_parent, item_data->list_parent)!=0)
+    {
+        idata->list_parent = (item_data->list_parent!=NULL) ?
+            g_string_chunk_insert_const(
+            g_tl_logger_data.current_string_chunk, item_data->list_parent) :
+            NULL;
+        changed = TRUE;
+    }
+    
+    if(item_data->list_parent!=NULL && key_len > 0)
+    {
+        if(idata->list_table==NULL)
+        {
+            idata->list_table = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+        value_data = g_hash_table_lookup(idata->list_table, key);
+        if(value_data==NULL)
         {
-            g_snprintf(svalue, 15, "%u", (guint)pdata->value);
-            g_string_append(pindex, svalue);
+            value_data = tl_logger_slab_alloc(
+                &(g_tl_logger_data.current_value_slab));
+            series_name = g_strdup_printf("%s[%s]", idata->name, key);
+            value_data->history_series = tl_history_series_add(series_name);
+            value_data->shm_slot = tl_shm_slot_add(series_name,
+                item_data->unit, item_data->offset, item_data->source);
+            g_free(series_name);
+            g_hash_table_replace(idata->list_table,
+                g_string_chunk_insert_const(
+                g_tl_logger_data.current_string_chunk, key), value_data);
+            changed = TRUE;
         }
-        else
+        else if(value_data->value!=item_data->value)
         {
-            g_snprintf(svalue, 15, "%u:", (guint)pdata->value);
-            g_string_prepend(pindex, svalue);
+            changed = TRUE;
         }
+        value_data->value = item_data->value;
+        tl_history_append(value_data->history_series, now, item_data->value);
+        tl_shm_slot_update(value_data->shm_slot, item_data->value, now);
     }
-    
-    if(g_hash_table_contains(g_tl_logger_data.last_log_data, item_data->name))
+    else
     {
-        idata = g_hash_table_lookup(g_tl_logger_data.last_log_data,
-            item_data->name);
-        if(idata!=NULL)
-        {
-            idata->value = item_data->value;
-            idata->unit = item_data->unit;
-            idata->source = item_data->source;
-            idata->offset = item_data->offset;
-            idata->list_index = item_data->list_index;
-            if(g_strcmp0(idata->list_parent, item_data->list_parent)!=0)
-            {
-                g_free(idata->list_parent);
-                idata->list_parent = g_strdup(item_data->list_parent);
-            }
-            
-            if(item_data->list_parent!=NULL && pindex->len > 0)
-            {
-                if(idata->list_table==NULL)
-                {
-                    idata->list_table = g_hash_table_new_full(g_str_hash,
-                        g_str_equal, g_free, g_free);
-                }
-                g_hash_table_replace(idata->list_table,
-                    g_strdup(pindex->str), g_memdup(&(item_data->value),
-                    sizeof(gint64)));
-            }
-            
-            if(item_data->list_index)
-            {
-                if(pindex->len==0)
-                {
-                    g_snprintf(svalue, 15, "%u", (guint)item_data->value);
-                    g_string_append(pindex, svalue);
-                }
-                else
-                {
-                    g_snprintf(svalue, 15, ":%u", (guint)item_data->value);
-                    g_string_append(pindex, svalue);
-                }
-                
-                if(idata->index_table==NULL)
-                {
-                    idata->index_table = g_hash_table_new_full(g_str_hash,
-                        g_str_equal, g_free, NULL);
-                }
-                
-                g_hash_table_add(idata->index_table, g_strdup(pindex->str));
-            }
-
-        }
+        tl_history_append(current_item->history_series, now,
+            item_data->value);
+        tl_shm_slot_update(current_item->shm_slot, item_data->value, now);
     }
-    else
+    
+    if(item_data->list_index)
     {
-        idata = g_new0(TLLoggerLogItemData, 1);
-        idata->name = g_strdup(item_data->name);
-        idata->value = item_data->value;
-        idata->unit = item_data->unit;
-        idata->source = item_data->source;
-        idata->list_index = item_data->list_index;
-        idata->offset = item_data->offset;
+        key_len = tl_logger_list_key_append(key, key_len,
+            (guint)item_data->value);
         
-        if(item_data->list_parent!=NULL && pindex->len > 0)
+        if(idata->index_table==NULL)
         {
-            idata->list_parent = g_strdup(item_data->list_parent);
-            idata->list_table = g_hash_table_new_full(g_str_hash,
-                g_str_equal, g_free, g_free);
-            
-            g_hash_table_replace(idata->list_table,
-                g_strdup(pindex->str), g_memdup(&(item_data->value),
-                sizeof(gint64)));
+            idata->index_table = g_hash_table_new(g_str_hash, g_str_equal);
         }
-        
-        if(item_data->list_index)
+        if(!g_hash_table_contains(idata->index_table, key))
         {
-            if(pindex->len==0)
-            {
-                g_snprintf(svalue, 15, "%u", (guint)item_data->value);
-                g_string_append(pindex, svalue);
-            }
-            else
-            {
-                g_snprintf(svalue, 15, ":%u", (guint)item_data->value);
-                g_string_append(pindex, svalue);
-            }
-            
-            idata->index_table = g_hash_table_new_full(g_str_hash,
-                g_str_equal, g_free, NULL);
-            idata->list_index = item_data->list_index;
-            
-            g_hash_table_add(idata->index_table, g_strdup(pindex->str));
+            g_hash_table_add(idata->index_table, g_string_chunk_insert_const(
+                g_tl_logger_data.current_string_chunk, key));
+            changed = TRUE;
         }
-        
-        
-        g_hash_table_replace(g_tl_logger_data.last_log_data, idata->name,
-            idata);
     }
     
-    g_string_free(pindex, TRUE);
+    if(changed && !current_item->dirty)
+    {
+        current_item->dirty = TRUE;
+        g_array_append_val(g_tl_logger_data.dirty_slots, current_item->slot);
+    }
     
     g_tl_logger_data.new_timestamp = g_get_monotonic_time();
+    
+    if(current_item->trigger!=NULL)
+    {
+        if(item_data->value!=0 && !current_item->trigger->active)
+        {
+            tl_logger_trigger_fire(&g_tl_logger_data, current_item->trigger);
+        }
+        current_item->trigger->active = (item_data->value!=0);
+    }
 }
 
+/*
+ * The live table is only consistent on the main loop, where it is updated.
+ * Other threads should use tl_logger_snapshot_acquire() instead.
+ */
 GHashTable *tl_logger_current_data_get(gboolean *updated)
 {
     static gint64 latest_timestamp = 0;
@@ -1580,6 +3352,124 @@ GHashTable *tl_logger_current_data_get(gboolean *updated)
     return g_tl_logger_data.last_log_data;
 }
 
+/*
+ * Returns the latest published snapshot with a reference held for the
+ * caller, safe to call from any thread without locking.
+ */
+TLLoggerSnapshot *tl_logger_snapshot_acquire()
+{
+    TLLoggerSnapshot *snapshot;
+    
+    g_atomic_int_inc(&(g_tl_logger_data.snapshot_readers));
+    snapshot = g_atomic_pointer_get(&(g_tl_logger_data.current_snapshot));
+    if(snapshot!=NULL)
+    {
+        g_atomic_int_inc(&(snapshot->ref_count));
+    }
+    g_atomic_int_add(&(g_tl_logger_data.snapshot_readers), -1);
+    
+    return snapshot;
+}
+
+TLLoggerSnapshot *tl_logger_snapshot_ref(TLLoggerSnapshot *snapshot)
+{
+    if(snapshot==NULL)
+    {
+        return NULL;
+    }
+    
+    g_atomic_int_inc(&(snapshot->ref_count));
+    
+    return snapshot;
+}
+
+void tl_logger_snapshot_unref(TLLoggerSnapshot *snapshot)
+{
+    guint i;
+    
+    if(snapshot==NULL || !g_atomic_int_dec_and_test(&(snapshot->ref_count)))
+    {
+        return;
+    }
+    
+    for(i=0;i<snapshot->page_count;i++)
+    {
+        tl_logger_snapshot_page_unref(snapshot->pages[i]);
+    }
+    tl_logger_snapshot_directory_unref(snapshot->directory);
+    g_free(snapshot);
+}
+
+guint64 tl_logger_snapshot_version_get(const TLLoggerSnapshot *snapshot)
+{
+    if(snapshot==NULL)
+    {
+        return 0;
+    }
+    
+    return snapshot->version;
+}
+
+gint64 tl_logger_snapshot_time_get(const TLLoggerSnapshot *snapshot)
+{
+    if(snapshot==NULL)
+    {
+        return 0;
+    }
+    
+    return snapshot->time;
+}
+
+guint tl_logger_snapshot_size_get(const TLLoggerSnapshot *snapshot)
+{
+    if(snapshot==NULL)
+    {
+        return 0;
+    }
+    
+    return snapshot->size;
+}
+
+const TLLoggerLogItemData *tl_logger_snapshot_item_get(
+    const TLLoggerSnapshot *snapshot, guint index)
+{
+    TLLoggerSnapshotItem *item;
+    
+    if(snapshot==NULL || index>=snapshot->size)
+    {
+        return NULL;
+    }
+    
+    item = snapshot->pages[index / TL_LOGGER_SNAPSHOT_PAGE_SIZE]->items[
+        index % TL_LOGGER_SNAPSHOT_PAGE_SIZE];
+    if(item==NULL)
+    {
+        return NULL;
+    }
+    
+    return &(item->data);
+}
+
+const TLLoggerLogItemData *tl_logger_snapshot_lookup(
+    const TLLoggerSnapshot *snapshot, const gchar *name)
+{
+    guint slot;
+    
+    if(snapshot==NULL || name==NULL)
+    {
+        return NULL;
+    }
+    
+    slot = GPOINTER_TO_UINT(g_hash_table_lookup(
+        snapshot->directory->name_table, name));
+    if(slot==0)
+    {
+        return NULL;
+    }
+    
+    return tl_logger_snapshot_item_get(snapshot, slot-1);
+}
+
 void *tl_logger_log_query_start(gboolean begin_time_set, gint64 begin_time,
     gboolean end_time_set, gint64 end_time,
     TLLoggerQueryResultCallback callback, gpointer user_data)
@@ -1601,7 +3491,7 @@ void *tl_logger_log_query_start(gboolean begin_time_set, gint64 begin_time,
     
     g_mutex_lock(&(g_tl_logger_data.query_queue_mutex));
     g_queue_push_tail(g_tl_logger_data.query_queue, query_data);
-    
+    g_cond_signal(&(g_tl_logger_data.query_cond));
     g_mutex_unlock(&(g_tl_logger_data.query_queue_mutex));
     
     return query_data;
@@ -1653,5 +3543,319 @@ void tl_logger_log_update_timeout_set(guint timeout)
         g_tl_logger_data.log_update_timeout_id = g_timeout_add(
             g_tl_logger_data.log_update_timeout,
             tl_logger_log_update_timer_cb, &g_tl_logger_data);
+        tl_logger_log_group_timer_restart(&g_tl_logger_data);
+    }
+}
+
+guint tl_logger_log_keyframe_interval_get()
+{
+    return g_atomic_int_get(&(g_tl_logger_data.log_keyframe_interval));
+}
+
+/*
+ * Sets how many records a keyframe is written, the others only carry the
+ * changed signals. 1 disables deltas, 0 writes keyframes only at the
+ * start of each log file.
+ */
+void tl_logger_log_keyframe_interval_set(guint interval)
+{
+    g_atomic_int_set(&(g_tl_logger_data.log_keyframe_interval), interval);
+}
+
+/*
+ * Buffered log records are committed to the storage once size bytes are
+ * buffered or interval seconds after the last commit, which bounds what a
+ * sudden power cut loses.
+ */
+void tl_logger_log_commit_size_set(guint size)
+{
+    g_atomic_int_set(&(g_tl_logger_data.log_commit_size), size);
+}
+
+void tl_logger_log_commit_interval_set(guint interval)
+{
+    g_atomic_int_set(&(g_tl_logger_data.log_commit_interval), interval);
+    
+    if(g_tl_logger_data.initialized)
+    {
+        /* Let the write thread sleep until the new deadline. */
+        g_mutex_lock(&(g_tl_logger_data.cached_log_mutex));
+        g_cond_signal(&(g_tl_logger_data.write_cond));
+        g_mutex_unlock(&(g_tl_logger_data.cached_log_mutex));
+    }
+}
+
+/*
+ * Compresses new log files while they are written, so they go to the
+ * archive without being read and written again. Each commit ends with a
+ * sync flush, which costs a few bytes of compression.
+ */
+void tl_logger_log_inline_compress_set(gboolean enabled)
+{
+    g_atomic_int_set(&(g_tl_logger_data.log_inline_compress), enabled);
+}
+
+/*
+ * Sets the codec and level for new log archives and compressed segments.
+ * Returns FALSE if the codec is not built in.
+ */
+gboolean tl_logger_log_codec_set(TLCodecType codec, gint level)
+{
+    if(!tl_codec_available(codec))
+    {
+        return FALSE;
+    }
+    
+    g_atomic_int_set(&(g_tl_logger_data.log_codec_level), level);
+    g_atomic_int_set(&(g_tl_logger_data.log_codec), codec);
+    
+    return TRUE;
+}
+
+/*
+ * Sets the downsampling tiers as "<days>:<seconds>[,...]": archived log
+ * older than days is rewritten with one record per seconds. NULL or an
+ * empty string turns downsampling off.
+ */
+gboolean tl_logger_log_downsample_set(const gchar *tiers)
+{
+    GArray *tier_array = NULL;
+    TLLoggerDownsampleTier tier;
+    gchar **tier_strv, **tier_pair;
+    gchar *end;
+    guint64 days, interval;
+    gboolean ret = TRUE;
+    guint i;
+    
+    if(tiers!=NULL && *tiers!='\0')
+    {
+        tier_array = g_array_new(FALSE, FALSE,
+            sizeof(TLLoggerDownsampleTier));
+        tier_strv = g_strsplit(tiers, ",", -1);
+        for(i=0;ret && tier_strv[i]!=NULL;i++)
+        {
+            tier_pair = g_strsplit(tier_strv[i], ":", 2);
+            ret = (tier_pair[0]!=NULL && tier_pair[1]!=NULL);
+            if(ret)
+            {
+                days = g_ascii_strtoull(tier_pair[0], &end, 10);
+                ret = (end!=tier_pair[0] && *end=='\0');
+            }
+            if(ret)
+            {
+                interval = g_ascii_strtoull(tier_pair[1], &end, 10);
+                ret = (end!=tier_pair[1] && *end=='\0' && interval>0 &&
+                    interval<=G_MAXUINT);
+            }
+            if(ret)
+            {
+                tier.age = (gint64)days * 86400;
+                tier.interval = interval;
+                g_array_append_val(tier_array, tier);
+            }
+            g_strfreev(tier_pair);
+        }
+        g_strfreev(tier_strv);
+        if(!ret)
+        {
+            g_array_unref(tier_array);
+            return FALSE;
+        }
+    }
+    
+    g_mutex_lock(&(g_tl_logger_data.archive_mutex));
+    if(g_tl_logger_data.downsample_tiers!=NULL)
+    {
+        g_array_unref(g_tl_logger_data.downsample_tiers);
+    }
+    g_tl_logger_data.downsample_tiers = tier_array;
+    g_tl_logger_data.archive_request = TRUE;
+    g_cond_signal(&(g_tl_logger_data.archive_cond));
+    g_mutex_unlock(&(g_tl_logger_data.archive_mutex));
+    
+    return TRUE;
+}
+
+/*
+ * Adds a log group sampled every interval milliseconds, for the signals
+ * matching one of the space separated glob patterns and in no earlier
+ * group. Records between two samples of a group do not carry its
+ * changes, keyframes repeat its last sample, so the state at any time is
+ * still complete. Signals in no group are sampled every log update
+ * timeout.
+ */
+gboolean tl_logger_log_group_add(const gchar *name, const gchar *patterns,
+    guint interval)
+{
+    TLLoggerLogGroup *group;
+    gchar *pattern_str;
+    
+    if(!g_tl_logger_data.initialized || name==NULL || patterns==NULL)
+    {
+        return FALSE;
+    }
+    if(g_tl_logger_data.log_groups->len>=TL_LOGGER_LOG_GROUP_MAXIMUM)
+    {
+        g_warning("TLLogger too many log groups, %s ignored!", name);
+        return FALSE;
+    }
+    if(interval<TL_LOGGER_LOG_GROUP_INTERVAL_MINIMUM)
+    {
+        g_warning("TLLogger log group %s interval raised to %ums.", name,
+            TL_LOGGER_LOG_GROUP_INTERVAL_MINIMUM);
+        interval = TL_LOGGER_LOG_GROUP_INTERVAL_MINIMUM;
+    }
+    
+    group = g_new0(TLLoggerLogGroup, 1);
+    group->name = g_strdup(name);
+    pattern_str = g_strstrip(g_strdup(patterns));
+    group->patterns = g_strsplit_set(pattern_str, " \t\r\n", -1);
+    g_free(pattern_str);
+    group->interval = interval;
+    g_ptr_array_add(g_tl_logger_data.log_groups, group);
+    
+    tl_logger_log_group_resolve(&g_tl_logger_data);
+    tl_logger_log_group_timer_restart(&g_tl_logger_data);
+    
+    return TRUE;
+}
+
+void tl_logger_log_group_clear()
+{
+    if(!g_tl_logger_data.initialized)
+    {
+        return;
+    }
+    
+    g_ptr_array_set_size(g_tl_logger_data.log_groups, 0);
+    tl_logger_log_group_resolve(&g_tl_logger_data);
+    tl_logger_log_group_timer_restart(&g_tl_logger_data);
+}
+
+/*
+ * Sets the sample interval of trigger windows in milliseconds, used from
+ * the next time the trigger timer starts.
+ */
+void tl_logger_log_trigger_interval_set(guint interval)
+{
+    if(interval>=10 && interval<=1000)
+    {
+        g_tl_logger_data.trigger_interval = interval;
+    }
+}
+
+/*
+ * Adds a trigger on the signal name: when its value becomes non-zero the
+ * log is written every trigger interval, from pre seconds before until
+ * post seconds after. Window records carry the trigger id as
+ * TL_LOGGER_TRIGGER_ITEM_NAME and start with an indexed keyframe.
+ */
+gboolean tl_logger_trigger_add(const gchar *name, guint pre, guint post)
+{
+    TLLoggerTriggerData *trigger;
+    TLLoggerCurrentItemData *current_item = NULL;
+    
+    if(!g_tl_logger_data.initialized || name==NULL)
+    {
+        return FALSE;
+    }
+    if(tl_logger_trigger_lookup(&g_tl_logger_data, name)!=NULL)
+    {
+        g_warning("TLLogger trigger %s already exists!", name);
+        return FALSE;
+    }
+    if(pre>TL_LOGGER_TRIGGER_PRE_MAXIMUM)
+    {
+        g_warning("TLLogger trigger %s pre-trigger time limited to %us.",
+            name, TL_LOGGER_TRIGGER_PRE_MAXIMUM);
+        pre = TL_LOGGER_TRIGGER_PRE_MAXIMUM;
+    }
+    
+    trigger = g_new0(TLLoggerTriggerData, 1);
+    trigger->name = g_strdup(name);
+    trigger->id = g_tl_logger_data.triggers->len + 1;
+    trigger->pre = pre;
+    trigger->post = post;
+    g_ptr_array_add(g_tl_logger_data.triggers, trigger);
+    
+    if(g_tl_logger_data.last_log_data!=NULL)
+    {
+        current_item = g_hash_table_lookup(g_tl_logger_data.last_log_data,
+            name);
+    }
+    if(current_item!=NULL)
+    {
+        current_item->trigger = trigger;
+        trigger->active = (current_item->data.value!=0);
+    }
+    
+    if(pre>g_tl_logger_data.trigger_pre)
+    {
+        g_tl_logger_data.trigger_pre = pre;
+    }
+    if(g_tl_logger_data.trigger_pre>0)
+    {
+        tl_logger_trigger_timer_start(&g_tl_logger_data);
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Removes all triggers. An open window runs to its end, then the trigger
+ * timer stops.
+ */
+void tl_logger_trigger_clear()
+{
+    TLLoggerCurrentItemData *current_item;
+    guint i;
+    
+    if(!g_tl_logger_data.initialized)
+    {
+        return;
+    }
+    
+    for(i=0;i<g_tl_logger_data.current_slots->len;i++)
+    {
+        current_item = g_ptr_array_index(g_tl_logger_data.current_slots, i);
+        current_item->trigger = NULL;
+    }
+    g_ptr_array_set_size(g_tl_logger_data.triggers, 0);
+    g_tl_logger_data.trigger_pre = 0;
+}
+
+/* Asks the write thread to commit the buffered records now. */
+void tl_logger_log_flush()
+{
+    if(!g_tl_logger_data.initialized)
+    {
+        return;
+    }
+    
+    tl_logger_trigger_ring_trim(&g_tl_logger_data, G_MAXINT64);
+    
+    g_atomic_int_set(&(g_tl_logger_data.log_flush_request), 1);
+    
+    g_mutex_lock(&(g_tl_logger_data.cached_log_mutex));
+    g_cond_signal(&(g_tl_logger_data.write_cond));
+    g_mutex_unlock(&(g_tl_logger_data.cached_log_mutex));
+}
+
+/*
+ * Asks the write thread to finish the current log file once the queued
+ * records are written, which moves it from the hot tier to the storage.
+ * Without a hot tier this is a flush.
+ */
+void tl_logger_log_migrate()
+{
+    if(!g_tl_logger_data.initialized)
+    {
+        return;
+    }
+    
+    if(g_tl_logger_data.hot_path!=NULL)
+    {
+        g_atomic_int_set(&(g_tl_logger_data.log_migrate_request), 1);
     }
+    tl_logger_log_flush();
 }
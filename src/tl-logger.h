@@ -2,6 +2,7 @@
 #define HAVE_TL_LOGGER_H
 
 #include <glib.h>
+#include "tl-codec.h"
 
 typedef struct _TLLoggerLogItemData
 {
@@ -17,15 +18,29 @@ typedef struct _TLLoggerLogItemData
     GHashTable *list_table;
 }TLLoggerLogItemData;
 
+typedef struct _TLLoggerSnapshot TLLoggerSnapshot;
+
 typedef void (*TLLoggerQueryResultCallback)(gboolean begin_time_set,
     gint64 begin_time, gboolean end_time_set, gint64 end_time,
     GHashTable *log_table, gpointer user_data);
 
-gboolean tl_logger_init(const gchar *storage_base_path);
+gboolean tl_logger_init(const gchar *storage_base_path,
+    const gchar *hot_path);
 void tl_logger_uninit();
 void tl_logger_current_data_update(const TLLoggerLogItemData *item_data);
 GHashTable *tl_logger_current_data_get(gboolean *updated);
 
+TLLoggerSnapshot *tl_logger_snapshot_acquire();
+TLLoggerSnapshot *tl_logger_snapshot_ref(TLLoggerSnapshot *snapshot);
+void tl_logger_snapshot_unref(TLLoggerSnapshot *snapshot);
+guint64 tl_logger_snapshot_version_get(const TLLoggerSnapshot *snapshot);
+gint64 tl_logger_snapshot_time_get(const TLLoggerSnapshot *snapshot);
+guint tl_logger_snapshot_size_get(const TLLoggerSnapshot *snapshot);
+const TLLoggerLogItemData *tl_logger_snapshot_item_get(
+    const TLLoggerSnapshot *snapshot, guint index);
+const TLLoggerLogItemData *tl_logger_snapshot_lookup(
+    const TLLoggerSnapshot *snapshot, const gchar *name);
+
 void *tl_logger_log_query_start(gboolean begin_time_set, gint64 begin_time,
     gboolean end_time_set, gint64 end_time,
     TLLoggerQueryResultCallback callback, gpointer user_data);
@@ -33,5 +48,20 @@ void tl_logger_log_query_stop(void *handler);
 
 guint tl_logger_log_update_timeout_get();
 void tl_logger_log_update_timeout_set(guint timeout);
+guint tl_logger_log_keyframe_interval_get();
+void tl_logger_log_keyframe_interval_set(guint interval);
+void tl_logger_log_commit_size_set(guint size);
+void tl_logger_log_commit_interval_set(guint interval);
+void tl_logger_log_inline_compress_set(gboolean enabled);
+gboolean tl_logger_log_codec_set(TLCodecType codec, gint level);
+gboolean tl_logger_log_downsample_set(const gchar *tiers);
+gboolean tl_logger_log_group_add(const gchar *name, const gchar *patterns,
+    guint interval);
+void tl_logger_log_group_clear();
+void tl_logger_log_trigger_interval_set(guint interval);
+gboolean tl_logger_trigger_add(const gchar *name, guint pre, guint post);
+void tl_logger_trigger_clear();
+void tl_logger_log_flush();
+void tl_logger_log_migrate();
 
 #endif
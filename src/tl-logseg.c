@@ -0,0 +1,993 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "tl-logseg.h"
+#include "tl-logfmt.h"
+
+#define TL_LOGSEG_MAGIC ((const guint8 *)"TLSG")
+#define TL_LOGSEG_VERSION 1
+#define TL_LOGSEG_HEADER_SIZE 18
+#define TL_LOGSEG_HEADER_CHECKPOINT 1
+#define TL_LOGSEG_CHECKPOINT_SIZE 50
+#define TL_LOGSEG_INDEX_MAGIC ((const guint8 *)"TLSI")
+#define TL_LOGSEG_INDEX_HEADER_SIZE 8
+#define TL_LOGSEG_INDEX_ENTRY_SIZE 24
+#define TL_LOGSEG_MIGRATE_BLOCK_SIZE 1024 * 1024
+
+typedef struct _TLLogSegCheckpoint
+{
+    guint64 end;
+    guint64 records;
+    gint64 last_time;
+}TLLogSegCheckpoint;
+
+struct _TLLogSegment
+{
+    int fd;
+    gchar *path;
+    guint flags;
+    TLCodecType codec;
+    GConverter *compressor;
+    guint64 end;
+    guint64 records;
+    gint64 first_time;
+    gint64 last_time;
+    TLLogSegCheckpoint committed;
+    guint64 buffer_offset;
+    GByteArray *buffer;
+    gsize pending;
+    int index_fd;
+    GByteArray *index_pending;
+};
+
+typedef struct _TLLogSegData
+{
+    guint64 app_bytes;
+    guint64 file_bytes;
+}TLLogSegData;
+
+static TLLogSegData g_tl_logseg_data = {0};
+
+static gboolean tl_logseg_pwrite(int fd, const guint8 *data, gsize len,
+    guint64 offset)
+{
+    ssize_t rsize;
+    
+    while(len>0)
+    {
+        rsize = pwrite(fd, data, len, offset);
+        if(rsize<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(rsize<=0)
+        {
+            return FALSE;
+        }
+        data += rsize;
+        len -= rsize;
+        offset += rsize;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Compresses len bytes of data to the end of the buffer. G_CONVERTER_FLUSH
+ * ends with a flush and G_CONVERTER_INPUT_AT_END ends the stream.
+ */
+static gboolean tl_logseg_compress(TLLogSegment *segment, const guint8 *data,
+    gsize len, GConverterFlags flags)
+{
+    GConverterResult result;
+    gsize offset, space, bytes_read, bytes_written;
+    GError *error = NULL;
+    
+    space = len + len / 8 + 64;
+    while(TRUE)
+    {
+        bytes_read = 0;
+        bytes_written = 0;
+        offset = segment->buffer->len;
+        g_byte_array_set_size(segment->buffer, offset + space);
+        result = g_converter_convert(segment->compressor, data, len,
+            segment->buffer->data + offset, space, flags, &bytes_read,
+            &bytes_written, &error);
+        g_byte_array_set_size(segment->buffer, offset + bytes_written);
+        if(result==G_CONVERTER_ERROR && g_error_matches(error, G_IO_ERROR,
+            G_IO_ERROR_NO_SPACE))
+        {
+            /* LZ4 wants room for a whole block. */
+            g_clear_error(&error);
+            space *= 2;
+            continue;
+        }
+        if(result==G_CONVERTER_ERROR)
+        {
+            g_warning("TLLogSeg failed to compress log file %s: %s",
+                segment->path, error->message);
+            g_clear_error(&error);
+            return FALSE;
+        }
+        data += bytes_read;
+        len -= bytes_read;
+        if(len==0 && (flags==G_CONVERTER_NO_FLAGS ||
+            result!=G_CONVERTER_CONVERTED))
+        {
+            break;
+        }
+    }
+    segment->end = segment->buffer_offset + segment->buffer->len;
+    
+    return TRUE;
+}
+
+/* Writes len bytes at the end of a file opened with O_APPEND. */
+static gboolean tl_logseg_write(int fd, const guint8 *data, gsize len)
+{
+    ssize_t rsize;
+    
+    while(len>0)
+    {
+        rsize = write(fd, data, len);
+        if(rsize<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(rsize<=0)
+        {
+            return FALSE;
+        }
+        data += rsize;
+        len -= rsize;
+    }
+    
+    return TRUE;
+}
+
+/* The index of tbl-X.tlw and tbl-X.tl is tbl-X.tli. */
+gchar *tl_logseg_index_path_get(const gchar *path)
+{
+    const gchar *suffix;
+    
+    suffix = strrchr(path, '.');
+    if(suffix==NULL || strchr(suffix, '/')!=NULL)
+    {
+        return g_strdup_printf("%s.tli", path);
+    }
+    
+    return g_strdup_printf("%.*s.tli", (int)(suffix - path), path);
+}
+
+static int tl_logseg_index_create(const gchar *path)
+{
+    guint8 header[TL_LOGSEG_INDEX_HEADER_SIZE];
+    gchar *index_path;
+    int fd;
+    
+    index_path = tl_logseg_index_path_get(path);
+    fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+        S_IRUSR | S_IWUSR);
+    if(fd<0)
+    {
+        g_warning("TLLogSeg cannot open log index %s: %s", index_path,
+            strerror(errno));
+        g_free(index_path);
+        return -1;
+    }
+    g_free(index_path);
+    
+    memset(header, 0, TL_LOGSEG_INDEX_HEADER_SIZE);
+    memcpy(header, TL_LOGSEG_INDEX_MAGIC, 4);
+    header[4] = TL_LOGSEG_VERSION;
+    if(!tl_logseg_write(fd, header, TL_LOGSEG_INDEX_HEADER_SIZE))
+    {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+/*
+ * Creates the segment file at path with room for size bytes of frames.
+ * Without fallocate() support the file grows as it is written.
+ */
+TLLogSegment *tl_logseg_create(const gchar *path, gsize size, guint flags,
+    TLCodecType codec, gint level)
+{
+    TLLogSegment *segment;
+    int fd;
+    
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if(fd<0)
+    {
+        g_warning("TLLogSeg cannot open log file %s: %s", path,
+            strerror(errno));
+        return NULL;
+    }
+    
+    if(fallocate(fd, 0, 0, TL_LOGSEG_BLOCK_SIZE + size)!=0)
+    {
+        g_warning("TLLogSeg cannot preallocate log file %s: %s", path,
+            strerror(errno));
+    }
+    
+    segment = g_new0(TLLogSegment, 1);
+    segment->fd = fd;
+    segment->path = g_strdup(path);
+    if(flags & TL_LOGSEG_FLAG_COMPRESSED)
+    {
+        segment->compressor = tl_codec_compressor_new(codec, level);
+        if(segment->compressor==NULL)
+        {
+            g_warning("TLLogSeg codec %s is not built in, log file %s is "
+                "not compressed.", tl_codec_name_get(codec), path);
+            flags &= ~TL_LOGSEG_FLAG_COMPRESSED;
+        }
+    }
+    segment->flags = flags;
+    segment->codec = codec;
+    segment->end = TL_LOGSEG_BLOCK_SIZE;
+    segment->committed.end = TL_LOGSEG_BLOCK_SIZE;
+    segment->buffer_offset = TL_LOGSEG_BLOCK_SIZE;
+    segment->buffer = g_byte_array_new();
+    segment->index_fd = -1;
+    if(!(flags & TL_LOGSEG_FLAG_COMPRESSED))
+    {
+        segment->index_fd = tl_logseg_index_create(path);
+        segment->index_pending = g_byte_array_new();
+    }
+    
+    return segment;
+}
+
+/* Buffers frames, they reach the file at the next commit. */
+void tl_logseg_append(TLLogSegment *segment, const guint8 *data, gsize len)
+{
+    if(len==0)
+    {
+        return;
+    }
+    if(segment->compressor!=NULL)
+    {
+        tl_logseg_compress(segment, data, len, G_CONVERTER_NO_FLAGS);
+    }
+    else
+    {
+        g_byte_array_append(segment->buffer, data, len);
+        segment->end += len;
+    }
+    segment->pending += len;
+    __atomic_add_fetch(&(g_tl_logseg_data.app_bytes), len, __ATOMIC_RELAXED);
+}
+
+/* Counts a record appended to the segment for the header checkpoint. */
+void tl_logseg_record_add(TLLogSegment *segment, gint64 time)
+{
+    if(segment->records==0)
+    {
+        segment->first_time = time;
+    }
+    segment->records++;
+    segment->last_time = time;
+}
+
+/*
+ * Adds an index entry for the data appended next, which holds a record
+ * at time and is len bytes long. Compressed segments have no index.
+ */
+void tl_logseg_index_add(TLLogSegment *segment, TLLogSegIndexType type,
+    gint64 time, gsize len)
+{
+    guint8 entry[TL_LOGSEG_INDEX_ENTRY_SIZE];
+    guint64 beoffset, betime;
+    guint32 belen;
+    guint16 becrc;
+    
+    if(segment->index_fd<0)
+    {
+        return;
+    }
+    
+    beoffset = GUINT64_TO_BE(segment->end);
+    betime = GUINT64_TO_BE((guint64)time);
+    belen = g_htonl(len);
+    memcpy(entry, &beoffset, 8);
+    memcpy(entry + 8, &betime, 8);
+    memcpy(entry + 16, &belen, 4);
+    entry[20] = type;
+    entry[21] = 0;
+    becrc = g_htons(tl_logfmt_crc16_compute(entry, 22));
+    memcpy(entry + 22, &becrc, 2);
+    g_byte_array_append(segment->index_pending, entry,
+        TL_LOGSEG_INDEX_ENTRY_SIZE);
+}
+
+/* Appends the pending index entries after their data is on disk. */
+static void tl_logseg_index_commit(TLLogSegment *segment)
+{
+    if(segment->index_fd<0 || segment->index_pending->len==0)
+    {
+        return;
+    }
+    
+    if(!tl_logseg_write(segment->index_fd, segment->index_pending->data,
+        segment->index_pending->len) || fdatasync(segment->index_fd)!=0)
+    {
+        /* Queries fall back to scanning, the segment itself is fine. */
+        g_warning("TLLogSeg failed to write index of log file %s: %s",
+            segment->path, strerror(errno));
+        close(segment->index_fd);
+        segment->index_fd = -1;
+    }
+    else
+    {
+        __atomic_add_fetch(&(g_tl_logseg_data.file_bytes),
+            segment->index_pending->len, __ATOMIC_RELAXED);
+    }
+    g_byte_array_set_size(segment->index_pending, 0);
+}
+
+static void tl_logseg_uint64_put(guint8 *data, guint64 value)
+{
+    guint64 bevalue;
+    
+    bevalue = GUINT64_TO_BE(value);
+    memcpy(data, &bevalue, 8);
+}
+
+static guint64 tl_logseg_uint64_get(const guint8 *data)
+{
+    guint64 bevalue;
+    
+    memcpy(&bevalue, data, 8);
+    
+    return GUINT64_FROM_BE(bevalue);
+}
+
+static void tl_logseg_header_build(guint8 *header, guint flags,
+    TLCodecType codec, gint64 first_time, const TLLogSegCheckpoint *current,
+    const TLLogSegCheckpoint *previous)
+{
+    guint16 becrc;
+    
+    memset(header, 0, TL_LOGSEG_HEADER_SIZE + TL_LOGSEG_CHECKPOINT_SIZE);
+    memcpy(header, TL_LOGSEG_MAGIC, 4);
+    header[4] = TL_LOGSEG_VERSION;
+    header[5] = flags;
+    header[6] = (flags & TL_LOGSEG_FLAG_COMPRESSED) ? codec : 0;
+    header[7] = TL_LOGSEG_HEADER_CHECKPOINT;
+    tl_logseg_uint64_put(header + 8, current->end);
+    becrc = g_htons(tl_logfmt_crc16_compute(header, 16));
+    memcpy(header + 16, &becrc, 2);
+    
+    tl_logseg_uint64_put(header + 18, current->records);
+    tl_logseg_uint64_put(header + 26, (guint64)first_time);
+    tl_logseg_uint64_put(header + 34, (guint64)current->last_time);
+    tl_logseg_uint64_put(header + 42, previous->end);
+    tl_logseg_uint64_put(header + 50, previous->records);
+    tl_logseg_uint64_put(header + 58, (guint64)previous->last_time);
+    becrc = g_htons(tl_logfmt_crc16_compute(header, 66));
+    memcpy(header + 66, &becrc, 2);
+}
+
+/*
+ * Writes the buffered frames from the start of their first block up to a
+ * whole block, then the header with the new logical end, and flushes the
+ * data. The partial last block is kept and written again next time.
+ */
+gboolean tl_logseg_commit(TLLogSegment *segment)
+{
+    guint8 header[TL_LOGSEG_HEADER_SIZE + TL_LOGSEG_CHECKPOINT_SIZE];
+    TLLogSegCheckpoint current;
+    guint64 tail_offset;
+    gsize len;
+    
+    if(segment->compressor!=NULL && segment->pending>0 &&
+        !tl_logseg_compress(segment, NULL, 0, G_CONVERTER_FLUSH))
+    {
+        return FALSE;
+    }
+    if(segment->end==segment->committed.end)
+    {
+        segment->pending = 0;
+        return TRUE;
+    }
+    
+    len = segment->buffer->len;
+    g_byte_array_set_size(segment->buffer, (len + TL_LOGSEG_BLOCK_SIZE - 1) /
+        TL_LOGSEG_BLOCK_SIZE * TL_LOGSEG_BLOCK_SIZE);
+    memset(segment->buffer->data + len, 0, segment->buffer->len - len);
+    
+    current.end = segment->end;
+    current.records = segment->records;
+    current.last_time = segment->last_time;
+    tl_logseg_header_build(header, segment->flags, segment->codec,
+        segment->first_time, &current, &(segment->committed));
+    
+    if(!tl_logseg_pwrite(segment->fd, segment->buffer->data,
+        segment->buffer->len, segment->buffer_offset) ||
+        !tl_logseg_pwrite(segment->fd, header, sizeof(header), 0))
+    {
+        g_warning("TLLogSeg failed to write log file %s: %s",
+            segment->path, strerror(errno));
+        g_byte_array_set_size(segment->buffer, len);
+        return FALSE;
+    }
+    __atomic_add_fetch(&(g_tl_logseg_data.file_bytes),
+        segment->buffer->len + sizeof(header), __ATOMIC_RELAXED);
+    
+    if(fdatasync(segment->fd)!=0)
+    {
+        g_warning("TLLogSeg failed to flush log file %s: %s",
+            segment->path, strerror(errno));
+        g_byte_array_set_size(segment->buffer, len);
+        return FALSE;
+    }
+    
+    tail_offset = segment->end / TL_LOGSEG_BLOCK_SIZE * TL_LOGSEG_BLOCK_SIZE;
+    g_byte_array_remove_range(segment->buffer, 0,
+        tail_offset - segment->buffer_offset);
+    g_byte_array_set_size(segment->buffer, segment->end - tail_offset);
+    segment->buffer_offset = tail_offset;
+    segment->committed = current;
+    segment->pending = 0;
+    
+    tl_logseg_index_commit(segment);
+    
+    return TRUE;
+}
+
+/*
+ * Returns the bytes of frames in the segment, committed or not. Compressed
+ * frames count once the compressor outputs them.
+ */
+gsize tl_logseg_length_get(const TLLogSegment *segment)
+{
+    return segment->end - TL_LOGSEG_BLOCK_SIZE;
+}
+
+gsize tl_logseg_pending_get(const TLLogSegment *segment)
+{
+    return segment->pending;
+}
+
+guint tl_logseg_flags_get(const TLLogSegment *segment)
+{
+    return segment->flags;
+}
+
+/* Commits and trims the file to its logical end, then frees segment. */
+gboolean tl_logseg_close(TLLogSegment *segment)
+{
+    gboolean ret;
+    
+    if(segment==NULL)
+    {
+        return FALSE;
+    }
+    
+    ret = TRUE;
+    if(segment->compressor!=NULL)
+    {
+        ret = tl_logseg_compress(segment, NULL, 0, G_CONVERTER_INPUT_AT_END);
+        g_object_unref(segment->compressor);
+        segment->compressor = NULL;
+    }
+    ret = tl_logseg_commit(segment) && ret;
+    if(ftruncate(segment->fd, segment->end)!=0)
+    {
+        g_warning("TLLogSeg failed to trim log file %s: %s",
+            segment->path, strerror(errno));
+        ret = FALSE;
+    }
+    close(segment->fd);
+    if(segment->index_fd>=0)
+    {
+        close(segment->index_fd);
+    }
+    if(segment->index_pending!=NULL)
+    {
+        g_byte_array_unref(segment->index_pending);
+    }
+    
+    g_byte_array_unref(segment->buffer);
+    g_free(segment->path);
+    g_free(segment);
+    
+    return ret;
+}
+
+static gboolean tl_logseg_header_parse(const guint8 *header, guint *flags,
+    TLCodecType *codec, guint64 *end)
+{
+    guint64 beend;
+    guint16 becrc;
+    
+    if(memcmp(header, TL_LOGSEG_MAGIC, 4)!=0 ||
+        header[4]!=TL_LOGSEG_VERSION)
+    {
+        return FALSE;
+    }
+    memcpy(&becrc, header + 16, 2);
+    if(g_ntohs(becrc)!=tl_logfmt_crc16_compute(header, 16))
+    {
+        return FALSE;
+    }
+    
+    if(flags!=NULL)
+    {
+        *flags = header[5];
+    }
+    if(codec!=NULL)
+    {
+        *codec = header[6];
+    }
+    if(end!=NULL)
+    {
+        memcpy(&beend, header + 8, 8);
+        *end = GUINT64_FROM_BE(beend);
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Trims a segment left open by a crash to the logical end in its header.
+ * Frames after the last commit are dropped. Returns FALSE if path has no
+ * valid segment header.
+ */
+gboolean tl_logseg_trim(const gchar *path)
+{
+    guint8 header[TL_LOGSEG_HEADER_SIZE];
+    guint64 end;
+    struct stat statbuf;
+    gboolean ret = FALSE;
+    int fd;
+    
+    fd = open(path, O_RDWR);
+    if(fd<0)
+    {
+        return FALSE;
+    }
+    
+    if(pread(fd, header, TL_LOGSEG_HEADER_SIZE, 0)==TL_LOGSEG_HEADER_SIZE &&
+        tl_logseg_header_parse(header, NULL, NULL, &end) &&
+        fstat(fd, &statbuf)==0 && end>=TL_LOGSEG_BLOCK_SIZE &&
+        end<=(guint64)statbuf.st_size)
+    {
+        ret = (ftruncate(fd, end)==0);
+    }
+    close(fd);
+    
+    return ret;
+}
+
+/*
+ * Reads the checkpoint after the header, FALSE if there is none or it does
+ * not belong to the header.
+ */
+static gboolean tl_logseg_checkpoint_parse(const guint8 *header,
+    gint64 *first_time, TLLogSegCheckpoint *current,
+    TLLogSegCheckpoint *previous)
+{
+    guint16 becrc;
+    
+    if(header[7]!=TL_LOGSEG_HEADER_CHECKPOINT)
+    {
+        return FALSE;
+    }
+    memcpy(&becrc, header + 66, 2);
+    if(g_ntohs(becrc)!=tl_logfmt_crc16_compute(header, 66))
+    {
+        return FALSE;
+    }
+    
+    current->end = tl_logseg_uint64_get(header + 8);
+    current->records = tl_logseg_uint64_get(header + 18);
+    *first_time = (gint64)tl_logseg_uint64_get(header + 26);
+    current->last_time = (gint64)tl_logseg_uint64_get(header + 34);
+    previous->end = tl_logseg_uint64_get(header + 42);
+    previous->records = tl_logseg_uint64_get(header + 50);
+    previous->last_time = (gint64)tl_logseg_uint64_get(header + 58);
+    
+    return TRUE;
+}
+
+/*
+ * Recovers a segment left open by a crash in time bounded by the size of
+ * its last commit, not of the segment. The frames after the checkpoint of
+ * the commit before are checked, torn ones at the end are cut off and the
+ * header is updated to match, then the file is trimmed to its logical
+ * end. Compressed segments cannot be checked from the middle of their
+ * stream and are only trimmed, readers stop at the end of their data.
+ * Returns FALSE if path has no checkpoint, callers then fall back to
+ * tl_logseg_trim() and count the records themselves.
+ */
+gboolean tl_logseg_recover(const gchar *path, guint64 *records,
+    gint64 *first_time, gint64 *last_time)
+{
+    guint8 header[TL_LOGSEG_HEADER_SIZE + TL_LOGSEG_CHECKPOINT_SIZE];
+    TLLogSegCheckpoint current, previous;
+    TLLogFmtFrameType type;
+    TLCodecType codec;
+    const guint8 *payload;
+    guint8 *data;
+    gsize len, pos, frame_len, payload_len;
+    guint64 end;
+    gint64 time, first;
+    struct stat statbuf;
+    guint flags;
+    gboolean ret;
+    int fd;
+    
+    fd = open(path, O_RDWR);
+    if(fd<0)
+    {
+        return FALSE;
+    }
+    
+    if(pread(fd, header, sizeof(header), 0)!=sizeof(header) ||
+        !tl_logseg_header_parse(header, &flags, &codec, &end) ||
+        !tl_logseg_checkpoint_parse(header, &first, &current, &previous) ||
+        fstat(fd, &statbuf)!=0 || previous.end<TL_LOGSEG_BLOCK_SIZE ||
+        previous.end>end || end>(guint64)statbuf.st_size)
+    {
+        close(fd);
+        return FALSE;
+    }
+    
+    if(!(flags & TL_LOGSEG_FLAG_COMPRESSED))
+    {
+        len = end - previous.end;
+        data = g_malloc(len);
+        if(len>0 && pread(fd, data, len, previous.end)!=(ssize_t)len)
+        {
+            g_warning("TLLogSeg cannot read log file %s: %s", path,
+                strerror(errno));
+            g_free(data);
+            close(fd);
+            return FALSE;
+        }
+        
+        current = previous;
+        for(pos=0;pos<len;pos+=frame_len)
+        {
+            frame_len = tl_logfmt_frame_check(data + pos, len - pos, &type,
+                &payload, &payload_len);
+            if(frame_len==0)
+            {
+                break;
+            }
+            if(type!=TL_LOGFMT_FRAME_META && tl_logfmt_frame_time_get(type,
+                payload, payload_len, &time))
+            {
+                if(current.records==0)
+                {
+                    first = time;
+                }
+                current.records++;
+                current.last_time = time;
+            }
+        }
+        g_free(data);
+        current.end = previous.end + pos;
+        
+        if(current.end<end)
+        {
+            g_message("TLLogSeg dropped %"G_GUINT64_FORMAT" bytes of torn "
+                "frames at the end of log file %s.", end - current.end,
+                path);
+            end = current.end;
+            tl_logseg_header_build(header, flags, codec, first, &current,
+                &current);
+            if(!tl_logseg_pwrite(fd, header, sizeof(header), 0))
+            {
+                g_warning("TLLogSeg failed to write log file %s: %s", path,
+                    strerror(errno));
+            }
+        }
+    }
+    
+    ret = (ftruncate(fd, end)==0 && fdatasync(fd)==0);
+    if(!ret)
+    {
+        g_warning("TLLogSeg failed to trim log file %s: %s", path,
+            strerror(errno));
+    }
+    close(fd);
+    
+    if(records!=NULL)
+    {
+        *records = current.records;
+    }
+    if(first_time!=NULL)
+    {
+        *first_time = current.records>0 ? first : 0;
+    }
+    if(last_time!=NULL)
+    {
+        *last_time = current.last_time;
+    }
+    
+    return ret;
+}
+
+/*
+ * Checks whether path starts with a segment header, its frames then start
+ * at TL_LOGSEG_BLOCK_SIZE. Files without one hold frames from the start.
+ */
+gboolean tl_logseg_header_get(const gchar *path, guint *flags,
+    TLCodecType *codec)
+{
+    guint8 header[TL_LOGSEG_HEADER_SIZE];
+    gboolean ret = FALSE;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if(fd<0)
+    {
+        return FALSE;
+    }
+    
+    if(pread(fd, header, TL_LOGSEG_HEADER_SIZE, 0)==TL_LOGSEG_HEADER_SIZE)
+    {
+        ret = tl_logseg_header_parse(header, flags, codec, NULL);
+    }
+    close(fd);
+    
+    return ret;
+}
+
+/*
+ * Loads the index of an uncompressed segment, sorted by offset. Entries
+ * past the logical end of the segment, written before a crash, and
+ * damaged ones are left out. Returns NULL if the segment has no index.
+ */
+GArray *tl_logseg_index_load(const gchar *path)
+{
+    GArray *entries;
+    TLLogSegIndexEntry entry;
+    guint8 header[TL_LOGSEG_HEADER_SIZE];
+    gchar *index_path, *contents;
+    const guint8 *data;
+    gsize len, i;
+    guint64 beoffset, betime, end;
+    guint32 belen;
+    guint16 becrc;
+    guint flags;
+    struct stat statbuf;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if(fd<0)
+    {
+        return NULL;
+    }
+    if(pread(fd, header, TL_LOGSEG_HEADER_SIZE, 0)!=TL_LOGSEG_HEADER_SIZE ||
+        !tl_logseg_header_parse(header, &flags, NULL, &end) ||
+        (flags & TL_LOGSEG_FLAG_COMPRESSED) || fstat(fd, &statbuf)!=0)
+    {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    end = MIN(end, (guint64)statbuf.st_size);
+    
+    index_path = tl_logseg_index_path_get(path);
+    if(!g_file_get_contents(index_path, &contents, &len, NULL))
+    {
+        g_free(index_path);
+        return NULL;
+    }
+    g_free(index_path);
+    
+    data = (const guint8 *)contents;
+    if(len < TL_LOGSEG_INDEX_HEADER_SIZE ||
+        memcmp(data, TL_LOGSEG_INDEX_MAGIC, 4)!=0 ||
+        data[4]!=TL_LOGSEG_VERSION)
+    {
+        g_free(contents);
+        return NULL;
+    }
+    
+    entries = g_array_new(FALSE, FALSE, sizeof(TLLogSegIndexEntry));
+    for(i=TL_LOGSEG_INDEX_HEADER_SIZE;i+TL_LOGSEG_INDEX_ENTRY_SIZE<=len;
+        i+=TL_LOGSEG_INDEX_ENTRY_SIZE)
+    {
+        memcpy(&becrc, data + i + 22, 2);
+        if(g_ntohs(becrc)!=tl_logfmt_crc16_compute(data + i, 22))
+        {
+            break;
+        }
+        memcpy(&beoffset, data + i, 8);
+        memcpy(&betime, data + i + 8, 8);
+        memcpy(&belen, data + i + 16, 4);
+        entry.offset = GUINT64_FROM_BE(beoffset);
+        entry.time = (gint64)GUINT64_FROM_BE(betime);
+        entry.len = g_ntohl(belen);
+        entry.type = data[i + 20];
+        if(entry.offset + entry.len > end || (entries->len>0 &&
+            entry.offset < g_array_index(entries, TLLogSegIndexEntry,
+            entries->len - 1).offset))
+        {
+            break;
+        }
+        g_array_append_val(entries, entry);
+    }
+    g_free(contents);
+    
+    return entries;
+}
+
+/*
+ * Copies path to dest_path through dest_path.part in large sequential
+ * writes, flushes the copy and renames it over dest_path. A missing path
+ * is not an error, the segment may have no index.
+ */
+static gboolean tl_logseg_migrate_file(const gchar *path,
+    const gchar *dest_path, guint8 *buffer)
+{
+    gchar *part_path;
+    ssize_t rsize;
+    int fd, dest_fd;
+    gboolean ret = TRUE;
+    
+    fd = open(path, O_RDONLY);
+    if(fd<0)
+    {
+        return (errno==ENOENT);
+    }
+    part_path = g_strdup_printf("%s.part", dest_path);
+    dest_fd = open(part_path, O_WRONLY | O_CREAT | O_TRUNC,
+        S_IRUSR | S_IWUSR);
+    if(dest_fd<0)
+    {
+        g_warning("TLLogSeg cannot open %s: %s", part_path, strerror(errno));
+        g_free(part_path);
+        close(fd);
+        return FALSE;
+    }
+    
+    while(ret)
+    {
+        rsize = read(fd, buffer, TL_LOGSEG_MIGRATE_BLOCK_SIZE);
+        if(rsize<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(rsize<=0)
+        {
+            ret = (rsize==0);
+            break;
+        }
+        ret = tl_logseg_write(dest_fd, buffer, rsize);
+        if(ret)
+        {
+            __atomic_add_fetch(&(g_tl_logseg_data.file_bytes), rsize,
+                __ATOMIC_RELAXED);
+        }
+    }
+    if(ret)
+    {
+        ret = (fdatasync(dest_fd)==0);
+    }
+    if(!ret)
+    {
+        g_warning("TLLogSeg failed to copy %s to %s: %s", path, part_path,
+            strerror(errno));
+    }
+    close(dest_fd);
+    close(fd);
+    
+    if(ret && rename(part_path, dest_path)!=0)
+    {
+        g_warning("TLLogSeg cannot rename %s: %s", part_path,
+            strerror(errno));
+        ret = FALSE;
+    }
+    if(!ret)
+    {
+        unlink(part_path);
+    }
+    g_free(part_path);
+    
+    return ret;
+}
+
+/*
+ * Moves a closed or recovered segment and its index to dest_path, usually
+ * from a RAM file system to the flash. The index goes first, so a segment
+ * at dest_path is always complete with its index. The sources are only
+ * removed once the copies and their names are on disk, a crash in between
+ * leaves the source for the next attempt to copy again.
+ */
+gboolean tl_logseg_migrate(const gchar *path, const gchar *dest_path)
+{
+    gchar *index_path, *dest_index_path, *dir_path;
+    guint8 *buffer;
+    gboolean ret;
+    int fd;
+    
+    index_path = tl_logseg_index_path_get(path);
+    dest_index_path = tl_logseg_index_path_get(dest_path);
+    buffer = g_malloc(TL_LOGSEG_MIGRATE_BLOCK_SIZE);
+    
+    ret = tl_logseg_migrate_file(index_path, dest_index_path, buffer) &&
+        tl_logseg_migrate_file(path, dest_path, buffer);
+    if(ret)
+    {
+        dir_path = g_path_get_dirname(dest_path);
+        fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+        if(fd>=0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+        g_free(dir_path);
+        
+        unlink(index_path);
+        unlink(path);
+    }
+    
+    g_free(buffer);
+    g_free(dest_index_path);
+    g_free(index_path);
+    
+    return ret;
+}
+
+/* Bytes of frames appended and bytes written to segment files so far. */
+void tl_logseg_stats_get(guint64 *app_bytes, guint64 *file_bytes)
+{
+    if(app_bytes!=NULL)
+    {
+        *app_bytes = __atomic_load_n(&(g_tl_logseg_data.app_bytes),
+            __ATOMIC_RELAXED);
+    }
+    if(file_bytes!=NULL)
+    {
+        *file_bytes = __atomic_load_n(&(g_tl_logseg_data.file_bytes),
+            __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Reads the bytes written to the block device holding path since boot
+ * from its sysfs stat file (write sectors, in 512 byte units).
+ */
+gboolean tl_logseg_device_written_get(const gchar *path, guint64 *bytes)
+{
+    struct stat statbuf;
+    gchar *stat_path, *contents = NULL;
+    guint64 fields[7];
+    gboolean ret = FALSE;
+    
+    if(stat(path, &statbuf)!=0)
+    {
+        return FALSE;
+    }
+    
+    stat_path = g_strdup_printf("/sys/dev/block/%u:%u/stat",
+        major(statbuf.st_dev), minor(statbuf.st_dev));
+    if(g_file_get_contents(stat_path, &contents, NULL, NULL) &&
+        sscanf(contents, "%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %"
+        G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %"
+        G_GUINT64_FORMAT" %"G_GUINT64_FORMAT, &fields[0], &fields[1],
+        &fields[2], &fields[3], &fields[4], &fields[5], &fields[6])==7)
+    {
+        *bytes = fields[6] * 512;
+        ret = TRUE;
+    }
+    g_free(contents);
+    g_free(stat_path);
+    
+    return ret;
+}
@@ -0,0 +1,84 @@
+#ifndef HAVE_TL_LOGSEG_H
+#define HAVE_TL_LOGSEG_H
+
+#include <glib.h>
+#include "tl-codec.h"
+
+/*
+ * Log segment files are preallocated to their full size, so commits only
+ * overwrite allocated blocks and never change the file size. The first
+ * block holds the header:
+ * | "TLSG" | version (1B) | flags (1B) | codec (1B) | checkpoint (1B) |
+ *   logical end (8B BE) | CRC16 | [checkpoint] |
+ * checkpoint: | records (8B BE) | first time (8B BE) | last time (8B BE) |
+ *   previous end (8B BE) | previous records (8B BE) |
+ *   previous last time (8B BE) | CRC16 of the header so far |
+ * Frames start at the second block and end at the logical end, the rest
+ * of the file is zero until the segment is closed and trimmed. Each commit
+ * writes the header with the record count at the new logical end and at
+ * the one before, whose data is known to be on disk, so recovery after a
+ * crash only has to check the frames of the last commit.
+ *
+ * Uncompressed segments have a sidecar index (.tli) of record offsets:
+ * | "TLSI" | version (1B) | reserved (3B) | entry... |
+ * entry: | offset (8B BE) | time (8B BE) | length (4B BE) | type (1B) |
+ *   reserved (1B) | CRC16 (2B BE) |
+ * Keyframe entries let readers seek close to a time, metadata entries
+ * locate the handle declarations needed to decode from there. Trigger
+ * entries are keyframes which start a high-rate window of the logger.
+ * Entries are appended after the data they point to is committed.
+ *
+ * With TL_LOGSEG_FLAG_COMPRESSED the frames are written as one stream of
+ * the codec, which is flushed at each commit, so the data up to the
+ * logical end always decompresses. A closed segment ends the stream, one
+ * trimmed after a crash stops at the last flush.
+ */
+
+#define TL_LOGSEG_BLOCK_SIZE 4096
+
+typedef enum
+{
+    TL_LOGSEG_FLAG_COMPRESSED = 1 << 0
+}TLLogSegFlags;
+
+typedef enum
+{
+    TL_LOGSEG_INDEX_KEYFRAME = 1,
+    TL_LOGSEG_INDEX_META = 2,
+    TL_LOGSEG_INDEX_TRIGGER = 3
+}TLLogSegIndexType;
+
+typedef struct _TLLogSegIndexEntry
+{
+    guint64 offset;
+    gint64 time;
+    guint32 len;
+    guint type;
+}TLLogSegIndexEntry;
+
+typedef struct _TLLogSegment TLLogSegment;
+
+TLLogSegment *tl_logseg_create(const gchar *path, gsize size, guint flags,
+    TLCodecType codec, gint level);
+void tl_logseg_append(TLLogSegment *segment, const guint8 *data, gsize len);
+void tl_logseg_record_add(TLLogSegment *segment, gint64 time);
+void tl_logseg_index_add(TLLogSegment *segment, TLLogSegIndexType type,
+    gint64 time, gsize len);
+gboolean tl_logseg_commit(TLLogSegment *segment);
+gsize tl_logseg_length_get(const TLLogSegment *segment);
+gsize tl_logseg_pending_get(const TLLogSegment *segment);
+guint tl_logseg_flags_get(const TLLogSegment *segment);
+gboolean tl_logseg_close(TLLogSegment *segment);
+gboolean tl_logseg_trim(const gchar *path);
+gboolean tl_logseg_recover(const gchar *path, guint64 *records,
+    gint64 *first_time, gint64 *last_time);
+gboolean tl_logseg_header_get(const gchar *path, guint *flags,
+    TLCodecType *codec);
+gchar *tl_logseg_index_path_get(const gchar *path);
+GArray *tl_logseg_index_load(const gchar *path);
+gboolean tl_logseg_migrate(const gchar *path, const gchar *dest_path);
+
+void tl_logseg_stats_get(guint64 *app_bytes, guint64 *file_bytes);
+gboolean tl_logseg_device_written_get(const gchar *path, guint64 *bytes);
+
+#endif
@@ -0,0 +1,480 @@
+#include <string.h>
+#include "tl-logtier.h"
+#include "tl-logfmt.h"
+#include "tl-logarc.h"
+
+/*
+ * The log writer takes an item it wrote before as unchanged, so each item
+ * has two buffers and a changed value goes to the other one. items[0] is
+ * the mean or list value, items[1] and items[2] the range.
+ */
+typedef struct _TLLogTierSignal
+{
+    TLLoggerLogItemData items[3][2];
+    guint current[3];
+    gboolean numeric;
+    gdouble sum;
+    gint64 min;
+    gint64 max;
+    guint count;
+    gboolean present;
+    gint64 list_value;
+    GHashTable *list_table;
+    GHashTable *index_table;
+}TLLogTierSignal;
+
+struct _TLLogTierWriter
+{
+    TLLogArcWriter *archive;
+    TLLogFmtScanner *scanner;
+    TLLogFmtReader *reader;
+    TLLogFmtWriter *writer;
+    guint interval;
+    gboolean bucket_set;
+    gint64 bucket_time;
+    GPtrArray *signals;
+    GHashTable *signal_table;
+    GPtrArray *items;
+    GByteArray *output;
+    guint64 records;
+    gint64 first_time;
+    gint64 last_time;
+    GError *error;
+};
+
+static void tl_logtier_signal_free(TLLogTierSignal *signal)
+{
+    guint i;
+    
+    if(signal==NULL)
+    {
+        return;
+    }
+    for(i=0;i<3;i++)
+    {
+        g_free(signal->items[i][0].name);
+    }
+    g_free(signal->items[0][0].list_parent);
+    for(i=0;i<2;i++)
+    {
+        if(signal->items[0][i].list_table!=NULL)
+        {
+            g_hash_table_unref(signal->items[0][i].list_table);
+        }
+        if(signal->items[0][i].index_table!=NULL)
+        {
+            g_hash_table_unref(signal->items[0][i].index_table);
+        }
+    }
+    if(signal->list_table!=NULL)
+    {
+        g_hash_table_unref(signal->list_table);
+    }
+    if(signal->index_table!=NULL)
+    {
+        g_hash_table_unref(signal->index_table);
+    }
+    g_free(signal);
+}
+
+static TLLogTierSignal *tl_logtier_signal_new(
+    const TLLoggerLogItemData *item_data)
+{
+    TLLogTierSignal *signal;
+    guint i;
+    
+    signal = g_new0(TLLogTierSignal, 1);
+    signal->numeric = (item_data->list_parent==NULL &&
+        !item_data->list_index);
+    signal->items[0][0].name = g_strdup(item_data->name);
+    if(signal->numeric)
+    {
+        signal->items[1][0].name = g_strconcat(item_data->name,
+            TL_LOGTIER_MIN_SUFFIX, NULL);
+        signal->items[2][0].name = g_strconcat(item_data->name,
+            TL_LOGTIER_MAX_SUFFIX, NULL);
+    }
+    else
+    {
+        signal->items[0][0].list_parent = g_strdup(item_data->list_parent);
+        signal->items[0][0].list_index = item_data->list_index;
+    }
+    for(i=0;i<3;i++)
+    {
+        signal->items[i][0].unit = item_data->unit;
+        signal->items[i][0].offset = item_data->offset;
+        signal->items[i][0].source = item_data->source;
+        signal->items[i][1] = signal->items[i][0];
+    }
+    
+    return signal;
+}
+
+/*
+ * Looks up the range item of name with suffix, if name was downsampled
+ * already, which is when it has both range items.
+ */
+static const TLLoggerLogItemData *tl_logtier_range_item_get(
+    GHashTable *log_table, const gchar *name, const gchar *suffix)
+{
+    const TLLoggerLogItemData *item_data;
+    gchar *range_name;
+    
+    range_name = g_strconcat(name, TL_LOGTIER_MIN_SUFFIX, NULL);
+    item_data = g_hash_table_lookup(log_table, range_name);
+    g_free(range_name);
+    if(item_data==NULL)
+    {
+        return NULL;
+    }
+    range_name = g_strconcat(name, TL_LOGTIER_MAX_SUFFIX, NULL);
+    if(g_hash_table_lookup(log_table, range_name)==NULL)
+    {
+        g_free(range_name);
+        return NULL;
+    }
+    g_free(range_name);
+    
+    if(strcmp(suffix, TL_LOGTIER_MIN_SUFFIX)==0)
+    {
+        return item_data;
+    }
+    range_name = g_strconcat(name, suffix, NULL);
+    item_data = g_hash_table_lookup(log_table, range_name);
+    g_free(range_name);
+    
+    return item_data;
+}
+
+/* Checks whether name is a range item of another signal in log_table. */
+static gboolean tl_logtier_is_range_item(GHashTable *log_table,
+    const gchar *name)
+{
+    gchar *base_name;
+    gboolean ret = FALSE;
+    
+    if(g_str_has_suffix(name, TL_LOGTIER_MIN_SUFFIX) ||
+        g_str_has_suffix(name, TL_LOGTIER_MAX_SUFFIX))
+    {
+        base_name = g_strndup(name, strlen(name) -
+            strlen(TL_LOGTIER_MIN_SUFFIX));
+        ret = g_hash_table_contains(log_table, base_name) &&
+            tl_logtier_range_item_get(log_table, base_name,
+            TL_LOGTIER_MIN_SUFFIX)!=NULL;
+        g_free(base_name);
+    }
+    
+    return ret;
+}
+
+/* Returns the item of signal at index, in the other buffer if it changed. */
+static TLLoggerLogItemData *tl_logtier_signal_item_update(
+    TLLogTierSignal *signal, guint index, gint64 value,
+    GHashTable *list_table, GHashTable *index_table)
+{
+    TLLoggerLogItemData *item_data;
+    
+    item_data = &(signal->items[index][signal->current[index]]);
+    if(item_data->value==value && item_data->list_table==list_table &&
+        item_data->index_table==index_table)
+    {
+        return item_data;
+    }
+    
+    signal->current[index] ^= 1;
+    item_data = &(signal->items[index][signal->current[index]]);
+    item_data->value = value;
+    if(item_data->list_table!=NULL)
+    {
+        g_hash_table_unref(item_data->list_table);
+    }
+    item_data->list_table = list_table!=NULL ?
+        g_hash_table_ref(list_table) : NULL;
+    if(item_data->index_table!=NULL)
+    {
+        g_hash_table_unref(item_data->index_table);
+    }
+    item_data->index_table = index_table!=NULL ?
+        g_hash_table_ref(index_table) : NULL;
+    
+    return item_data;
+}
+
+/* Writes the record of the current interval, if it has any signal. */
+static gboolean tl_logtier_writer_bucket_flush(TLLogTierWriter *writer)
+{
+    TLLogTierSignal *signal;
+    gdouble mean;
+    gboolean empty = TRUE;
+    guint i;
+    
+    g_ptr_array_set_size(writer->items, 0);
+    g_ptr_array_set_size(writer->items, writer->signals->len * 3);
+    for(i=0;i<writer->signals->len;i++)
+    {
+        signal = g_ptr_array_index(writer->signals, i);
+        if(signal->numeric && signal->count>0)
+        {
+            mean = signal->sum / signal->count;
+            g_ptr_array_index(writer->items, i * 3) =
+                tl_logtier_signal_item_update(signal, 0, (gint64)(mean<0 ?
+                mean - 0.5 : mean + 0.5), NULL, NULL);
+            g_ptr_array_index(writer->items, i * 3 + 1) =
+                tl_logtier_signal_item_update(signal, 1, signal->min, NULL,
+                NULL);
+            g_ptr_array_index(writer->items, i * 3 + 2) =
+                tl_logtier_signal_item_update(signal, 2, signal->max, NULL,
+                NULL);
+            signal->sum = 0;
+            signal->count = 0;
+            empty = FALSE;
+        }
+        else if(!signal->numeric && signal->present)
+        {
+            g_ptr_array_index(writer->items, i * 3) =
+                tl_logtier_signal_item_update(signal, 0, signal->list_value,
+                signal->list_table, signal->index_table);
+            signal->present = FALSE;
+            empty = FALSE;
+        }
+    }
+    if(empty)
+    {
+        return TRUE;
+    }
+    
+    g_byte_array_set_size(writer->output, 0);
+    tl_logfmt_writer_record_append(writer->writer, writer->output,
+        writer->bucket_time, (const TLLoggerLogItemData * const *)
+        writer->items->pdata, writer->items->len);
+    if(writer->records==0)
+    {
+        writer->first_time = writer->bucket_time;
+    }
+    writer->last_time = writer->bucket_time;
+    writer->records++;
+    
+    return tl_logarc_writer_write(writer->archive, writer->output->data,
+        writer->output->len, &(writer->error));
+}
+
+static void tl_logtier_writer_item_add(TLLogTierWriter *writer,
+    GHashTable *log_table, const TLLoggerLogItemData *item_data)
+{
+    TLLogTierSignal *signal;
+    const TLLoggerLogItemData *range_data;
+    gint64 min, max;
+    
+    signal = g_hash_table_lookup(writer->signal_table, item_data->name);
+    if(signal==NULL)
+    {
+        signal = tl_logtier_signal_new(item_data);
+        g_ptr_array_add(writer->signals, signal);
+        g_hash_table_insert(writer->signal_table, signal->items[0][0].name,
+            signal);
+    }
+    
+    if(!signal->numeric)
+    {
+        signal->list_value = item_data->value;
+        if(signal->list_table!=NULL)
+        {
+            g_hash_table_unref(signal->list_table);
+        }
+        signal->list_table = item_data->list_table!=NULL ?
+            g_hash_table_ref(item_data->list_table) : NULL;
+        if(signal->index_table!=NULL)
+        {
+            g_hash_table_unref(signal->index_table);
+        }
+        signal->index_table = item_data->index_table!=NULL ?
+            g_hash_table_ref(item_data->index_table) : NULL;
+        signal->present = TRUE;
+        return;
+    }
+    
+    min = item_data->value;
+    max = item_data->value;
+    range_data = tl_logtier_range_item_get(log_table, item_data->name,
+        TL_LOGTIER_MIN_SUFFIX);
+    if(range_data!=NULL)
+    {
+        min = range_data->value;
+        range_data = tl_logtier_range_item_get(log_table, item_data->name,
+            TL_LOGTIER_MAX_SUFFIX);
+        max = range_data->value;
+    }
+    if(signal->count==0 || min<signal->min)
+    {
+        signal->min = min;
+    }
+    if(signal->count==0 || max>signal->max)
+    {
+        signal->max = max;
+    }
+    signal->sum += item_data->value;
+    signal->count++;
+}
+
+static gboolean tl_logtier_writer_frame_cb(TLLogFmtFrameType type,
+    const guint8 *payload, gsize len, gpointer user_data)
+{
+    TLLogTierWriter *writer = (TLLogTierWriter *)user_data;
+    GHashTable *log_table;
+    GHashTableIter iter;
+    TLLoggerLogItemData *item_data;
+    const gchar *name;
+    gint64 bucket_time;
+    gboolean ret = TRUE;
+    
+    log_table = tl_logfmt_reader_frame_decode(writer->reader, type, payload,
+        len);
+    if(log_table==NULL)
+    {
+        return TRUE;
+    }
+    item_data = g_hash_table_lookup(log_table, "time");
+    if(item_data==NULL)
+    {
+        g_hash_table_unref(log_table);
+        return TRUE;
+    }
+    
+    bucket_time = item_data->value - (item_data->value %
+        (gint64)writer->interval + writer->interval) % writer->interval;
+    if(writer->bucket_set && bucket_time!=writer->bucket_time)
+    {
+        ret = tl_logtier_writer_bucket_flush(writer);
+    }
+    writer->bucket_time = bucket_time;
+    writer->bucket_set = TRUE;
+    
+    g_hash_table_iter_init(&iter, log_table);
+    while(ret && g_hash_table_iter_next(&iter, (gpointer *)&name,
+        (gpointer *)&item_data))
+    {
+        if(strcmp(name, "time")==0 || tl_logtier_is_range_item(log_table,
+            name))
+        {
+            continue;
+        }
+        tl_logtier_writer_item_add(writer, log_table, item_data);
+    }
+    g_hash_table_unref(log_table);
+    
+    return ret;
+}
+
+/*
+ * Starts a tier of interval seconds, written as a block archive on ostream
+ * with codec at level.
+ */
+TLLogTierWriter *tl_logtier_writer_new(GOutputStream *ostream,
+    TLCodecType codec, gint level, guint interval, GError **error)
+{
+    TLLogTierWriter *writer;
+    TLLogArcWriter *archive;
+    
+    if(interval==0)
+    {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+            "Tier interval must not be 0");
+        return NULL;
+    }
+    
+    archive = tl_logarc_writer_new(ostream, codec, level,
+        TL_LOGARC_BLOCK_SIZE_DEFAULT, error);
+    if(archive==NULL)
+    {
+        return NULL;
+    }
+    
+    writer = g_new0(TLLogTierWriter, 1);
+    writer->archive = archive;
+    writer->scanner = tl_logfmt_scanner_new();
+    writer->reader = tl_logfmt_reader_new();
+    writer->writer = tl_logfmt_writer_new();
+    writer->interval = interval;
+    writer->signals = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)tl_logtier_signal_free);
+    writer->signal_table = g_hash_table_new(g_str_hash, g_str_equal);
+    writer->items = g_ptr_array_new();
+    writer->output = g_byte_array_new();
+    
+    return writer;
+}
+
+/* Adds log data to the tier, data may be cut anywhere between calls. */
+gboolean tl_logtier_writer_write(TLLogTierWriter *writer,
+    const guint8 *data, gsize len, GError **error)
+{
+    if(writer->error==NULL)
+    {
+        tl_logfmt_scanner_feed(writer->scanner, data, len,
+            tl_logtier_writer_frame_cb, writer);
+    }
+    if(writer->error!=NULL)
+    {
+        if(error!=NULL)
+        {
+            *error = g_error_copy(writer->error);
+        }
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* Writes the last interval and the archive index. */
+gboolean tl_logtier_writer_finish(TLLogTierWriter *writer, GError **error)
+{
+    if(writer->error==NULL && writer->bucket_set)
+    {
+        tl_logtier_writer_bucket_flush(writer);
+        writer->bucket_set = FALSE;
+    }
+    if(writer->error!=NULL)
+    {
+        if(error!=NULL)
+        {
+            *error = g_error_copy(writer->error);
+        }
+        return FALSE;
+    }
+    
+    return tl_logarc_writer_finish(writer->archive, error);
+}
+
+/* Returns the number of records written and their time range. */
+guint64 tl_logtier_writer_records_get(const TLLogTierWriter *writer,
+    gint64 *first_time, gint64 *last_time)
+{
+    if(first_time!=NULL)
+    {
+        *first_time = writer->first_time;
+    }
+    if(last_time!=NULL)
+    {
+        *last_time = writer->last_time;
+    }
+    
+    return writer->records;
+}
+
+void tl_logtier_writer_free(TLLogTierWriter *writer)
+{
+    if(writer==NULL)
+    {
+        return;
+    }
+    tl_logarc_writer_free(writer->archive);
+    tl_logfmt_scanner_free(writer->scanner);
+    tl_logfmt_reader_free(writer->reader);
+    tl_logfmt_writer_free(writer->writer);
+    g_hash_table_unref(writer->signal_table);
+    g_ptr_array_unref(writer->signals);
+    g_ptr_array_unref(writer->items);
+    g_byte_array_unref(writer->output);
+    g_clear_error(&(writer->error));
+    g_free(writer);
+}
@@ -0,0 +1,32 @@
+#ifndef HAVE_TL_LOGTIER_H
+#define HAVE_TL_LOGTIER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "tl-codec.h"
+
+/*
+ * Downsampled log tiers. A tier writer reads the frames of a log file and
+ * writes one record per interval seconds to a block archive, timed at the
+ * start of the interval. Each numeric signal is written as its mean over
+ * the interval, with "<name>.min" and "<name>.max" items for its range;
+ * list signals keep their last value. Input which is downsampled already
+ * is recognised by these items, so a tier can be downsampled again to a
+ * longer interval.
+ */
+
+#define TL_LOGTIER_MIN_SUFFIX ".min"
+#define TL_LOGTIER_MAX_SUFFIX ".max"
+
+typedef struct _TLLogTierWriter TLLogTierWriter;
+
+TLLogTierWriter *tl_logtier_writer_new(GOutputStream *ostream,
+    TLCodecType codec, gint level, guint interval, GError **error);
+gboolean tl_logtier_writer_write(TLLogTierWriter *writer,
+    const guint8 *data, gsize len, GError **error);
+gboolean tl_logtier_writer_finish(TLLogTierWriter *writer, GError **error);
+guint64 tl_logtier_writer_records_get(const TLLogTierWriter *writer,
+    gint64 *first_time, gint64 *last_time);
+void tl_logtier_writer_free(TLLogTierWriter *writer);
+
+#endif
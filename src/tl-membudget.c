@@ -0,0 +1,224 @@
+#include "tl-membudget.h"
+#include "tl-shm.h"
+
+#define TL_MEMBUDGET_EXPORT_INTERVAL 1
+
+/*
+ * Byte accounting for the queues which can grow while the storage or the
+ * network stalls. Owners charge what they queue and release what they
+ * drop, then check tl_membudget_is_over() to apply backpressure or spill
+ * early. The over state has a hysteresis of 1/8 of the budget, so a queue
+ * hovering around its limit does not flap.
+ */
+typedef struct _TLMemBudgetQueueData
+{
+    const gchar *name;
+    gsize budget;
+    gsize usage;
+    gsize peak;
+    gint over;
+    gint usage_slot;
+    gint budget_slot;
+}TLMemBudgetQueueData;
+
+typedef struct _TLMemBudgetData
+{
+    gboolean initialized;
+    TLMemBudgetQueueData queues[TL_MEMBUDGET_QUEUE_MAXIMUM];
+    guint export_timeout_id;
+}TLMemBudgetData;
+
+static TLMemBudgetData g_tl_membudget_data =
+{
+    .queues =
+    {
+        [TL_MEMBUDGET_QUEUE_LOG_WRITE] = { "log-write", 4 * 1024 * 1024 },
+        [TL_MEMBUDGET_QUEUE_LOG_CACHE] = { "log-cache", 16 * 1024 * 1024 },
+        [TL_MEMBUDGET_QUEUE_NET_DATA] = { "net-data", 8 * 1024 * 1024 },
+        [TL_MEMBUDGET_QUEUE_NET_WRITE] = { "net-write", 1024 * 1024 }
+    }
+};
+
+static gboolean tl_membudget_export_timer_cb(gpointer user_data)
+{
+    TLMemBudgetQueueData *queue_data;
+    gint64 now;
+    guint i;
+    
+    now = g_get_real_time();
+    for(i=0;i<TL_MEMBUDGET_QUEUE_MAXIMUM;i++)
+    {
+        queue_data = &(g_tl_membudget_data.queues[i]);
+        tl_shm_slot_update(queue_data->usage_slot, (gint64)__atomic_load_n(
+            &(queue_data->usage), __ATOMIC_RELAXED), now);
+        tl_shm_slot_update(queue_data->budget_slot, (gint64)__atomic_load_n(
+            &(queue_data->budget), __ATOMIC_RELAXED), now);
+    }
+    
+    return TRUE;
+}
+
+gboolean tl_membudget_init()
+{
+    TLMemBudgetQueueData *queue_data;
+    gchar *name;
+    guint i;
+    
+    if(g_tl_membudget_data.initialized)
+    {
+        g_warning("TLMemBudget already initialized!");
+        return TRUE;
+    }
+    
+    for(i=0;i<TL_MEMBUDGET_QUEUE_MAXIMUM;i++)
+    {
+        queue_data = &(g_tl_membudget_data.queues[i]);
+        
+        name = g_strdup_printf("membudget.%s", queue_data->name);
+        queue_data->usage_slot = tl_shm_slot_add(name, 1.0, 0, 0);
+        g_free(name);
+        
+        name = g_strdup_printf("membudget.%s.budget", queue_data->name);
+        queue_data->budget_slot = tl_shm_slot_add(name, 1.0, 0, 0);
+        g_free(name);
+    }
+    
+    g_tl_membudget_data.export_timeout_id = g_timeout_add_seconds(
+        TL_MEMBUDGET_EXPORT_INTERVAL, tl_membudget_export_timer_cb, NULL);
+    
+    g_tl_membudget_data.initialized = TRUE;
+    
+    return TRUE;
+}
+
+void tl_membudget_uninit()
+{
+    TLMemBudgetQueueData *queue_data;
+    guint i;
+    
+    if(!g_tl_membudget_data.initialized)
+    {
+        return;
+    }
+    
+    g_tl_membudget_data.initialized = FALSE;
+    
+    if(g_tl_membudget_data.export_timeout_id>0)
+    {
+        g_source_remove(g_tl_membudget_data.export_timeout_id);
+        g_tl_membudget_data.export_timeout_id = 0;
+    }
+    
+    for(i=0;i<TL_MEMBUDGET_QUEUE_MAXIMUM;i++)
+    {
+        queue_data = &(g_tl_membudget_data.queues[i]);
+        g_message("TLMemBudget queue %s peak usage %"G_GSIZE_FORMAT
+            " of %"G_GSIZE_FORMAT" bytes.", queue_data->name,
+            queue_data->peak, queue_data->budget);
+        queue_data->usage_slot = -1;
+        queue_data->budget_slot = -1;
+    }
+}
+
+void tl_membudget_budget_set(TLMemBudgetQueue queue, gsize budget)
+{
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM)
+    {
+        return;
+    }
+    
+    __atomic_store_n(&(g_tl_membudget_data.queues[queue].budget), budget,
+        __ATOMIC_RELAXED);
+}
+
+gsize tl_membudget_budget_get(TLMemBudgetQueue queue)
+{
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM)
+    {
+        return 0;
+    }
+    
+    return __atomic_load_n(&(g_tl_membudget_data.queues[queue].budget),
+        __ATOMIC_RELAXED);
+}
+
+void tl_membudget_charge(TLMemBudgetQueue queue, gsize size)
+{
+    TLMemBudgetQueueData *queue_data;
+    gsize usage, peak, budget;
+    
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM || size==0)
+    {
+        return;
+    }
+    
+    queue_data = &(g_tl_membudget_data.queues[queue]);
+    usage = __atomic_add_fetch(&(queue_data->usage), size, __ATOMIC_RELAXED);
+    
+    peak = __atomic_load_n(&(queue_data->peak), __ATOMIC_RELAXED);
+    while(usage>peak && !__atomic_compare_exchange_n(&(queue_data->peak),
+        &peak, usage, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    budget = __atomic_load_n(&(queue_data->budget), __ATOMIC_RELAXED);
+    if(budget>0 && usage>budget &&
+        g_atomic_int_compare_and_exchange(&(queue_data->over), 0, 1))
+    {
+        g_warning("TLMemBudget queue %s is over budget (%"G_GSIZE_FORMAT
+            " of %"G_GSIZE_FORMAT" bytes)!", queue_data->name, usage,
+            budget);
+    }
+}
+
+void tl_membudget_release(TLMemBudgetQueue queue, gsize size)
+{
+    TLMemBudgetQueueData *queue_data;
+    gsize usage, budget;
+    
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM || size==0)
+    {
+        return;
+    }
+    
+    queue_data = &(g_tl_membudget_data.queues[queue]);
+    usage = __atomic_sub_fetch(&(queue_data->usage), size, __ATOMIC_RELAXED);
+    
+    budget = __atomic_load_n(&(queue_data->budget), __ATOMIC_RELAXED);
+    if(usage<=budget - budget/8 &&
+        g_atomic_int_compare_and_exchange(&(queue_data->over), 1, 0))
+    {
+        g_message("TLMemBudget queue %s is back under budget.",
+            queue_data->name);
+    }
+}
+
+gsize tl_membudget_usage_get(TLMemBudgetQueue queue)
+{
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM)
+    {
+        return 0;
+    }
+    
+    return __atomic_load_n(&(g_tl_membudget_data.queues[queue].usage),
+        __ATOMIC_RELAXED);
+}
+
+gsize tl_membudget_peak_get(TLMemBudgetQueue queue)
+{
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM)
+    {
+        return 0;
+    }
+    
+    return __atomic_load_n(&(g_tl_membudget_data.queues[queue].peak),
+        __ATOMIC_RELAXED);
+}
+
+gboolean tl_membudget_is_over(TLMemBudgetQueue queue)
+{
+    if(queue>=TL_MEMBUDGET_QUEUE_MAXIMUM)
+    {
+        return FALSE;
+    }
+    
+    return g_atomic_int_get(&(g_tl_membudget_data.queues[queue].over))!=0;
+}
@@ -0,0 +1,25 @@
+#ifndef HAVE_TL_MEMBUDGET_H
+#define HAVE_TL_MEMBUDGET_H
+
+#include <glib.h>
+
+typedef enum
+{
+    TL_MEMBUDGET_QUEUE_LOG_WRITE,
+    TL_MEMBUDGET_QUEUE_LOG_CACHE,
+    TL_MEMBUDGET_QUEUE_NET_DATA,
+    TL_MEMBUDGET_QUEUE_NET_WRITE,
+    TL_MEMBUDGET_QUEUE_MAXIMUM
+}TLMemBudgetQueue;
+
+gboolean tl_membudget_init();
+void tl_membudget_uninit();
+void tl_membudget_budget_set(TLMemBudgetQueue queue, gsize budget);
+gsize tl_membudget_budget_get(TLMemBudgetQueue queue);
+void tl_membudget_charge(TLMemBudgetQueue queue, gsize size);
+void tl_membudget_release(TLMemBudgetQueue queue, gsize size);
+gsize tl_membudget_usage_get(TLMemBudgetQueue queue);
+gsize tl_membudget_peak_get(TLMemBudgetQueue queue);
+gboolean tl_membudget_is_over(TLMemBudgetQueue queue);
+
+#endif
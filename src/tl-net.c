@@ -7,9 +7,11 @@
 #include "tl-parser.h"
 #include "tl-gps.h"
 #include "tl-serial.h"
+#include "tl-membudget.h"
 
 #define TL_NET_BACKLOG_MAXIMUM 45
 #define TL_NET_LOG_TO_DISK_TRIGGER 2048
+#define TL_NET_DATA_NODE_OVERHEAD 96
 
 #define TL_NET_PACKET_FILE_HEADER ((const guint8 *)"TLNP")
 
@@ -99,6 +101,7 @@ typedef struct _TLNetData
 typedef struct _TLNetWriteBufferData
 {
     GByteArray *buffer;
+    gsize charged_size;
     gint64 timestamp;
     gboolean request_answer;
     guint8 request_type;
@@ -214,6 +217,8 @@ static TLNetWriteBufferData *tl_net_write_buffer_data_new(GByteArray *ba)
     
     data = g_new0(TLNetWriteBufferData, 1);
     data->buffer = g_byte_array_ref(ba);
+    data->charged_size = sizeof(TLNetWriteBufferData) + ba->len;
+    tl_membudget_charge(TL_MEMBUDGET_QUEUE_NET_WRITE, data->charged_size);
     
     return data;
 }
@@ -228,9 +233,45 @@ static void tl_net_write_buffer_data_free(TLNetWriteBufferData *data)
     {
         g_byte_array_unref(data->buffer);
     }
+    tl_membudget_release(TL_MEMBUDGET_QUEUE_NET_WRITE, data->charged_size);
     g_free(data);
 }
 
+static inline gsize tl_net_vehicle_data_size(const GByteArray *ba)
+{
+    return TL_NET_DATA_NODE_OVERHEAD + ba->len;
+}
+
+static GByteArray *tl_net_vehicle_data_charge(GByteArray *ba)
+{
+    tl_membudget_charge(TL_MEMBUDGET_QUEUE_NET_DATA,
+        tl_net_vehicle_data_size(ba));
+    
+    return ba;
+}
+
+static void tl_net_vehicle_data_free(GByteArray *ba)
+{
+    if(ba==NULL)
+    {
+        return;
+    }
+    tl_membudget_release(TL_MEMBUDGET_QUEUE_NET_DATA,
+        tl_net_vehicle_data_size(ba));
+    g_byte_array_unref(ba);
+}
+
+/* Stops loading spilled packets back well before the budget is reached. */
+static gboolean tl_net_vehicle_data_reload_is_full(guint count)
+{
+    gsize budget;
+    
+    budget = tl_membudget_budget_get(TL_MEMBUDGET_QUEUE_NET_DATA);
+    
+    return (count >= TL_NET_LOG_TO_DISK_TRIGGER/2 || (budget>0 &&
+        tl_membudget_usage_get(TL_MEMBUDGET_QUEUE_NET_DATA) >= budget / 2));
+}
+
 static void tl_net_backlog_data_free(TLNetBacklogData *data)
 {
     if(data==NULL)
@@ -1239,8 +1280,13 @@ static gboolean tl_net_vehicle_connection_check_timeout_cb(gpointer user_data)
                 break;
             }
             
+            /*
+             * Packets stay in the data tree, where they can be spilled to
+             * disk, while the write queue is over its budget.
+             */
             if(g_queue_is_empty(net_data->vehicle_write_queue) &&
-                net_data->vehicle_write_buffer==NULL)
+                net_data->vehicle_write_buffer==NULL &&
+                !tl_membudget_is_over(TL_MEMBUDGET_QUEUE_NET_WRITE))
             {
                 dt = g_date_time_new_now_local();
                 net_data->realtime_now = g_date_time_to_unix(dt);
@@ -1430,7 +1476,8 @@ static gboolean tl_net_vehicle_data_report_timeout(gpointer user_data)
                     g_mutex_lock(&(net_data->vehicle_data_mutex));
                     g_tree_replace(net_data->vehicle_data_tree,
                         g_memdup(&(backlog_data->timestamp), sizeof(gint64)),
-                        g_byte_array_ref(backlog_data->backlog));
+                        tl_net_vehicle_data_charge(g_byte_array_ref(
+                        backlog_data->backlog)));
                     g_mutex_unlock(&(net_data->vehicle_data_mutex));
                 }
                 
@@ -1460,7 +1507,7 @@ static gboolean tl_net_vehicle_data_report_timeout(gpointer user_data)
         
         g_mutex_lock(&(net_data->vehicle_data_mutex));
         g_tree_replace(net_data->vehicle_data_tree, g_memdup(&timestamp,
-            sizeof(gint64)), packet_dup);
+            sizeof(gint64)), tl_net_vehicle_data_charge(packet_dup));
         g_mutex_unlock(&(net_data->vehicle_data_mutex));
         
         net_data->vehicle_data_report_timestamp = now;
@@ -1590,12 +1637,14 @@ static guint tl_net_vehicle_data_from_file(TLNetData *net_data,
                             
                             g_mutex_lock(&(net_data->vehicle_data_mutex));
                             g_tree_insert(net_data->vehicle_data_tree,
-                                g_memdup(&timestamp, sizeof(gint64)), packet);
+                                g_memdup(&timestamp, sizeof(gint64)),
+                                tl_net_vehicle_data_charge(packet));
                             g_mutex_unlock(&(net_data->vehicle_data_mutex));
                             
                             ret++;
                             
-                            if(ret + count >= TL_NET_LOG_TO_DISK_TRIGGER/2)
+                            if(tl_net_vehicle_data_reload_is_full(
+                                ret + count))
                             {
                                 flag = TRUE;
                                 tmp_file = g_strdup_printf("%s.new",
@@ -1765,7 +1814,8 @@ static gpointer tl_net_vehicle_data_log_thread(gpointer user_data)
         tree_len = g_tree_nnodes(net_data->vehicle_data_tree);
         g_mutex_unlock(&(net_data->vehicle_data_mutex));
         
-        if(tree_len > TL_NET_LOG_TO_DISK_TRIGGER)
+        if(tree_len > TL_NET_LOG_TO_DISK_TRIGGER ||
+            tl_membudget_is_over(TL_MEMBUDGET_QUEUE_NET_DATA))
         {
             net_data->vehicle_data_file_remove_list = NULL;
             net_data->vehicle_data_file_node_count = 0;
@@ -1875,7 +1925,7 @@ static gpointer tl_net_vehicle_data_log_thread(gpointer user_data)
             if(dir!=NULL)
             {
                 while((dfname=g_dir_read_name(dir))!=NULL &&
-                    i<TL_NET_LOG_TO_DISK_TRIGGER/2)
+                    !tl_net_vehicle_data_reload_is_full(i))
                 {
                     if(g_str_has_suffix(dfname, ".tn"))
                     {
@@ -2010,7 +2060,7 @@ gboolean tl_net_init(const gchar *vin, const gchar *iccid,
     g_mutex_init(&(g_tl_net_data.vehicle_backlog_data_mutex));
     
     g_tl_net_data.vehicle_data_tree = g_tree_new_full(tl_net_int64ptr_compare,
-        NULL, g_free, (GDestroyNotify)g_byte_array_unref);
+        NULL, g_free, (GDestroyNotify)tl_net_vehicle_data_free);
     g_tl_net_data.vehicle_backlog_data_queue = g_queue_new();
     
     g_tl_net_data.vehicle_packet_read_buffer = g_byte_array_new();
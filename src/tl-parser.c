@@ -4,6 +4,10 @@
 #include <errno.h>
 #include "tl-parser.h"
 #include "tl-logger.h"
+#include "tl-expr.h"
+
+#define TL_PARSER_TRIGGER_PRE_DEFAULT 10
+#define TL_PARSER_TRIGGER_POST_DEFAULT 30
 
 typedef enum 
 {
@@ -12,7 +16,10 @@ typedef enum
     TL_PARSER_PRIMARY_STATE_NAME,
     TL_PARSER_PRIMARY_STATE_REV,
     TL_PARSER_PRIMARY_STATE_BATTERY_CODE_LEN,
-    TL_PARSER_PRIMARY_STATE_BATTERY_CODE
+    TL_PARSER_PRIMARY_STATE_BATTERY_CODE,
+    TL_PARSER_PRIMARY_STATE_DERIVED,
+    TL_PARSER_PRIMARY_STATE_TRIGGER,
+    TL_PARSER_PRIMARY_STATE_GROUP
 }TLParserPrimaryState;
 
 typedef struct _TLParserData
@@ -25,6 +32,14 @@ typedef struct _TLParserData
     gchar *name;
     guint rev;
     gboolean use_ext_id;
+    GHashTable *parser_tail_table;
+    guint signal_count;
+    gchar *derived_name;
+    gdouble derived_unit;
+    gint derived_offset;
+    guint trigger_pre;
+    guint trigger_post;
+    guint group_interval;
     guint8 single_bat_code_len;
     gchar *bat_code;
     guint bat_code_total_len;
@@ -58,6 +73,62 @@ static void tl_parser_signal_data_list_free(GSList *list)
     g_slist_free_full(list, (GDestroyNotify)tl_parser_signal_data_free);
 }
 
+static void tl_parser_signal_table_add(TLParserData *parser_data,
+    TLParserSignalData *signal_data)
+{
+    GSList *signal_list, *tail;
+    
+    if(signal_data->id >= 2048)
+    {
+        parser_data->use_ext_id = TRUE;
+    }
+    
+    signal_list = g_hash_table_lookup(parser_data->parser_table,
+        GINT_TO_POINTER(signal_data->id));
+    if(signal_list==NULL)
+    {
+        signal_list = g_slist_prepend(NULL, signal_data);
+        g_hash_table_replace(parser_data->parser_table,
+            GINT_TO_POINTER(signal_data->id), signal_list);
+        g_hash_table_replace(parser_data->parser_tail_table,
+            GINT_TO_POINTER(signal_data->id), signal_list);
+    }
+    else if(signal_data->mux_type==TL_PARSER_MUX_TYPE_MULTIPLEXOR)
+    {
+        /* Multiplexor must be decoded before its multiplexed signals. */
+        g_hash_table_steal(parser_data->parser_table,
+            GINT_TO_POINTER(signal_data->id));
+        g_hash_table_replace(parser_data->parser_table,
+            GINT_TO_POINTER(signal_data->id),
+            g_slist_prepend(signal_list, signal_data));
+    }
+    else
+    {
+        /* Append with the cached tail, g_slist_append() is O(n). */
+        tail = g_hash_table_lookup(parser_data->parser_tail_table,
+            GINT_TO_POINTER(signal_data->id));
+        if(tail==NULL)
+        {
+            tail = g_slist_last(signal_list);
+        }
+        tail->next = g_slist_prepend(NULL, signal_data);
+        g_hash_table_replace(parser_data->parser_tail_table,
+            GINT_TO_POINTER(signal_data->id), tail->next);
+    }
+    
+    parser_data->signal_count++;
+}
+
+static inline guint tl_parser_attr_uint(const gchar *value, guint base)
+{
+    return (guint)g_ascii_strtoull(value, NULL, base);
+}
+
+static inline gint tl_parser_attr_int(const gchar *value)
+{
+    return (gint)g_ascii_strtoll(value, NULL, 10);
+}
+
 static void tl_parser_markup_parser_start_element(GMarkupParseContext *context,
     const gchar *element_name, const gchar **attribute_names,
     const gchar **attribute_values, gpointer user_data, GError **error)
@@ -66,7 +137,7 @@ static void tl_parser_markup_parser_start_element(GMarkupParseContext *context,
     int i;
     TLParserSignalData *signal_data;
     gboolean have_id = FALSE;
-    GSList *signal_list;
+    gchar *endptr;
     
     if(user_data==NULL)
     {
@@ -87,14 +158,11 @@ static void tl_parser_markup_parser_start_element(GMarkupParseContext *context,
         {
             if(g_strcmp0(attribute_names[i], "id")==0)
             {
-                if(sscanf(attribute_values[i], "0x%X", &(signal_data->id))>=1)
+                if(g_ascii_strncasecmp(attribute_values[i], "0x", 2)==0)
                 {
-                    have_id = TRUE;
-                    if(signal_data->id >= 2048)
-                    {
-                        parser_data->use_ext_id = TRUE;
-                    }
-                    g_debug("Parsed CAN-Bus ID %d", signal_data->id);
+                    signal_data->id = g_ascii_strtoull(attribute_values[i] + 2,
+                        &endptr, 16);
+                    have_id = (endptr!=attribute_values[i] + 2);
                 }
             }
             else if(g_strcmp0(attribute_names[i], "name")==0)
@@ -110,23 +178,26 @@ static void tl_parser_markup_parser_start_element(GMarkupParseContext *context,
             }
             else if(g_strcmp0(attribute_names[i], "firstbyte")==0)
             {
-                sscanf(attribute_values[i], "%u", &(signal_data->firstbyte));
+                signal_data->firstbyte = tl_parser_attr_uint(
+                    attribute_values[i], 10);
             }
             else if(g_strcmp0(attribute_names[i], "firstbit")==0)
             {
-                sscanf(attribute_values[i], "%u", &(signal_data->firstbit));
+                signal_data->firstbit = tl_parser_attr_uint(
+                    attribute_values[i], 10);
             }
             else if(g_strcmp0(attribute_names[i], "bitlength")==0)
             {
-                sscanf(attribute_values[i], "%u", &(signal_data->bitlength));
+                signal_data->bitlength = tl_parser_attr_uint(
+                    attribute_values[i], 10);
             }
             else if(g_strcmp0(attribute_names[i], "unit")==0)
             {
-                sscanf(attribute_values[i], "%lf", &(signal_data->unit));
+                signal_data->unit = g_ascii_strtod(attribute_values[i], NULL);
             }
             else if(g_strcmp0(attribute_names[i], "offset")==0)
             {
-                sscanf(attribute_values[i], "%d", &(signal_data->offset));
+                signal_data->offset = tl_parser_attr_int(attribute_values[i]);
             }
             else if(g_strcmp0(attribute_names[i], "listparent")==0)
             {
@@ -134,34 +205,113 @@ static void tl_parser_markup_parser_start_element(GMarkupParseContext *context,
             }
             else if(g_strcmp0(attribute_names[i], "listindex")==0)
             {
-                sscanf(attribute_values[i], "%u", &(signal_data->listindex));
+                signal_data->listindex = tl_parser_attr_uint(
+                    attribute_values[i], 10);
             }
             else if(g_strcmp0(attribute_names[i], "source")==0)
             {
-                sscanf(attribute_values[i], "%d", &(signal_data->source));
+                signal_data->source = tl_parser_attr_int(attribute_values[i]);
+            }
+            else if(g_strcmp0(attribute_names[i], "signed")==0)
+            {
+                signal_data->is_signed = (tl_parser_attr_uint(
+                    attribute_values[i], 10)!=0);
             }
         }
         
         if(have_id)
         {
-            if(g_hash_table_contains(parser_data->parser_table,
-                GINT_TO_POINTER(signal_data->id)))
+            tl_parser_signal_table_add(parser_data, signal_data);
+        }
+        else
+        {
+            tl_parser_signal_data_free(signal_data);
+        }
+    }
+    else if(parser_data->data_flag && g_strcmp0(element_name, "derived")==0)
+    {
+        parser_data->primary_state = TL_PARSER_PRIMARY_STATE_DERIVED;
+        if(parser_data->derived_name!=NULL)
+        {
+            g_free(parser_data->derived_name);
+            parser_data->derived_name = NULL;
+        }
+        parser_data->derived_unit = 1.0;
+        parser_data->derived_offset = 0;
+        
+        for(i=0;attribute_names[i]!=NULL;i++)
+        {
+            if(g_strcmp0(attribute_names[i], "name")==0)
             {
-                signal_list = g_hash_table_lookup(parser_data->parser_table,
-                    GINT_TO_POINTER(signal_data->id));
-                signal_list = g_slist_append(signal_list, signal_data);
+                parser_data->derived_name = g_strdup(attribute_values[i]);
             }
-            else
+            else if(g_strcmp0(attribute_names[i], "unit")==0)
             {
-                signal_list = g_slist_append(NULL, signal_data);
-                g_hash_table_replace(parser_data->parser_table,
-                    GINT_TO_POINTER(signal_data->id), signal_list);
+                parser_data->derived_unit = g_ascii_strtod(
+                    attribute_values[i], NULL);
+            }
+            else if(g_strcmp0(attribute_names[i], "offset")==0)
+            {
+                parser_data->derived_offset = tl_parser_attr_int(
+                    attribute_values[i]);
             }
-            
         }
-        else
+    }
+    else if(parser_data->data_flag && g_strcmp0(element_name, "trigger")==0)
+    {
+        /*
+         * A trigger is a derived signal which is 1 while its condition
+         * holds and opens a high-rate log window when it becomes 1.
+         */
+        parser_data->primary_state = TL_PARSER_PRIMARY_STATE_TRIGGER;
+        if(parser_data->derived_name!=NULL)
         {
-            tl_parser_signal_data_free(signal_data);
+            g_free(parser_data->derived_name);
+            parser_data->derived_name = NULL;
+        }
+        parser_data->trigger_pre = TL_PARSER_TRIGGER_PRE_DEFAULT;
+        parser_data->trigger_post = TL_PARSER_TRIGGER_POST_DEFAULT;
+        
+        for(i=0;attribute_names[i]!=NULL;i++)
+        {
+            if(g_strcmp0(attribute_names[i], "name")==0)
+            {
+                parser_data->derived_name = g_strdup(attribute_values[i]);
+            }
+            else if(g_strcmp0(attribute_names[i], "pre")==0)
+            {
+                parser_data->trigger_pre = tl_parser_attr_uint(
+                    attribute_values[i], 10);
+            }
+            else if(g_strcmp0(attribute_names[i], "post")==0)
+            {
+                parser_data->trigger_post = tl_parser_attr_uint(
+                    attribute_values[i], 10);
+            }
+        }
+    }
+    else if(parser_data->data_flag && g_strcmp0(element_name, "group")==0)
+    {
+        /* A log group lists signal name patterns with their log rate. */
+        parser_data->primary_state = TL_PARSER_PRIMARY_STATE_GROUP;
+        if(parser_data->derived_name!=NULL)
+        {
+            g_free(parser_data->derived_name);
+            parser_data->derived_name = NULL;
+        }
+        parser_data->group_interval = 0;
+        
+        for(i=0;attribute_names[i]!=NULL;i++)
+        {
+            if(g_strcmp0(attribute_names[i], "name")==0)
+            {
+                parser_data->derived_name = g_strdup(attribute_values[i]);
+            }
+            else if(g_strcmp0(attribute_names[i], "interval")==0)
+            {
+                parser_data->group_interval = tl_parser_attr_uint(
+                    attribute_values[i], 10);
+            }
         }
     }
     else if(parser_data->data_flag && g_strcmp0(element_name, "name")==0)
@@ -216,6 +366,7 @@ static void tl_parser_markup_parser_text(GMarkupParseContext *context,
 {
     TLParserData *parser_data = (TLParserData *)user_data;
     guint value;
+    gchar *expression;
     
     if(user_data==NULL)
     {
@@ -244,6 +395,49 @@ static void tl_parser_markup_parser_text(GMarkupParseContext *context,
             parser_data->single_bat_code_len = value;
             break;
         }
+        case TL_PARSER_PRIMARY_STATE_DERIVED:
+        {
+            if(parser_data->derived_name!=NULL)
+            {
+                expression = g_strndup(text, text_len);
+                tl_expr_add(parser_data->derived_name, expression,
+                    parser_data->derived_unit, parser_data->derived_offset);
+                g_free(expression);
+                g_free(parser_data->derived_name);
+                parser_data->derived_name = NULL;
+            }
+            break;
+        }
+        case TL_PARSER_PRIMARY_STATE_TRIGGER:
+        {
+            if(parser_data->derived_name!=NULL)
+            {
+                expression = g_strndup(text, text_len);
+                if(tl_expr_add(parser_data->derived_name, expression, 1.0,
+                    0))
+                {
+                    tl_logger_trigger_add(parser_data->derived_name,
+                        parser_data->trigger_pre, parser_data->trigger_post);
+                }
+                g_free(expression);
+                g_free(parser_data->derived_name);
+                parser_data->derived_name = NULL;
+            }
+            break;
+        }
+        case TL_PARSER_PRIMARY_STATE_GROUP:
+        {
+            if(parser_data->derived_name!=NULL)
+            {
+                expression = g_strndup(text, text_len);
+                tl_logger_log_group_add(parser_data->derived_name, expression,
+                    parser_data->group_interval);
+                g_free(expression);
+                g_free(parser_data->derived_name);
+                parser_data->derived_name = NULL;
+            }
+            break;
+        }
         case TL_PARSER_PRIMARY_STATE_BATTERY_CODE:
         {
             if(parser_data->bat_code!=NULL)
@@ -280,6 +474,10 @@ gboolean tl_parser_init()
     g_tl_parser_data.primary_state = TL_PARSER_PRIMARY_STATE_NONE;
     g_tl_parser_data.parser_table = g_hash_table_new_full(g_direct_hash,
         g_direct_equal, NULL, (GDestroyNotify)tl_parser_signal_data_list_free);
+    g_tl_parser_data.parser_tail_table = g_hash_table_new(g_direct_hash,
+        g_direct_equal);
+    
+    tl_expr_init();
     
     g_tl_parser_data.initialized = TRUE;
     
@@ -297,6 +495,18 @@ void tl_parser_uninit()
         g_markup_parse_context_free(g_tl_parser_data.parser_context);
         g_tl_parser_data.parser_context = NULL;
     }
+    tl_expr_uninit();
+    
+    if(g_tl_parser_data.derived_name!=NULL)
+    {
+        g_free(g_tl_parser_data.derived_name);
+        g_tl_parser_data.derived_name = NULL;
+    }
+    if(g_tl_parser_data.parser_tail_table!=NULL)
+    {
+        g_hash_table_unref(g_tl_parser_data.parser_tail_table);
+        g_tl_parser_data.parser_tail_table = NULL;
+    }
     if(g_tl_parser_data.parser_table!=NULL)
     {
         g_hash_table_unref(g_tl_parser_data.parser_table);
@@ -306,6 +516,413 @@ void tl_parser_uninit()
     g_tl_parser_data.initialized = FALSE;
 }
 
+static void tl_parser_signal_table_reset(TLParserData *parser_data)
+{
+    g_hash_table_remove_all(parser_data->parser_table);
+    g_hash_table_remove_all(parser_data->parser_tail_table);
+    if(parser_data->name!=NULL)
+    {
+        g_free(parser_data->name);
+        parser_data->name = NULL;
+    }
+    parser_data->rev = 0;
+    parser_data->use_ext_id = FALSE;
+    parser_data->signal_count = 0;
+    tl_expr_clear();
+    tl_logger_trigger_clear();
+    tl_logger_log_group_clear();
+}
+
+static void tl_parser_signal_table_finish(TLParserData *parser_data)
+{
+    GHashTableIter iter;
+    GSList *signal_list, *list_foreach;
+    TLParserSignalData *signal_data;
+    
+    g_hash_table_remove_all(parser_data->parser_tail_table);
+    
+    /* Resolve expression input slots once, not per decoded frame. */
+    g_hash_table_iter_init(&iter, parser_data->parser_table);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&signal_list))
+    {
+        for(list_foreach=signal_list;list_foreach!=NULL;
+            list_foreach=g_slist_next(list_foreach))
+        {
+            signal_data = list_foreach->data;
+            signal_data->expr_slot = tl_expr_slot_lookup(signal_data->name);
+        }
+    }
+}
+
+static inline const gchar *tl_parser_dbc_skip_space(const gchar *p)
+{
+    while(*p==' ' || *p=='\t')
+    {
+        p++;
+    }
+    return p;
+}
+
+static const gchar *tl_parser_dbc_token(const gchar *p, gchar *buffer,
+    gsize size)
+{
+    gsize i = 0;
+    
+    p = tl_parser_dbc_skip_space(p);
+    while(*p!='\0' && *p!=' ' && *p!='\t' && *p!=':' && *p!=';' &&
+        *p!='\r' && *p!='\n')
+    {
+        if(i+1<size)
+        {
+            buffer[i++] = *p;
+        }
+        p++;
+    }
+    buffer[i] = '\0';
+    
+    return p;
+}
+
+static const gchar *tl_parser_dbc_string(const gchar *p, gchar *buffer,
+    gsize size)
+{
+    gsize i = 0;
+    
+    p = tl_parser_dbc_skip_space(p);
+    buffer[0] = '\0';
+    if(*p!='"')
+    {
+        return NULL;
+    }
+    p++;
+    while(*p!='\0' && *p!='"')
+    {
+        if(i+1<size)
+        {
+            buffer[i++] = *p;
+        }
+        p++;
+    }
+    buffer[i] = '\0';
+    if(*p!='"')
+    {
+        return NULL;
+    }
+    
+    return p + 1;
+}
+
+static inline const gchar *tl_parser_dbc_expect(const gchar *p, gchar c)
+{
+    if(p==NULL)
+    {
+        return NULL;
+    }
+    p = tl_parser_dbc_skip_space(p);
+    if(*p!=c)
+    {
+        return NULL;
+    }
+    return p + 1;
+}
+
+/*
+ * DBC Motorola signals use the MSB as start bit, but the decoder expects the
+ * LSB position (same as the "firstbit" attribute in tboxparse.xml).
+ */
+static guint tl_parser_dbc_motorola_lsb(guint startbit, guint bitlength)
+{
+    guint pos = startbit;
+    guint i;
+    
+    for(i=1;i<bitlength;i++)
+    {
+        if(pos%8==0)
+        {
+            pos += 15;
+        }
+        else
+        {
+            pos--;
+        }
+    }
+    
+    return pos;
+}
+
+/*
+ * SG_ <name> [M|m<value>] : <start>|<length>@<order><sign> (<factor>,<offset>)
+ *     [<min>|<max>] "<unit>" <receivers>
+ */
+static TLParserSignalData *tl_parser_dbc_signal_parse(const gchar *line,
+    int can_id)
+{
+    TLParserSignalData *signal_data;
+    gchar name[256], mux[32];
+    const gchar *p;
+    gchar *endptr;
+    guint startbit, bitlength;
+    gboolean motorola;
+    gdouble factor, offset;
+    
+    p = tl_parser_dbc_token(line, name, sizeof(name));
+    if(name[0]=='\0')
+    {
+        return NULL;
+    }
+    
+    mux[0] = '\0';
+    p = tl_parser_dbc_skip_space(p);
+    if(*p!=':')
+    {
+        p = tl_parser_dbc_token(p, mux, sizeof(mux));
+    }
+    p = tl_parser_dbc_expect(p, ':');
+    if(p==NULL)
+    {
+        return NULL;
+    }
+    
+    startbit = g_ascii_strtoull(p, &endptr, 10);
+    if(endptr==p)
+    {
+        return NULL;
+    }
+    p = tl_parser_dbc_expect(endptr, '|');
+    if(p==NULL)
+    {
+        return NULL;
+    }
+    bitlength = g_ascii_strtoull(p, &endptr, 10);
+    if(endptr==p || bitlength==0 || bitlength>64)
+    {
+        return NULL;
+    }
+    p = tl_parser_dbc_expect(endptr, '@');
+    if(p==NULL || (p[0]!='0' && p[0]!='1') || (p[1]!='+' && p[1]!='-'))
+    {
+        return NULL;
+    }
+    motorola = (p[0]=='0');
+    
+    signal_data = g_new0(TLParserSignalData, 1);
+    signal_data->id = can_id;
+    signal_data->name = g_strdup(name);
+    signal_data->endian = motorola;
+    signal_data->is_signed = (p[1]=='-');
+    signal_data->bitlength = bitlength;
+    if(motorola)
+    {
+        signal_data->firstbit = tl_parser_dbc_motorola_lsb(startbit,
+            bitlength);
+    }
+    else
+    {
+        signal_data->firstbit = startbit;
+    }
+    signal_data->firstbyte = signal_data->firstbit / 8;
+    
+    factor = 1.0;
+    offset = 0.0;
+    p = tl_parser_dbc_expect(p + 2, '(');
+    if(p!=NULL)
+    {
+        factor = g_ascii_strtod(p, &endptr);
+        p = tl_parser_dbc_expect(endptr, ',');
+        if(p!=NULL)
+        {
+            offset = g_ascii_strtod(p, &endptr);
+        }
+    }
+    signal_data->unit = factor;
+    signal_data->offset = (int)(offset>=0 ? offset + 0.5 : offset - 0.5);
+    if((gdouble)signal_data->offset!=offset)
+    {
+        g_debug("TLParser rounded offset of signal %s from %lf to %d.",
+            name, offset, signal_data->offset);
+    }
+    
+    if(mux[0]=='M')
+    {
+        signal_data->mux_type = TL_PARSER_MUX_TYPE_MULTIPLEXOR;
+    }
+    else if(mux[0]=='m')
+    {
+        signal_data->mux_type = TL_PARSER_MUX_TYPE_MULTIPLEXED;
+        signal_data->mux_value = g_ascii_strtoull(mux + 1, NULL, 10);
+    }
+    
+    return signal_data;
+}
+
+/*
+ * Signal names are only unique within a message, so signals are looked
+ * up by the message id and the name.
+ */
+static gchar *tl_parser_dbc_signal_key(guint64 raw_id, const gchar *name)
+{
+    return g_strdup_printf("%"G_GUINT64_FORMAT" %s", raw_id & 0x1FFFFFFFULL,
+        name);
+}
+
+/*
+ * BA_ "TBoxListIndex" SG_ <id> <signal> 1;
+ * BA_ "TBoxListParent" SG_ <id> <signal> "<parent>";
+ * BA_ "TBoxSource" SG_ <id> <signal> <source>;
+ */
+static void tl_parser_dbc_attribute_parse(const gchar *line,
+    GHashTable *signal_name_table)
+{
+    gchar attribute[64], type[8], name[256], svalue[256];
+    const gchar *p;
+    gchar *endptr, *key;
+    guint64 raw_id;
+    TLParserSignalData *signal_data;
+    
+    p = tl_parser_dbc_string(line, attribute, sizeof(attribute));
+    if(p==NULL)
+    {
+        return;
+    }
+    p = tl_parser_dbc_token(p, type, sizeof(type));
+    if(g_strcmp0(type, "SG_")!=0)
+    {
+        return;
+    }
+    p = tl_parser_dbc_token(p, svalue, sizeof(svalue));
+    raw_id = g_ascii_strtoull(svalue, &endptr, 10);
+    if(endptr==svalue)
+    {
+        return;
+    }
+    p = tl_parser_dbc_token(p, name, sizeof(name));
+    
+    key = tl_parser_dbc_signal_key(raw_id, name);
+    signal_data = g_hash_table_lookup(signal_name_table, key);
+    g_free(key);
+    if(signal_data==NULL)
+    {
+        return;
+    }
+    
+    if(g_strcmp0(attribute, "TBoxListParent")==0)
+    {
+        if(tl_parser_dbc_string(p, svalue, sizeof(svalue))!=NULL &&
+            svalue[0]!='\0')
+        {
+            g_free(signal_data->listparent);
+            signal_data->listparent = g_strdup(svalue);
+        }
+    }
+    else if(g_strcmp0(attribute, "TBoxListIndex")==0)
+    {
+        signal_data->listindex = tl_parser_attr_uint(
+            tl_parser_dbc_skip_space(p), 10);
+    }
+    else if(g_strcmp0(attribute, "TBoxSource")==0)
+    {
+        signal_data->source = tl_parser_attr_int(
+            tl_parser_dbc_skip_space(p));
+    }
+}
+
+gboolean tl_parser_load_dbc_file(const gchar *file)
+{
+    FILE *fp;
+    gchar *line = NULL;
+    size_t line_size = 0;
+    const gchar *p;
+    gchar *endptr;
+    gchar svalue[256];
+    guint64 raw_id;
+    int can_id = -1;
+    TLParserSignalData *signal_data;
+    GHashTable *signal_name_table;
+    
+    if(!g_tl_parser_data.initialized)
+    {
+        g_warning("TLParser is not initialized yet!");
+        return FALSE;
+    }
+    
+    if(file==NULL)
+    {
+        return FALSE;
+    }
+    
+    fp = fopen(file, "r");
+    if(fp==NULL)
+    {
+        g_warning("TLParser failed to open file %s: %s", file,
+            strerror(errno));
+        return FALSE;
+    }
+    
+    tl_parser_signal_table_reset(&g_tl_parser_data);
+    signal_name_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+        g_free, NULL);
+    
+    while(getline(&line, &line_size, fp)>0)
+    {
+        p = tl_parser_dbc_skip_space(line);
+        
+        if(strncmp(p, "BO_ ", 4)==0)
+        {
+            raw_id = g_ascii_strtoull(p + 4, &endptr, 10);
+            if(endptr==p + 4 || raw_id==0xC0000000ULL)
+            {
+                /* VECTOR__INDEPENDENT_SIG_MSG carries no real frame. */
+                can_id = -1;
+                continue;
+            }
+            can_id = (int)(raw_id & 0x1FFFFFFFULL);
+        }
+        else if(strncmp(p, "SG_ ", 4)==0)
+        {
+            if(can_id<0)
+            {
+                continue;
+            }
+            signal_data = tl_parser_dbc_signal_parse(p + 4, can_id);
+            if(signal_data==NULL)
+            {
+                g_warning("TLParser failed to parse DBC signal: %s", p);
+                continue;
+            }
+            g_hash_table_replace(signal_name_table,
+                tl_parser_dbc_signal_key(can_id, signal_data->name),
+                signal_data);
+            tl_parser_signal_table_add(&g_tl_parser_data, signal_data);
+        }
+        else if(strncmp(p, "BA_ ", 4)==0)
+        {
+            tl_parser_dbc_attribute_parse(p + 4, signal_name_table);
+        }
+        else if(strncmp(p, "VERSION ", 8)==0)
+        {
+            if(tl_parser_dbc_string(p + 8, svalue, sizeof(svalue))!=NULL)
+            {
+                g_free(g_tl_parser_data.name);
+                g_tl_parser_data.name = g_strdup(svalue);
+            }
+        }
+    }
+    
+    g_hash_table_unref(signal_name_table);
+    tl_parser_signal_table_finish(&g_tl_parser_data);
+    
+    if(line!=NULL)
+    {
+        free(line);
+    }
+    fclose(fp);
+    
+    g_message("TLParser loaded %u signal(s) from DBC file %s.",
+        g_tl_parser_data.signal_count, file);
+    
+    return TRUE;
+}
+
 gboolean tl_parser_load_parse_file(const gchar *file)
 {
     gchar buffer[4096];
@@ -324,6 +941,11 @@ gboolean tl_parser_load_parse_file(const gchar *file)
         return FALSE;
     }
     
+    if(g_str_has_suffix(file, ".dbc") || g_str_has_suffix(file, ".DBC"))
+    {
+        return tl_parser_load_dbc_file(file);
+    }
+    
     fp = fopen(file, "r");
     if(fp==NULL)
     {
@@ -332,14 +954,7 @@ gboolean tl_parser_load_parse_file(const gchar *file)
         return FALSE;
     }
     
-    g_hash_table_remove_all(g_tl_parser_data.parser_table);
-    if(g_tl_parser_data.name!=NULL)
-    {
-        g_free(g_tl_parser_data.name);
-        g_tl_parser_data.name = NULL;
-    }
-    g_tl_parser_data.rev = 0;
-    g_tl_parser_data.use_ext_id = FALSE;
+    tl_parser_signal_table_reset(&g_tl_parser_data);
     
     g_tl_parser_data.parser_context = g_markup_parse_context_new(
         &g_tl_parser_markup_parser, 0, &g_tl_parser_data, NULL);
@@ -355,7 +970,12 @@ gboolean tl_parser_load_parse_file(const gchar *file)
                 g_clear_error(&error);
             }
         }
+        else if(ferror(fp))
+        {
+            break;
+        }
     }
+    fclose(fp);
     g_markup_parse_context_end_parse(g_tl_parser_data.parser_context, &error);
     if(error!=NULL)
     {
@@ -367,6 +987,59 @@ gboolean tl_parser_load_parse_file(const gchar *file)
         g_markup_parse_context_free(g_tl_parser_data.parser_context);
         g_tl_parser_data.parser_context = NULL;
     }
+    tl_parser_signal_table_finish(&g_tl_parser_data);
+    
+    return TRUE;
+}
+
+guint tl_parser_signal_count_get()
+{
+    return g_tl_parser_data.signal_count;
+}
+
+static inline gboolean tl_parser_signal_raw_decode(
+    const TLParserSignalData *signal_data, const guint8 *data, gsize len,
+    gint64 *value)
+{
+    guint firstbyte, rbits;
+    guint64 rvalue = 0;
+    guint i, x, y;
+    
+    firstbyte = signal_data->firstbit / 8;
+    
+    if(firstbyte >= len)
+    {
+        return FALSE;
+    }
+    
+    if(signal_data->endian) /* BE */
+    {
+        rbits = 8 - (signal_data->firstbit%8) + firstbyte * 8;
+        for(i=0;i<signal_data->bitlength && i<rbits;i++)
+        {
+            x = (rbits - i - 1) / 8;
+            y = (signal_data->firstbit + i) % 8;
+            rvalue |= ((guint64)((data[x] >> y) & 1) << i);
+        }
+    }
+    else
+    {
+        rbits = len * 8 - signal_data->firstbit;
+        for(i=0;i<signal_data->bitlength && i<rbits;i++)
+        {
+            x = (signal_data->firstbit + i) / 8;
+            y = (signal_data->firstbit + i) % 8;
+            rvalue |= ((guint64)((data[x] >> y) & 1) << i);
+        }
+    }
+    
+    if(signal_data->is_signed && signal_data->bitlength<64 &&
+        ((rvalue >> (signal_data->bitlength - 1)) & 1))
+    {
+        rvalue |= (G_MAXUINT64 << signal_data->bitlength);
+    }
+    
+    *value = (gint64)rvalue;
     
     return TRUE;
 }
@@ -378,10 +1051,9 @@ gboolean tl_parser_parse_can_data(const gchar *device,
     TLParserSignalData *signal_data;
     gboolean parsed = FALSE;
     guint source = 0;
-    guint firstbyte, rbits;
-    guint64 rvalue;
     gint64 value;
-    gint i, x, y;
+    gboolean mux_set = FALSE;
+    guint mux_value = 0;
     TLLoggerLogItemData item_data;
     
     if(!g_tl_parser_data.initialized || g_tl_parser_data.parser_table==NULL)
@@ -391,7 +1063,7 @@ gboolean tl_parser_parse_can_data(const gchar *device,
     
     signal_list = g_hash_table_lookup(g_tl_parser_data.parser_table,
         GINT_TO_POINTER(can_id));
-        
+    
     if(signal_list==NULL)
     {
         return FALSE;
@@ -412,38 +1084,23 @@ gboolean tl_parser_parse_can_data(const gchar *device,
             continue;
         }
         
-        firstbyte = signal_data->firstbit / 8;
-        
-        if(firstbyte >= len)
+        if(signal_data->mux_type==TL_PARSER_MUX_TYPE_MULTIPLEXED &&
+            (!mux_set || signal_data->mux_value!=mux_value))
         {
             continue;
         }
         
-        rvalue = 0;
-        
-        if(signal_data->endian) /* BE */
+        if(!tl_parser_signal_raw_decode(signal_data, data, len, &value))
         {
-            rbits = 8 - (signal_data->firstbit%8) + firstbyte * 8;
-            for(i=0;i<signal_data->bitlength && i<rbits;i++)
-            {
-                x = (rbits - i - 1) / 8;
-                y = (signal_data->firstbit + i) % 8;
-                rvalue |= (((data[x] >> y) & 1) << i);
-            }
+            continue;
         }
-        else
+        
+        if(signal_data->mux_type==TL_PARSER_MUX_TYPE_MULTIPLEXOR)
         {
-            rbits = len * 8 - signal_data->firstbit;
-            for(i=0;i<signal_data->bitlength && i<rbits;i++)
-            {
-                x = (signal_data->firstbit + i) / 8;
-                y = (signal_data->firstbit + i) % 8;
-                rvalue |= (((data[x] >> y) & 1) << i);
-            }
+            mux_set = TRUE;
+            mux_value = (guint)value;
         }
         
-        value = (gint64)rvalue;
-        
         /*
         g_debug("Got %s value %"G_GUINT64_FORMAT".", signal_data->name, value);
         */
@@ -457,6 +1114,12 @@ gboolean tl_parser_parse_can_data(const gchar *device,
         item_data.offset = signal_data->offset;
         
         tl_logger_current_data_update(&item_data);
+        
+        if(signal_data->expr_slot>=0)
+        {
+            tl_expr_slot_update(signal_data->expr_slot, (gdouble)value *
+                signal_data->unit + signal_data->offset);
+        }
     }
     
     return parsed;
@@ -474,5 +1137,5 @@ const gchar *tl_parser_battery_code_get(guint8 *single_bat_code_len,
         *bat_code_total_len = g_tl_parser_data.bat_code_total_len;
     }
     return g_tl_parser_data.bat_code;
-    
+
 }
@@ -3,6 +3,13 @@
 
 #include <glib.h>
 
+typedef enum
+{
+    TL_PARSER_MUX_TYPE_NONE = 0,
+    TL_PARSER_MUX_TYPE_MULTIPLEXOR = 1,
+    TL_PARSER_MUX_TYPE_MULTIPLEXED = 2
+}TLParserMuxType;
+
 typedef struct _TLParserSignalData
 {
     int id;
@@ -16,6 +23,10 @@ typedef struct _TLParserSignalData
     guint listindex;
     gchar *listparent;
     int source;
+    gboolean is_signed;
+    TLParserMuxType mux_type;
+    guint mux_value;
+    gint expr_slot;
 }TLParserSignalData;
 
 #define TL_PARSER_VEHICLE_STATE "VCU01_PTReady"
@@ -126,6 +137,8 @@ typedef struct _TLParserSignalData
 gboolean tl_parser_init();
 void tl_parser_uninit();
 gboolean tl_parser_load_parse_file(const gchar *file);
+gboolean tl_parser_load_dbc_file(const gchar *file);
+guint tl_parser_signal_count_get();
 gboolean tl_parser_parse_can_data(const gchar *device,
     int can_id, const guint8 *data, gsize len);
 const gchar *tl_parser_battery_code_get(guint8 *single_bat_code_len,
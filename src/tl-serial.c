@@ -9,6 +9,7 @@
 
 #include "tl-serial.h"
 #include "tl-main.h"
+#include "tl-logger.h"
 
 #define TL_SERIAL_WRITE_RETRY_MAXIUM 3
 #define TL_SERIAL_READ_BUFFER_SIZE 512
@@ -267,6 +268,11 @@ static void tl_serial_data_parse(TLSerialData *serial_data)
         }
         case 5:
         {
+            /*
+             * Power is going away, do not wait for the group commit and
+             * move the log file out of RAM while the UPS lasts.
+             */
+            tl_logger_log_migrate();
             serial_data->low_voltage_shutdown = TRUE;
             tl_main_request_shutdown();
             break;
@@ -0,0 +1,68 @@
+#ifndef HAVE_TL_SHM_LAYOUT_H
+#define HAVE_TL_SHM_LAYOUT_H
+
+#include <stdint.h>
+
+/*
+ * Shared memory segment layout, shared by tbox-logger and the readers:
+ *
+ * | Header | Entry[capacity] | Slot[capacity] | Hash[hash_size] |
+ *
+ * Entries are written once and published by bumping header.count. Slot
+ * values are guarded by a per-slot sequence counter which is odd while the
+ * producer is writing. The hash table maps a name (FNV-1a, linear probing)
+ * to entry index + 1, 0 marks an empty bucket.
+ */
+
+#define TL_SHM_NAME_DEFAULT "/tbox-state"
+#define TL_SHM_MAGIC 0x4D534C54
+#define TL_SHM_VERSION 1
+#define TL_SHM_SIGNAL_NAME_MAXIMUM 48
+
+typedef struct _TLShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t hash_size;
+    uint32_t alive;
+    uint64_t generation;
+    uint64_t entry_offset;
+    uint64_t slot_offset;
+    uint64_t hash_offset;
+    uint64_t total_size;
+}TLShmHeader;
+
+typedef struct _TLShmEntry
+{
+    char name[TL_SHM_SIGNAL_NAME_MAXIMUM];
+    double unit;
+    int32_t offset;
+    int32_t source;
+}TLShmEntry;
+
+typedef struct _TLShmSlot
+{
+    uint32_t seq;
+    uint32_t reserved;
+    int64_t value;
+    int64_t timestamp;
+    int64_t reserved2;
+}TLShmSlot;
+
+static inline uint32_t tl_shm_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261U;
+    
+    while(*name!='\0')
+    {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619U;
+        name++;
+    }
+    
+    return hash;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tl-shm-reader.h"
+#include "tl-shm-layout.h"
+
+#define TL_SHM_READER_RETRY_MAXIMUM 64
+
+/*
+ * Reader side of the tbox-logger state segment. It does not depend on
+ * glib, and once the segment is mapped no call makes a system call, apart
+ * from yielding when a slot stays busy.
+ */
+struct _TLShmReader
+{
+    const uint8_t *base;
+    size_t size;
+    const TLShmHeader *header;
+    const TLShmEntry *entries;
+    const TLShmSlot *slots;
+    const uint32_t *hash;
+};
+
+TLShmReader *tl_shm_reader_open(const char *name)
+{
+    TLShmReader *reader;
+    const TLShmHeader *header;
+    struct stat statbuf;
+    void *base;
+    int fd;
+    
+    if(name==NULL)
+    {
+        name = TL_SHM_NAME_DEFAULT;
+    }
+    
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd<0)
+    {
+        return NULL;
+    }
+    if(fstat(fd, &statbuf)!=0 || (size_t)statbuf.st_size<sizeof(TLShmHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    base = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED)
+    {
+        return NULL;
+    }
+    
+    header = base;
+    if(__atomic_load_n(&(header->magic), __ATOMIC_ACQUIRE)!=TL_SHM_MAGIC ||
+        header->version!=TL_SHM_VERSION ||
+        header->total_size>(uint64_t)statbuf.st_size)
+    {
+        munmap(base, statbuf.st_size);
+        return NULL;
+    }
+    
+    reader = calloc(1, sizeof(TLShmReader));
+    if(reader==NULL)
+    {
+        munmap(base, statbuf.st_size);
+        return NULL;
+    }
+    reader->base = base;
+    reader->size = statbuf.st_size;
+    reader->header = header;
+    reader->entries = (const TLShmEntry *)(reader->base +
+        header->entry_offset);
+    reader->slots = (const TLShmSlot *)(reader->base + header->slot_offset);
+    reader->hash = (const uint32_t *)(reader->base + header->hash_offset);
+    
+    return reader;
+}
+
+void tl_shm_reader_close(TLShmReader *reader)
+{
+    if(reader==NULL)
+    {
+        return;
+    }
+    
+    munmap((void *)reader->base, reader->size);
+    free(reader);
+}
+
+/* Returns non-zero once the producer has exited, reopen to follow a new one. */
+int tl_shm_reader_is_stale(const TLShmReader *reader)
+{
+    if(reader==NULL)
+    {
+        return 1;
+    }
+    
+    return __atomic_load_n(&(reader->header->alive), __ATOMIC_ACQUIRE)==0;
+}
+
+unsigned int tl_shm_reader_signal_count(const TLShmReader *reader)
+{
+    if(reader==NULL)
+    {
+        return 0;
+    }
+    
+    return __atomic_load_n(&(reader->header->count), __ATOMIC_ACQUIRE);
+}
+
+int tl_shm_reader_lookup(const TLShmReader *reader, const char *name)
+{
+    uint32_t mask, bucket, index, i;
+    
+    if(reader==NULL || name==NULL)
+    {
+        return -1;
+    }
+    
+    mask = reader->header->hash_size - 1;
+    bucket = tl_shm_name_hash(name) & mask;
+    for(i=0;i<=mask;i++)
+    {
+        index = __atomic_load_n(&(reader->hash[bucket]), __ATOMIC_ACQUIRE);
+        if(index==0)
+        {
+            break;
+        }
+        if(strncmp(reader->entries[index-1].name, name,
+            TL_SHM_SIGNAL_NAME_MAXIMUM)==0)
+        {
+            return index - 1;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    
+    return -1;
+}
+
+const char *tl_shm_reader_signal_name(const TLShmReader *reader,
+    unsigned int index)
+{
+    if(index>=tl_shm_reader_signal_count(reader))
+    {
+        return NULL;
+    }
+    
+    return reader->entries[index].name;
+}
+
+int tl_shm_reader_signal_scale(const TLShmReader *reader, unsigned int index,
+    double *unit, int *offset, int *source)
+{
+    if(index>=tl_shm_reader_signal_count(reader))
+    {
+        return -1;
+    }
+    
+    if(unit!=NULL)
+    {
+        *unit = reader->entries[index].unit;
+    }
+    if(offset!=NULL)
+    {
+        *offset = reader->entries[index].offset;
+    }
+    if(source!=NULL)
+    {
+        *source = reader->entries[index].source;
+    }
+    
+    return 0;
+}
+
+/*
+ * Reads a consistent value/timestamp pair (timestamp in microseconds since
+ * epoch). Returns 0 on success, -1 for an unknown index or if the slot
+ * stayed busy.
+ */
+int tl_shm_reader_read(const TLShmReader *reader, unsigned int index,
+    int64_t *value, int64_t *timestamp)
+{
+    const TLShmSlot *slot;
+    uint32_t seq1, seq2;
+    int64_t v, t;
+    unsigned int i;
+    
+    if(index>=tl_shm_reader_signal_count(reader))
+    {
+        return -1;
+    }
+    
+    slot = &(reader->slots[index]);
+    for(i=0;i<TL_SHM_READER_RETRY_MAXIMUM;i++)
+    {
+        seq1 = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if(seq1 & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        v = *(const volatile int64_t *)&(slot->value);
+        t = *(const volatile int64_t *)&(slot->timestamp);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&(slot->seq), __ATOMIC_RELAXED);
+        if(seq1==seq2)
+        {
+            if(value!=NULL)
+            {
+                *value = v;
+            }
+            if(timestamp!=NULL)
+            {
+                *timestamp = t;
+            }
+            return 0;
+        }
+    }
+    
+    return -1;
+}
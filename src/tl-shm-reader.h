@@ -0,0 +1,34 @@
+#ifndef HAVE_TL_SHM_READER_H
+#define HAVE_TL_SHM_READER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The segment is created with mode 0640, owned by the user and group the
+ * tbox-logger daemon runs as. A reader must run as that user or belong to
+ * that group, otherwise tl_shm_reader_open() fails with EACCES.
+ */
+
+typedef struct _TLShmReader TLShmReader;
+
+TLShmReader *tl_shm_reader_open(const char *name);
+void tl_shm_reader_close(TLShmReader *reader);
+int tl_shm_reader_is_stale(const TLShmReader *reader);
+unsigned int tl_shm_reader_signal_count(const TLShmReader *reader);
+int tl_shm_reader_lookup(const TLShmReader *reader, const char *name);
+const char *tl_shm_reader_signal_name(const TLShmReader *reader,
+    unsigned int index);
+int tl_shm_reader_signal_scale(const TLShmReader *reader, unsigned int index,
+    double *unit, int *offset, int *source);
+int tl_shm_reader_read(const TLShmReader *reader, unsigned int index,
+    int64_t *value, int64_t *timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,204 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tl-shm.h"
+#include "tl-shm-layout.h"
+
+typedef struct _TLShmData
+{
+    gboolean initialized;
+    gchar *name;
+    guint8 *base;
+    gsize size;
+    TLShmHeader *header;
+    TLShmEntry *entries;
+    TLShmSlot *slots;
+    guint32 *hash;
+}TLShmData;
+
+static TLShmData g_tl_shm_data = {0};
+
+gboolean tl_shm_init(const gchar *name, guint capacity)
+{
+    TLShmHeader *header;
+    guint hash_size;
+    gsize size;
+    int fd;
+    void *base;
+    
+    if(g_tl_shm_data.initialized)
+    {
+        g_warning("TLShm already initialized!");
+        return TRUE;
+    }
+    if(capacity==0)
+    {
+        return FALSE;
+    }
+    if(name==NULL)
+    {
+        name = TL_SHM_NAME_DEFAULT;
+    }
+    
+    for(hash_size=16;hash_size<capacity*2;hash_size*=2);
+    
+    size = sizeof(TLShmHeader) + capacity * sizeof(TLShmEntry) +
+        capacity * sizeof(TLShmSlot) + hash_size * sizeof(guint32);
+    
+    /*
+     * The values include position and vehicle state, only the group of
+     * the daemon may read them. fchmod() is not subject to the umask.
+     */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR |
+        S_IRGRP);
+    if(fd<0)
+    {
+        g_warning("TLShm cannot create shared memory %s: %s", name,
+            strerror(errno));
+        return FALSE;
+    }
+    if(fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP)!=0)
+    {
+        g_warning("TLShm cannot set mode of shared memory %s: %s", name,
+            strerror(errno));
+    }
+    if(ftruncate(fd, size)!=0)
+    {
+        g_warning("TLShm cannot resize shared memory %s: %s", name,
+            strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return FALSE;
+    }
+    
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED)
+    {
+        g_warning("TLShm cannot map shared memory %s: %s", name,
+            strerror(errno));
+        shm_unlink(name);
+        return FALSE;
+    }
+    
+    header = base;
+    header->version = TL_SHM_VERSION;
+    header->capacity = capacity;
+    header->count = 0;
+    header->hash_size = hash_size;
+    header->generation = g_get_real_time();
+    header->entry_offset = sizeof(TLShmHeader);
+    header->slot_offset = header->entry_offset +
+        capacity * sizeof(TLShmEntry);
+    header->hash_offset = header->slot_offset +
+        capacity * sizeof(TLShmSlot);
+    header->total_size = size;
+    header->alive = 1;
+    __atomic_store_n(&(header->magic), TL_SHM_MAGIC, __ATOMIC_RELEASE);
+    
+    g_tl_shm_data.name = g_strdup(name);
+    g_tl_shm_data.base = base;
+    g_tl_shm_data.size = size;
+    g_tl_shm_data.header = header;
+    g_tl_shm_data.entries = (TLShmEntry *)(g_tl_shm_data.base +
+        header->entry_offset);
+    g_tl_shm_data.slots = (TLShmSlot *)(g_tl_shm_data.base +
+        header->slot_offset);
+    g_tl_shm_data.hash = (guint32 *)(g_tl_shm_data.base +
+        header->hash_offset);
+    
+    g_tl_shm_data.initialized = TRUE;
+    
+    return TRUE;
+}
+
+void tl_shm_uninit()
+{
+    if(!g_tl_shm_data.initialized)
+    {
+        return;
+    }
+    
+    g_tl_shm_data.initialized = FALSE;
+    
+    __atomic_store_n(&(g_tl_shm_data.header->alive), 0, __ATOMIC_RELEASE);
+    munmap(g_tl_shm_data.base, g_tl_shm_data.size);
+    shm_unlink(g_tl_shm_data.name);
+    
+    g_free(g_tl_shm_data.name);
+    g_tl_shm_data.name = NULL;
+    g_tl_shm_data.base = NULL;
+    g_tl_shm_data.header = NULL;
+    g_tl_shm_data.entries = NULL;
+    g_tl_shm_data.slots = NULL;
+    g_tl_shm_data.hash = NULL;
+}
+
+/*
+ * Publishes a new signal. The entry and its hash bucket are filled before
+ * the count is released, so readers never see a half written entry.
+ */
+gint tl_shm_slot_add(const gchar *name, gdouble unit, gint offset,
+    gint8 source)
+{
+    TLShmHeader *header = g_tl_shm_data.header;
+    TLShmEntry *entry;
+    guint32 index, bucket, mask;
+    
+    if(!g_tl_shm_data.initialized || name==NULL)
+    {
+        return -1;
+    }
+    if(strlen(name)>=TL_SHM_SIGNAL_NAME_MAXIMUM)
+    {
+        g_warning("TLShm signal name %s is too long to export.", name);
+        return -1;
+    }
+    
+    index = header->count;
+    if(index>=header->capacity)
+    {
+        g_warning("TLShm slot capacity exhausted, %s is not exported.",
+            name);
+        return -1;
+    }
+    
+    entry = &(g_tl_shm_data.entries[index]);
+    g_strlcpy(entry->name, name, TL_SHM_SIGNAL_NAME_MAXIMUM);
+    entry->unit = unit;
+    entry->offset = offset;
+    entry->source = source;
+    
+    mask = header->hash_size - 1;
+    for(bucket=tl_shm_name_hash(name) & mask;
+        g_tl_shm_data.hash[bucket]!=0;bucket=(bucket+1) & mask);
+    __atomic_store_n(&(g_tl_shm_data.hash[bucket]), index + 1,
+        __ATOMIC_RELEASE);
+    
+    __atomic_store_n(&(header->count), index + 1, __ATOMIC_RELEASE);
+    
+    return index;
+}
+
+void tl_shm_slot_update(gint slot, gint64 value, gint64 timestamp)
+{
+    TLShmSlot *shm_slot;
+    guint32 seq;
+    
+    if(!g_tl_shm_data.initialized || slot<0)
+    {
+        return;
+    }
+    
+    shm_slot = &(g_tl_shm_data.slots[slot]);
+    seq = shm_slot->seq;
+    __atomic_store_n(&(shm_slot->seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *(volatile gint64 *)&(shm_slot->value) = value;
+    *(volatile gint64 *)&(shm_slot->timestamp) = timestamp;
+    __atomic_store_n(&(shm_slot->seq), seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,12 @@
+#ifndef HAVE_TL_SHM_H
+#define HAVE_TL_SHM_H
+
+#include <glib.h>
+
+gboolean tl_shm_init(const gchar *name, guint capacity);
+void tl_shm_uninit();
+gint tl_shm_slot_add(const gchar *name, gdouble unit, gint offset,
+    gint8 source);
+void tl_shm_slot_update(gint slot, gint64 value, gint64 timestamp);
+
+#endif